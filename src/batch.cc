@@ -0,0 +1,115 @@
+#include "batch.h"
+
+#include <chrono>
+#include <exception>
+#include <thread>
+
+namespace pane {
+BatchRunner::BatchRunner(size_t nThreads) {
+	if (nThreads == 0) {
+		nThreads = std::thread::hardware_concurrency();
+	}
+	if (nThreads == 0) {
+		nThreads = 1;
+	}
+
+	for (size_t i = 0; i < nThreads; i++) {
+		m_vWorkers.push_back(std::make_unique<Worker>());
+	}
+}
+
+BatchRunner::~BatchRunner() {
+	for (std::unique_ptr<Worker>& pWorker : m_vWorkers) {
+		if (pWorker->pMachine) {
+			pWorker->pMachine->Shutdown();
+		}
+	}
+}
+
+BatchStats BatchRunner::Run(size_t nJobs, const BatchJob& fnJob) {
+	size_t nThreads = m_vWorkers.size();
+	for (size_t i = 0; i < nThreads; i++) {
+		Worker* pWorker = m_vWorkers[i].get();
+		pWorker->xJobs.clear();
+		pWorker->nFrames = 0;
+		pWorker->nSteals = 0;
+		// Contiguous ranges keep neighbouring jobs (often similar in cost) on
+		// one worker, stealing evens out the rest
+		for (size_t nJob = nJobs * i / nThreads; nJob < nJobs * (i + 1) / nThreads; nJob++) {
+			pWorker->xJobs.push_back(nJob);
+		}
+	}
+
+	std::vector<std::exception_ptr> vErrors(nThreads);
+	std::vector<std::thread> vThreads;
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < nThreads; i++) {
+		vThreads.emplace_back([this, i, &fnJob, &vErrors]() {
+			try {
+				this->RunWorker(i, fnJob);
+			} catch (...) {
+				vErrors[i] = std::current_exception();
+			}
+		});
+	}
+	for (std::thread& xThread : vThreads) {
+		xThread.join();
+	}
+	auto tEnd = std::chrono::steady_clock::now();
+
+	for (std::exception_ptr& pError : vErrors) {
+		if (pError) {
+			std::rethrow_exception(pError);
+		}
+	}
+
+	BatchStats xStats = { nJobs, 0, std::chrono::duration<double>(tEnd - tStart).count(), 0 };
+	for (std::unique_ptr<Worker>& pWorker : m_vWorkers) {
+		xStats.nFrames += pWorker->nFrames;
+		xStats.nSteals += pWorker->nSteals;
+	}
+	return xStats;
+}
+
+void BatchRunner::RunWorker(size_t nWorker, const BatchJob& fnJob) {
+	Worker* pWorker = m_vWorkers[nWorker].get();
+	size_t nJob;
+	while (this->PopJob(nWorker, &nJob)) {
+		// Machines are kept for every later job and batch, and reset on their
+		// worker thread so their memory is local to it and nothing of the
+		// previous job leaks into this one
+		if (!pWorker->pMachine) {
+			pWorker->pMachine = std::make_unique<Machine>();
+		}
+		pWorker->pMachine->Reset();
+		pWorker->nFrames += fnJob(*pWorker->pMachine, nJob);
+	}
+}
+
+bool BatchRunner::PopJob(size_t nWorker, size_t* pJob) {
+	Worker* pWorker = m_vWorkers[nWorker].get();
+	{
+		std::lock_guard<std::mutex> xGuard(pWorker->xLock);
+		if (!pWorker->xJobs.empty()) {
+			*pJob = pWorker->xJobs.front();
+			pWorker->xJobs.pop_front();
+			return true;
+		}
+	}
+
+	// Own queue is empty, steal from the back of the next busy worker. Jobs
+	// are never added during a run so one empty pass means we are done.
+	size_t nThreads = m_vWorkers.size();
+	for (size_t i = 1; i < nThreads; i++) {
+		Worker* pVictim = m_vWorkers[(nWorker + i) % nThreads].get();
+		std::lock_guard<std::mutex> xGuard(pVictim->xLock);
+		if (!pVictim->xJobs.empty()) {
+			*pJob = pVictim->xJobs.back();
+			pVictim->xJobs.pop_back();
+			pWorker->nSteals++;
+			return true;
+		}
+	}
+	return false;
+}
+}
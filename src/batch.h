@@ -0,0 +1,63 @@
+#ifndef CEE_PANE_BATCH_H_
+#define CEE_PANE_BATCH_H_
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <cstdint>
+#include <cstddef>
+
+#include "machine.h"
+
+namespace pane {
+// Runs one job on a machine that has been reset but not started, returns
+// the number of frames it emulated.
+typedef std::function<uint64_t(Machine& xMachine, size_t nJob)> BatchJob;
+
+struct BatchStats {
+	size_t nJobs;
+	uint64_t nFrames;
+	double nSeconds;
+	// Jobs a worker took from another worker's queue
+	size_t nSteals;
+
+	double GetFramesPerSecond() const { return nSeconds > 0.0 ? nFrames / nSeconds : 0.0; }
+};
+
+// Runs independent jobs over a fixed set of worker threads. Each worker owns
+// one Machine that is reset in place and reused for every job it runs, jobs
+// are dealt out in contiguous ranges and idle workers steal from the back of
+// the others.
+class BatchRunner {
+public:
+	// 0 threads uses every hardware thread
+	explicit BatchRunner(size_t nThreads = 0);
+	~BatchRunner();
+
+	size_t GetThreadCount() const { return m_vWorkers.size(); }
+
+	// Blocks until every job has run. The first exception thrown by a job is
+	// rethrown here once all workers have stopped.
+	BatchStats Run(size_t nJobs, const BatchJob& fnJob);
+
+private:
+	struct Worker {
+		std::unique_ptr<Machine> pMachine;
+		std::mutex xLock;
+		std::deque<size_t> xJobs;
+		uint64_t nFrames;
+		size_t nSteals;
+	};
+
+	void RunWorker(size_t nWorker, const BatchJob& fnJob);
+	bool PopJob(size_t nWorker, size_t* pJob);
+
+private:
+	std::vector<std::unique_ptr<Worker>> m_vWorkers;
+};
+}
+
+#endif
@@ -0,0 +1,1399 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mmu.h"
+#include "cpu.h"
+#include "ram.h"
+#include "machine.h"
+#include "batch.h"
+#include "lockstep.h"
+#include "rewind.h"
+#include "movie.h"
+#include "keyframes.h"
+#include "verifier.h"
+#include "netplay.h"
+#include "cartridge.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+namespace {
+// Tight mixed workload: indexed copy loop with ALU ops, zero page RMW,
+// a subroutine call and stack traffic.
+const uint8_t g_pCPUBenchProgram[] = {
+	0xA2, 0x00,             // 8000: LDX #$00
+	0xBD, 0x00, 0x02,       // 8002: LDA $0200,X
+	0x18,                   // 8005: CLC
+	0x69, 0x03,             // 8006: ADC #$03
+	0x9D, 0x00, 0x03,       // 8008: STA $0300,X
+	0x45, 0x10,             // 800B: EOR $10
+	0x85, 0x10,             // 800D: STA $10
+	0xE8,                   // 800F: INX
+	0xD0, 0xF0,             // 8010: BNE $8002
+	0xE6, 0x11,             // 8012: INC $11
+	0x20, 0x1A, 0x80,       // 8014: JSR $801A
+	0x4C, 0x00, 0x80,       // 8017: JMP $8000
+	0xA5, 0x11,             // 801A: LDA $11
+	0x0A,                   // 801C: ASL A
+	0x48,                   // 801D: PHA
+	0x68,                   // 801E: PLA
+	0x60,                   // 801F: RTS
+};
+
+// Arithmetic, shifts and compares feeding branches, nearly every instruction
+// writes flags that the next one overwrites.
+const uint8_t g_pFlagsBenchProgram[] = {
+	0xA2, 0x00,             // 8000: LDX #$00
+	0xA5, 0x10,             // 8002: LDA $10
+	0x18,                   // 8004: CLC
+	0x69, 0x35,             // 8005: ADC #$35
+	0x2A,                   // 8007: ROL A
+	0xC9, 0x80,             // 8008: CMP #$80
+	0x90, 0x02,             // 800A: BCC $800E
+	0x49, 0xFF,             // 800C: EOR #$FF
+	0x85, 0x10,             // 800E: STA $10
+	0xE9, 0x07,             // 8010: SBC #$07
+	0x4A,                   // 8012: LSR A
+	0xE0, 0x80,             // 8013: CPX #$80
+	0xD0, 0x01,             // 8015: BNE $8018
+	0xC8,                   // 8017: INY
+	0xE8,                   // 8018: INX
+	0xD0, 0xE7,             // 8019: BNE $8002
+	0x4C, 0x00, 0x80,       // 801B: JMP $8000
+};
+
+// Reads pad 1 every pass and folds it into a page of RAM, so every input
+// changes the state from then on.
+const uint8_t g_pInputBenchProgram[] = {
+	0xA9, 0x01,             // 8000: LDA #$01
+	0x8D, 0x16, 0x40,       // 8002: STA $4016
+	0xA9, 0x00,             // 8005: LDA #$00
+	0x8D, 0x16, 0x40,       // 8007: STA $4016
+	0xA2, 0x08,             // 800A: LDX #$08
+	0xAD, 0x16, 0x40,       // 800C: LDA $4016
+	0x4A,                   // 800F: LSR A
+	0x26, 0x12,             // 8010: ROL $12
+	0xCA,                   // 8012: DEX
+	0xD0, 0xF7,             // 8013: BNE $800C
+	0xA5, 0x12,             // 8015: LDA $12
+	0x18,                   // 8017: CLC
+	0x65, 0x13,             // 8018: ADC $13
+	0x85, 0x13,             // 801A: STA $13
+	0xA2, 0x00,             // 801C: LDX #$00
+	0xBD, 0x00, 0x02,       // 801E: LDA $0200,X
+	0x65, 0x13,             // 8021: ADC $13
+	0x9D, 0x00, 0x02,       // 8023: STA $0200,X
+	0xE8,                   // 8026: INX
+	0xD0, 0xF5,             // 8027: BNE $801E
+	0x4C, 0x00, 0x80,       // 8029: JMP $8000
+};
+
+// MMC3 at 0xE000. Turns rendering on and the scanline IRQ every 8 lines,
+// then switches the 8K PRG bank at 0x8000 and a 1K CHR bank through all 32
+// of each, summing a byte of every PRG bank. The IRQ handler counts IRQs.
+const uint8_t g_pMapperBenchProgram[] = {
+	0xA9, 0x00,             // E000: LDA #$00
+	0x8D, 0x00, 0xA0,       // E002: STA $A000
+	0xA9, 0x1E,             // E005: LDA #$1E
+	0x8D, 0x01, 0x20,       // E007: STA $2001
+	0xA9, 0x07,             // E00A: LDA #$07
+	0x8D, 0x00, 0xC0,       // E00C: STA $C000
+	0x8D, 0x01, 0xC0,       // E00F: STA $C001
+	0x8D, 0x01, 0xE0,       // E012: STA $E001
+	0x58,                   // E015: CLI
+	0xA2, 0x00,             // E016: LDX #$00
+	0xA9, 0x06,             // E018: LDA #$06
+	0x8D, 0x00, 0x80,       // E01A: STA $8000
+	0x8E, 0x01, 0x80,       // E01D: STX $8001
+	0xAD, 0x00, 0x80,       // E020: LDA $8000
+	0x18,                   // E023: CLC
+	0x65, 0x10,             // E024: ADC $10
+	0x85, 0x10,             // E026: STA $10
+	0xA9, 0x02,             // E028: LDA #$02
+	0x8D, 0x00, 0x80,       // E02A: STA $8000
+	0x8E, 0x01, 0x80,       // E02D: STX $8001
+	0xE8,                   // E030: INX
+	0xE0, 0x20,             // E031: CPX #$20
+	0xD0, 0xE3,             // E033: BNE $E018
+	0xE6, 0x11,             // E035: INC $11
+	0xD0, 0x02,             // E037: BNE $E03B
+	0xE6, 0x14,             // E039: INC $14
+	0x4C, 0x16, 0xE0,       // E03B: JMP $E016
+	0x8D, 0x00, 0xE0,       // E03E: STA $E000
+	0x8D, 0x01, 0xE0,       // E041: STA $E001
+	0xE6, 0x12,             // E044: INC $12
+	0xD0, 0x02,             // E046: BNE $E04A
+	0xE6, 0x13,             // E048: INC $13
+	0x40,                   // E04A: RTI
+};
+const uint16_t g_pMapperBenchIRQ = 0xE03E;
+
+// Waits for vblank in a PPUSTATUS loop and counts frames
+const uint8_t g_pVBlankSpinProgram[] = {
+	0xAD, 0x02, 0x20,       // 8000: LDA $2002
+	0x10, 0xFB,             // 8003: BPL $8000
+	0xE6, 0x00,             // 8005: INC $00
+	0x4C, 0x00, 0x80,       // 8007: JMP $8000
+};
+
+// Spins with NMI on. The handler polls PPUSTATUS until VBLANK reads clear,
+// which the first read of it does, so the loop leaves on its second pass.
+const uint8_t g_pNMIPollProgram[] = {
+	0xA9, 0x80,             // 8000: LDA #$80
+	0x8D, 0x00, 0x20,       // 8002: STA $2000
+	0x4C, 0x05, 0x80,       // 8005: JMP $8005
+	0xAD, 0x02, 0x20,       // 8008: LDA $2002
+	0x30, 0xFB,             // 800B: BMI $8008
+	0xE6, 0x20,             // 800D: INC $20
+	0x40,                   // 800F: RTI
+};
+
+// Streams a counter through PPUDATA forever, filling nametables, palette
+// and pattern RAM in turn
+const uint8_t g_pVRAMFillProgram[] = {
+	0xA9, 0x20,             // 8000: LDA #$20
+	0x8D, 0x06, 0x20,       // 8002: STA $2006
+	0xA9, 0x00,             // 8005: LDA #$00
+	0x8D, 0x06, 0x20,       // 8007: STA $2006
+	0xE6, 0x10,             // 800A: INC $10
+	0xA5, 0x10,             // 800C: LDA $10
+	0x8D, 0x07, 0x20,       // 800E: STA $2007
+	0x4C, 0x0A, 0x80,       // 8011: JMP $800A
+};
+
+void LoadProgram(pane::MMU& xMMU, const uint8_t* pProgram, size_t nSize) {
+	const uint8_t pResetVector[] = { 0x00, 0x80 };
+	xMMU.LoadROM(pProgram, 0x8000, nSize);
+	xMMU.LoadROM(pResetVector, RESET_ADDRESS, sizeof(pResetVector));
+}
+
+// Writes an iNES image for mapper nMapper with nPRGSize bytes of PRG and
+// nCHRSize bytes of CHR ROM, vertical mirroring. PRG bytes hold the number of
+// the 8K bank they are in and CHR bytes the number of their 1K bank. The
+// program goes at pReset, counted back from the end of PRG like a fixed last
+// bank, and the reset and IRQ vectors point at pReset and pIRQ.
+void WriteBenchImage(const std::string& sPath, uint8_t nMapper, size_t nPRGSize, size_t nCHRSize,
+                     const uint8_t* pProgram, size_t nSize, uint16_t pReset, uint16_t pIRQ = 0) {
+	std::vector<uint8_t> vImage(PANE_INES_HEADER_SIZE + nPRGSize + nCHRSize, 0);
+	uint32_t nMagic = PANE_INES_MAGIC;
+	std::memcpy(vImage.data(), &nMagic, sizeof(nMagic));
+	vImage[4] = static_cast<uint8_t>(nPRGSize / PANE_INES_PRG_UNIT);
+	vImage[5] = static_cast<uint8_t>(nCHRSize / PANE_INES_CHR_UNIT);
+	vImage[6] = static_cast<uint8_t>((nMapper << 4) | 0x01);
+	vImage[7] = nMapper & 0xF0;
+	uint8_t* pPRG = vImage.data() + PANE_INES_HEADER_SIZE;
+	for (size_t i = 0; i < nPRGSize; i++) {
+		pPRG[i] = static_cast<uint8_t>(i >> 13);
+	}
+	for (size_t i = 0; i < nCHRSize; i++) {
+		pPRG[nPRGSize + i] = static_cast<uint8_t>(i >> 10);
+	}
+	std::memcpy(pPRG + nPRGSize - (0x10000 - pReset), pProgram, nSize);
+	pPRG[nPRGSize - 4] = pReset & 0xFF;
+	pPRG[nPRGSize - 3] = pReset >> 8;
+	pPRG[nPRGSize - 2] = pIRQ & 0xFF;
+	pPRG[nPRGSize - 1] = pIRQ >> 8;
+	std::ofstream xFile(sPath, std::ios::binary);
+	xFile.write(reinterpret_cast<const char*>(vImage.data()), vImage.size());
+}
+
+double ParseSeconds(int argc, char** argv, double nDefault) {
+	for (int i = 0; i + 1 < argc; i++) {
+		if (std::strcmp(argv[i], "--seconds") == 0) {
+			return std::stod(argv[i + 1]);
+		}
+	}
+	return nDefault;
+}
+
+uint64_t ParseCount(int argc, char** argv, const char* sOption, uint64_t nDefault) {
+	for (int i = 0; i + 1 < argc; i++) {
+		if (std::strcmp(argv[i], sOption) == 0) {
+			return std::stoull(argv[i + 1]);
+		}
+	}
+	return nDefault;
+}
+
+bool HasFlag(int argc, char** argv, const char* sFlag) {
+	for (int i = 0; i < argc; i++) {
+		if (std::strcmp(argv[i], sFlag) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Resident set size, 0 where it can't be read
+size_t GetResidentBytes() {
+#ifdef __linux__
+	std::ifstream xStatm("/proc/self/statm");
+	size_t nSize = 0;
+	size_t nResident = 0;
+	if (xStatm >> nSize >> nResident) {
+		return nResident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	}
+#endif
+	return 0;
+}
+
+// 1, 2, 4, ... threads and finally all of them
+std::vector<size_t> GetThreadCounts(size_t nMaxThreads) {
+	std::vector<size_t> vThreadCounts;
+	for (size_t nThreads = 1; nThreads < nMaxThreads; nThreads *= 2) {
+		vThreadCounts.push_back(nThreads);
+	}
+	vThreadCounts.push_back(nMaxThreads);
+	return vThreadCounts;
+}
+
+int RunCPUBenchmark(const uint8_t* pProgram, size_t nSize, int argc, char** argv) {
+	double nSeconds = ParseSeconds(argc, argv, 2.0);
+
+	pane::MMU xMMU;
+	xMMU.Init();
+	LoadProgram(xMMU, pProgram, nSize);
+
+	std::unique_ptr<pane::CPU> pCPU = std::make_unique<pane::CPU>();
+	pCPU->SetBus(&xMMU);
+	pCPU->SetBlockCacheEnabled(HasFlag(argc, argv, "--block-cache"));
+	pCPU->SetJITEnabled(HasFlag(argc, argv, "--jit"));
+	if (HasFlag(argc, argv, "--perf-map")) {
+		pCPU->SetJITPerfMapEnabled(true);
+	}
+	pCPU->Start();
+
+	uint64_t nCycles = 0;
+	auto tStart = std::chrono::steady_clock::now();
+	double nElapsed = 0.0;
+	while (nElapsed < nSeconds) {
+		nCycles += 1000000 + pCPU->RunCycles(1000000);
+		nElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	}
+
+	uint64_t nInstructions = pCPU->GetInstructionCount();
+	std::cout << "cpu: " << nInstructions << " instructions, " << nCycles << " cycles in " << nElapsed << "s" << std::endl;
+	std::cout << "cpu: " << nInstructions / nElapsed / 1e6 << " M instructions/s, "
+	          << nCycles / nElapsed / 1e6 << " M cycles/s" << std::endl;
+	if (pCPU->IsBlockCacheEnabled()) {
+		std::cout << "cpu: block cache " << pCPU->GetBlockCacheHits() << " hits, "
+		          << pCPU->GetBlockCacheMisses() << " misses" << std::endl;
+	}
+	if (pCPU->IsJITEnabled()) {
+		std::cout << "cpu: " << pCPU->GetJITBlockCount() << " blocks translated" << std::endl;
+	}
+	return EXIT_SUCCESS;
+}
+
+int BenchCPU(int argc, char** argv) {
+	return RunCPUBenchmark(g_pCPUBenchProgram, sizeof(g_pCPUBenchProgram), argc, argv);
+}
+
+int BenchFlags(int argc, char** argv) {
+	return RunCPUBenchmark(g_pFlagsBenchProgram, sizeof(g_pFlagsBenchProgram), argc, argv);
+}
+
+// Runs every batch twice on the same runner and times the second, checking
+// each worker kept its machine's state block and how much memory the second
+// batch added on top of the first.
+int BenchBatch(int argc, char** argv) {
+	size_t nInstances = ParseCount(argc, argv, "--instances", 64);
+	uint64_t nFrames = ParseCount(argc, argv, "--frames", 300);
+	size_t nMaxThreads = ParseCount(argc, argv, "--threads", std::max(1u, std::thread::hardware_concurrency()));
+	bool bJIT = HasFlag(argc, argv, "--jit");
+
+	// State block each job ran on
+	std::vector<const pane::MachineState*> vBlocks(nInstances);
+	pane::BatchJob fnJob = [nFrames, bJIT, &vBlocks](pane::Machine& xMachine, size_t nJob) -> uint64_t {
+		vBlocks[nJob] = &xMachine.SyncState();
+		LoadProgram(*xMachine.GetMMU(), g_pCPUBenchProgram, sizeof(g_pCPUBenchProgram));
+		xMachine.GetCPU()->SetJITEnabled(bJIT);
+		xMachine.Start();
+		// Give every instance different data to chew on
+		xMachine.GetMMU()->Write(0x10, static_cast<uint8_t>(nJob));
+
+		uint64_t nRun = 0;
+		while (nRun < nFrames && xMachine.RunFrame() == pane::STOP_FRAME) {
+			nRun++;
+		}
+		return nRun;
+	};
+
+	bool bMatch = true;
+	double nBaseline = 0.0;
+	for (size_t nThreads : GetThreadCounts(nMaxThreads)) {
+		pane::BatchRunner xRunner(nThreads);
+		xRunner.Run(nInstances, fnJob);
+		size_t nResident = GetResidentBytes();
+		pane::BatchStats xStats = xRunner.Run(nInstances, fnJob);
+		size_t nAdded = std::max(GetResidentBytes(), nResident) - nResident;
+		std::sort(vBlocks.begin(), vBlocks.end());
+		size_t nDistinct = std::unique(vBlocks.begin(), vBlocks.end()) - vBlocks.begin();
+		bool bReused = nDistinct <= nThreads;
+		bMatch = bMatch && bReused;
+
+		double nFPS = xStats.GetFramesPerSecond();
+		if (nBaseline == 0.0) {
+			nBaseline = nFPS;
+		}
+		std::cout << "batch: " << nThreads << " threads, " << xStats.nJobs << " instances, "
+		          << xStats.nFrames << " frames in " << xStats.nSeconds << "s, " << nFPS << " fps, "
+		          << nFPS / nBaseline << "x (" << 100.0 * nFPS / nBaseline / nThreads << "% efficiency), "
+		          << xStats.nSteals << " steals" << std::endl;
+		std::cout << "batch: " << nThreads << " threads, " << nDistinct << " state blocks for " << xStats.nJobs
+		          << " jobs, " << nAdded << " resident bytes added by the second batch "
+		          << (bReused ? "match" : "DIFFER") << std::endl;
+	}
+	return bMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Checks that a restored state reproduces the original run exactly, from a
+// frame boundary and from the middle of a frame, then times save and load.
+// Runs polling loops with idle loop skipping off and on and checks both end
+// in the same state after the same number of instructions
+int BenchIdle(int argc, char** argv) {
+	uint64_t nFrames = ParseCount(argc, argv, "--frames", 600);
+	struct IdleCase {
+		const char* sName;
+		const uint8_t* pProgram;
+		size_t nSize;
+		// 0 leaves the NMI vector unset
+		uint16_t pNMI;
+	};
+	const IdleCase pCases[] = {
+		{ "vblank spin", g_pVBlankSpinProgram, sizeof(g_pVBlankSpinProgram), 0 },
+		{ "NMI handler polling PPUSTATUS", g_pNMIPollProgram, sizeof(g_pNMIPollProgram), 0x8008 },
+	};
+
+	bool bMatch = true;
+	for (const IdleCase& xCase : pCases) {
+		uint64_t pHashes[2];
+		uint64_t pInstructions[2];
+		double pFPS[2];
+		uint64_t nIdleCycles = 0;
+		for (int nSkip = 0; nSkip < 2; nSkip++) {
+			pane::Machine xMachine;
+			xMachine.Init();
+			LoadProgram(*xMachine.GetMMU(), xCase.pProgram, xCase.nSize);
+			if (xCase.pNMI != 0) {
+				const uint8_t pNMIVector[] = { static_cast<uint8_t>(xCase.pNMI & 0xFF), static_cast<uint8_t>(xCase.pNMI >> 8) };
+				xMachine.GetMMU()->LoadROM(pNMIVector, NMI_ADDRESS, sizeof(pNMIVector));
+			}
+			xMachine.GetCPU()->SetIdleLoopSkipEnabled(nSkip == 1);
+			xMachine.Start();
+
+			auto tStart = std::chrono::steady_clock::now();
+			for (uint64_t i = 0; i < nFrames; i++) {
+				xMachine.RunFrame();
+				nIdleCycles += xMachine.GetIdleCycles();
+			}
+			pFPS[nSkip] = nFrames / std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+			pHashes[nSkip] = xMachine.GetStateHash();
+			pInstructions[nSkip] = xMachine.GetCPU()->GetInstructionCount();
+		}
+		bool bSame = pHashes[0] == pHashes[1] && pInstructions[0] == pInstructions[1];
+		bMatch = bMatch && bSame;
+		std::cout << "idle: " << xCase.sName << ", " << pFPS[0] << " fps without skipping, " << pFPS[1] << " fps with, "
+		          << nIdleCycles / nFrames << " cycles skipped per frame " << (bSame ? "match" : "DIFFER") << std::endl;
+	}
+	return bMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int BenchState(int argc, char** argv) {
+	double nSeconds = ParseSeconds(argc, argv, 1.0);
+
+	pane::Machine xMachine;
+	xMachine.Init();
+	LoadProgram(*xMachine.GetMMU(), g_pCPUBenchProgram, sizeof(g_pCPUBenchProgram));
+	xMachine.Start();
+	for (int i = 0; i < 10; i++) {
+		xMachine.RunFrame();
+	}
+
+	std::unique_ptr<pane::MachineState> pSaved = std::make_unique<pane::MachineState>();
+	std::unique_ptr<pane::MachineState> pFirst = std::make_unique<pane::MachineState>();
+	std::unique_ptr<pane::MachineState> pSecond = std::make_unique<pane::MachineState>();
+	bool bMatch = true;
+	for (uint64_t nOffset : { uint64_t(0), uint64_t(12345) }) {
+		xMachine.RunUntil(xMachine.GetCPU()->GetTotalCycles() + nOffset);
+		xMachine.SaveState(pSaved.get());
+		for (int i = 0; i < 30; i++) {
+			xMachine.RunFrame();
+		}
+		xMachine.SaveState(pFirst.get());
+
+		xMachine.LoadState(*pSaved);
+		for (int i = 0; i < 30; i++) {
+			xMachine.RunFrame();
+		}
+		xMachine.SaveState(pSecond.get());
+		bMatch = bMatch && std::memcmp(pFirst.get(), pSecond.get(), sizeof(pane::MachineState)) == 0;
+	}
+
+	uint64_t nSaves = 0;
+	auto tStart = std::chrono::steady_clock::now();
+	double nElapsed = 0.0;
+	while (nElapsed < nSeconds / 2) {
+		for (int i = 0; i < 1000; i++) {
+			xMachine.SaveState(pSaved.get());
+		}
+		nSaves += 1000;
+		nElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	}
+	double nSaveTime = nElapsed / nSaves;
+
+	uint64_t nLoads = 0;
+	tStart = std::chrono::steady_clock::now();
+	nElapsed = 0.0;
+	while (nElapsed < nSeconds / 2) {
+		for (int i = 0; i < 1000; i++) {
+			xMachine.LoadState(*pSaved);
+		}
+		nLoads += 1000;
+		nElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	}
+	double nLoadTime = nElapsed / nLoads;
+
+	std::cout << "state: " << sizeof(pane::MachineState) << " bytes, restored runs "
+	          << (bMatch ? "match" : "DIFFER") << std::endl;
+	std::cout << "state: save " << nSaveTime * 1e6 << " us, load " << nLoadTime * 1e6 << " us ("
+	          << sizeof(pane::MachineState) / nSaveTime / 1e9 << " / " << sizeof(pane::MachineState) / nLoadTime / 1e9
+	          << " GB/s)" << std::endl;
+	return bMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Records nFrames frames into a rewind buffer of nBudget bytes, keeping
+// whole copies of the last few states, then steps back through them and
+// checks each one comes back exactly.
+bool RunRewindBenchmark(uint64_t nFrames, size_t nBudget) {
+	const size_t nChecked = 64;
+
+	pane::Machine xMachine;
+	xMachine.Init();
+	LoadProgram(*xMachine.GetMMU(), g_pCPUBenchProgram, sizeof(g_pCPUBenchProgram));
+	xMachine.Start();
+
+	pane::RewindBuffer xRewind(nBudget);
+	std::vector<std::unique_ptr<pane::MachineState>> vStates;
+	for (size_t i = 0; i < nChecked; i++) {
+		vStates.push_back(std::make_unique<pane::MachineState>());
+	}
+
+	double nFrameSeconds = 0.0;
+	for (uint64_t i = 0; i < nFrames; i++) {
+		auto tStart = std::chrono::steady_clock::now();
+		xMachine.RunFrame();
+		nFrameSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+		xRewind.Record(xMachine);
+		if (nFrames - i <= nChecked) {
+			xMachine.SaveState(vStates[nFrames - i - 1].get());
+		}
+	}
+	pane::RewindStats xStats = xRewind.GetStats();
+
+	// vStates[0] is the newest, StepBack starts from the one before it
+	std::unique_ptr<pane::MachineState> pRestored = std::make_unique<pane::MachineState>();
+	size_t nSteps = 0;
+	bool bMatch = true;
+	while (nSteps + 1 < nChecked && xRewind.StepBack(xMachine)) {
+		nSteps++;
+		xMachine.SaveState(pRestored.get());
+		bMatch = bMatch && std::memcmp(pRestored.get(), vStates[nSteps].get(), sizeof(pane::MachineState)) == 0;
+	}
+	bMatch = bMatch && nSteps == std::min<size_t>(nChecked - 1, xStats.nSnapshots);
+
+	// Real time NTSC frame
+	const double nRealFrame = 1.0 / 60.0988;
+	double nRecordTime = xStats.GetSecondsPerSnapshot();
+	std::cout << "rewind: " << nBudget << " byte budget, " << xStats.nRecorded << " frames, " << xStats.nSnapshots
+	          << " steps held in " << xStats.nBytesUsed << " bytes, rewound " << nSteps << " "
+	          << (bMatch ? "match" : "DIFFER") << std::endl;
+	std::cout << "rewind: " << xStats.GetBytesPerSnapshot() << " bytes/frame ("
+	          << xStats.GetBytesPerSnapshot() * 60.0988 * 3600 / (1 << 20) << " MB/hour), "
+	          << nRecordTime * 1e6 << " us/frame, " << 100.0 * nRecordTime / nRealFrame << "% of a 60 Hz frame, "
+	          << 100.0 * nRecordTime * nFrames / nFrameSeconds << "% of emulation time" << std::endl;
+	return bMatch;
+}
+
+int BenchRewind(int argc, char** argv) {
+	uint64_t nFrames = ParseCount(argc, argv, "--frames", 3600);
+	bool bMatch = RunRewindBenchmark(nFrames, PANE_REWIND_DEFAULT_BUDGET);
+	// Small enough that the ring wraps many times
+	bMatch = RunRewindBenchmark(nFrames, 64 << 10) && bMatch;
+	return bMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Host frames per second with 0 to 3 frames of run-ahead, checking the real
+// timeline is the same as without.
+int BenchRunAhead(int argc, char** argv) {
+	double nSeconds = ParseSeconds(argc, argv, 1.0);
+	bool bJIT = HasFlag(argc, argv, "--jit");
+	const uint64_t nCompared = 120;
+
+	std::unique_ptr<pane::MachineState> pReference = std::make_unique<pane::MachineState>();
+	std::unique_ptr<pane::MachineState> pState = std::make_unique<pane::MachineState>();
+	bool bMatch = true;
+	double nBaseline = 0.0;
+	for (uint32_t nAhead = 0; nAhead <= 3; nAhead++) {
+		pane::Machine xMachine;
+		xMachine.Init();
+		LoadProgram(*xMachine.GetMMU(), g_pCPUBenchProgram, sizeof(g_pCPUBenchProgram));
+		xMachine.GetCPU()->SetJITEnabled(bJIT);
+		xMachine.Start();
+
+		for (uint64_t i = 0; i < nCompared; i++) {
+			xMachine.RunFrameAhead(nAhead);
+		}
+		xMachine.SaveState(nAhead == 0 ? pReference.get() : pState.get());
+		bool bSame = nAhead == 0 || std::memcmp(pReference.get(), pState.get(), sizeof(pane::MachineState)) == 0;
+		bMatch = bMatch && bSame;
+
+		uint64_t nFrames = 0;
+		auto tStart = std::chrono::steady_clock::now();
+		double nElapsed = 0.0;
+		while (nElapsed < nSeconds) {
+			for (int i = 0; i < 16; i++) {
+				xMachine.RunFrameAhead(nAhead);
+			}
+			nFrames += 16;
+			nElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+		}
+		double nFPS = nFrames / nElapsed;
+		if (nAhead == 0) {
+			nBaseline = nFPS;
+		}
+		// Ideal is 1 / (N + 1), the rest is the save and restore
+		std::cout << "runahead: " << nAhead << " frames, " << nFPS << " host fps, "
+		          << nFPS / nBaseline << "x of plain (ideal " << 1.0 / (nAhead + 1) << "x)"
+		          << (bSame ? "" : ", timeline DIFFERS") << std::endl;
+	}
+	return bMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Runs nLanes copies of the CPU benchmark, each seeded with different data,
+// on the lockstep core and on as many scalar CPUs, checks they agree lane by
+// lane and reports aggregate instructions per second for both.
+template <size_t nLanes>
+bool RunLockstepBenchmark(double nSeconds) {
+	std::vector<uint8_t> vPRG(0x8000, 0);
+	std::memcpy(vPRG.data(), g_pCPUBenchProgram, sizeof(g_pCPUBenchProgram));
+	vPRG[RESET_ADDRESS - 0x8000] = 0x00;
+	vPRG[RESET_ADDRESS - 0x8000 + 1] = 0x80;
+
+	const int32_t nSlice = 100000;
+
+	std::unique_ptr<pane::LockstepCPU<nLanes>> pLockstep = std::make_unique<pane::LockstepCPU<nLanes>>();
+	pLockstep->SetPRG(vPRG.data(), vPRG.size());
+	for (size_t l = 0; l < nLanes; l++) {
+		pLockstep->WriteRAM(l, 0x10, static_cast<uint8_t>(l * 37));
+	}
+	pLockstep->Start();
+	uint64_t nSlices = 0;
+	auto tStart = std::chrono::steady_clock::now();
+	double nLockstepElapsed = 0.0;
+	while (nLockstepElapsed < nSeconds) {
+		pLockstep->RunCycles(nSlice);
+		nSlices++;
+		nLockstepElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	}
+	uint64_t nLockstepInstructions = 0;
+	for (size_t l = 0; l < nLanes; l++) {
+		nLockstepInstructions += pLockstep->GetInstructionCount(l);
+	}
+
+	// Same slices on the scalar path, one CPU and MMU per instance
+	std::vector<std::unique_ptr<pane::MMU>> vMMUs;
+	std::vector<std::unique_ptr<pane::CPU>> vCPUs;
+	for (size_t l = 0; l < nLanes; l++) {
+		vMMUs.push_back(std::make_unique<pane::MMU>());
+		vMMUs[l]->Init();
+		LoadProgram(*vMMUs[l], g_pCPUBenchProgram, sizeof(g_pCPUBenchProgram));
+		vMMUs[l]->Write(0x10, static_cast<uint8_t>(l * 37));
+		vCPUs.push_back(std::make_unique<pane::CPU>());
+		vCPUs[l]->SetBus(vMMUs[l].get());
+		vCPUs[l]->SetBlockCacheEnabled(true);
+		vCPUs[l]->Start();
+	}
+	tStart = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < nSlices; i++) {
+		for (size_t l = 0; l < nLanes; l++) {
+			vCPUs[l]->RunCycles(nSlice);
+		}
+	}
+	double nScalarElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+	uint64_t nScalarInstructions = 0;
+	size_t nMismatches = 0;
+	for (size_t l = 0; l < nLanes; l++) {
+		nScalarInstructions += vCPUs[l]->GetInstructionCount();
+		bool bMatch = pLockstep->GetLaneState(l) == pane::LANE_RUNNING
+			&& vCPUs[l]->GetInstructionCount() == pLockstep->GetInstructionCount(l)
+			&& vCPUs[l]->GetTotalCycles() == pLockstep->GetTotalCycles(l)
+			&& vCPUs[l]->GetStatus() == pLockstep->GetRegisters(l).sr;
+		for (uint16_t pAddress = 0; pAddress < PANE_LOCKSTEP_RAM_SIZE && bMatch; pAddress++) {
+			bMatch = vMMUs[l]->Read(pAddress) == pLockstep->ReadRAM(l, pAddress);
+		}
+		nMismatches += !bMatch;
+	}
+
+	double nLockstepRate = nLockstepInstructions / nLockstepElapsed / 1e6;
+	double nScalarRate = nScalarInstructions / nScalarElapsed / 1e6;
+	std::cout << "lockstep: " << nLanes << " lanes, " << nLockstepRate << " M instructions/s, "
+	          << 100.0 * nLockstepInstructions / (pLockstep->GetStepCount() * nLanes) << "% lane utilisation" << std::endl;
+	std::cout << "lockstep: " << nLanes << " scalar CPUs, " << nScalarRate << " M instructions/s ("
+	          << nLockstepRate / nScalarRate << "x)" << std::endl;
+	if (nMismatches != 0) {
+		std::cout << "lockstep: " << nMismatches << " lanes differ from the scalar CPU!" << std::endl;
+	}
+	return nMismatches == 0;
+}
+
+// Tree search over inputs: forks a running machine nForks times and runs
+// every fork nFrames with its own buttons, against full copies made with
+// Init and LoadState. Checks a fork of a fork runs exactly like a copy and
+// that forking leaves the parent alone.
+int BenchFork(int argc, char** argv) {
+	double nSeconds = ParseSeconds(argc, argv, 1.0);
+	uint64_t nForks = ParseCount(argc, argv, "--forks", 1000);
+	uint64_t nFrames = ParseCount(argc, argv, "--frames", 2);
+
+	pane::Machine xRoot;
+	xRoot.Init();
+	LoadProgram(*xRoot.GetMMU(), g_pCPUBenchProgram, sizeof(g_pCPUBenchProgram));
+	xRoot.Start();
+	for (int i = 0; i < 10; i++) {
+		xRoot.RunFrame();
+	}
+
+	std::unique_ptr<pane::MachineState> pRootState = std::make_unique<pane::MachineState>();
+	std::unique_ptr<pane::MachineState> pForked = std::make_unique<pane::MachineState>();
+	std::unique_ptr<pane::MachineState> pCopied = std::make_unique<pane::MachineState>();
+	xRoot.SaveState(pRootState.get());
+
+	std::unique_ptr<pane::Machine> pChild = xRoot.Fork();
+	pChild->GetControllers()->SetButtons(0, pane::BUTTON_A);
+	for (uint64_t i = 0; i < nFrames; i++) {
+		pChild->RunFrame();
+	}
+	std::unique_ptr<pane::Machine> pGrandchild = pChild->Fork();
+	pChild.reset();
+	for (uint64_t i = 0; i < nFrames; i++) {
+		pGrandchild->RunFrame();
+	}
+	pGrandchild->SaveState(pForked.get());
+
+	pane::Machine xCopy;
+	xCopy.Init();
+	xCopy.LoadState(*pRootState);
+	xCopy.GetControllers()->SetButtons(0, pane::BUTTON_A);
+	for (uint64_t i = 0; i < 2 * nFrames; i++) {
+		xCopy.RunFrame();
+	}
+	xCopy.SaveState(pCopied.get());
+	bool bMatch = std::memcmp(pForked.get(), pCopied.get(), sizeof(pane::MachineState)) == 0;
+	xRoot.SaveState(pCopied.get());
+	bMatch = bMatch && std::memcmp(pRootState.get(), pCopied.get(), sizeof(pane::MachineState)) == 0;
+
+	// Cartridge space under mapped ROM is never shared, yet saved and hashed
+	std::string sPath = (std::filesystem::temp_directory_path() / "pane_bench_fork.nes").string();
+	WriteBenchImage(sPath, 0, 0x8000, PANE_INES_CHR_UNIT, g_pInputBenchProgram, sizeof(g_pInputBenchProgram), 0x8000);
+	std::shared_ptr<pane::Cartridge> pCartridge = std::make_shared<pane::Cartridge>();
+	pCartridge->Load(sPath);
+	std::filesystem::remove(sPath);
+	pane::Machine xMapped;
+	xMapped.Init();
+	xMapped.InsertCartridge(pCartridge);
+	xMapped.Start();
+	xMapped.RunFrame();
+	{
+		// Leaves a freed block of other bytes behind for the fork to land on
+		std::unique_ptr<pane::MachineState> pStale(new pane::MachineState);
+		std::memset(pStale.get(), 0xA5, sizeof(pane::MachineState));
+		bMatch = bMatch && pane::HashMachineState(*pStale) != 0;
+	}
+	std::unique_ptr<pane::Machine> pMappedFork = xMapped.Fork();
+	bool bMappedMatch = pMappedFork->GetStateHash() == xMapped.GetStateHash();
+	for (uint64_t i = 0; i < nFrames; i++) {
+		xMapped.RunFrame();
+		pMappedFork->RunFrame();
+	}
+	bMappedMatch = bMappedMatch && pMappedFork->GetStateHash() == xMapped.GetStateHash();
+	bMatch = bMatch && bMappedMatch;
+	pMappedFork.reset();
+
+	uint64_t nForked = 0;
+	auto tStart = std::chrono::steady_clock::now();
+	double nElapsed = 0.0;
+	while (nElapsed < nSeconds) {
+		for (int i = 0; i < 100; i++) {
+			std::unique_ptr<pane::Machine> pFork = xRoot.Fork();
+		}
+		nForked += 100;
+		nElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	}
+	double nForkTime = nElapsed / nForked;
+
+	// nForks live at once, each branching on different buttons
+	std::vector<std::unique_ptr<pane::Machine>> vForks;
+	size_t nResident = GetResidentBytes();
+	tStart = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < nForks; i++) {
+		vForks.push_back(xRoot.Fork());
+		vForks.back()->GetControllers()->SetButtons(0, static_cast<uint8_t>(i));
+		for (uint64_t j = 0; j < nFrames; j++) {
+			vForks.back()->RunFrame();
+		}
+	}
+	double nForkRunTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	size_t nForkResident = GetResidentBytes() - nResident;
+	size_t nPrivatePages = 0;
+	for (const std::unique_ptr<pane::Machine>& pFork : vForks) {
+		nPrivatePages += pFork->GetMMU()->GetPrivatePageCount();
+	}
+	vForks.clear();
+
+	// The same with whole copies, without the block cache like forks
+	std::vector<std::unique_ptr<pane::Machine>> vCopies;
+	nResident = GetResidentBytes();
+	tStart = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < nForks; i++) {
+		vCopies.push_back(std::make_unique<pane::Machine>());
+		vCopies.back()->Init();
+		vCopies.back()->GetCPU()->SetBlockCacheEnabled(false);
+		vCopies.back()->LoadState(*pRootState);
+		vCopies.back()->GetControllers()->SetButtons(0, static_cast<uint8_t>(i));
+		for (uint64_t j = 0; j < nFrames; j++) {
+			vCopies.back()->RunFrame();
+		}
+	}
+	double nCopyRunTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	size_t nCopyResident = GetResidentBytes() - nResident;
+	vCopies.clear();
+
+	std::cout << "fork: fork of a fork runs like a copy and leaves the parent alone: "
+	          << (bMatch ? "match" : "DIFFER") << std::endl;
+	std::cout << "fork: fork of a machine with a cartridge hashes like its parent: "
+	          << (bMappedMatch ? "match" : "DIFFER") << std::endl;
+	std::cout << "fork: " << 1.0 / nForkTime << " forks/s (" << nForkTime * 1e6 << " us)" << std::endl;
+	std::cout << "fork: " << nForks << " live forks x " << nFrames << " frames in " << nForkRunTime << "s, "
+	          << nForkResident / nForks << " resident bytes/fork, "
+	          << static_cast<double>(nPrivatePages) / nForks << " pages copied/fork" << std::endl;
+	std::cout << "fork: " << nForks << " full copies x " << nFrames << " frames in " << nCopyRunTime << "s, "
+	          << nCopyResident / nForks << " resident bytes/copy" << std::endl;
+	return bMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Plays the movie from the machine's current frame up to nFrame
+void PlayMovieTo(pane::Machine& xMachine, const pane::Movie& xMovie, uint64_t nFrame) {
+	for (uint64_t i = xMachine.GetPPU()->GetFrameCount(); i < nFrame; i++) {
+		for (uint8_t nPort = 0; nPort < PANE_CONTROLLER_PORTS; nPort++) {
+			xMachine.GetControllers()->SetButtons(nPort, xMovie.GetButtons(i)[nPort]);
+		}
+		xMachine.RunFrame();
+	}
+}
+
+// Records nFrames of a program, the CPU bench one by default, with made up
+// input into xMovie, frame hashes included, saving a keyframe every
+// nInterval frames through xWriter. Returns the time spent in RunFrame.
+double RecordBenchMovie(pane::Movie& xMovie, pane::KeyframeWriter& xWriter, uint64_t nFrames, uint64_t nInterval,
+                        const uint8_t* pProgram = g_pCPUBenchProgram, size_t nSize = sizeof(g_pCPUBenchProgram)) {
+	xMovie.Reset(0);
+
+	pane::Machine xMachine;
+	xMachine.Init();
+	LoadProgram(*xMachine.GetMMU(), pProgram, nSize);
+	xMachine.Start();
+
+	uint32_t nSeed = 0x1234567;
+	double nFrameSeconds = 0.0;
+	for (uint64_t i = 0; i < nFrames; i++) {
+		if (i % nInterval == 0) {
+			xWriter.Append(i, xMovie.GetInputHash(i), xMachine.SyncState());
+		}
+		nSeed = nSeed * 1103515245 + 12345;
+		uint8_t pButtons[PANE_CONTROLLER_PORTS] = { static_cast<uint8_t>(nSeed >> 16), 0 };
+		xMovie.SetFrame(i, pButtons);
+		xMachine.GetControllers()->SetButtons(0, pButtons[0]);
+
+		auto tStart = std::chrono::steady_clock::now();
+		xMachine.RunFrame();
+		nFrameSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+		xMovie.SetFrameHash(i, xMachine.GetStateHash());
+	}
+	return nFrameSeconds;
+}
+
+// Records a session with a keyframe every --interval frames written in the
+// background, then seeks to frames across it through the index and checks
+// each lands on the state the straight run had there.
+int BenchKeyframes(int argc, char** argv) {
+	uint64_t nFrames = std::max<uint64_t>(ParseCount(argc, argv, "--frames", 12000), 1);
+	uint64_t nInterval = std::max<uint64_t>(ParseCount(argc, argv, "--interval", PANE_KEYFRAME_DEFAULT_INTERVAL), 1);
+	std::string sPath = (std::filesystem::temp_directory_path() / "pane_bench.keyframes").string();
+
+	// Just before a keyframe, the most a seek ever has to emulate
+	std::vector<uint64_t> vTargets = { nFrames / 4, std::min(nFrames / 2 + nInterval - 1, nFrames), nFrames };
+
+	pane::Movie xMovie;
+	pane::KeyframeWriter xWriter;
+	xWriter.Open(sPath, 0, false);
+	double nFrameSeconds = RecordBenchMovie(xMovie, xWriter, nFrames, nInterval);
+	xWriter.Close();
+
+	pane::KeyframeIndex xIndex;
+	bool bMatch = xIndex.Open(sPath, 0);
+	std::cout << "keyframes: " << nFrames << " frames, " << xIndex.GetEntryCount() << " keyframes in "
+	          << std::filesystem::file_size(sPath) << " bytes, " << xWriter.GetAppendSeconds() / xWriter.GetAppendCount() * 1e6
+	          << " us per keyframe on the emulation thread (a frame takes " << nFrameSeconds / nFrames * 1e6 << " us)" << std::endl;
+
+	for (size_t i = 0; i < vTargets.size() && bMatch; i++) {
+		pane::Machine xSeeker;
+		xSeeker.Init();
+		LoadProgram(*xSeeker.GetMMU(), g_pCPUBenchProgram, sizeof(g_pCPUBenchProgram));
+		xSeeker.Start();
+
+		auto tStart = std::chrono::steady_clock::now();
+		const pane::KeyframeEntry* pKeyframe = xIndex.Find(xMovie, vTargets[i]);
+		if (pKeyframe != nullptr) {
+			xSeeker.LoadState(pKeyframe->xState);
+		}
+		uint64_t nKeyframe = xSeeker.GetPPU()->GetFrameCount();
+		PlayMovieTo(xSeeker, xMovie, vTargets[i]);
+		double nSeekTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+		bool bSeekMatch = vTargets[i] == 0 || xSeeker.GetStateHash() == xMovie.GetFrameHash(vTargets[i] - 1);
+		bMatch = bMatch && bSeekMatch;
+		std::cout << "keyframes: seek to " << vTargets[i] << " from " << nKeyframe << " in " << nSeekTime * 1e3 << " ms "
+		          << (bSeekMatch ? "match" : "DIFFER") << std::endl;
+	}
+
+	// What every seek would cost without the index
+	pane::Machine xReplay;
+	xReplay.Init();
+	LoadProgram(*xReplay.GetMMU(), g_pCPUBenchProgram, sizeof(g_pCPUBenchProgram));
+	xReplay.Start();
+	auto tStart = std::chrono::steady_clock::now();
+	PlayMovieTo(xReplay, xMovie, nFrames);
+	double nReplayTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	bMatch = bMatch && xReplay.GetStateHash() == xMovie.GetFrameHash(nFrames - 1);
+	std::cout << "keyframes: replay to " << nFrames << " from power-on in " << nReplayTime * 1e3 << " ms" << std::endl;
+
+	xIndex.Close();
+	std::filesystem::remove(sPath);
+	return bMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Verifies a recorded session cut into keyframe segments on 1..N threads,
+// then corrupts one frame hash and checks the verifier names that frame.
+int BenchVerify(int argc, char** argv) {
+	uint64_t nFrames = std::max<uint64_t>(ParseCount(argc, argv, "--frames", 12000), 1);
+	uint64_t nInterval = std::max<uint64_t>(ParseCount(argc, argv, "--interval", PANE_KEYFRAME_DEFAULT_INTERVAL), 1);
+	size_t nMaxThreads = ParseCount(argc, argv, "--threads", std::max(1u, std::thread::hardware_concurrency()));
+	bool bJIT = HasFlag(argc, argv, "--jit");
+	std::string sPath = (std::filesystem::temp_directory_path() / "pane_bench_verify.keyframes").string();
+
+	pane::Movie xMovie;
+	pane::KeyframeWriter xWriter;
+	xWriter.Open(sPath, 0, false);
+	RecordBenchMovie(xMovie, xWriter, nFrames, nInterval);
+	xWriter.Close();
+	pane::KeyframeIndex xIndex;
+	bool bMatch = xIndex.Open(sPath, 0);
+
+	pane::MachineSetup fnSetup = [bJIT](pane::Machine& xMachine) {
+		LoadProgram(*xMachine.GetMMU(), g_pCPUBenchProgram, sizeof(g_pCPUBenchProgram));
+		xMachine.GetCPU()->SetJITEnabled(bJIT);
+	};
+
+	pane::MovieVerifier xSerial(1);
+	pane::VerifyResult xResult = xSerial.Verify(xMovie, nullptr, fnSetup);
+	bMatch = bMatch && xResult.bMatch;
+	double nBaseline = xResult.nFrames / xResult.nSeconds;
+	std::cout << "verify: serial replay, " << xResult.nFrames << " frames in " << xResult.nSeconds << "s, "
+	          << nBaseline << " fps " << (xResult.bMatch ? "match" : "DIFFER") << std::endl;
+
+	for (size_t nThreads : GetThreadCounts(nMaxThreads)) {
+		pane::MovieVerifier xVerifier(nThreads);
+		xResult = xVerifier.Verify(xMovie, &xIndex, fnSetup);
+		bMatch = bMatch && xResult.bMatch;
+		double nFPS = xResult.nFrames / xResult.nSeconds;
+		std::cout << "verify: " << nThreads << " threads, " << xResult.nSegments << " segments in " << xResult.nSeconds
+		          << "s, " << nFPS << " fps, " << nFPS / nBaseline << "x " << (xResult.bMatch ? "match" : "DIFFER") << std::endl;
+	}
+
+	// A desync in the middle of a segment
+	uint64_t nCorrupt = nFrames * 2 / 3 + nInterval / 2;
+	if (nCorrupt < nFrames) {
+		uint64_t nHash = xMovie.GetFrameHash(nCorrupt);
+		xMovie.SetFrameHash(nCorrupt, ~nHash);
+		pane::MovieVerifier xVerifier(nMaxThreads);
+		xResult = xVerifier.Verify(xMovie, &xIndex, fnSetup);
+		xMovie.SetFrameHash(nCorrupt, nHash);
+		bool bFound = !xResult.bMatch && xResult.nDivergedFrame == nCorrupt;
+		bMatch = bMatch && bFound;
+		std::cout << "verify: desync injected at frame " << nCorrupt << ", reported at "
+		          << (xResult.bMatch ? std::string("none") : std::to_string(xResult.nDivergedFrame)) << " "
+		          << (bFound ? "match" : "DIFFER") << std::endl;
+	}
+
+	xIndex.Close();
+
+	// Verifying twice on one worker, so the second power-on segment runs on
+	// a machine that already ran the keyframe segments. Their states carry
+	// VRAM that a power-on machine doesn't have.
+	pane::Movie xVRAMMovie;
+	xWriter.Open(sPath, 0, false);
+	RecordBenchMovie(xVRAMMovie, xWriter, std::min<uint64_t>(nFrames, nInterval * 4), nInterval, g_pVRAMFillProgram, sizeof(g_pVRAMFillProgram));
+	xWriter.Close();
+	bMatch = xIndex.Open(sPath, 0) && bMatch;
+	pane::MachineSetup fnVRAMSetup = [bJIT](pane::Machine& xMachine) {
+		LoadProgram(*xMachine.GetMMU(), g_pVRAMFillProgram, sizeof(g_pVRAMFillProgram));
+		xMachine.GetCPU()->SetJITEnabled(bJIT);
+	};
+	pane::MovieVerifier xReused(1);
+	for (uint32_t i = 0; i < 2; i++) {
+		xResult = xReused.Verify(xVRAMMovie, &xIndex, fnVRAMSetup);
+		bMatch = bMatch && xResult.bMatch;
+		std::cout << "verify: reused verifier, pass " << i + 1 << ", " << xResult.nSegments << " segments "
+		          << (xResult.bMatch ? "match" : "DIFFER") << std::endl;
+	}
+	xIndex.Close();
+
+	std::filesystem::remove(sPath);
+	return bMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Made up pad input that holds each combination for a while, like a
+// player would
+uint8_t NextButtons(uint32_t* pSeed, uint8_t nButtons) {
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return ((*pSeed >> 16) & 0x07) == 0 ? static_cast<uint8_t>(*pSeed >> 24) : nButtons;
+}
+
+struct NetplayRun {
+	pane::NetplayStats pStats[2];
+	// Longest AdvanceFrame, rollback included
+	double nWorstSeconds;
+	bool bDesynced;
+	uint64_t nDesyncFrame;
+};
+
+// Two peers on one thread, taking turns each tick of the link. pfnPoke, if
+// set, is called on the second peer's machine every tick.
+NetplayRun RunNetplaySession(uint64_t nFrames, uint32_t nLatency, double nLoss, uint32_t nDelay, uint32_t nRollback, bool bJIT, uint64_t nPokeFrame) {
+	pane::LoopbackLink xLink(nLatency, nLoss);
+	std::shared_ptr<pane::Machine> pMachines[2];
+	std::unique_ptr<pane::NetplaySession> pSessions[2];
+	for (uint8_t i = 0; i < 2; i++) {
+		pMachines[i] = std::make_shared<pane::Machine>();
+		pMachines[i]->Init();
+		LoadProgram(*pMachines[i]->GetMMU(), g_pInputBenchProgram, sizeof(g_pInputBenchProgram));
+		pMachines[i]->GetCPU()->SetJITEnabled(bJIT);
+		pMachines[i]->Start();
+		pSessions[i] = std::make_unique<pane::NetplaySession>(pMachines[i], xLink.GetEnd(i), i, nDelay, nRollback);
+	}
+
+	NetplayRun xRun = { {}, 0.0, false, UINT64_MAX };
+	uint32_t pSeeds[2] = { 1, 2 };
+	uint8_t pButtons[2] = { 0, 0 };
+	// Runs on until the last hash check is through both ways
+	uint64_t nEnd = nFrames + nRollback + nDelay + PANE_NETPLAY_HASH_INTERVAL;
+	for (uint64_t nTick = 0; nTick < 4 * nEnd && (pSessions[0]->GetFrame() < nEnd || pSessions[1]->GetFrame() < nEnd); nTick++) {
+		for (size_t i = 0; i < 2; i++) {
+			// A bad poke into RAM the program never touches
+			if (i == 1 && pSessions[i]->GetFrame() == nPokeFrame) {
+				pMachines[i]->GetMMU()->Write(0x0400, 0xA5);
+			}
+			pButtons[i] = NextButtons(&pSeeds[i], pButtons[i]);
+			auto tStart = std::chrono::steady_clock::now();
+			pSessions[i]->AdvanceFrame(pButtons[i]);
+			xRun.nWorstSeconds = std::max(xRun.nWorstSeconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count());
+		}
+		xLink.Tick();
+	}
+
+	for (size_t i = 0; i < 2; i++) {
+		xRun.pStats[i] = pSessions[i]->GetStats();
+		xRun.bDesynced = xRun.bDesynced || pSessions[i]->IsDesynced();
+		xRun.nDesyncFrame = std::min(xRun.nDesyncFrame, pSessions[i]->GetDesyncFrame());
+	}
+	return xRun;
+}
+
+// Rollback cost over a range of link latencies: frames re-simulated, the
+// longest host frame against the 16.7 ms budget, and whether the peers'
+// confirmed states ever differed. Then a desync is injected on a link with
+// enough input delay that nothing rolls back, and has to be caught.
+int BenchNetplay(int argc, char** argv) {
+	uint64_t nFrames = std::max<uint64_t>(ParseCount(argc, argv, "--frames", 3600), 1);
+	uint32_t nDelay = static_cast<uint32_t>(ParseCount(argc, argv, "--delay", 0));
+	uint32_t nRollback = static_cast<uint32_t>(ParseCount(argc, argv, "--rollback", PANE_NETPLAY_DEFAULT_ROLLBACK));
+	double nLoss = ParseCount(argc, argv, "--loss", 0) / 100.0;
+	bool bJIT = HasFlag(argc, argv, "--jit");
+
+	// What every rollback frame pays on top of emulation
+	pane::Machine xMachine;
+	xMachine.Init();
+	LoadProgram(*xMachine.GetMMU(), g_pInputBenchProgram, sizeof(g_pInputBenchProgram));
+	xMachine.Start();
+	xMachine.RunFrame();
+	std::unique_ptr<pane::MachineState> pState = std::make_unique<pane::MachineState>();
+	const int nRepeats = 1000;
+	uint64_t nHash = 0;
+	auto tStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < nRepeats; i++) {
+		xMachine.SaveState(pState.get());
+		xMachine.LoadState(*pState);
+	}
+	double nRestoreTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count() / nRepeats;
+	tStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < nRepeats; i++) {
+		nHash += pane::HashMachineState(*pState);
+	}
+	double nHashTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count() / nRepeats;
+	std::cout << "netplay: save and load " << nRestoreTime * 1e6 << " us, state hash " << nHashTime * 1e6
+	          << " us (" << (nHash != 0 ? sizeof(pane::MachineState) : 0) << " bytes)" << std::endl;
+
+	bool bMatch = true;
+	for (uint32_t nLatency : { 0u, 1u, 2u, 4u, 6u }) {
+		NetplayRun xRun = RunNetplaySession(nFrames, nLatency, nLoss, nDelay, nRollback, bJIT, UINT64_MAX);
+		bool bSynced = !xRun.bDesynced && xRun.pStats[0].nHashChecks > 0 && xRun.pStats[1].nHashChecks > 0;
+		bMatch = bMatch && bSynced;
+		const pane::NetplayStats& xStats = xRun.pStats[0];
+		std::cout << "netplay: latency " << nLatency << " frames, " << xStats.nRollbacks << " rollbacks of "
+		          << (xStats.nRollbacks > 0 ? static_cast<double>(xStats.nRollbackFrames) / xStats.nRollbacks : 0.0)
+		          << " frames (max " << xStats.nMaxRollbackFrames << "), " << xStats.nStalls << " stalls, "
+		          << (xStats.nRollbacks > 0 ? xStats.nRollbackSeconds / xStats.nRollbacks * 1e3 : 0.0) << " ms per rollback, worst host frame "
+		          << xRun.nWorstSeconds * 1e3 << " ms, " << xStats.nHashChecks << " hash checks "
+		          << (bSynced ? "match" : "DESYNC") << std::endl;
+	}
+
+	uint64_t nPokeFrame = std::min<uint64_t>(nFrames / 2, 300);
+	NetplayRun xRun = RunNetplaySession(nFrames, 0, 0.0, 2, nRollback, bJIT, nPokeFrame);
+	bool bCaught = xRun.bDesynced && xRun.nDesyncFrame > nPokeFrame && xRun.nDesyncFrame <= nPokeFrame + PANE_NETPLAY_HASH_INTERVAL
+	               && xRun.pStats[1].nRollbacks == 0;
+	bMatch = bMatch && bCaught;
+	std::cout << "netplay: desync injected at frame " << nPokeFrame << ", caught at "
+	          << (xRun.bDesynced ? std::to_string(xRun.nDesyncFrame) : std::string("none")) << " "
+	          << (bCaught ? "match" : "DIFFER") << std::endl;
+	return bMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Runs a program from a mapped NROM image and copied in with LoadROM and
+// checks they agree, then times loading images of 32K to 4M against reading
+// them into memory, and inserting one image into many machines.
+int BenchCartridge(int argc, char** argv) {
+	uint64_t nFrames = ParseCount(argc, argv, "--frames", 600);
+	size_t nMachines = ParseCount(argc, argv, "--machines", 256);
+	std::string sPath = (std::filesystem::temp_directory_path() / "pane_bench.nes").string();
+
+	WriteBenchImage(sPath, 0, 0x8000, PANE_INES_CHR_UNIT, g_pInputBenchProgram, sizeof(g_pInputBenchProgram), 0x8000);
+	std::shared_ptr<pane::Cartridge> pCartridge = std::make_shared<pane::Cartridge>();
+	pCartridge->Load(sPath);
+
+	pane::Machine xMapped;
+	xMapped.Init();
+	xMapped.InsertCartridge(pCartridge);
+	xMapped.Start();
+	pane::Machine xCopied;
+	xCopied.Init();
+	LoadProgram(*xCopied.GetMMU(), g_pInputBenchProgram, sizeof(g_pInputBenchProgram));
+	xCopied.Start();
+	uint32_t nSeed = 1;
+	uint8_t nButtons = 0;
+	for (uint64_t i = 0; i < nFrames; i++) {
+		nButtons = NextButtons(&nSeed, nButtons);
+		xMapped.GetControllers()->SetButtons(0, nButtons);
+		xCopied.GetControllers()->SetButtons(0, nButtons);
+		xMapped.RunFrame();
+		xCopied.RunFrame();
+	}
+	// Stray writes to ROM are dropped, and the map points into the file
+	xMapped.GetMMU()->Write(0x8000, 0xFF);
+	// The copy sits in cartridge space of the state, compare RAM and registers
+	const pane::MachineState& xMappedState = xMapped.SyncState();
+	const pane::MachineState& xCopiedState = xCopied.SyncState();
+	bool bMatch = std::memcmp(xMappedState.xMemory.pRAM, xCopiedState.xMemory.pRAM, PANE_RAM_SIZE) == 0
+	              && std::memcmp(&xMappedState.xCPU, &xCopiedState.xCPU, sizeof(pane::CPUState)) == 0
+	              && xMapped.GetMMU()->GetReadPage(0x80) == pCartridge->GetPRG()
+	              && xMapped.GetMMU()->Read(0x8000) == g_pInputBenchProgram[0];
+	std::cout << "cartridge: mapped image runs like a copied program, " << nFrames << " frames "
+	          << (bMatch ? "match" : "DIFFER") << std::endl;
+
+	for (size_t nPRGSize : { 0x8000, 0x80000, 0x3FC000 }) {
+		WriteBenchImage(sPath, 0, nPRGSize, PANE_INES_CHR_UNIT, g_pInputBenchProgram, sizeof(g_pInputBenchProgram), 0x8000);
+		// The program starts the last 32K
+		size_t nProgram = nPRGSize - 0x8000;
+		const int nRepeats = 20;
+		uint64_t nSum = 0;
+		auto tStart = std::chrono::steady_clock::now();
+		for (int i = 0; i < nRepeats; i++) {
+			pane::Cartridge xCartridge;
+			xCartridge.Load(sPath);
+			nSum += xCartridge.GetPRG()[nProgram];
+		}
+		double nLoadTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count() / nRepeats;
+
+		// Loaded once more and every page touched, all of it page faults
+		tStart = std::chrono::steady_clock::now();
+		for (int i = 0; i < nRepeats; i++) {
+			pane::Cartridge xCartridge;
+			xCartridge.Load(sPath);
+			for (size_t j = 0; j < xCartridge.GetPRGSize(); j += 4096) {
+				nSum += xCartridge.GetPRG()[j];
+			}
+		}
+		double nTouchTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count() / nRepeats;
+
+		tStart = std::chrono::steady_clock::now();
+		for (int i = 0; i < nRepeats; i++) {
+			std::ifstream xFile(sPath, std::ios::binary);
+			std::vector<char> vImage(std::filesystem::file_size(sPath));
+			xFile.read(vImage.data(), vImage.size());
+			nSum += static_cast<uint8_t>(vImage[PANE_INES_HEADER_SIZE + nProgram]);
+		}
+		double nReadTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count() / nRepeats;
+		std::cout << "cartridge: " << nPRGSize / 1024 << "K PRG, load " << nLoadTime * 1e6 << " us, load and touch every page "
+		          << nTouchTime * 1e6 << " us, read into memory " << nReadTime * 1e6 << " us" << std::endl;
+		// Every load saw the program, and the reads can't be dropped
+		bMatch = bMatch && nSum >= g_pInputBenchProgram[0] * 3u * nRepeats;
+	}
+
+	std::vector<std::unique_ptr<pane::Machine>> vMachines;
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < nMachines; i++) {
+		vMachines.push_back(std::make_unique<pane::Machine>());
+		vMachines.back()->Init();
+		vMachines.back()->InsertCartridge(pCartridge);
+	}
+	double nInsertTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	std::cout << "cartridge: " << nMachines << " machines created sharing one image in " << nInsertTime * 1e3 << " ms, "
+	          << pCartridge.use_count() - 1 << " references to " << pCartridge->GetPRGSize() / 1024 << "K of PRG" << std::endl;
+	vMachines.clear();
+
+	std::filesystem::remove(sPath);
+	return bMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Reads pattern memory through PPUADDR and PPUDATA
+uint8_t ReadPatterns(pane::MMU& xMMU, uint16_t pAddress) {
+	xMMU.Read(0x2002);
+	xMMU.Write(0x2006, pAddress >> 8);
+	xMMU.Write(0x2006, pAddress & 0xFF);
+	xMMU.Read(0x2007);
+	return xMMU.Read(0x2007);
+}
+
+struct BankSwitchCase {
+	const char* sName;
+	uint8_t nMapper;
+	// Window the switched bank shows up in, CPU or PPU space
+	bool bCHR;
+	uint16_t pWindow;
+	size_t nBankSize;
+	// Register writes selecting bank nBank
+	void (*fnSwitch)(pane::MMU& xMMU, uint32_t nBank);
+};
+
+// MMC1 registers load a bit per write, five writes to the register's
+// address
+void WriteMMC1(pane::MMU& xMMU, uint16_t pAddress, uint8_t cVal) {
+	for (int i = 0; i < 5; i++) {
+		xMMU.Write(pAddress, (cVal >> i) & 0x01);
+	}
+}
+
+// Switches banks straight through the mapper registers on boards with small
+// and large ROMs and checks the window shows the right bank, then runs a
+// program that switches PRG and CHR banks all frame long with the scanline
+// IRQ on, checking the IRQ count and that the interpreter, JIT and a
+// restored state all end up in the same place.
+int BenchMapper(int argc, char** argv) {
+	uint64_t nSwitches = ParseCount(argc, argv, "--switches", 1000000);
+	uint64_t nFrames = ParseCount(argc, argv, "--frames", 600);
+	std::string sPath = (std::filesystem::temp_directory_path() / "pane_bench_mapper.nes").string();
+	bool bMatch = true;
+
+	const BankSwitchCase pCases[] = {
+		{ "UxROM 16K PRG", 2, false, 0x8000, 0x4000, [](pane::MMU& xMMU, uint32_t nBank) {
+			xMMU.Write(0x8000, static_cast<uint8_t>(nBank));
+		} },
+		{ "CNROM 8K CHR", 3, true, 0x0000, 0x2000, [](pane::MMU& xMMU, uint32_t nBank) {
+			xMMU.Write(0x8000, static_cast<uint8_t>(nBank));
+		} },
+		{ "MMC1 16K PRG", 1, false, 0x8000, 0x4000, [](pane::MMU& xMMU, uint32_t nBank) {
+			WriteMMC1(xMMU, 0xE000, static_cast<uint8_t>(nBank & 0x0F));
+		} },
+		{ "MMC1 4K CHR", 1, true, 0x0000, 0x1000, [](pane::MMU& xMMU, uint32_t nBank) {
+			WriteMMC1(xMMU, 0xA000, static_cast<uint8_t>(nBank & 0x1F));
+		} },
+		{ "MMC3 8K PRG", 4, false, 0x8000, 0x2000, [](pane::MMU& xMMU, uint32_t nBank) {
+			xMMU.Write(0x8000, 0x06);
+			xMMU.Write(0x8001, static_cast<uint8_t>(nBank));
+		} },
+		{ "MMC3 2K CHR", 4, true, 0x0000, 0x0800, [](pane::MMU& xMMU, uint32_t nBank) {
+			xMMU.Write(0x8000, 0x00);
+			xMMU.Write(0x8001, static_cast<uint8_t>(nBank << 1));
+		} },
+		{ "MMC3 1K CHR", 4, true, 0x1000, 0x0400, [](pane::MMU& xMMU, uint32_t nBank) {
+			xMMU.Write(0x8000, 0x02);
+			xMMU.Write(0x8001, static_cast<uint8_t>(nBank));
+		} },
+	};
+	for (const BankSwitchCase& xCase : pCases) {
+		for (size_t nScale : { 1, 8 }) {
+			// 128K or 1M of PRG, 32K or 256K of CHR
+			size_t nPRGSize = 0x20000 * nScale;
+			size_t nCHRSize = 0x8000 * nScale;
+			WriteBenchImage(sPath, xCase.nMapper, nPRGSize, nCHRSize, g_pMapperBenchProgram, sizeof(g_pMapperBenchProgram), 0xE000, g_pMapperBenchIRQ);
+			std::shared_ptr<pane::Cartridge> pCartridge = std::make_shared<pane::Cartridge>();
+			pCartridge->Load(sPath);
+			pane::Machine xMachine;
+			xMachine.Init();
+			xMachine.InsertCartridge(pCartridge);
+			xMachine.Start();
+			pane::MMU& xMMU = *xMachine.GetMMU();
+			if (xCase.nMapper == 1 && xCase.bCHR) {
+				// 4K CHR mode, PRG as after reset
+				WriteMMC1(xMMU, 0x8000, 0x1D);
+			}
+
+			// MMC1 PRG and the CNROM/MMC1 CHR registers only reach so far
+			uint32_t nBanks = static_cast<uint32_t>((xCase.bCHR ? nCHRSize : nPRGSize) / xCase.nBankSize);
+			nBanks = std::min<uint32_t>(nBanks, xCase.nMapper == 1 ? (xCase.bCHR ? 32 : 16) : 256);
+			const uint8_t* pROM = xCase.bCHR ? pCartridge->GetCHR() : pCartridge->GetPRG();
+			bool bCorrect = true;
+			for (uint32_t nBank = 0; nBank < nBanks; nBank++) {
+				xCase.fnSwitch(xMMU, nBank);
+				uint16_t pLast = static_cast<uint16_t>(xCase.pWindow + xCase.nBankSize - 1);
+				uint8_t nFirst = xCase.bCHR ? ReadPatterns(xMMU, xCase.pWindow) : xMMU.Read(xCase.pWindow);
+				uint8_t nLast = xCase.bCHR ? ReadPatterns(xMMU, pLast) : xMMU.Read(pLast);
+				bCorrect = bCorrect && nFirst == pROM[nBank * xCase.nBankSize] && nLast == pROM[(nBank + 1) * xCase.nBankSize - 1];
+			}
+			bMatch = bMatch && bCorrect;
+
+			auto tStart = std::chrono::steady_clock::now();
+			for (uint64_t i = 0; i < nSwitches; i++) {
+				xCase.fnSwitch(xMMU, static_cast<uint32_t>(i % nBanks));
+			}
+			double nSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+			std::cout << "mapper: " << xCase.sName << ", " << nPRGSize / 1024 << "K PRG " << nCHRSize / 1024 << "K CHR, "
+			          << nSeconds * 1e9 / nSwitches << " ns per switch " << (bCorrect ? "match" : "DIFFER") << std::endl;
+		}
+	}
+
+	// 256K of PRG and CHR, the program goes round all 32 banks of each
+	WriteBenchImage(sPath, 4, 0x40000, 0x40000, g_pMapperBenchProgram, sizeof(g_pMapperBenchProgram), 0xE000, g_pMapperBenchIRQ);
+	std::shared_ptr<pane::Cartridge> pCartridge = std::make_shared<pane::Cartridge>();
+	pCartridge->Load(sPath);
+	std::filesystem::remove(sPath);
+
+	pane::MachineState xHalfway;
+	uint64_t pHashes[3] = {};
+	for (int nMode = 0; nMode < 3; nMode++) {
+		pane::Machine xMachine;
+		xMachine.Init();
+		xMachine.InsertCartridge(pCartridge);
+		if (nMode == 2) {
+			// Restored from halfway, banks and the pending IRQ come from the state
+			xMachine.LoadState(xHalfway);
+		} else {
+			xMachine.GetCPU()->SetJITEnabled(nMode == 1);
+			xMachine.Start();
+		}
+
+		auto tStart = std::chrono::steady_clock::now();
+		for (uint64_t i = nMode == 2 ? nFrames / 2 : 0; i < nFrames; i++) {
+			if (nMode == 0 && i == nFrames / 2) {
+				xMachine.SaveState(&xHalfway);
+			}
+			xMachine.RunFrame();
+		}
+		double nSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+		pHashes[nMode] = xMachine.GetStateHash();
+		if (nMode == 2) {
+			break;
+		}
+
+		const uint8_t* pRAM = xMachine.SyncState().xMemory.pRAM;
+		uint64_t nLoops = pRAM[0x11] | (pRAM[0x14] << 8);
+		uint64_t nIRQs = pRAM[0x12] | (pRAM[0x13] << 8);
+		// One clock per visible and pre-render scanline, an IRQ every 8
+		uint64_t nExpected = nFrames * (PANE_NES_VISIBLE_IMAGE_HEIGHT + 1) / 8;
+		bool bIRQs = nIRQs + 1 >= nExpected && nIRQs <= nExpected;
+		bMatch = bMatch && bIRQs;
+		std::cout << "mapper: MMC3 program " << (nMode == 1 ? "JIT" : "interpreter") << ", " << nFrames / nSeconds << " fps, "
+		          << nLoops * 64 / nFrames << " bank switches per frame, " << nIRQs << " IRQs (" << nExpected << " expected) "
+		          << (bIRQs ? "match" : "DIFFER") << std::endl;
+	}
+	bool bSame = pHashes[0] == pHashes[1] && pHashes[0] == pHashes[2];
+	bMatch = bMatch && bSame;
+	std::cout << "mapper: interpreter, JIT and restored state " << (bSame ? "match" : "DIFFER") << std::endl;
+	return bMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int BenchLockstep(int argc, char** argv) {
+	double nSeconds = ParseSeconds(argc, argv, 1.0);
+	bool bMatch = RunLockstepBenchmark<8>(nSeconds);
+	bMatch = RunLockstepBenchmark<16>(nSeconds) && bMatch;
+	return bMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+struct Benchmark {
+	const char* sName;
+	const char* sDescription;
+	int (*fnRun)(int argc, char** argv);
+};
+
+const Benchmark g_pBenchmarks[] = {
+	{ "cpu", "Interpreter throughput on a synthetic ALU/memory loop", BenchCPU },
+	{ "flags", "Interpreter throughput on a flag-heavy arithmetic/compare loop", BenchFlags },
+	{ "lockstep", "Lockstep SoA core vs scalar CPUs, 8 and 16 instances", BenchLockstep },
+	{ "idle", "Polling loops with idle loop skipping off and on [--frames N]", BenchIdle },
+	{ "state", "Machine state save and load times", BenchState },
+	{ "rewind", "Rewind recording cost and delta size per frame [--frames N]", BenchRewind },
+	{ "runahead", "Host frame rate with 0-3 frames of run-ahead", BenchRunAhead },
+	{ "keyframes", "Keyframe index write cost and seek times [--frames N] [--interval N]", BenchKeyframes },
+	{ "verify", "Movie verification split at keyframes on 1..N threads [--frames N] [--interval N] [--threads N] [--jit]", BenchVerify },
+	{ "netplay", "Rollback netplay over a loopback link at 0-6 frames of latency [--frames N] [--delay N] [--rollback N] [--loss PERCENT] [--jit]", BenchNetplay },
+	{ "cartridge", "Mapped iNES loading against copying, load times by image size [--frames N] [--machines N]", BenchCartridge },
+	{ "mapper", "Bank switch cost by board and ROM size, and a switch-heavy MMC3 program [--switches N] [--frames N]", BenchMapper },
+	{ "fork", "Copy-on-write forks per second and memory per live fork [--forks N] [--frames N]", BenchFork },
+	{ "batch", "Aggregate fps of many machines on 1..N threads and their reuse across jobs [--instances N] [--frames N] [--threads N] [--jit]", BenchBatch },
+};
+
+void PrintUsage(const char* sProgram) {
+	std::cout << "Usage: " << sProgram << " <benchmark> [--seconds N] [--block-cache] [--jit [--perf-map]]" << std::endl;
+	for (const Benchmark& xBenchmark : g_pBenchmarks) {
+		std::cout << "  " << xBenchmark.sName << "  " << xBenchmark.sDescription << std::endl;
+	}
+}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (const Benchmark& xBenchmark : g_pBenchmarks) {
+		if (std::strcmp(argv[1], xBenchmark.sName) == 0) {
+			return xBenchmark.fnRun(argc - 2, argv + 2);
+		}
+	}
+
+	PrintUsage(argv[0]);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,51 @@
+#ifndef CEE_PANE_BUS_H_
+#define CEE_PANE_BUS_H_
+
+#include <cstdint>
+
+#include "mmu.h"
+
+namespace pane {
+// Instrumented bus for debug and benchmark builds. Forwards to an MMU and
+// counts every access the CPU makes.
+class CountingBus {
+public:
+	CountingBus(MMU* pMMU)
+	 : m_pMMU(pMMU), m_pNoPages{}, m_nReads(0), m_nWrites(0)
+	{ }
+
+	inline uint8_t Read(uint16_t pAddress) { m_nReads++; return m_pMMU->Read(pAddress); }
+	inline void Write(uint16_t pAddress, uint8_t cVal) { m_nWrites++; m_pMMU->Write(pAddress, cVal); }
+
+	inline uint16_t ReadAddress(uint16_t pAddress) { m_nReads += 2; return m_pMMU->ReadAddress(pAddress); }
+	inline void WriteAddress(uint16_t pAddress, uint16_t pVal) { m_nWrites += 2; m_pMMU->WriteAddress(pAddress, pVal); }
+
+	inline void Push(uint8_t* ppSp, uint8_t cVal) { m_nWrites++; m_pMMU->Push(ppSp, cVal); }
+	inline uint8_t Pull(uint8_t* ppSp) { m_nReads++; return m_pMMU->Pull(ppSp); }
+
+	inline void PushAddress(uint8_t* ppSp, uint16_t pVal) { m_nWrites += 2; m_pMMU->PushAddress(ppSp, pVal); }
+	inline uint16_t PullAddress(uint8_t* ppSp) { m_nReads += 2; return m_pMMU->PullAddress(ppSp); }
+
+	inline const uint8_t* GetReadPage(uint8_t nPage) const { return m_pMMU->GetReadPage(nPage); }
+	// Empty tables push translated code onto the counted slow path
+	inline uint8_t* const* GetReadPageTable() const { return m_pNoPages; }
+	inline uint8_t* const* GetWritePageTable() const { return m_pNoPages; }
+	// Skipped polling loops would hide their reads from the counters
+	inline bool IsPollable(uint16_t pAddress) const { return false; }
+	void ProtectCode(uint16_t pAddress) { m_pMMU->ProtectCode(pAddress); }
+	void SetCodeWriteCallback(CodeWriteCallback fnCallback, void* pUserData) { m_pMMU->SetCodeWriteCallback(fnCallback, pUserData); }
+
+	uint64_t GetReads() const { return m_nReads; }
+	uint64_t GetWrites() const { return m_nWrites; }
+	void ResetCounters() { m_nReads = m_nWrites = 0; }
+
+private:
+	MMU* m_pMMU;
+	uint8_t* m_pNoPages[PANE_MMU_PAGE_COUNT];
+	uint64_t m_nReads;
+	uint64_t m_nWrites;
+};
+}
+
+#endif
+
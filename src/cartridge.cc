@@ -0,0 +1,93 @@
+#include "cartridge.h"
+#include "hash.h"
+
+#include <stdexcept>
+
+#include <cstring>
+
+namespace pane {
+Cartridge::Cartridge()
+ : m_pPRG(nullptr), m_nPRGSize(0), m_pCHR(nullptr), m_nCHRSize(0), m_nMapper(0), m_nSubmapper(0), m_eMirroring(MIRROR_HORIZONTAL), m_bFourScreen(false), m_bBattery(false), m_bNES20(false), m_nHash(0), m_bHashed(false)
+{
+
+}
+
+Cartridge::~Cartridge() {
+
+}
+
+void Cartridge::Load(const std::string& sPath) {
+	m_xFile.Open(sPath);
+	m_bHashed = false;
+	try {
+		this->Parse();
+	} catch (const std::runtime_error& e) {
+		m_xFile.Close();
+		throw std::runtime_error(sPath + ": " + e.what());
+	}
+}
+
+void Cartridge::Parse() {
+	const uint8_t* pData = m_xFile.GetData();
+	size_t nSize = m_xFile.GetSize();
+
+	uint32_t nMagic = 0;
+	if (nSize >= PANE_INES_HEADER_SIZE) {
+		std::memcpy(&nMagic, pData, sizeof(nMagic));
+	}
+	if (nMagic != PANE_INES_MAGIC) {
+		throw std::runtime_error("Not an iNES image!");
+	}
+
+	uint8_t nFlags6 = pData[6];
+	uint8_t nFlags7 = pData[7];
+	m_bNES20 = (nFlags7 & 0x0C) == 0x08;
+	m_nMapper = nFlags6 >> 4;
+	m_nSubmapper = 0;
+	if (m_bNES20) {
+		m_nMapper |= (nFlags7 & 0xF0) | ((pData[8] & 0x0F) << 8);
+		m_nSubmapper = pData[8] >> 4;
+	} else if ((nFlags7 & 0x0C) == 0 && pData[12] == 0 && pData[13] == 0 && pData[14] == 0 && pData[15] == 0) {
+		// Old tools wrote their name over bytes 7 - 15, the upper nibble is
+		// only trusted when the padding is clean
+		m_nMapper |= nFlags7 & 0xF0;
+	}
+	m_eMirroring = (nFlags6 & 0x01) ? MIRROR_VERTICAL : MIRROR_HORIZONTAL;
+	m_bBattery = (nFlags6 & 0x02) != 0;
+	m_bFourScreen = (nFlags6 & 0x08) != 0;
+
+	m_nPRGSize = Cartridge::GetROMSize(pData[4], m_bNES20 ? pData[9] & 0x0F : 0, PANE_INES_PRG_UNIT);
+	m_nCHRSize = Cartridge::GetROMSize(pData[5], m_bNES20 ? pData[9] >> 4 : 0, PANE_INES_CHR_UNIT);
+	size_t nOffset = PANE_INES_HEADER_SIZE + ((nFlags6 & 0x04) ? PANE_INES_TRAINER_SIZE : 0);
+	if (m_nPRGSize == 0) {
+		throw std::runtime_error("Image has no PRG ROM!");
+	}
+	// Each checked on its own first so the sum can't overflow
+	if (m_nPRGSize > nSize || m_nCHRSize > nSize || nOffset + m_nPRGSize + m_nCHRSize > nSize) {
+		throw std::runtime_error("Image is truncated!");
+	}
+
+	m_pPRG = pData + nOffset;
+	m_pCHR = m_nCHRSize > 0 ? m_pPRG + m_nPRGSize : nullptr;
+}
+
+size_t Cartridge::GetROMSize(uint8_t nSize, uint8_t nMSB, size_t nUnit) {
+	if (nMSB != 0x0F) {
+		return ((static_cast<size_t>(nMSB) << 8) | nSize) * nUnit;
+	}
+	// NES 2.0 exponent-multiplier form, 2^E * (MM * 2 + 1) bytes
+	uint32_t nExponent = nSize >> 2;
+	if (nExponent >= 48) {
+		return SIZE_MAX;
+	}
+	return (static_cast<size_t>(1) << nExponent) * ((nSize & 0x03) * 2 + 1);
+}
+
+uint64_t Cartridge::GetHash() const {
+	if (!m_bHashed) {
+		m_nHash = HashBytes(m_xFile.GetData(), m_xFile.GetSize());
+		m_bHashed = true;
+	}
+	return m_nHash;
+}
+}
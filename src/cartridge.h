@@ -0,0 +1,72 @@
+#ifndef CEE_PANE_CARTRIDGE_H_
+#define CEE_PANE_CARTRIDGE_H_
+
+#include <string>
+
+#include <cstdint>
+#include <cstddef>
+
+#include "mappedfile.h"
+#include "ppu.h"
+
+// "NES" followed by an MS-DOS end of file
+#define PANE_INES_MAGIC        0x1A53454E
+#define PANE_INES_HEADER_SIZE  16
+#define PANE_INES_TRAINER_SIZE 512
+#define PANE_INES_PRG_UNIT     0x4000
+#define PANE_INES_CHR_UNIT     0x2000
+
+namespace pane {
+// An iNES or NES 2.0 image. The file is mapped read-only and PRG and CHR are
+// used in place, so loading only parses the header and the pages come in as
+// the game touches them. Any number of machines can share one cartridge.
+class Cartridge {
+public:
+	Cartridge();
+	~Cartridge();
+
+	// Throws if the file can't be read or isn't a valid image
+	void Load(const std::string& sPath);
+
+	const uint8_t* GetPRG() const { return m_pPRG; }
+	size_t GetPRGSize() const { return m_nPRGSize; }
+	// No CHR ROM means the board has 8K of CHR RAM
+	const uint8_t* GetCHR() const { return m_pCHR; }
+	size_t GetCHRSize() const { return m_nCHRSize; }
+
+	uint16_t GetMapper() const { return m_nMapper; }
+	uint8_t GetSubmapper() const { return m_nSubmapper; }
+	// Only meaningful for boards without mapper controlled mirroring
+	NametableMirroring GetMirroring() const { return m_eMirroring; }
+	bool HasFourScreenVRAM() const { return m_bFourScreen; }
+	bool HasBattery() const { return m_bBattery; }
+	bool IsNES20() const { return m_bNES20; }
+
+	// Identifies the image for movies. Reads the whole file, so it is only
+	// computed the first time it is asked for.
+	uint64_t GetHash() const;
+
+private:
+	void Parse();
+	static size_t GetROMSize(uint8_t nSize, uint8_t nMSB, size_t nUnit);
+
+private:
+	MappedFile m_xFile;
+	const uint8_t* m_pPRG;
+	size_t m_nPRGSize;
+	const uint8_t* m_pCHR;
+	size_t m_nCHRSize;
+
+	uint16_t m_nMapper;
+	uint8_t m_nSubmapper;
+	NametableMirroring m_eMirroring;
+	bool m_bFourScreen;
+	bool m_bBattery;
+	bool m_bNES20;
+
+	mutable uint64_t m_nHash;
+	mutable bool m_bHashed;
+};
+}
+
+#endif
@@ -0,0 +1,70 @@
+#include "controllers.h"
+
+#include <stdexcept>
+
+namespace pane {
+Controllers::Controllers()
+ : m_pState(nullptr)
+{
+
+}
+
+Controllers::~Controllers() {
+
+}
+
+void Controllers::SetMMU(std::shared_ptr<MMU> pMMU) {
+	m_pMMU = pMMU;
+	m_pMMU->SetInputHandlers(Controllers::ReadPort, Controllers::WriteStrobe, this);
+}
+
+void Controllers::SetState(InputState* pState) {
+	m_pState = pState;
+}
+
+void Controllers::Start() {
+	for (uint8_t i = 0; i < PANE_CONTROLLER_PORTS; i++) {
+		m_pState->pButtons[i] = 0;
+		m_pState->pShift[i] = 0;
+	}
+	m_pState->bStrobe = false;
+}
+
+void Controllers::SetButtons(uint8_t nPort, uint8_t nButtons) {
+	if (nPort >= PANE_CONTROLLER_PORTS) {
+		throw std::runtime_error("Invalid controller port!");
+	}
+	m_pState->pButtons[nPort] = nButtons;
+}
+
+// Every read shifts, so the ports are never marked pollable
+uint8_t Controllers::ReadPort(void* pUserData, uint16_t pAddress) {
+	Controllers* pControllers = reinterpret_cast<Controllers*>(pUserData);
+	InputState* pState = pControllers->m_pState;
+	uint8_t nPort = pAddress & 0x0001;
+
+	// While strobe is high the shift register keeps reloading, so reads
+	// return A
+	if (pState->bStrobe) {
+		pState->pShift[nPort] = pState->pButtons[nPort];
+	}
+	uint8_t cBit = pState->pShift[nPort] & 0x01;
+	// Official pads return 1 once all eight buttons are out
+	pState->pShift[nPort] = (pState->pShift[nPort] >> 1) | 0x80;
+
+	// Upper bits are open bus, the high byte of the address
+	return 0x40 | cBit;
+}
+
+void Controllers::WriteStrobe(void* pUserData, uint16_t pAddress, uint8_t cVal) {
+	Controllers* pControllers = reinterpret_cast<Controllers*>(pUserData);
+	InputState* pState = pControllers->m_pState;
+
+	pState->bStrobe = cVal & 0x01;
+	if (pState->bStrobe) {
+		for (uint8_t i = 0; i < PANE_CONTROLLER_PORTS; i++) {
+			pState->pShift[i] = pState->pButtons[i];
+		}
+	}
+}
+}
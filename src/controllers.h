@@ -0,0 +1,51 @@
+#ifndef CEE_PANE_CONTROLLERS_H_
+#define CEE_PANE_CONTROLLERS_H_
+
+#include <memory>
+
+#include <cstdint>
+
+#include "mmu.h"
+#include "state.h"
+
+namespace pane {
+// Bit order is the order the pad shifts them out in
+enum ControllerButton {
+	BUTTON_A      = 1 << 0,
+	BUTTON_B      = 1 << 1,
+	BUTTON_SELECT = 1 << 2,
+	BUTTON_START  = 1 << 3,
+	BUTTON_UP     = 1 << 4,
+	BUTTON_DOWN   = 1 << 5,
+	BUTTON_LEFT   = 1 << 6,
+	BUTTON_RIGHT  = 1 << 7
+};
+
+// Two standard pads on $4016/$4017. Writing 1 to bit 0 of $4016 latches the
+// buttons, each read then shifts one out in the order above.
+class Controllers {
+public:
+	Controllers();
+	~Controllers();
+
+	void SetMMU(std::shared_ptr<MMU> pMMU);
+	// Worked on in place, like PPUMemory
+	void SetState(InputState* pState);
+
+	void Start();
+
+	// Takes effect at the next strobe, as on hardware
+	void SetButtons(uint8_t nPort, uint8_t nButtons);
+	uint8_t GetButtons(uint8_t nPort) const { return m_pState->pButtons[nPort]; }
+
+private:
+	static uint8_t ReadPort(void* pUserData, uint16_t pAddress);
+	static void WriteStrobe(void* pUserData, uint16_t pAddress, uint8_t cVal);
+
+private:
+	std::shared_ptr<MMU> m_pMMU;
+	InputState* m_pState;
+};
+}
+
+#endif
@@ -1,310 +1,868 @@
 #include "cpu.h"
 #include "ram.h"
 
+#include <cstdio>
 #include <cstring>
 #include <stdexcept>
-#include <format>
 
 namespace pane {
-CPU::CPU() {
+// Anything that can move the PC somewhere other than the next instruction
+static constexpr bool EndsBlock(OpCode oc) {
+	switch (oc) {
+	case OC_BCC:
+	case OC_BCS:
+	case OC_BEQ:
+	case OC_BMI:
+	case OC_BNE:
+	case OC_BPL:
+	case OC_BVC:
+	case OC_BVS:
+	case OC_BRK:
+	case OC_JMP:
+	case OC_JSR:
+	case OC_RTI:
+	case OC_RTS:
+		return true;
+	default:
+		return false;
+	}
+}
+
+template <typename Bus>
+BasicCPU<Bus>::BasicCPU()
+ : m_pBus(nullptr), m_bStopped(false), m_bRunEnded(false), m_bJammed(false), m_bBlockInvalidated(false), m_pPageInvalidations{}, m_nBlockHits(0), m_nBlockMisses(0),
+   m_nBreakpoints(0), m_bBreakpointHit(false), m_bIdleLoopSkip(true), m_nIdleCycles(0), m_pIdleBlock(nullptr), m_nIdleInstructions(0), m_xIdleRegs{}, m_nIdleStatus(0), m_nCompiledBlocks(0)
+{
 
 }
 
-CPU::~CPU() {
-	m_pMMU.reset();
+template <typename Bus>
+BasicCPU<Bus>::~BasicCPU() {
+	this->SetBlockCacheEnabled(false);
+	m_pBus = nullptr;
 }
 
-void CPU::SetMMU(std::shared_ptr<MMU> pMMU) {
-	m_pMMU = pMMU;
+template <typename Bus>
+void BasicCPU<Bus>::SetBus(Bus* pBus) {
+	m_pBus = pBus;
+	// Translated code has the bus page tables baked in
+	this->FlushBlockCache();
 }
 
-void CPU::Start() {
-	std::memset(reinterpret_cast<void*>(&m_xRegs), 0, sizeof(CPU::Registers));
-	m_xRegs.pc = m_pMMU->ReadAddress(RESET_ADDRESS);
+template <typename Bus>
+void BasicCPU<Bus>::Start() {
+	std::memset(reinterpret_cast<void*>(&m_xRegs), 0, sizeof(Registers));
+	m_xRegs.pc = m_pBus->ReadAddress(RESET_ADDRESS);
 
 	m_bInturruptPending = false;
 	m_eInterruptType = INT_NONE;
+	m_bStopped = m_bJammed = false;
+	m_bBreakpointHit = false;
 
-	m_xRegs.sr = 0x24;
+	this->SetStatus(0x24);
+	m_xRegs.sp = 0xFD;
 
 	m_nCycles = m_nTotalCycles = 0;
+	m_nInstructions = 0;
+	m_nIdleCycles = 0;
+
+	// ROM may have been reloaded behind the bus
+	this->FlushBlockCache();
+	m_nBlockHits = m_nBlockMisses = 0;
 }
 
-void CPU::Execute() {
-	m_nTotalCycles++;
-	if (m_nCycles == 0) {
-		if (m_eInterruptType != INT_NONE) {
-			m_bInturruptPending = true;
-			m_nCycles = 6;
-			return;
+template <typename Bus>
+int32_t BasicCPU<Bus>::RunCycles(int32_t nBudget) {
+	// Handlers add their base cycles and penalties to m_nCycles, so it counts
+	// cycles elapsed since the start of this run.
+	m_nCycles = 0;
+	m_bStopped = m_bJammed;
+	m_bRunEnded = false;
+	// Resuming from a breakpoint executes the instruction it stopped on
+	bool bResume = m_bBreakpointHit;
+	m_bBreakpointHit = false;
+	while (m_nCycles < nBudget && !m_bStopped && !m_bRunEnded) {
+		if (m_bInturruptPending && (m_eInterruptType == INT_NMI || !(m_xRegs.sr & SR_INTERRUPT))) {
+			this->HandleInterrupt();
+			bResume = false;
+			continue;
+		}
+		if (m_nBreakpoints != 0) {
+			if (!bResume && m_xBreakpoints[m_xRegs.pc]) {
+				m_bBreakpointHit = m_bStopped = true;
+				break;
+			}
+			bResume = false;
+		} else if (m_pBlocks != nullptr && this->RunBlock(nBudget)) {
+			continue;
+		}
+		m_nOpCode = m_pBus->Read(m_xRegs.pc++);
+		s_pHandlers[m_nOpCode](this, 0);
+		m_nInstructions++;
+	}
+	int32_t nOvershoot = m_nCycles - nBudget;
+	m_nTotalCycles += m_nCycles;
+	m_nCycles = 0;
+	return nOvershoot;
+}
+
+template <typename Bus>
+template <uint8_t nOpCode, bool bPredecoded>
+void BasicCPU<Bus>::Dispatch(BasicCPU* pCPU, uint16_t nOperand) {
+	constexpr Instruction xInstruction = g_xInstructionLUT[nOpCode];
+	constexpr bool bPageCrossPenalty = HasPageCrossPenalty(xInstruction.oc);
+
+	if constexpr (xInstruction.oc == OC_NONE) {
+		// Unofficial opcodes aren't implemented, all of them jam like KIL.
+		// Blocks never contain one, so only the plain interpreter gets here.
+		pCPU->m_xRegs.pc--;
+		pCPU->m_bJammed = true;
+		pCPU->RequestStop();
+	} else {
+		pCPU->template GetOperandAddress<xInstruction.am, bPageCrossPenalty, bPredecoded>(nOperand);
+		pCPU->m_nCycles += g_nCyclesLUT[nOpCode];
+
+		switch (xInstruction.oc) {
+		case OC_ADC: pCPU->ADC(); break;
+		case OC_AND: pCPU->AND(); break;
+		case OC_ASL: xInstruction.am == AM_ACC ? pCPU->ASLACC() : pCPU->ASL(); break;
+		case OC_BCC: pCPU->BCC(); break;
+		case OC_BCS: pCPU->BCS(); break;
+		case OC_BEQ: pCPU->BEQ(); break;
+		case OC_BIT: pCPU->BIT(); break;
+		case OC_BMI: pCPU->BMI(); break;
+		case OC_BNE: pCPU->BNE(); break;
+		case OC_BPL: pCPU->BPL(); break;
+		case OC_BRK: pCPU->BRK(); break;
+		case OC_BVC: pCPU->BVC(); break;
+		case OC_BVS: pCPU->BVS(); break;
+		case OC_CLC: pCPU->CLC(); break;
+		case OC_CLD: pCPU->CLD(); break;
+		case OC_CLI: pCPU->CLI(); break;
+		case OC_CLV: pCPU->CLV(); break;
+		case OC_CMP: pCPU->CMP(); break;
+		case OC_CPX: pCPU->CPX(); break;
+		case OC_CPY: pCPU->CPY(); break;
+		case OC_DEC: pCPU->DEC(); break;
+		case OC_DEX: pCPU->DEX(); break;
+		case OC_DEY: pCPU->DEY(); break;
+		case OC_EOR: pCPU->EOR(); break;
+		case OC_INC: pCPU->INC(); break;
+		case OC_INX: pCPU->INX(); break;
+		case OC_INY: pCPU->INY(); break;
+		case OC_JMP: pCPU->JMP(); break;
+		case OC_JSR: pCPU->JSR(); break;
+		case OC_LDA: pCPU->LDA(); break;
+		case OC_LDX: pCPU->LDX(); break;
+		case OC_LDY: pCPU->LDY(); break;
+		case OC_LSR: xInstruction.am == AM_ACC ? pCPU->LSRACC() : pCPU->LSR(); break;
+		case OC_NOP: pCPU->NOP(); break;
+		case OC_ORA: pCPU->ORA(); break;
+		case OC_PHA: pCPU->PHA(); break;
+		case OC_PHP: pCPU->PHP(); break;
+		case OC_PLA: pCPU->PLA(); break;
+		case OC_PLP: pCPU->PLP(); break;
+		case OC_ROL: xInstruction.am == AM_ACC ? pCPU->ROLACC() : pCPU->ROL(); break;
+		case OC_ROR: xInstruction.am == AM_ACC ? pCPU->RORACC() : pCPU->ROR(); break;
+		case OC_RTI: pCPU->RTI(); break;
+		case OC_RTS: pCPU->RTS(); break;
+		case OC_SBC: pCPU->SBC(); break;
+		case OC_SEC: pCPU->SEC(); break;
+		case OC_SED: pCPU->SED(); break;
+		case OC_SEI: pCPU->SEI(); break;
+		case OC_STA: pCPU->STA(); break;
+		case OC_STX: pCPU->STX(); break;
+		case OC_STY: pCPU->STY(); break;
+		case OC_TAX: pCPU->TAX(); break;
+		case OC_TAY: pCPU->TAY(); break;
+		case OC_TSX: pCPU->TSX(); break;
+		case OC_TXA: pCPU->TXA(); break;
+		case OC_TXS: pCPU->TXS(); break;
+		case OC_TYA: pCPU->TYA(); break;
+		default: break;
 		}
-		m_nOpCode = m_pMMU->Read(m_xRegs.pc++);
-		m_xInstruction = g_xInstructionLUT[m_nOpCode];
-		this->GetOperandAddress();
+	}
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::RequestStop() {
+	m_bStopped = true;
+	// Also ends the block or translated code in flight
+	m_bBlockInvalidated = true;
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::EndRun() {
+	m_bRunEnded = true;
+	m_bBlockInvalidated = true;
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::SetBreakpoint(uint16_t pAddress, bool bEnabled) {
+	if (m_xBreakpoints[pAddress] != bEnabled) {
+		m_xBreakpoints[pAddress] = bEnabled;
+		m_nBreakpoints += bEnabled ? 1 : -1;
+	}
+}
 
-		m_nCycles += g_nCyclesLUT[m_nOpCode];
+template <typename Bus>
+void BasicCPU<Bus>::ClearBreakpoints() {
+	m_xBreakpoints.reset();
+	m_nBreakpoints = 0;
+	m_bBreakpointHit = false;
+}
+
+template <typename Bus>
+template <bool bPredecoded, size_t... nOpCodes>
+constexpr std::array<typename BasicCPU<Bus>::Handler, 256> BasicCPU<Bus>::MakeHandlerTable(std::index_sequence<nOpCodes...>) {
+	return {{ &BasicCPU<Bus>::template Dispatch<static_cast<uint8_t>(nOpCodes), bPredecoded>... }};
+}
+
+template <typename Bus>
+const std::array<typename BasicCPU<Bus>::Handler, 256> BasicCPU<Bus>::s_pHandlers = BasicCPU<Bus>::MakeHandlerTable<false>(std::make_index_sequence<256>());
+
+template <typename Bus>
+const std::array<typename BasicCPU<Bus>::Handler, 256> BasicCPU<Bus>::s_pPredecodedHandlers = BasicCPU<Bus>::MakeHandlerTable<true>(std::make_index_sequence<256>());
+
+template <typename Bus>
+void BasicCPU<Bus>::SetBlockCacheEnabled(bool bEnabled) {
+	if (bEnabled && m_pBlocks == nullptr) {
+		m_pBlocks.reset(new Block[PANE_CPU_BLOCK_CACHE_SIZE]());
+		m_pBus->SetCodeWriteCallback(BasicCPU<Bus>::OnCodeWrite, this);
+		this->FlushBlockCache();
+	} else if (!bEnabled && m_pBlocks != nullptr) {
+		this->SetJITEnabled(false);
+		m_pBus->SetCodeWriteCallback(nullptr, nullptr);
+		m_pBlocks.reset();
+	}
+}
 
-		m_nCycles--;
+template <typename Bus>
+void BasicCPU<Bus>::FlushBlockCache() {
+	if (m_pBlocks == nullptr) {
 		return;
-	} else if (m_nCycles == 1) {
-		m_nCycles--;
+	}
+	for (uint32_t i = 0; i < PANE_CPU_BLOCK_CACHE_SIZE; i++) {
+		m_pBlocks[i].nCount = 0;
+		m_pBlocks[i].pPage = nullptr;
+	}
+	std::memset(m_pPageInvalidations, 0, sizeof(m_pPageInvalidations));
+	m_bBlockInvalidated = true;
+	m_pIdleBlock = nullptr;
+	this->ResetCompiledBlocks();
+}
+
+template <typename Bus>
+bool BasicCPU<Bus>::RunBlock(int32_t nBudget) {
+	uint16_t pStart = m_xRegs.pc;
+	Block* pBlock = &m_pBlocks[pStart & (PANE_CPU_BLOCK_CACHE_SIZE - 1)];
+	if (pBlock->nCount != 0 && pBlock->pStart == pStart && pBlock->pPage == m_pBus->GetReadPage(pStart >> 8)) {
+		m_nBlockHits++;
 	} else {
-		m_nCycles--;
+		m_nBlockMisses++;
+		pBlock = this->DecodeBlock(pStart);
+		if (pBlock == nullptr) {
+			return false;
+		}
+	}
+
+	// Only check the budget per instruction when the block might overrun it
+	bool bCheckBudget = nBudget - m_nCycles < pBlock->nMaxCycles;
+#ifdef PANE_JIT_SUPPORTED
+	if (m_pCode != nullptr && !bCheckBudget) {
+		if (pBlock->fnCompiled == nullptr && ++pBlock->nExecutions >= PANE_CPU_JIT_THRESHOLD) {
+			this->CompileBlock(pBlock);
+		}
+		if (pBlock->fnCompiled != nullptr) {
+			m_bBlockInvalidated = false;
+			pBlock->fnCompiled(this);
+			this->SkipIdleLoop(pBlock, nBudget);
+			return true;
+		}
+	}
+#endif
+	uint8_t nCount = pBlock->nCount;
+	m_bBlockInvalidated = false;
+	for (uint8_t i = 0; i < nCount; i++) {
+		const DecodedInstruction& xInstruction = pBlock->pInstructions[i];
+		m_nOpCode = xInstruction.nOpCode;
+		m_xRegs.pc += xInstruction.nLength;
+		xInstruction.fnHandler(this, xInstruction.nOperand);
+		m_nInstructions++;
+
+		// Self-modifying code, bank switches and interrupts end the block early
+		if (m_bBlockInvalidated || m_bInturruptPending || (bCheckBudget && m_nCycles >= nBudget)) {
+			break;
+		}
+	}
+	this->SkipIdleLoop(pBlock, nBudget);
+	return true;
+}
+
+// A polling loop goes round identically until something it reads changes.
+// Its reads are pollable, so nothing changes before the next scheduled
+// event, which the budget never runs past. The first pass may still have
+// had a side effect (reading PPUSTATUS clears VBLANK), so a loop is only
+// skipped once a pass straight after another one left the same registers
+// and flags. Whole iterations are skipped and the last partial one is
+// executed normally so the overshoot matches.
+template <typename Bus>
+void BasicCPU<Bus>::SkipIdleLoop(Block* pBlock, int32_t nBudget) {
+	if (!m_bIdleLoopSkip || pBlock->nIdleCycles == 0 || m_xRegs.pc != pBlock->pStart || m_bInturruptPending || m_bBlockInvalidated) {
 		return;
 	}
 
-	if (m_bInturruptPending) {
-		this->HandleInterrupt();
-		m_bInturruptPending = false;
+	uint8_t nStatus = this->GetStatus();
+	bool bRepeated = m_pIdleBlock == pBlock && m_nInstructions - m_nIdleInstructions == pBlock->nCount && m_nIdleStatus == nStatus
+	                 && m_xIdleRegs.ac == m_xRegs.ac && m_xIdleRegs.x == m_xRegs.x && m_xIdleRegs.y == m_xRegs.y;
+	m_pIdleBlock = pBlock;
+	m_nIdleInstructions = m_nInstructions;
+	m_xIdleRegs = m_xRegs;
+	m_nIdleStatus = nStatus;
+	if (!bRepeated) {
 		return;
 	}
 
-	switch(m_xInstruction.oc) {
-		case OC_ADC:
-			ADC();
-			break;
-		
-		case OC_AND:
-			AND();
-			break;
-		
-		case OC_ASL:
-			m_xInstruction.am == AM_ACC ? ASLACC() : ASL();
-			break;
-		
-		case OC_BCC:
-			BCC();
-			break;
-		
-		case OC_BCS:
-			BCS();
-			break;
-		
-		case OC_BEQ:
-			BEQ();
-			break;
-		
-		case OC_BIT:
-			BIT();
-			break;
-		
-		case OC_BMI:
-			BMI();
-			break;
-		
-		case OC_BNE:
-			BNE();
-			break;
-		
-		case OC_BPL:
-			BPL();
-			break;
-		
-		case OC_BRK:
-			BRK();
-			break;
-		
-		case OC_BVC:
-			BVC();
-			break;
-		
-		case OC_BVS:
-			BVS();
-			break;
-		
-		case OC_CLC:
-			CLC();
-			break;
-		
-		case OC_CLD:
-			CLD();
-			break;
-		
-		case OC_CLI:
-			CLI();
-			break;
-		
-		case OC_CLV:
-			CLV();
-			break;
-		
+	int32_t nRemaining = nBudget - m_nCycles;
+	if (nRemaining <= pBlock->nIdleCycles) {
+		return;
+	}
+
+	for (uint8_t i = 0; i < pBlock->nCount; i++) {
+		const DecodedInstruction& xInstruction = pBlock->pInstructions[i];
+		AddressMode am = g_xInstructionLUT[xInstruction.nOpCode].am;
+		if ((am == AM_ZPG || am == AM_ABS) && g_xInstructionLUT[xInstruction.nOpCode].oc != OC_JMP && !m_pBus->IsPollable(xInstruction.nOperand)) {
+			return;
+		}
+	}
+
+	int32_t nIterations = (nRemaining - 1) / pBlock->nIdleCycles;
+	m_nCycles += nIterations * pBlock->nIdleCycles;
+	m_nInstructions += static_cast<uint64_t>(nIterations) * pBlock->nCount;
+	m_nIdleCycles += static_cast<uint64_t>(nIterations) * pBlock->nIdleCycles;
+}
+
+// Cycles per iteration if the block is a loop back to its own start that
+// only reads memory and recomputes whatever registers it changes, 0 if not.
+template <typename Bus>
+int32_t BasicCPU<Bus>::GetIdleLoopCycles(const Block* pBlock) const {
+	const DecodedInstruction& xLast = pBlock->pInstructions[pBlock->nCount - 1];
+	Instruction xLastInstruction = g_xInstructionLUT[xLast.nOpCode];
+	uint16_t pEnd = pBlock->pStart;
+	for (uint8_t i = 0; i < pBlock->nCount; i++) {
+		pEnd += pBlock->pInstructions[i].nLength;
+	}
+
+	int32_t nCycles = g_nCyclesLUT[xLast.nOpCode];
+	if (xLastInstruction.am == AM_REL) {
+		if (static_cast<uint16_t>(pEnd + static_cast<int8_t>(xLast.nOperand)) != pBlock->pStart) {
+			return 0;
+		}
+		// Taken, plus one more if the branch crosses back over a page
+		nCycles += 1 + ((pEnd & 0xFF00) != (pBlock->pStart & 0xFF00));
+	} else if (xLastInstruction.oc != OC_JMP || xLastInstruction.am != AM_ABS || xLast.nOperand != pBlock->pStart) {
+		return 0;
+	}
+
+	bool bLoadedA = false;
+	for (uint8_t i = 0; i + 1 < pBlock->nCount; i++) {
+		Instruction xInstruction = g_xInstructionLUT[pBlock->pInstructions[i].nOpCode];
+		bool bImmediate = xInstruction.am == AM_IMM;
+		bool bDirect = xInstruction.am == AM_ZPG || xInstruction.am == AM_ABS;
+		switch (xInstruction.oc) {
+		case OC_LDA:
+			bLoadedA = true;
+			// Fall through
+		case OC_LDX:
+		case OC_LDY:
 		case OC_CMP:
-			CMP();
-			break;
-		
 		case OC_CPX:
-			CPX();
-			break;
-		
 		case OC_CPY:
-			CPY();
-			break;
-		
-		case OC_DEC:
-			DEC();
-			break;
-		
-		case OC_DEX:
-			DEX();
+			if (!bImmediate && !bDirect) {
+				return 0;
+			}
 			break;
-		
-		case OC_DEY:
-			DEY();
+		case OC_BIT:
+			if (!bDirect) {
+				return 0;
+			}
 			break;
-		
+		case OC_AND:
+		case OC_ORA:
 		case OC_EOR:
-			EOR();
-			break;
-		
-		case OC_INC:
-			INC();
-			break;
-		
-		case OC_INX:
-			INX();
+			// Only idempotent when A is reloaded earlier in the iteration
+			if (!bImmediate || !bLoadedA) {
+				return 0;
+			}
 			break;
-		
-		case OC_INY:
-			INY();
+		case OC_NOP:
 			break;
-		
-		case OC_JMP:
-			JMP();
+		default:
+			return 0;
+		}
+		nCycles += g_nCyclesLUT[pBlock->pInstructions[i].nOpCode];
+	}
+	return nCycles;
+}
+
+template <typename Bus>
+typename BasicCPU<Bus>::Block* BasicCPU<Bus>::DecodeBlock(uint16_t pStart) {
+	uint8_t nPage = pStart >> 8;
+	const uint8_t* pPage = m_pBus->GetReadPage(nPage);
+	if (pPage == nullptr || m_pPageInvalidations[nPage] >= PANE_CPU_BLOCK_MAX_INVALIDATIONS) {
+		return nullptr;
+	}
+
+	// Blocks never leave their page so a block only depends on one bank
+	Block* pBlock = &m_pBlocks[pStart & (PANE_CPU_BLOCK_CACHE_SIZE - 1)];
+	if (pBlock == m_pIdleBlock) {
+		m_pIdleBlock = nullptr;
+	}
+	pBlock->nCount = 0;
+	pBlock->nMaxCycles = 0;
+	pBlock->nExecutions = 0;
+	pBlock->fnCompiled = nullptr;
+	uint32_t nOffset = pStart & 0xFF;
+	while (pBlock->nCount < PANE_CPU_BLOCK_MAX_INSTRUCTIONS) {
+		uint8_t nOpCode = pPage[nOffset];
+		Instruction xInstruction = g_xInstructionLUT[nOpCode];
+		uint8_t nLength = GetInstructionLength(xInstruction.am);
+		if (xInstruction.oc == OC_NONE || nOffset + nLength > 0x0100) {
 			break;
-		
-		case OC_JSR:
-			JSR();
+		}
+
+		uint16_t nOperand = 0;
+		if (nLength == 2) {
+			nOperand = pPage[nOffset + 1];
+		} else if (nLength == 3) {
+			nOperand = pPage[nOffset + 1] | (static_cast<uint16_t>(pPage[nOffset + 2]) << 8);
+		}
+
+		pBlock->pInstructions[pBlock->nCount++] = { s_pPredecodedHandlers[nOpCode], nOperand, nLength, nOpCode };
+		// Page crossing and taken branches cost at most two extra cycles
+		pBlock->nMaxCycles += g_nCyclesLUT[nOpCode] + 2;
+		nOffset += nLength;
+
+		if (EndsBlock(xInstruction.oc)) {
 			break;
-		
+		}
+	}
+
+	if (pBlock->nCount == 0) {
+		return nullptr;
+	}
+
+	pBlock->pStart = pStart;
+	pBlock->pPage = pPage;
+	pBlock->nIdleCycles = this->GetIdleLoopCycles(pBlock);
+	m_pBus->ProtectCode(pStart);
+	return pBlock;
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::OnCodeWrite(void* pUserData, const uint8_t* pPage) {
+	BasicCPU* pCPU = reinterpret_cast<BasicCPU*>(pUserData);
+	pCPU->m_bBlockInvalidated = true;
+	if (pPage == nullptr) {
+		// Memory map changed, blocks are keyed by their host page so stale
+		// ones miss on their own
+		return;
+	}
+
+	for (uint32_t i = 0; i < PANE_CPU_BLOCK_CACHE_SIZE; i++) {
+		Block& xBlock = pCPU->m_pBlocks[i];
+		if (xBlock.nCount != 0 && xBlock.pPage == pPage) {
+			uint8_t& nInvalidations = pCPU->m_pPageInvalidations[xBlock.pStart >> 8];
+			if (nInvalidations < PANE_CPU_BLOCK_MAX_INVALIDATIONS) {
+				nInvalidations++;
+			}
+			xBlock.nCount = 0;
+		}
+	}
+}
+
+// Instructions the translator emits host code for, everything else calls
+// the predecoded interpreter handler.
+static constexpr bool IsTranslatable(Instruction xInstruction) {
+	switch (xInstruction.oc) {
+	case OC_CLC:
+	case OC_CLD:
+	case OC_CLV:
+	case OC_DEX:
+	case OC_DEY:
+	case OC_INX:
+	case OC_INY:
+	case OC_NOP:
+	case OC_SEC:
+	case OC_SED:
+	case OC_TAX:
+	case OC_TAY:
+	case OC_TSX:
+	case OC_TXA:
+	case OC_TXS:
+	case OC_TYA:
+		return xInstruction.am == AM_IMPL;
+	case OC_ADC:
+	case OC_AND:
+	case OC_CMP:
+	case OC_CPX:
+	case OC_CPY:
+	case OC_EOR:
+	case OC_LDA:
+	case OC_LDX:
+	case OC_LDY:
+	case OC_ORA:
+	case OC_SBC:
+		return xInstruction.am == AM_IMM || xInstruction.am == AM_ZPG || xInstruction.am == AM_ABS;
+	case OC_STA:
+	case OC_STX:
+	case OC_STY:
+		return xInstruction.am == AM_ZPG || xInstruction.am == AM_ABS;
+	default:
+		return false;
+	}
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::SetJITEnabled(bool bEnabled) {
+	if (bEnabled && m_pCode == nullptr) {
+#ifdef PANE_JIT_SUPPORTED
+		this->SetBlockCacheEnabled(true);
+		m_pCode = std::make_unique<CodeBuffer>();
+		m_pCode->Init();
+		this->ResetCompiledBlocks();
+#else
+		throw std::runtime_error("JIT is not supported on this platform!");
+#endif
+	} else if (!bEnabled && m_pCode != nullptr) {
+		m_pCode.reset();
+		this->ResetCompiledBlocks();
+	}
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::SetJITPerfMapEnabled(bool bEnabled) {
+	if (m_pCode == nullptr) {
+		throw std::runtime_error("JIT is not enabled!");
+	}
+	m_pCode->SetPerfMapEnabled(bEnabled);
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::ResetCompiledBlocks() {
+	if (m_pCode != nullptr) {
+		m_pCode->Reset();
+	}
+	if (m_pBlocks != nullptr) {
+		for (uint32_t i = 0; i < PANE_CPU_BLOCK_CACHE_SIZE; i++) {
+			m_pBlocks[i].fnCompiled = nullptr;
+			m_pBlocks[i].nExecutions = 0;
+		}
+	}
+}
+
+#ifdef PANE_JIT_SUPPORTED
+// Translated blocks run with the CPU pointer in rbx and keep the 6502 state
+// in memory. Cycles and instruction counts of register-only instructions are
+// batched and flushed before anything that can observe them (bus accesses
+// and handler calls). Handlers and bus slow paths may invalidate the block
+// or raise an interrupt, so the block returns early after them like
+// RunBlock does. Blocks are only entered when their worst case cycle count
+// fits the budget. Nothing called from translated code may throw, there is
+// no unwind info for it; blocks never contain invalid opcodes.
+template <typename Bus>
+void BasicCPU<Bus>::CompileBlock(Block* pBlock) {
+	CodeBuffer& xCode = *m_pCode;
+	if (!xCode.HasSpace(PANE_JIT_MAX_BLOCK_SIZE)) {
+		this->ResetCompiledBlocks();
+	}
+
+	int32_t nPCOffset = this->GetMemberOffset(&m_xRegs.pc);
+	std::vector<size_t> vExits;
+	int32_t nCycles = 0;
+	int32_t nInstructions = 0;
+	uint16_t pc = pBlock->pStart;
+	bool bEndsNative = false;
+
+	xCode.BeginFunction();
+	xCode.Push(X64_RBX);
+	xCode.MovRegReg64(X64_RBX, X64_RDI);
+
+	for (uint8_t i = 0; i < pBlock->nCount; i++) {
+		const DecodedInstruction& xDecoded = pBlock->pInstructions[i];
+		Instruction xInstruction = g_xInstructionLUT[xDecoded.nOpCode];
+		bool bLast = i + 1 == pBlock->nCount;
+		pc += xDecoded.nLength;
+		nInstructions++;
+
+		if (!IsTranslatable(xInstruction)) {
+			this->EmitFlush(nCycles, nInstructions);
+			xCode.StoreImm16(nPCOffset, pc);
+			xCode.MovRegReg64(X64_RDI, X64_RBX);
+			xCode.MovRegImm32(X64_RSI, xDecoded.nOperand);
+			xCode.MovRegImm64(X64_RAX, reinterpret_cast<uint64_t>(xDecoded.fnHandler));
+			xCode.CallRegister(X64_RAX);
+			if (!bLast) {
+				this->EmitExitCheck(vExits);
+			}
+			bEndsNative = false;
+			continue;
+		}
+
+		bEndsNative = true;
+		nCycles += g_nCyclesLUT[xDecoded.nOpCode];
+
+		uint8_t* pRegister = nullptr;
+		switch (xInstruction.oc) {
+		case OC_LDA: case OC_STA: case OC_CMP: pRegister = &m_xRegs.ac; break;
+		case OC_LDX: case OC_STX: case OC_CPX: pRegister = &m_xRegs.x; break;
+		case OC_LDY: case OC_STY: case OC_CPY: pRegister = &m_xRegs.y; break;
+		default: break;
+		}
+
+		if (xInstruction.am == AM_IMPL) {
+			switch (xInstruction.oc) {
+			case OC_CLC: xCode.StoreImm8(this->GetMemberOffset(&m_nFlagC), 0); break;
+			case OC_CLD: xCode.AndImm8(this->GetMemberOffset(&m_xRegs.sr), static_cast<uint8_t>(~SR_DECIMAL)); break;
+			case OC_CLV: xCode.StoreImm8(this->GetMemberOffset(&m_nFlagV), 0); break;
+			case OC_SEC: xCode.StoreImm8(this->GetMemberOffset(&m_nFlagC), 1); break;
+			case OC_SED: xCode.OrImm8(this->GetMemberOffset(&m_xRegs.sr), SR_DECIMAL); break;
+			case OC_NOP: break;
+			case OC_TXS:
+				xCode.LoadByte(X64_RAX, this->GetMemberOffset(&m_xRegs.x));
+				xCode.StoreByte(this->GetMemberOffset(&m_xRegs.sp), X64_AL);
+				break;
+			default: {
+				uint8_t* pSrc = nullptr;
+				uint8_t* pDst = nullptr;
+				switch (xInstruction.oc) {
+				case OC_TAX: pSrc = &m_xRegs.ac; pDst = &m_xRegs.x; break;
+				case OC_TAY: pSrc = &m_xRegs.ac; pDst = &m_xRegs.y; break;
+				case OC_TSX: pSrc = &m_xRegs.sp; pDst = &m_xRegs.x; break;
+				case OC_TXA: pSrc = &m_xRegs.x; pDst = &m_xRegs.ac; break;
+				case OC_TYA: pSrc = &m_xRegs.y; pDst = &m_xRegs.ac; break;
+				case OC_INX: case OC_DEX: pSrc = pDst = &m_xRegs.x; break;
+				case OC_INY: case OC_DEY: pSrc = pDst = &m_xRegs.y; break;
+				default: break;
+				}
+				xCode.LoadByte(X64_RAX, this->GetMemberOffset(pSrc));
+				if (xInstruction.oc == OC_INX || xInstruction.oc == OC_INY) {
+					xCode.IncByte(X64_AL);
+				} else if (xInstruction.oc == OC_DEX || xInstruction.oc == OC_DEY) {
+					xCode.DecByte(X64_AL);
+				}
+				xCode.StoreByte(this->GetMemberOffset(pDst), X64_AL);
+				this->EmitSetZN();
+				break;
+			}
+			}
+			continue;
+		}
+
+		if (xInstruction.oc == OC_STA || xInstruction.oc == OC_STX || xInstruction.oc == OC_STY) {
+			this->EmitFlush(nCycles, nInstructions);
+			xCode.StoreImm16(nPCOffset, pc);
+			xCode.LoadByte(X64_RAX, this->GetMemberOffset(pRegister));
+			this->EmitWrite(xDecoded.nOperand, vExits);
+			continue;
+		}
+
+		// Operand into al, bus reads see the cycle count up to and
+		// including this instruction like the interpreter's do
+		if (xInstruction.am == AM_IMM) {
+			xCode.MovByteImm8(X64_AL, static_cast<uint8_t>(xDecoded.nOperand));
+		} else {
+			this->EmitFlush(nCycles, nInstructions);
+			this->EmitRead(xDecoded.nOperand);
+		}
+
+		int32_t nACOffset = this->GetMemberOffset(&m_xRegs.ac);
+		switch (xInstruction.oc) {
 		case OC_LDA:
-			LDA();
-			break;
-		
 		case OC_LDX:
-			LDX();
-			break;
-		
 		case OC_LDY:
-			LDY();
-			break;
-		
-		case OC_LSR:
-			m_xInstruction.am == AM_ACC ? LSRACC() : LSR();
-			break;
-		
-		case OC_NOP:
-			NOP();
+			xCode.StoreByte(this->GetMemberOffset(pRegister), X64_AL);
+			this->EmitSetZN();
 			break;
-		
+		case OC_AND:
 		case OC_ORA:
-			ORA();
-			break;
-		
-		case OC_PHA:
-			PHA();
-			break;
-		
-		case OC_PHP:
-			PHP();
-			break;
-		
-		case OC_PLA:
-			PLA();
-			break;
-		
-		case OC_PLP:
-			PLP();
-			break;
-		
-		case OC_ROL:
-			m_xInstruction.am == AM_ACC ? ROLACC() : ROL();
-			break;
-		
-		case OC_ROR:
-			m_xInstruction.am == AM_ACC ? RORACC() : ROR();
-			break;
-		
-		case OC_RTI:
-			RTI();
-			break;
-		
-		case OC_RTS:
-			RTS();
+		case OC_EOR:
+			if (xInstruction.oc == OC_AND) {
+				xCode.AndAlMem(nACOffset);
+			} else if (xInstruction.oc == OC_ORA) {
+				xCode.OrAlMem(nACOffset);
+			} else {
+				xCode.XorAlMem(nACOffset);
+			}
+			xCode.StoreByte(nACOffset, X64_AL);
+			this->EmitSetZN();
 			break;
-		
+		case OC_ADC:
 		case OC_SBC:
-			SBC();
-			break;
-		
-		case OC_SEC:
-			SEC();
-			break;
-		
-		case OC_SED:
-			SED();
-			break;
-		
-		case OC_SEI:
-			SEI();
-			break;
-		
-		case OC_STA:
-			STA();
-			break;
-		
-		case OC_STX:
-			STX();
-			break;
-		
-		case OC_STY:
-			STY();
-			break;
-		
-		case OC_TAX:
-			TAX();
-			break;
-		
-		case OC_TAY:
-			TAY();
+			// SBC is ADC of the inverted operand, x86 carry and overflow
+			// match the 6502 for binary arithmetic
+			if (xInstruction.oc == OC_SBC) {
+				xCode.NotByte(X64_AL);
+			}
+			xCode.MovByteReg(X64_CL, X64_AL);
+			xCode.LoadByte(X64_RAX, nACOffset);
+			xCode.LoadByte(X64_RDX, this->GetMemberOffset(&m_nFlagC));
+			xCode.ShrByte1(X64_DL);
+			xCode.AdcByteReg(X64_AL, X64_CL);
+			xCode.SetCondition(X64_CC_B, X64_DL);
+			xCode.SetCondition(X64_CC_O, X64_DH);
+			xCode.StoreByte(this->GetMemberOffset(&m_nFlagC), X64_DL);
+			xCode.StoreByte(this->GetMemberOffset(&m_nFlagV), X64_DH);
+			xCode.StoreByte(nACOffset, X64_AL);
+			this->EmitSetZN();
 			break;
-		
-		case OC_TSX:
-			TSX();
+		case OC_CMP:
+		case OC_CPX:
+		case OC_CPY:
+			xCode.MovByteReg(X64_CL, X64_AL);
+			xCode.LoadByte(X64_RAX, this->GetMemberOffset(pRegister));
+			xCode.SubByteReg(X64_AL, X64_CL);
+			xCode.SetCondition(X64_CC_AE, X64_DL);
+			xCode.StoreByte(this->GetMemberOffset(&m_nFlagC), X64_DL);
+			this->EmitSetZN();
 			break;
-		
-		case OC_TXA:
-			TXA();
+		default:
 			break;
+		}
+	}
 
-		case OC_TXS:
-			TXS();
-			break;
-		
-		case OC_TYA:
-			TYA();
-			break;
-		
-		default:
-			throw std::runtime_error(std::format("Invlad opcode {:#04x} called", static_cast<int8_t>(m_xInstruction.oc)));
+	this->EmitFlush(nCycles, nInstructions);
+	if (bEndsNative) {
+		xCode.StoreImm16(nPCOffset, pc);
+	}
+	for (size_t nExit : vExits) {
+		xCode.BindLabel(nExit);
+	}
+	xCode.Pop(X64_RBX);
+	xCode.Ret();
+
+	char sName[32];
+	std::snprintf(sName, sizeof(sName), "pane_6502_%04X", pBlock->pStart);
+	pBlock->fnCompiled = reinterpret_cast<CompiledBlock>(xCode.EndFunction(sName));
+	m_nCompiledBlocks++;
+}
+
+template <typename Bus>
+int32_t BasicCPU<Bus>::GetMemberOffset(const void* pMember) const {
+	return static_cast<int32_t>(reinterpret_cast<const uint8_t*>(pMember) - reinterpret_cast<const uint8_t*>(this));
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::EmitFlush(int32_t& nCycles, int32_t& nInstructions) {
+	if (nCycles != 0) {
+		m_pCode->AddImm32(this->GetMemberOffset(&m_nCycles), nCycles);
+		nCycles = 0;
+	}
+	if (nInstructions != 0) {
+		m_pCode->AddImm64(this->GetMemberOffset(&m_nInstructions), nInstructions);
+		nInstructions = 0;
 	}
 }
-void CPU::Interrupt(InterruptType t) {
+
+// Z and N from the result in al
+template <typename Bus>
+void BasicCPU<Bus>::EmitSetZN() {
+	m_pCode->ZeroExtendByte(X64_RAX, X64_AL);
+	m_pCode->StoreWord(this->GetMemberOffset(&m_nFlagZN), X64_RAX);
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::EmitExitCheck(std::vector<size_t>& vExits) {
+	m_pCode->CmpImm8(this->GetMemberOffset(&m_bBlockInvalidated), 0);
+	vExits.push_back(m_pCode->JumpIf(X64_CC_NE));
+	m_pCode->CmpImm8(this->GetMemberOffset(&m_bInturruptPending), 0);
+	vExits.push_back(m_pCode->JumpIf(X64_CC_NE));
+}
+
+// Page table lookups happen at run time so bank switches need no
+// retranslation. Handled pages (I/O, open bus, protected code) fall back to
+// the bus.
+template <typename Bus>
+void BasicCPU<Bus>::EmitRead(uint16_t pAddress) {
+	CodeBuffer& xCode = *m_pCode;
+	xCode.MovRegImm64(X64_RAX, reinterpret_cast<uint64_t>(&m_pBus->GetReadPageTable()[pAddress >> PANE_MMU_PAGE_SHIFT]));
+	xCode.LoadPointer(X64_RAX, X64_RAX);
+	xCode.TestRegReg64(X64_RAX, X64_RAX);
+	size_t nSlowPath = xCode.JumpIf(X64_CC_E);
+	xCode.LoadByteIndirect(X64_RAX, X64_RAX, pAddress & PANE_MMU_PAGE_MASK);
+	size_t nDone = xCode.Jump();
+
+	xCode.BindLabel(nSlowPath);
+	xCode.MovRegReg64(X64_RDI, X64_RBX);
+	xCode.MovRegImm32(X64_RSI, pAddress);
+	xCode.MovRegImm64(X64_RAX, reinterpret_cast<uint64_t>(&BasicCPU<Bus>::JITRead));
+	xCode.CallRegister(X64_RAX);
+	xCode.ZeroExtendByte(X64_RAX, X64_AL);
+	xCode.BindLabel(nDone);
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::EmitWrite(uint16_t pAddress, std::vector<size_t>& vExits) {
+	CodeBuffer& xCode = *m_pCode;
+	xCode.MovRegImm64(X64_RCX, reinterpret_cast<uint64_t>(&m_pBus->GetWritePageTable()[pAddress >> PANE_MMU_PAGE_SHIFT]));
+	xCode.LoadPointer(X64_RCX, X64_RCX);
+	xCode.TestRegReg64(X64_RCX, X64_RCX);
+	size_t nSlowPath = xCode.JumpIf(X64_CC_E);
+	xCode.StoreByteIndirect(X64_RCX, pAddress & PANE_MMU_PAGE_MASK, X64_AL);
+	size_t nDone = xCode.Jump();
+
+	xCode.BindLabel(nSlowPath);
+	xCode.MovRegReg64(X64_RDI, X64_RBX);
+	xCode.MovRegImm32(X64_RSI, pAddress);
+	xCode.ZeroExtendByte(X64_RDX, X64_AL);
+	xCode.MovRegImm64(X64_RAX, reinterpret_cast<uint64_t>(&BasicCPU<Bus>::JITWrite));
+	xCode.CallRegister(X64_RAX);
+	this->EmitExitCheck(vExits);
+	xCode.BindLabel(nDone);
+}
+
+template <typename Bus>
+uint8_t BasicCPU<Bus>::JITRead(BasicCPU* pCPU, uint16_t pAddress) {
+	return pCPU->m_pBus->Read(pAddress);
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::JITWrite(BasicCPU* pCPU, uint16_t pAddress, uint8_t cVal) {
+	pCPU->m_pBus->Write(pAddress, cVal);
+}
+#endif
+
+template <typename Bus>
+void BasicCPU<Bus>::Interrupt(InterruptType t) {
+	// An IRQ can't take the place of an NMI still waiting to be taken
+	if (m_bInturruptPending && m_eInterruptType == INT_NMI && t == INT_IRQ) {
+		return;
+	}
 	m_bInturruptPending = true;
 	m_eInterruptType = t;
 }
 
-void CPU::Reset() {
+template <typename Bus>
+void BasicCPU<Bus>::CancelInterrupt(InterruptType t) {
+	if (m_bInturruptPending && m_eInterruptType == t) {
+		m_bInturruptPending = false;
+		m_eInterruptType = INT_NONE;
+	}
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::Reset() {
 	m_xRegs.sr |= SR_INTERRUPT;
 	m_xRegs.sp -= 3;
-	m_xRegs.pc = m_pMMU->ReadAddress(RESET_ADDRESS);
+	m_xRegs.pc = m_pBus->ReadAddress(RESET_ADDRESS);
 	m_nCycles = 0;
 }
 
-void CPU::ADC() {
-	uint8_t opr = m_pMMU->Read(m_pOperandAddress);
-	uint16_t result = m_xRegs.ac + opr + ((m_xRegs.sr & SR_CARRY) != 0);
-	
-	m_xRegs.sr &= ~(SR_CARRY | SR_ZERO | SR_NEGATIVE | SR_OVERFLOW);
+template <typename Bus>
+void BasicCPU<Bus>::ADC() {
+	uint8_t opr = m_pBus->Read(m_pOperandAddress);
+	uint16_t result = m_xRegs.ac + opr + (m_nFlagC);
+
 	this->CheckAndSetCarryFlag(result);
 	this->CheckAndSetOverflowFlag(result, m_xRegs.ac, opr);
 	this->CheckAndSetZNFlags(result);
@@ -312,570 +870,677 @@ void CPU::ADC() {
 	m_xRegs.ac = result & 0xFF;
 }
 
-void CPU::AND() {
-	int8_t opr = m_pMMU->Read(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::AND() {
+	int8_t opr = m_pBus->Read(m_pOperandAddress);
 	int8_t result = m_xRegs.ac & opr;
 
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(result);
 
 	m_xRegs.ac = result;
 }
 
-void CPU::ASL() {
-	int16_t result = static_cast<int16_t>(m_pMMU->Read(m_pOperandAddress)) << 1;
+template <typename Bus>
+void BasicCPU<Bus>::ASL() {
+	int16_t result = static_cast<int16_t>(m_pBus->Read(m_pOperandAddress)) << 1;
 
-	m_xRegs.sr &= ~(SR_CARRY | SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(result);
 	this->CheckAndSetCarryFlag(result);
 
-	m_pMMU->Write(m_pOperandAddress, result & 0xFF);
+	m_pBus->Write(m_pOperandAddress, result & 0xFF);
 }
 
-void CPU::ASLACC() {
+template <typename Bus>
+void BasicCPU<Bus>::ASLACC() {
 	int16_t result = m_xRegs.ac << 1;
 
-	m_xRegs.sr &= ~(SR_CARRY | SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(result);
 	this->CheckAndSetCarryFlag(result);
 
 	m_xRegs.ac = result & 0xFF;
 }
 
-void CPU::BCC() {
-	if (!(m_xRegs.sr & SR_CARRY)) {
-		m_xRegs.pc = m_pOperandAddress;
+template <typename Bus>
+void BasicCPU<Bus>::BCC() {
+	if (!m_nFlagC) {
+		this->TakeBranch();
 	}
 }
 
-void CPU::BCS() {
-	if (m_xRegs.sr & SR_CARRY) {
-		m_xRegs.pc = m_pOperandAddress;
+template <typename Bus>
+void BasicCPU<Bus>::BCS() {
+	if (m_nFlagC) {
+		this->TakeBranch();
 	}
 }
 
-void CPU::BEQ() {
-	if (m_xRegs.sr & SR_ZERO) {
-		m_xRegs.pc = m_pOperandAddress;
+template <typename Bus>
+void BasicCPU<Bus>::BEQ() {
+	if ((m_nFlagZN & 0xFF) == 0) {
+		this->TakeBranch();
 	}
 }
 
-void CPU::BIT() {
-	int8_t opr = m_pMMU->Read(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::BIT() {
+	int8_t opr = m_pBus->Read(m_pOperandAddress);
 	int8_t result = m_xRegs.ac & opr;
 
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE | SR_OVERFLOW);
-	m_xRegs.sr |= (result == 0) ? SR_ZERO : 0;
-	m_xRegs.sr |= opr & (SR_NEGATIVE | SR_OVERFLOW);
+	// Z comes from the AND, N and V straight from the operand
+	m_nFlagZN = (result != 0) | ((opr & SR_NEGATIVE) << 1);
+	m_nFlagV = opr & SR_OVERFLOW;
 }
 
-void CPU::BMI() {
-	if (m_xRegs.sr & SR_NEGATIVE) {
-		m_xRegs.pc = m_pOperandAddress;
+template <typename Bus>
+void BasicCPU<Bus>::BMI() {
+	if (m_nFlagZN & 0x180) {
+		this->TakeBranch();
 	}
 }
 
-void CPU::BNE() {
-	if (!(m_xRegs.sr & SR_ZERO)) {
-		m_xRegs.pc = m_pOperandAddress;
+template <typename Bus>
+void BasicCPU<Bus>::BNE() {
+	if ((m_nFlagZN & 0xFF) != 0) {
+		this->TakeBranch();
 	}
 }
 
-void CPU::BPL() {
-	if (!(m_xRegs.sr & SR_NEGATIVE)) {
-		m_xRegs.pc = m_pOperandAddress;
+template <typename Bus>
+void BasicCPU<Bus>::BPL() {
+	if (!(m_nFlagZN & 0x180)) {
+		this->TakeBranch();
 	}
 }
 
-void CPU::BRK() {
-	m_pMMU->PushAddress(&m_xRegs.sp, m_xRegs.pc);
+template <typename Bus>
+void BasicCPU<Bus>::BRK() {
+	// BRK has a padding byte after the opcode
+	m_pBus->PushAddress(&m_xRegs.sp, m_xRegs.pc + 1);
+	m_pBus->Push(&m_xRegs.sp, this->GetStatus() | SR_BREAK | 1 << 5);
 	m_xRegs.sr |= SR_INTERRUPT;
-	m_pMMU->Push(&m_xRegs.sp, m_xRegs.sr);
 
-	m_xRegs.pc = m_pMMU->ReadAddress(IRQ_ADDRESS);
+	m_xRegs.pc = m_pBus->ReadAddress(IRQ_ADDRESS);
 }
 
-void CPU::BVC() {
-	if (!(m_xRegs.sr & SR_OVERFLOW)) {
-		m_xRegs.pc = m_pOperandAddress;
+template <typename Bus>
+void BasicCPU<Bus>::BVC() {
+	if (!m_nFlagV) {
+		this->TakeBranch();
 	}
 }
 
-void CPU::BVS() {
-	if (m_xRegs.sr & SR_OVERFLOW) {
-		m_xRegs.pc = m_pOperandAddress;
+template <typename Bus>
+void BasicCPU<Bus>::BVS() {
+	if (m_nFlagV) {
+		this->TakeBranch();
 	}
 }
 
-void CPU::CLC() {
-	m_xRegs.sr &= ~(SR_CARRY);
+template <typename Bus>
+void BasicCPU<Bus>::CLC() {
+	m_nFlagC = 0;
 }
 
-void CPU::CLD() {
+template <typename Bus>
+void BasicCPU<Bus>::CLD() {
 	m_xRegs.sr &= ~(SR_DECIMAL);
 }
 
-void CPU::CLI() {
+template <typename Bus>
+void BasicCPU<Bus>::CLI() {
 	m_xRegs.sr &= ~(SR_INTERRUPT);
 }
 
-void CPU::CLV() {
-	m_xRegs.sr &= ~(SR_OVERFLOW);
+template <typename Bus>
+void BasicCPU<Bus>::CLV() {
+	m_nFlagV = 0;
 }
 
-void CPU::CMP() {
-	uint8_t opr = m_pMMU->Read(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::CMP() {
+	uint8_t opr = m_pBus->Read(m_pOperandAddress);
 	uint16_t result = m_xRegs.ac - opr;
 
-	m_xRegs.sr &= ~(SR_CARRY | SR_ZERO | SR_NEGATIVE);
-	this->CheckAndSetCarryFlag(result);
+	m_nFlagC = m_xRegs.ac >= opr;
 	this->CheckAndSetZNFlags(result);
 }
 
-void CPU::CPX() {
-	uint8_t opr = m_pMMU->Read(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::CPX() {
+	uint8_t opr = m_pBus->Read(m_pOperandAddress);
 	uint16_t result = m_xRegs.x - opr;
 
-	m_xRegs.sr &= ~(SR_CARRY | SR_ZERO | SR_NEGATIVE);
-	this->CheckAndSetCarryFlag(result);
+	m_nFlagC = m_xRegs.x >= opr;
 	this->CheckAndSetZNFlags(result);
 }
 
-void CPU::CPY() {
-	uint8_t opr = m_pMMU->Read(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::CPY() {
+	uint8_t opr = m_pBus->Read(m_pOperandAddress);
 	uint16_t result = m_xRegs.y - opr;
 
-	m_xRegs.sr &= ~(SR_CARRY | SR_ZERO | SR_NEGATIVE);
-	this->CheckAndSetCarryFlag(result);
+	m_nFlagC = m_xRegs.y >= opr;
 	this->CheckAndSetZNFlags(result);
 }
 
-void CPU::DEC() {
-	int8_t opr = m_pMMU->Read(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::DEC() {
+	int8_t opr = m_pBus->Read(m_pOperandAddress);
 	int16_t result = opr - 1;
 
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(result);
 
-	m_pMMU->Write(m_pOperandAddress, result);
+	m_pBus->Write(m_pOperandAddress, result);
 }
 
-void CPU::DEX() {
+template <typename Bus>
+void BasicCPU<Bus>::DEX() {
 	int16_t result = m_xRegs.x - 1;
 
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(result);
 
 	m_xRegs.x = result;
 }
 
-void CPU::DEY() {
+template <typename Bus>
+void BasicCPU<Bus>::DEY() {
 	int16_t result = m_xRegs.y - 1;
 
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(result);
 
-	m_xRegs.x = result;
+	m_xRegs.y = result;
 }
 
-void CPU::EOR() {
-	int8_t opr = m_pMMU->Read(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::EOR() {
+	int8_t opr = m_pBus->Read(m_pOperandAddress);
 	int8_t result = opr ^ m_xRegs.ac;
 
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(result);
 
 	m_xRegs.ac = result;
 }
 
-void CPU::INC() {
-	int8_t opr = m_pMMU->Read(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::INC() {
+	int8_t opr = m_pBus->Read(m_pOperandAddress);
 	int16_t result = opr + 1;
 
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(result);
 
-	m_pMMU->Write(m_pOperandAddress, result);
+	m_pBus->Write(m_pOperandAddress, result);
 }
 
-void CPU::INX() {
+template <typename Bus>
+void BasicCPU<Bus>::INX() {
 	int16_t result = m_xRegs.x + 1;
 
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(result);
 
 	m_xRegs.x = result;
 }
 
-void CPU::INY() {
+template <typename Bus>
+void BasicCPU<Bus>::INY() {
 	int16_t result = m_xRegs.y + 1;
 
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(result);
 
-	m_xRegs.x = result;
+	m_xRegs.y = result;
 }
 
-void CPU::JMP() {
-	m_xRegs.pc = m_pMMU->ReadAddress(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::JMP() {
+	m_xRegs.pc = m_pOperandAddress;
 }
 
-void CPU::JSR() {
-	m_pMMU->PushAddress(&m_xRegs.sp, m_xRegs.pc);
-	m_xRegs.pc = m_pMMU->ReadAddress(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::JSR() {
+	// Return address pushed is the last byte of the JSR instruction
+	m_pBus->PushAddress(&m_xRegs.sp, m_xRegs.pc - 1);
+	m_xRegs.pc = m_pOperandAddress;
 }
 
-void CPU::LDA() {
-	m_xRegs.ac = m_pMMU->Read(m_pOperandAddress);
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
+template <typename Bus>
+void BasicCPU<Bus>::LDA() {
+	m_xRegs.ac = m_pBus->Read(m_pOperandAddress);
 	this->CheckAndSetZNFlags(m_xRegs.ac);
 }
 
-void CPU::LDX() {
-	m_xRegs.x = m_pMMU->Read(m_pOperandAddress);
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
+template <typename Bus>
+void BasicCPU<Bus>::LDX() {
+	m_xRegs.x = m_pBus->Read(m_pOperandAddress);
 	this->CheckAndSetZNFlags(m_xRegs.x);
 }
 
-void CPU::LDY() {
-	m_xRegs.y = m_pMMU->Read(m_pOperandAddress);
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
+template <typename Bus>
+void BasicCPU<Bus>::LDY() {
+	m_xRegs.y = m_pBus->Read(m_pOperandAddress);
 	this->CheckAndSetZNFlags(m_xRegs.y);
 }
 
-void CPU::LSR() {
-	int8_t opr = m_pMMU->Read(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::LSR() {
+	int8_t opr = m_pBus->Read(m_pOperandAddress);
 	int16_t result = opr >> 1;
 	// Ensure bit shifted in is zero.
 	result &= 0x7F;
 
-	m_xRegs.sr &= ~(SR_CARRY | SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(result);
-	this->CheckAndSetCarryFlag(opr & 1 ? 0xFFFF : 0x0000);
-	// Ensure negative flag is set to zero.
-	m_xRegs.sr &= ~(SR_NEGATIVE);
+	m_nFlagC = opr & 1;
 
-	m_pMMU->Write(m_pOperandAddress, result & 0xFF);
+	m_pBus->Write(m_pOperandAddress, result & 0xFF);
 }
 
-void CPU::LSRACC() {
+template <typename Bus>
+void BasicCPU<Bus>::LSRACC() {
 	int8_t opr = m_xRegs.ac;
 	int16_t result = m_xRegs.ac >> 1;
 	// Ensure bit shifted in is zero.
 	result &= 0x7F;
 
-	m_xRegs.sr &= ~(SR_CARRY | SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(result);
-	this->CheckAndSetCarryFlag(opr & 1 ? 0xFFFF : 0x0000);
-	// Ensure negative flag is set to zero.
-	m_xRegs.sr &= ~(SR_NEGATIVE);
+	m_nFlagC = opr & 1;
 
 	m_xRegs.ac = result & 0xFF;
 }
 
-void CPU::NOP() {
+template <typename Bus>
+void BasicCPU<Bus>::NOP() {
 	;
 }
 
-void CPU::ORA() {
-	int8_t opr = m_pMMU->Read(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::ORA() {
+	int8_t opr = m_pBus->Read(m_pOperandAddress);
 	int8_t result = m_xRegs.ac | opr;
 
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(result);
 
 	m_xRegs.ac = result;
 }
 
-void CPU::PHA() {
-	m_pMMU->Push(&m_xRegs.sp, m_xRegs.ac);
+template <typename Bus>
+void BasicCPU<Bus>::PHA() {
+	m_pBus->Push(&m_xRegs.sp, m_xRegs.ac);
 }
 
-void CPU::PHP() {
-	m_pMMU->Push(&m_xRegs.sp, m_xRegs.sr | SR_INTERRUPT | 1 << 5);
+template <typename Bus>
+void BasicCPU<Bus>::PHP() {
+	m_pBus->Push(&m_xRegs.sp, this->GetStatus() | SR_BREAK | 1 << 5);
 }
 
-void CPU::PLA() {
-	m_xRegs.ac = m_pMMU->Pull(&m_xRegs.sp);
+template <typename Bus>
+void BasicCPU<Bus>::PLA() {
+	m_xRegs.ac = m_pBus->Pull(&m_xRegs.sp);
 
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(m_xRegs.ac);
 }
 
-void CPU::PLP() {
-	m_xRegs.sr = m_pMMU->Pull(&m_xRegs.sp);
+template <typename Bus>
+void BasicCPU<Bus>::PLP() {
+	this->SetStatus((m_pBus->Pull(&m_xRegs.sp) & ~SR_BREAK) | 1 << 5);
 }
 
-void CPU::ROL() {
-	int8_t opr = m_pMMU->Read(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::ROL() {
+	uint8_t opr = m_pBus->Read(m_pOperandAddress);
 	int16_t result = static_cast<int16_t>(opr) << 1;
-	result |= (m_xRegs.sr ^ SR_CARRY) != m_xRegs.sr;
+	result |= m_nFlagC;
 
 	this->CheckAndSetZNFlags(result);
 	this->CheckAndSetCarryFlag(result);
 
-	m_pMMU->Write(m_pOperandAddress, result);
+	m_pBus->Write(m_pOperandAddress, result & 0xFF);
 }
 
-void CPU::ROLACC() {
-	int16_t result = static_cast<int16_t>(m_pOperandAddress) << 1;
-	result |= (m_xRegs.sr ^ SR_CARRY) != m_xRegs.sr;
+template <typename Bus>
+void BasicCPU<Bus>::ROLACC() {
+	int16_t result = static_cast<int16_t>(m_xRegs.ac) << 1;
+	result |= m_nFlagC;
 
 	this->CheckAndSetZNFlags(result);
 	this->CheckAndSetCarryFlag(result);
 
-	m_xRegs.ac = static_cast<int8_t>(result);
+	m_xRegs.ac = result & 0xFF;
 }
 
-void CPU::ROR() {
-	int8_t opr = m_pMMU->Read(m_pOperandAddress);
+template <typename Bus>
+void BasicCPU<Bus>::ROR() {
+	uint8_t opr = m_pBus->Read(m_pOperandAddress);
 	int16_t result = static_cast<int16_t>(opr) >> 1;
-	result |= ((m_xRegs.sr ^ SR_CARRY) != m_xRegs.sr) << 7;
+	result |= (m_nFlagC) << 7;
 
 	this->CheckAndSetZNFlags(result);
-	this->CheckAndSetCarryFlag(opr & 1 ? 0xFFFF : 0x0000);
+	m_nFlagC = opr & 1;
 
-	m_pMMU->Write(m_pOperandAddress, result);
+	m_pBus->Write(m_pOperandAddress, result & 0xFF);
 }
 
-void CPU::RORACC() {
-	int16_t result = static_cast<int16_t>(m_pOperandAddress) >> 1;
-	result |= ((m_xRegs.sr ^ SR_CARRY) != m_xRegs.sr) << 7;
+template <typename Bus>
+void BasicCPU<Bus>::RORACC() {
+	uint8_t opr = m_xRegs.ac;
+	int16_t result = static_cast<int16_t>(opr) >> 1;
+	result |= (m_nFlagC) << 7;
 
 	this->CheckAndSetZNFlags(result);
-	this->CheckAndSetCarryFlag(m_pOperandAddress & 1 ? 0xFFFF : 0x0000);
+	m_nFlagC = opr & 1;
 
-	m_xRegs.ac = result;
+	m_xRegs.ac = result & 0xFF;
 }
 
-void CPU::RTI() {
-	m_xRegs.sr = m_pMMU->Pull(&m_xRegs.sp);
-	m_xRegs.pc = m_pMMU->PullAddress(&m_xRegs.sp);
+template <typename Bus>
+void BasicCPU<Bus>::RTI() {
+	this->SetStatus((m_pBus->Pull(&m_xRegs.sp) & ~SR_BREAK) | 1 << 5);
+	m_xRegs.pc = m_pBus->PullAddress(&m_xRegs.sp);
 }
 
-void CPU::RTS() {
-	m_xRegs.pc = m_pMMU->PullAddress(&m_xRegs.sp);
+template <typename Bus>
+void BasicCPU<Bus>::RTS() {
+	m_xRegs.pc = m_pBus->PullAddress(&m_xRegs.sp) + 1;
 }
 
-void CPU::SBC() {
-	uint8_t opr = m_pMMU->Read(m_pOperandAddress);
-	uint16_t result = m_xRegs.ac - opr - ((m_xRegs.sr & SR_CARRY) == 0);
+template <typename Bus>
+void BasicCPU<Bus>::SBC() {
+	// A - M - !C is A + ~M + C, so borrow out is the inverted carry.
+	uint8_t opr = ~m_pBus->Read(m_pOperandAddress);
+	uint16_t result = m_xRegs.ac + opr + (m_nFlagC);
+
 
-	m_xRegs.sr &= ~(SR_CARRY | SR_ZERO | SR_NEGATIVE | SR_OVERFLOW);
-	
 	this->CheckAndSetCarryFlag(result);
-	this->CheckAndSetOverflowFlag(result, m_xRegs.ac, ~opr);
+	this->CheckAndSetOverflowFlag(result, m_xRegs.ac, opr);
 	this->CheckAndSetZNFlags(result);
 
 	m_xRegs.ac = result & 0xFF;
 }
 
-void CPU::SEC() {
-	m_xRegs.sr |= SR_CARRY;
+template <typename Bus>
+void BasicCPU<Bus>::SEC() {
+	m_nFlagC = 1;
 }
 
-void CPU::SED() {
+template <typename Bus>
+void BasicCPU<Bus>::SED() {
 	m_xRegs.sr |= SR_DECIMAL;
 }
 
-void CPU::SEI() {
+template <typename Bus>
+void BasicCPU<Bus>::SEI() {
 	m_xRegs.sr |= SR_INTERRUPT;
 }
 
-void CPU::STA() {
-	m_pMMU->Write(m_pOperandAddress, m_xRegs.ac);
+template <typename Bus>
+void BasicCPU<Bus>::STA() {
+	m_pBus->Write(m_pOperandAddress, m_xRegs.ac);
 }
 
-void CPU::STX() {
-	m_pMMU->Write(m_pOperandAddress, m_xRegs.x);
+template <typename Bus>
+void BasicCPU<Bus>::STX() {
+	m_pBus->Write(m_pOperandAddress, m_xRegs.x);
 }
 
-void CPU::STY() {
-	m_pMMU->Write(m_pOperandAddress, m_xRegs.y);
+template <typename Bus>
+void BasicCPU<Bus>::STY() {
+	m_pBus->Write(m_pOperandAddress, m_xRegs.y);
 }
 
-void CPU::TAX() {
+template <typename Bus>
+void BasicCPU<Bus>::TAX() {
 	m_xRegs.x = m_xRegs.ac;
-	
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
+
 	this->CheckAndSetZNFlags(m_xRegs.x);
 }
 
-void CPU::TAY() {
+template <typename Bus>
+void BasicCPU<Bus>::TAY() {
 	m_xRegs.y = m_xRegs.ac;
-	
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
+
 	this->CheckAndSetZNFlags(m_xRegs.y);
 }
 
-void CPU::TSX() {
+template <typename Bus>
+void BasicCPU<Bus>::TSX() {
 	m_xRegs.x = m_xRegs.sp;
-	
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
+
 	this->CheckAndSetZNFlags(m_xRegs.x);
 }
 
-void CPU::TXA() {
+template <typename Bus>
+void BasicCPU<Bus>::TXA() {
 	m_xRegs.ac = m_xRegs.x;
-	
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
+
 	this->CheckAndSetZNFlags(m_xRegs.ac);
 }
 
-void CPU::TXS() {
+template <typename Bus>
+void BasicCPU<Bus>::TXS() {
 	m_xRegs.sp = m_xRegs.x;
 }
 
-void CPU::TYA() {
+template <typename Bus>
+void BasicCPU<Bus>::TYA() {
 	m_xRegs.ac = m_xRegs.y;
 
-	m_xRegs.sr &= ~(SR_ZERO | SR_NEGATIVE);
 	this->CheckAndSetZNFlags(m_xRegs.ac);
 }
 
-void CPU::GetOperandAddress() {
-	switch (m_xInstruction.am) {
-	case AM_ACC:
-		m_pMMU->ReadAddress(m_xRegs.pc); // Dummy read
-		m_pOperandAddress = m_xRegs.ac;
-		return;
-	case AM_ABS:
-		m_pOperandAddress = m_xRegs.pc;
-		m_xRegs.pc += 2;
-		return;
-	case AM_ABSX:
-		m_pOperandAddress = m_xRegs.pc;
-		m_xRegs.pc += 2;
-		switch (m_xInstruction.oc) {
-		case OC_STA:
-		case OC_ASL:
-		case OC_DEC:
-		case OC_INC:
-		case OC_LSR:
-		case OC_ROL:
-		case OC_ROR:
-				break;
-		default:
-			CheckIfPageBarrierCrossed(m_pOperandAddress, m_pOperandAddress + m_xRegs.x);
+template <typename Bus>
+void BasicCPU<Bus>::TakeBranch() {
+	// One extra cycle for a taken branch, another if it lands on a new page
+	m_nCycles++;
+	this->CheckIfPageBarrierCrossed(m_xRegs.pc, m_pOperandAddress);
+	m_xRegs.pc = m_pOperandAddress;
+}
+
+template <typename Bus>
+template <AddressMode am, bool bPageCrossPenalty, bool bPredecoded>
+void BasicCPU<Bus>::GetOperandAddress(uint16_t nOperand) {
+	if constexpr (bPredecoded) {
+		// Operand bytes come from the block cache and the PC already points
+		// past the instruction
+		if constexpr (am == AM_ACC || am == AM_IMPL) {
+			m_pOperandAddress = 0;
+		} else if constexpr (am == AM_ABS || am == AM_ZPG) {
+			m_pOperandAddress = nOperand;
+		} else if constexpr (am == AM_ABSX || am == AM_ABSY) {
+			m_pOperandAddress = nOperand + (am == AM_ABSX ? m_xRegs.x : m_xRegs.y);
+			if constexpr (bPageCrossPenalty) {
+				this->CheckIfPageBarrierCrossed(nOperand, m_pOperandAddress);
+			}
+		} else if constexpr (am == AM_IMM) {
+			m_pOperandAddress = m_xRegs.pc - 1;
+		} else if constexpr (am == AM_IND) {
+			uint8_t lo = m_pBus->Read(nOperand);
+			uint8_t hi = m_pBus->Read((nOperand & 0xFF00) | ((nOperand + 1) & 0x00FF));
+			m_pOperandAddress = (static_cast<uint16_t>(hi) << 8) | lo;
+		} else if constexpr (am == AM_XIND) {
+			uint8_t pPointer = nOperand + m_xRegs.x;
+			uint8_t lo = m_pBus->Read(pPointer);
+			uint8_t hi = m_pBus->Read(static_cast<uint8_t>(pPointer + 1));
+			m_pOperandAddress = (static_cast<uint16_t>(hi) << 8) | lo;
+		} else if constexpr (am == AM_INDY) {
+			uint8_t lo = m_pBus->Read(nOperand);
+			uint8_t hi = m_pBus->Read(static_cast<uint8_t>(nOperand + 1));
+			uint16_t pBase = (static_cast<uint16_t>(hi) << 8) | lo;
+			m_pOperandAddress = pBase + m_xRegs.y;
+			if constexpr (bPageCrossPenalty) {
+				this->CheckIfPageBarrierCrossed(pBase, m_pOperandAddress);
+			}
+		} else if constexpr (am == AM_REL) {
+			m_pOperandAddress = m_xRegs.pc + static_cast<int8_t>(nOperand);
+		} else if constexpr (am == AM_ZPGX) {
+			m_pOperandAddress = static_cast<uint8_t>(nOperand + m_xRegs.x);
+		} else if constexpr (am == AM_ZPGY) {
+			m_pOperandAddress = static_cast<uint8_t>(nOperand + m_xRegs.y);
+		} else {
+			static_assert(am != AM_NONE, "Invalid address mode!");
 		}
-		m_pOperandAddress += m_xRegs.x;
-		return;
-	case AM_ABSY:
-		m_pOperandAddress = m_xRegs.pc;
+	} else if constexpr (am == AM_ACC || am == AM_IMPL) {
+		m_pOperandAddress = 0;
+	} else if constexpr (am == AM_ABS) {
+		m_pOperandAddress = m_pBus->ReadAddress(m_xRegs.pc);
 		m_xRegs.pc += 2;
-		switch (m_xInstruction.oc) {
-		case OC_STA:
-		case OC_ASL:
-		case OC_DEC:
-		case OC_INC:
-		case OC_LSR:
-		case OC_ROL:
-		case OC_ROR:
-				break;
-		default:
-			CheckIfPageBarrierCrossed(m_pOperandAddress, m_pOperandAddress + m_xRegs.y);
+	} else if constexpr (am == AM_ABSX || am == AM_ABSY) {
+		uint16_t pBase = m_pBus->ReadAddress(m_xRegs.pc);
+		m_xRegs.pc += 2;
+		m_pOperandAddress = pBase + (am == AM_ABSX ? m_xRegs.x : m_xRegs.y);
+		if constexpr (bPageCrossPenalty) {
+			this->CheckIfPageBarrierCrossed(pBase, m_pOperandAddress);
 		}
-		m_pOperandAddress += m_xRegs.y;
-		return;
-	case AM_IMM:
+	} else if constexpr (am == AM_IMM) {
 		m_pOperandAddress = m_xRegs.pc;
 		m_xRegs.pc += 1;
-		return;
-	case AM_IMPL:
-		m_pOperandAddress = 0;;
-		return;
-	case AM_IND:
-		m_pOperandAddress = m_pMMU->ReadAddress(m_pMMU->ReadAddress(m_xRegs.pc));
+	} else if constexpr (am == AM_IND) {
+		// The pointer's high byte is fetched without carrying into the next page
+		uint16_t pPointer = m_pBus->ReadAddress(m_xRegs.pc);
 		m_xRegs.pc += 2;
-		return;
-	case AM_XIND:
-		m_pOperandAddress = m_pMMU->ReadAddress(m_pMMU->Read(m_xRegs.pc) + m_xRegs.x);
+		uint8_t lo = m_pBus->Read(pPointer);
+		uint8_t hi = m_pBus->Read((pPointer & 0xFF00) | ((pPointer + 1) & 0x00FF));
+		m_pOperandAddress = (static_cast<uint16_t>(hi) << 8) | lo;
+	} else if constexpr (am == AM_XIND) {
+		uint8_t pPointer = m_pBus->Read(m_xRegs.pc) + m_xRegs.x;
 		m_xRegs.pc += 1;
-		return;
-	case AM_INDY:
-		m_pOperandAddress = m_pMMU->ReadAddress(m_pMMU->Read(m_xRegs.pc));
+		uint8_t lo = m_pBus->Read(pPointer);
+		uint8_t hi = m_pBus->Read(static_cast<uint8_t>(pPointer + 1));
+		m_pOperandAddress = (static_cast<uint16_t>(hi) << 8) | lo;
+	} else if constexpr (am == AM_INDY) {
+		uint8_t pPointer = m_pBus->Read(m_xRegs.pc);
 		m_xRegs.pc += 1;
-		switch (m_xInstruction.oc) {
-		case OC_STA:
-		case OC_ASL:
-		case OC_DEC:
-		case OC_INC:
-		case OC_LSR:
-		case OC_ROL:
-		case OC_ROR:
-				break;
-		default:
-			CheckIfPageBarrierCrossed(m_pOperandAddress, m_pOperandAddress + m_xRegs.y);
+		uint8_t lo = m_pBus->Read(pPointer);
+		uint8_t hi = m_pBus->Read(static_cast<uint8_t>(pPointer + 1));
+		uint16_t pBase = (static_cast<uint16_t>(hi) << 8) | lo;
+		m_pOperandAddress = pBase + m_xRegs.y;
+		if constexpr (bPageCrossPenalty) {
+			this->CheckIfPageBarrierCrossed(pBase, m_pOperandAddress);
 		}
-		m_pOperandAddress += m_xRegs.y;
-		return;
-	case AM_REL: {
-			int16_t offset = m_pMMU->Read(m_xRegs.pc);
-			if (offset & 0x80) {
-				offset |= 0xFF00;
-			}
-			m_xRegs.pc += 1;
-			m_pOperandAddress = m_xRegs.pc + offset;
-			return;
-		}
-	case AM_ZPG:
-		m_pOperandAddress = m_pMMU->Read(m_xRegs.pc);
+	} else if constexpr (am == AM_REL) {
+		int8_t offset = m_pBus->Read(m_xRegs.pc);
 		m_xRegs.pc += 1;
-		return;
-	case AM_ZPGX:
-		m_pOperandAddress = static_cast<uint8_t>(m_pMMU->Read(m_xRegs.pc) + m_xRegs.x);
+		m_pOperandAddress = m_xRegs.pc + offset;
+	} else if constexpr (am == AM_ZPG) {
+		m_pOperandAddress = m_pBus->Read(m_xRegs.pc);
 		m_xRegs.pc += 1;
-		return;
-	case AM_ZPGY:
-		m_pOperandAddress = static_cast<uint8_t>(m_pMMU->Read(m_xRegs.pc) + m_xRegs.y);
+	} else if constexpr (am == AM_ZPGX) {
+		m_pOperandAddress = static_cast<uint8_t>(m_pBus->Read(m_xRegs.pc) + m_xRegs.x);
 		m_xRegs.pc += 1;
-		return;
-	default:
-		throw std::runtime_error("Invalid address mode!");
-
+	} else if constexpr (am == AM_ZPGY) {
+		m_pOperandAddress = static_cast<uint8_t>(m_pBus->Read(m_xRegs.pc) + m_xRegs.y);
+		m_xRegs.pc += 1;
+	} else {
+		static_assert(am != AM_NONE, "Invalid address mode!");
 	}
 }
 
-void CPU::CheckAndSetZNFlags(int8_t val) {
-	m_xRegs.sr |= (val == 0) ? SR_ZERO : 0;
-	m_xRegs.sr |= (val & 0x80) ? SR_NEGATIVE : 0;
-}
-
-void CPU::CheckAndSetOverflowFlag(int16_t result, int8_t lhs, int8_t rhs) {
-	m_xRegs.sr |= ((result ^ lhs) & (result ^ rhs)) ? SR_OVERFLOW : 0;
-}
-
-void CPU::CheckAndSetCarryFlag(int16_t result) {
-	m_xRegs.sr |= (result & 0xff00) ? SR_CARRY : 0;
+template <typename Bus>
+void BasicCPU<Bus>::CheckAndSetZNFlags(int8_t val) {
+	m_nFlagZN = static_cast<uint8_t>(val);
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::CheckAndSetOverflowFlag(int16_t result, int8_t lhs, int8_t rhs) {
+	m_nFlagV = (result ^ lhs) & (result ^ rhs) & 0x80;
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::CheckAndSetCarryFlag(int16_t result) {
+	m_nFlagC = (result & 0xff00) != 0;
+}
+
+template <typename Bus>
+uint8_t BasicCPU<Bus>::GetStatus() const {
+	uint8_t sr = m_xRegs.sr & ~(SR_CARRY | SR_ZERO | SR_OVERFLOW | SR_NEGATIVE);
+	sr |= m_nFlagC ? SR_CARRY : 0;
+	sr |= (m_nFlagZN & 0xFF) == 0 ? SR_ZERO : 0;
+	sr |= m_nFlagV ? SR_OVERFLOW : 0;
+	sr |= (m_nFlagZN & 0x180) ? SR_NEGATIVE : 0;
+	return sr;
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::SetStatus(uint8_t sr) {
+	m_xRegs.sr = sr;
+	m_nFlagC = sr & SR_CARRY;
+	m_nFlagV = sr & SR_OVERFLOW;
+	// Bit 8 lets Z and N both be set, which no single result can do
+	m_nFlagZN = ((sr & SR_ZERO) ? 0 : 1) | ((sr & SR_NEGATIVE) ? 0x100 : 0);
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::SaveState(CPUState* pState) const {
+	pState->pc = m_xRegs.pc;
+	pState->ac = m_xRegs.ac;
+	pState->x = m_xRegs.x;
+	pState->y = m_xRegs.y;
+	pState->sr = this->GetStatus();
+	pState->sp = m_xRegs.sp;
+	pState->bJammed = m_bJammed;
+	pState->bInterruptPending = m_bInturruptPending;
+	pState->nInterruptType = static_cast<uint8_t>(m_eInterruptType);
+	pState->nTotalCycles = m_nTotalCycles;
+	pState->nInstructions = m_nInstructions;
+	pState->nIdleCycles = m_nIdleCycles;
+}
+
+template <typename Bus>
+void BasicCPU<Bus>::LoadState(const CPUState& xState) {
+	m_xRegs.pc = xState.pc;
+	m_xRegs.ac = xState.ac;
+	m_xRegs.x = xState.x;
+	m_xRegs.y = xState.y;
+	this->SetStatus(xState.sr);
+	m_xRegs.sp = xState.sp;
+	m_bJammed = xState.bJammed;
+	m_bStopped = m_bJammed;
+	m_bBreakpointHit = false;
+	m_bInturruptPending = xState.bInterruptPending;
+	m_eInterruptType = static_cast<InterruptType>(xState.nInterruptType);
+	m_nCycles = 0;
+	m_nTotalCycles = xState.nTotalCycles;
+	m_nInstructions = xState.nInstructions;
+	m_nIdleCycles = xState.nIdleCycles;
+	m_bBlockInvalidated = true;
 }
 
-void CPU::CheckIfPageBarrierCrossed(uint16_t pAddr1, uint16_t pAddr2) {
+template <typename Bus>
+void BasicCPU<Bus>::CheckIfPageBarrierCrossed(uint16_t pAddr1, uint16_t pAddr2) {
 	if ((pAddr1 & 0xFF00) != (pAddr2 & 0xFF00)) {
 		m_nCycles++;
 	}
 }
 
-void CPU::HandleInterrupt() {
-	int16_t addr;
+template <typename Bus>
+void BasicCPU<Bus>::HandleInterrupt() {
+	uint16_t addr;
 	switch (m_eInterruptType) {
 	case INT_IRQ:
+	case INT_SW:
 		addr = IRQ_ADDRESS;
+		break;
 	case INT_NMI:
 		addr = NMI_ADDRESS;
+		break;
 	case INT_RSI:
 		addr = RESET_ADDRESS;
-	case INT_SW:
-		addr = IRQ_ADDRESS;
+		break;
 	case INT_NONE: // Fall through
 	default:
-		throw std::runtime_error("No interrupt type set or invalid type!");
+		// Nothing valid to service, drop it rather than vector anywhere
+		m_bInturruptPending = false;
+		m_eInterruptType = INT_NONE;
+		return;
 	};
 
+	m_bInturruptPending = false;
 	m_eInterruptType = INT_NONE;
 
-	m_pMMU->PushAddress(&m_xRegs.sp, m_xRegs.pc);
+	m_pBus->PushAddress(&m_xRegs.sp, m_xRegs.pc);
+	m_pBus->Push(&m_xRegs.sp, (this->GetStatus() & ~SR_BREAK) | 1 << 5);
 	m_xRegs.sr |= SR_INTERRUPT;
-	m_pMMU->Push(&m_xRegs.sp, m_xRegs.sr);
-}
+
+	m_xRegs.pc = m_pBus->ReadAddress(addr);
+	m_nCycles += 7;
 }
 
+template class BasicCPU<MMU>;
+template class BasicCPU<CountingBus>;
+}
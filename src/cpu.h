@@ -1,10 +1,25 @@
 #ifndef CEE_PANE_CPU_H_
 #define CEE_PANE_CPU_H_
 
+#include <array>
+#include <bitset>
 #include <memory>
+#include <utility>
+#include <vector>
 #include <unistd.h>
 
 #include "mmu.h"
+#include "bus.h"
+#include "jit.h"
+#include "state.h"
+
+#define PANE_CPU_BLOCK_CACHE_SIZE         1024
+#define PANE_CPU_BLOCK_MAX_INSTRUCTIONS   16
+// Blocks are only cached once, code pages that keep getting written to are
+// run through the plain interpreter after this many invalidations.
+#define PANE_CPU_BLOCK_MAX_INVALIDATIONS  8
+// Executions of a block before it is translated to host code
+#define PANE_CPU_JIT_THRESHOLD            32
 
 namespace pane {
 
@@ -109,9 +124,9 @@ struct Instruction {
 	AddressMode am;
 };
 
-static const Instruction g_xInstructionLUT[256] = {
+static constexpr Instruction g_xInstructionLUT[256] = {
 	          /*       0x0                   0x1                   0x2                   0x3                   0x4                   0x5                   0x6                   0x7                   0x8                   0x9                   0xA                   0xB                   0xC                   0xD                   0xE                   0xF      */
-	/* 0x0 */ { OC_BRK,  AM_IMPL }, { OC_ORA,  AM_IND  }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_ORA,  AM_ZPG  }, { OC_ASL,  AM_ZPG  }, { OC_NONE, AM_NONE }, { OC_PHP,  AM_IMPL }, { OC_ORA,  AM_IMM  }, { OC_ASL,  AM_ACC  }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_ORA,  AM_ABS  }, { OC_ASL,  AM_ABS  }, { OC_NONE, AM_NONE },
+	/* 0x0 */ { OC_BRK,  AM_IMPL }, { OC_ORA,  AM_XIND }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_ORA,  AM_ZPG  }, { OC_ASL,  AM_ZPG  }, { OC_NONE, AM_NONE }, { OC_PHP,  AM_IMPL }, { OC_ORA,  AM_IMM  }, { OC_ASL,  AM_ACC  }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_ORA,  AM_ABS  }, { OC_ASL,  AM_ABS  }, { OC_NONE, AM_NONE },
 	/* 0x1 */ { OC_BPL,  AM_REL  }, { OC_ORA,  AM_INDY }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_ORA,  AM_ZPGX }, { OC_ASL,  AM_ZPGX }, { OC_NONE, AM_NONE }, { OC_CLC,  AM_IMPL }, { OC_ORA,  AM_ABSY }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_ORA,  AM_ABSX }, { OC_ASL,  AM_ABSX }, { OC_NONE, AM_NONE },
 	/* 0x2 */ { OC_JSR,  AM_ABS  }, { OC_AND,  AM_XIND }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_BIT , AM_ZPG  }, { OC_AND,  AM_ZPG  }, { OC_ROL,  AM_ZPG  }, { OC_NONE, AM_NONE }, { OC_PLP,  AM_IMPL }, { OC_AND,  AM_IMM  }, { OC_ROL,  AM_ACC  }, { OC_NONE, AM_NONE }, { OC_BIT,  AM_ABS  }, { OC_AND,  AM_ABS  }, { OC_ROL,  AM_ABS  }, { OC_NONE, AM_NONE },
 	/* 0x3 */ { OC_BMI,  AM_REL  }, { OC_AND,  AM_INDY }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_AND,  AM_ZPGX }, { OC_ROL,  AM_ZPGX }, { OC_NONE, AM_NONE }, { OC_SEC,  AM_IMPL }, { OC_AND,  AM_ABSY }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_AND,  AM_ABSX }, { OC_ROL,  AM_ABSX }, { OC_NONE, AM_NONE },
@@ -129,7 +144,7 @@ static const Instruction g_xInstructionLUT[256] = {
 	/* 0xF */ { OC_BEQ,  AM_REL  }, { OC_SBC,  AM_INDY }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_SBC,  AM_ZPGX }, { OC_INC,  AM_ZPGX }, { OC_NONE, AM_NONE }, { OC_SED,  AM_IMPL }, { OC_SBC,  AM_ABSY }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_NONE, AM_NONE }, { OC_SBC,  AM_ABSX }, { OC_INC,  AM_ABSX }, { OC_NONE, AM_NONE },
 };
 
-static const int32_t g_nCyclesLUT[256] {
+static constexpr int32_t g_nCyclesLUT[256] {
 	/*       0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F */
 	/* 0 */  7, 6, 0, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,
 	/* 1 */  2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
@@ -149,19 +164,120 @@ static const int32_t g_nCyclesLUT[256] {
 	/* F */  2, 5, 0, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7
 };
 
-class CPU {
+// Read instructions pay an extra cycle when indexing crosses a page, stores
+// and read-modify-write instructions always take the long path.
+static constexpr bool HasPageCrossPenalty(OpCode oc) {
+	switch (oc) {
+	case OC_STA:
+	case OC_ASL:
+	case OC_DEC:
+	case OC_INC:
+	case OC_LSR:
+	case OC_ROL:
+	case OC_ROR:
+		return false;
+	default:
+		return true;
+	}
+}
+
+// Opcode plus operand bytes
+static constexpr uint8_t GetInstructionLength(AddressMode am) {
+	switch (am) {
+	case AM_ABS:
+	case AM_ABSX:
+	case AM_ABSY:
+	case AM_IND:
+		return 3;
+	case AM_IMM:
+	case AM_XIND:
+	case AM_INDY:
+	case AM_REL:
+	case AM_ZPG:
+	case AM_ZPGX:
+	case AM_ZPGY:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+// The CPU is bound to its bus at compile time so memory accesses inline into
+// the instruction handlers. Production code uses CPU (bound to the MMU), any
+// other bus type needs an explicit instantiation at the bottom of cpu.cc.
+template <typename Bus>
+class BasicCPU {
 public:
-	CPU();
-	~CPU();
+	BasicCPU();
+	~BasicCPU();
 
-	void SetMMU(std::shared_ptr<MMU> pMMU);
+	void SetBus(Bus* pBus);
 
 	void Start();
-	void Execute();
+	// Runs whole instructions until at least nBudget cycles have elapsed and
+	// returns how many cycles the last instruction overshot the budget by.
+	// Returns early (negative) if the CPU jams, hits a breakpoint or is asked
+	// to stop, IsStopped() tells these apart from a finished budget.
+	int32_t RunCycles(int32_t nBudget);
+
+	// Ends the current RunCycles after the instruction in flight. Meant for
+	// bus handlers, not thread safe.
+	void RequestStop();
+	bool IsStopped() const { return m_bStopped; }
+	// Returns from RunCycles early without stopping, for devices that
+	// scheduled an event the running budget didn't account for
+	void EndRun();
+	// Illegal opcodes halt the CPU with pc on the opcode until Start.
+	bool IsJammed() const { return m_bJammed; }
+
+	// Execution stops before an instruction at a breakpoint, the next
+	// RunCycles resumes past it. Blocks are bypassed while any are set.
+	void SetBreakpoint(uint16_t pAddress, bool bEnabled);
+	void ClearBreakpoints();
+	bool IsAtBreakpoint() const { return m_bBreakpointHit; }
 
 	void Interrupt(InterruptType t);
+	// Drops a pending interrupt of type t that hasn't been taken yet, for
+	// devices acknowledging their IRQ
+	void CancelInterrupt(InterruptType t);
 	void Reset();
 
+	// Predecoded basic blocks, keyed by PC and the host page (bank) backing it.
+	void SetBlockCacheEnabled(bool bEnabled);
+	bool IsBlockCacheEnabled() const { return m_pBlocks != nullptr; }
+	void FlushBlockCache();
+	uint64_t GetBlockCacheHits() const { return m_nBlockHits; }
+	uint64_t GetBlockCacheMisses() const { return m_nBlockMisses; }
+
+	// Fast-forwards side-effect-free polling loops (LDA $2002 / BPL, JMP *)
+	// to the end of the budget. Needs the block cache, on by default.
+	void SetIdleLoopSkipEnabled(bool bEnabled) { m_bIdleLoopSkip = bEnabled; }
+	bool IsIdleLoopSkipEnabled() const { return m_bIdleLoopSkip; }
+	uint64_t GetIdleCycles() const { return m_nIdleCycles; }
+
+	// Translates hot blocks to x86-64, the interpreter stays the reference
+	// and runs everything the translator doesn't handle. Enabling the JIT
+	// enables the block cache.
+	void SetJITEnabled(bool bEnabled);
+	bool IsJITEnabled() const { return m_pCode != nullptr; }
+	void SetJITPerfMapEnabled(bool bEnabled);
+	uint64_t GetJITBlockCount() const { return m_nCompiledBlocks; }
+
+	// Processor status with the lazily tracked flags folded in.
+	uint8_t GetStatus() const;
+	void SetStatus(uint8_t sr);
+
+	uint64_t GetInstructionCount() const { return m_nInstructions; }
+	uint64_t GetTotalCycles() const { return m_nTotalCycles; }
+	// Cycle count including the instruction in flight, for components that
+	// need to know the current time from inside a bus access.
+	uint64_t GetCycleCount() const { return m_nTotalCycles + m_nCycles; }
+
+	// Only valid between RunCycles calls. Loading keeps the block cache, the
+	// bus has to report code that changed with the state (MMU::LoadMemory).
+	void SaveState(CPUState* pState) const;
+	void LoadState(const CPUState& xState);
+
 private:
 	void ADC();
 	void AND();
@@ -224,7 +340,10 @@ private:
 	void TXS();
 	void TYA();
 
-	void GetOperandAddress();
+	void TakeBranch();
+
+	template <AddressMode am, bool bPageCrossPenalty, bool bPredecoded>
+	void GetOperandAddress(uint16_t nOperand);
 	void CheckAndSetZNFlags(int8_t val);
 	void CheckAndSetOverflowFlag(int16_t result, int8_t lhs, int8_t rhs);
 	void CheckAndSetCarryFlag(int16_t result);
@@ -232,29 +351,120 @@ private:
 
 	void HandleInterrupt();
 
+private:
+	// One handler per opcode, each specialized at compile time for its
+	// operation, addressing mode, base cycle count and page-cross penalty.
+	// Predecoded handlers take their operand bytes from the block cache
+	// instead of fetching them through the bus.
+	typedef void (*Handler)(BasicCPU* pCPU, uint16_t nOperand);
+
+	template <uint8_t nOpCode, bool bPredecoded>
+	static void Dispatch(BasicCPU* pCPU, uint16_t nOperand);
+	template <bool bPredecoded, size_t... nOpCodes>
+	static constexpr std::array<Handler, 256> MakeHandlerTable(std::index_sequence<nOpCodes...>);
+
+	static const std::array<Handler, 256> s_pHandlers;
+	static const std::array<Handler, 256> s_pPredecodedHandlers;
+
+	struct DecodedInstruction {
+		Handler fnHandler;
+		uint16_t nOperand;
+		uint8_t nLength;
+		uint8_t nOpCode;
+	};
+
+	typedef void (*CompiledBlock)(BasicCPU* pCPU);
+
+	struct Block {
+		const uint8_t* pPage;
+		uint16_t pStart;
+		uint8_t nCount;
+		// Base cycles of the whole block plus worst case penalties
+		int32_t nMaxCycles;
+		// Cycles per iteration if the block is a polling loop, otherwise 0
+		int32_t nIdleCycles;
+		uint32_t nExecutions;
+		CompiledBlock fnCompiled;
+		DecodedInstruction pInstructions[PANE_CPU_BLOCK_MAX_INSTRUCTIONS];
+	};
+
+	bool RunBlock(int32_t nBudget);
+	Block* DecodeBlock(uint16_t pStart);
+	static void OnCodeWrite(void* pUserData, const uint8_t* pPage);
+	void SkipIdleLoop(Block* pBlock, int32_t nBudget);
+	int32_t GetIdleLoopCycles(const Block* pBlock) const;
+
+	// Block translator, see cpu.cc
+	void CompileBlock(Block* pBlock);
+	void ResetCompiledBlocks();
+	int32_t GetMemberOffset(const void* pMember) const;
+	void EmitFlush(int32_t& nCycles, int32_t& nInstructions);
+	void EmitSetZN();
+	void EmitExitCheck(std::vector<size_t>& vExits);
+	void EmitRead(uint16_t pAddress);
+	void EmitWrite(uint16_t pAddress, std::vector<size_t>& vExits);
+	static uint8_t JITRead(BasicCPU* pCPU, uint16_t pAddress);
+	static void JITWrite(BasicCPU* pCPU, uint16_t pAddress, uint8_t cVal);
+
 private:
 	// Hardaware
 	struct Registers {
 		uint16_t pc;
 		uint8_t ac, y, x;
 		uint8_t sr, sp;
-	} m_xRegs;
+	};
 
-	std::shared_ptr<MMU> m_pMMU;
+	// Everything touched per instruction shares the first cache line.
+	alignas(64) Registers m_xRegs;
+	// C, Z, N and V live outside m_xRegs.sr and are only folded into it by
+	// GetStatus. Z is set when the low byte of m_nFlagZN is zero, N when
+	// bit 7 or 8 is set. C and V are set when non-zero.
+	uint16_t m_nFlagZN;
+	uint8_t m_nFlagC;
+	uint8_t m_nFlagV;
+	Bus* m_pBus;
+	int32_t m_nCycles;
+	bool m_bStopped;
+	bool m_bRunEnded;
+	bool m_bJammed;
+	uint16_t m_pOperandAddress;
+	uint8_t m_nOpCode;
+	uint64_t m_nInstructions;
 
 	// Timing
-	uint32_t m_nCycles;
-	uint32_t m_nTotalCycles;
+	uint64_t m_nTotalCycles;
 
 	// Interrupt
 	bool m_bInturruptPending;
 	InterruptType m_eInterruptType;
 
-	// State
-	uint8_t m_nOpCode;
-	Instruction m_xInstruction;
-	uint16_t m_pOperandAddress;
+	// Block cache
+	std::unique_ptr<Block[]> m_pBlocks;
+	bool m_bBlockInvalidated;
+	uint8_t m_pPageInvalidations[256];
+	uint64_t m_nBlockHits;
+	uint64_t m_nBlockMisses;
+
+	// Debugging
+	std::bitset<0x10000> m_xBreakpoints;
+	uint32_t m_nBreakpoints;
+	bool m_bBreakpointHit;
+
+	// Idle loops
+	bool m_bIdleLoopSkip;
+	uint64_t m_nIdleCycles;
+	// Last pass of a candidate loop, the one after it must see the same
+	const Block* m_pIdleBlock;
+	uint64_t m_nIdleInstructions;
+	Registers m_xIdleRegs;
+	uint8_t m_nIdleStatus;
+
+	// JIT
+	std::unique_ptr<CodeBuffer> m_pCode;
+	uint64_t m_nCompiledBlocks;
 };
+
+typedef BasicCPU<MMU> CPU;
 }
 
 #endif
@@ -1,12 +1,33 @@
 #include "emulator.h"
 #include "event.h"
+#include "hash.h"
 
+#include <algorithm>
 #include <chrono>
+#include <stdexcept>
 #include <vector>
 #include <random>
 
+#include <cstring>
+
 namespace pane {
-Emulator::Emulator() {
+static const struct {
+	int nKey;
+	uint8_t nButton;
+} g_pKeyMap[] = {
+	{ GLFW_KEY_X, BUTTON_A },
+	{ GLFW_KEY_Z, BUTTON_B },
+	{ GLFW_KEY_RIGHT_SHIFT, BUTTON_SELECT },
+	{ GLFW_KEY_ENTER, BUTTON_START },
+	{ GLFW_KEY_UP, BUTTON_UP },
+	{ GLFW_KEY_DOWN, BUTTON_DOWN },
+	{ GLFW_KEY_LEFT, BUTTON_LEFT },
+	{ GLFW_KEY_RIGHT, BUTTON_RIGHT }
+};
+
+Emulator::Emulator()
+ : m_eMovieMode(MOVIE_MODE_NONE), m_nMovieStart(0), m_nKeyframeInterval(PANE_KEYFRAME_DEFAULT_INTERVAL), m_nSeekFrame(0), m_xSeekStats{ 0, 0, 0.0 }, m_bHeadless(false), m_bRewinding(false), m_nRunAhead(0), m_nButtons(0)
+{
 
 }
 
@@ -14,16 +35,15 @@ Emulator::~Emulator() {
 
 }
 
-void Emulator::Init() {
-	m_pMMU = std::make_shared<MMU>();
-	m_pCPU = std::make_shared<CPU>();
-	m_pPPU = std::make_shared<PPU>();
+void Emulator::Init(bool bHeadless) {
+	m_bHeadless = bHeadless;
 
-	m_pMMU->Init();
+	m_pMachine = std::make_shared<Machine>();
+	m_pMachine->Init();
 
-	m_pCPU->SetMMU(m_pMMU);
-	m_pPPU->SetMMU(m_pMMU);
-	m_pPPU->SetCPU(m_pCPU);
+	if (m_bHeadless) {
+		return;
+	}
 
 	m_pWindow = std::make_shared<Window>();
 	m_pWindow->Init(1280, 720, "pane");
@@ -33,40 +53,244 @@ void Emulator::Init() {
 }
 
 void Emulator::Shutdown() {
-	m_pRenderer->Shutdown();
-	m_pRenderer.reset();
-	m_pWindow->Shutdown();
-	m_pWindow.reset();
+	if (m_pRenderer) {
+		m_pRenderer->Shutdown();
+		m_pRenderer.reset();
+	}
+	if (m_pWindow) {
+		m_pWindow->Shutdown();
+		m_pWindow.reset();
+	}
+
+	m_pMachine->Shutdown();
+	m_pMachine.reset();
+}
+	
+void Emulator::SetRewindEnabled(bool bEnabled, size_t nBudget, uint32_t nInterval) {
+	if (bEnabled) {
+		m_pRewind = std::make_unique<RewindBuffer>(nBudget, nInterval);
+	} else {
+		m_pRewind.reset();
+	}
+}
 
-	m_pPPU.reset();
-	m_pCPU->Reset();
-	m_pCPU.reset();
+void Emulator::LoadROM(const std::string& sPath) {
+	std::shared_ptr<Cartridge> pCartridge = std::make_shared<Cartridge>();
+	pCartridge->Load(sPath);
+	m_pMachine->InsertCartridge(pCartridge);
+	m_pCartridge = pCartridge;
+}
 
-	m_pMMU->Shutdown();
+uint64_t Emulator::GetROMHash() const {
+	// Movies recorded without a cartridge all share the hash of nothing
+	return m_pCartridge ? m_pCartridge->GetHash() : HashBytes(nullptr, 0);
+}
 
-	m_pMMU.reset();
+void Emulator::RecordMovie(const std::string& sPath) {
+	m_pMovie = std::make_unique<Movie>();
+	m_sMoviePath = sPath;
+	m_eMovieMode = MOVIE_MODE_RECORD;
 }
-	
+
+void Emulator::PlayMovie(const std::string& sPath) {
+	std::unique_ptr<Movie> pMovie = std::make_unique<Movie>();
+	pMovie->Load(sPath);
+	if (pMovie->GetROMHash() != this->GetROMHash()) {
+		throw std::runtime_error("Movie was recorded on a different ROM!");
+	}
+	m_pMovie = std::move(pMovie);
+	m_sMoviePath = sPath;
+	m_eMovieMode = MOVIE_MODE_PLAY;
+}
+
+bool Emulator::VerifyMovie() {
+	if (m_eMovieMode != MOVIE_MODE_PLAY || this->GetMovieFrame() != m_pMovie->GetFrameCount()) {
+		throw std::runtime_error("Movie has not been played to the end!");
+	}
+	if (!m_pMovie->HasEndHash()) {
+		throw std::runtime_error("Movie has no end state to verify!");
+	}
+	return m_pMachine->GetStateHash() == m_pMovie->GetEndHash();
+}
+
+VerifyResult Emulator::VerifyMovieSegments(size_t nThreads) {
+	if (m_eMovieMode != MOVIE_MODE_PLAY) {
+		throw std::runtime_error("No movie to verify!");
+	}
+
+	KeyframeIndex xIndex;
+	bool bIndexed = xIndex.Open(m_sMoviePath + PANE_KEYFRAME_SUFFIX, this->GetROMHash());
+	MovieVerifier xVerifier(nThreads);
+	// Workers share the cartridge image and run the CPU the way this machine
+	// does
+	bool bJIT = m_pMachine->GetCPU()->IsJITEnabled();
+	std::shared_ptr<const Cartridge> pCartridge = m_pCartridge;
+	return xVerifier.Verify(*m_pMovie, bIndexed ? &xIndex : nullptr, [bJIT, pCartridge](Machine& xMachine) {
+		if (pCartridge) {
+			xMachine.InsertCartridge(pCartridge);
+		}
+		xMachine.GetCPU()->SetJITEnabled(bJIT);
+	});
+}
+
+void Emulator::StartMovie() {
+	if (m_eMovieMode == MOVIE_MODE_NONE) {
+		return;
+	}
+
+	if (m_eMovieMode == MOVIE_MODE_RECORD) {
+		m_pMovie->Reset(this->GetROMHash());
+	} else if (m_pMovie->GetStartState() != nullptr) {
+		m_pMachine->LoadState(*m_pMovie->GetStartState());
+	}
+	m_nMovieStart = m_pMachine->GetPPU()->GetFrameCount();
+
+	// A new recording makes an old index useless
+	std::string sIndex = m_sMoviePath + PANE_KEYFRAME_SUFFIX;
+	bool bIndexed = m_eMovieMode == MOVIE_MODE_PLAY && m_xKeyframes.Open(sIndex, this->GetROMHash());
+	if (m_nKeyframeInterval > 0) {
+		m_pKeyframeWriter = std::make_unique<KeyframeWriter>();
+		m_pKeyframeWriter->Open(sIndex, this->GetROMHash(), bIndexed);
+	}
+	if (m_eMovieMode == MOVIE_MODE_PLAY && m_nSeekFrame > 0) {
+		this->SeekMovie();
+	}
+}
+
+void Emulator::SeekMovie() {
+	auto tStart = std::chrono::steady_clock::now();
+	uint64_t nTarget = std::min(m_nSeekFrame, m_pMovie->GetFrameCount());
+	const KeyframeEntry* pKeyframe = m_xKeyframes.Find(*m_pMovie, nTarget);
+	if (pKeyframe != nullptr) {
+		m_pMachine->LoadState(pKeyframe->xState);
+	}
+
+	// Plain frames, no run-ahead or rewind
+	m_xSeekStats.nKeyframe = this->GetMovieFrame();
+	while (this->GetMovieFrame() < nTarget) {
+		this->SetInput();
+		if (m_pMachine->RunFrame() != STOP_FRAME) {
+			break;
+		}
+	}
+	m_xSeekStats.nFrame = this->GetMovieFrame();
+	m_xSeekStats.nSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+}
+
+void Emulator::FinishMovie() {
+	if (m_pKeyframeWriter) {
+		m_pKeyframeWriter->Close();
+		m_pKeyframeWriter.reset();
+	}
+	m_xKeyframes.Close();
+	if (m_eMovieMode == MOVIE_MODE_RECORD) {
+		m_pMovie->SetEndHash(m_pMachine->GetStateHash());
+		m_pMovie->Save(m_sMoviePath);
+	}
+}
+
 void Emulator::Run() {
-	m_pCPU->Start();
+	m_pMachine->Start();
+	this->StartMovie();
+	if (m_pRewind) {
+		m_pRewind->Clear();
+	}
 	std::shared_ptr<Event> e;
 	while (!m_pWindow->ShouldClose()) {
-		while (!m_pPPU->ShouldRender()) {
-			m_pPPU->Execute();
-			m_pPPU->Execute();
-			m_pPPU->Execute();
-			m_pCPU->Execute();
+		// Input first so the frame about to run sees it
+		while ((e = m_pWindow->PollEvents()).get() != nullptr) {
+			if (e->GetType() == EventType::EVENT_TYPE_KEYBOARD_KEY_DOWN) {
+				this->HandleKey(std::static_pointer_cast<KeyDownEvent>(e)->GetKeycode(), true);
+			} else if (e->GetType() == EventType::EVENT_TYPE_KEYBOARD_KEY_UP) {
+				this->HandleKey(std::static_pointer_cast<KeyUpEvent>(e)->GetKeycode(), false);
+			}
 		}
 
-		m_pRenderer->UpdateImage(m_pPPU->GetPixels());
+		// Holds on the oldest frame once history runs out
+		if (m_bRewinding && m_pRewind) {
+			m_pRewind->StepBack(*m_pMachine);
+		} else {
+			this->StepFrame();
+		}
+
+		m_pRenderer->UpdateImage(m_pMachine->GetPixels());
 		m_pRenderer->RenderFrame();
 		m_pWindow->SwapBuffers();
-		m_pPPU->Rendered();
+	}
+	this->FinishMovie();
+}
 
-		while ((e = m_pWindow->PollEvents()).get() != nullptr) {
-			// Handle event
+void Emulator::SetInput() {
+	uint8_t pButtons[PANE_CONTROLLER_PORTS] = { m_nButtons, 0 };
+	if (m_eMovieMode != MOVIE_MODE_NONE) {
+		// Indexed by the machine's frame so rewinding seeks in the movie too
+		uint64_t nFrame = this->GetMovieFrame();
+		if (m_pKeyframeWriter && nFrame % m_nKeyframeInterval == 0 && nFrame <= m_pMovie->GetFrameCount()) {
+			uint64_t nInputHash = m_pMovie->GetInputHash(nFrame);
+			if (!m_xKeyframes.Contains(nFrame, nInputHash)) {
+				m_pKeyframeWriter->Append(nFrame, nInputHash, m_pMachine->SyncState());
+			}
+		}
+
+		if (m_eMovieMode == MOVIE_MODE_PLAY && nFrame < m_pMovie->GetFrameCount()) {
+			std::memcpy(pButtons, m_pMovie->GetButtons(nFrame), PANE_CONTROLLER_PORTS);
+		} else if (m_eMovieMode == MOVIE_MODE_RECORD) {
+			m_pMovie->SetFrame(nFrame, pButtons);
 		}
 	}
+	for (uint8_t i = 0; i < PANE_CONTROLLER_PORTS; i++) {
+		m_pMachine->GetControllers()->SetButtons(i, pButtons[i]);
+	}
+}
+
+StopReason Emulator::StepFrame() {
+	this->SetInput();
+	StopReason eStopReason = m_pMachine->RunFrameAhead(m_nRunAhead);
+	if (eStopReason == STOP_FRAME && m_eMovieMode == MOVIE_MODE_RECORD) {
+		m_pMovie->SetFrameHash(this->GetMovieFrame() - 1, m_pMachine->GetStateHash());
+	}
+	if (eStopReason == STOP_FRAME && m_pRewind) {
+		m_pRewind->Record(*m_pMachine);
+	}
+	return eStopReason;
+}
+
+void Emulator::HandleKey(uint32_t nKeycode, bool bPressed) {
+	if (nKeycode == GLFW_KEY_BACKSPACE) {
+		m_bRewinding = bPressed;
+		return;
+	}
+	for (const auto& xKey : g_pKeyMap) {
+		if (static_cast<uint32_t>(xKey.nKey) == nKeycode) {
+			m_nButtons = bPressed ? (m_nButtons | xKey.nButton) : (m_nButtons & ~xKey.nButton);
+		}
+	}
+}
+
+RunStats Emulator::RunHeadless(uint64_t nFrames) {
+	RunStats xStats = { 0, 0.0, 0, STOP_FRAME };
+
+	m_pMachine->Start();
+	this->StartMovie();
+	if (m_pRewind) {
+		m_pRewind->Clear();
+	}
+	bool bToMovieEnd = nFrames == 0 && m_eMovieMode == MOVIE_MODE_PLAY;
+	auto tStart = std::chrono::steady_clock::now();
+	while (bToMovieEnd ? this->GetMovieFrame() < m_pMovie->GetFrameCount() : (nFrames == 0 || xStats.nFrames < nFrames)) {
+		StopReason eStopReason = this->StepFrame();
+		if (eStopReason != STOP_FRAME) {
+			xStats.eStopReason = eStopReason;
+			break;
+		}
+		xStats.nFrames++;
+		xStats.nIdleCycles += m_pMachine->GetIdleCycles();
+	}
+	auto tEnd = std::chrono::steady_clock::now();
+
+	xStats.nSeconds = std::chrono::duration<double>(tEnd - tStart).count();
+	this->FinishMovie();
+	return xStats;
 }
 }
 
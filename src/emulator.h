@@ -2,31 +2,140 @@
 #define CEE_PANE_EMULATOR_H_
 
 #include <memory>
+#include <string>
 
-#include "mmu.h"
-#include "cpu.h"
-#include "ppu.h"
+#include <cstdint>
+
+#include "machine.h"
+#include "rewind.h"
+#include "movie.h"
+#include "keyframes.h"
+#include "verifier.h"
 #include "window.h"
 #include "renderer.h"
 
 namespace pane {
+struct RunStats {
+	uint64_t nFrames;
+	double nSeconds;
+	uint64_t nIdleCycles;
+	// STOP_FRAME if every requested frame ran
+	StopReason eStopReason;
+
+	double GetFramesPerSecond() const { return nSeconds > 0.0 ? nFrames / nSeconds : 0.0; }
+};
+
+struct SeekStats {
+	// Movie frame restored from a keyframe, 0 if none could be used
+	uint64_t nKeyframe;
+	// Movie frame reached
+	uint64_t nFrame;
+	double nSeconds;
+};
+
+enum MovieMode {
+	MOVIE_MODE_NONE = 0,
+	MOVIE_MODE_RECORD,
+	MOVIE_MODE_PLAY
+};
+
 class Emulator {
 public:
 	Emulator();
 	~Emulator();
 
-	void Init();
+	// Headless emulators never create a window or GL context and run the core
+	// uncapped, no vsync.
+	void Init(bool bHeadless = false);
 	void Shutdown();
 	
 	void Run();
+	// Runs nFrames frames (0 runs until the machine stops) as fast as the
+	// host allows.
+	RunStats RunHeadless(uint64_t nFrames);
+
+	bool IsHeadless() const { return m_bHeadless; }
+
+	// Inserts an iNES or NES 2.0 image into the machine, before running or
+	// any movie. Throws if it can't be loaded or its board isn't supported.
+	void LoadROM(const std::string& sPath);
+
+	// Records every nInterval-th frame, holding backspace in the window steps
+	// back through them.
+	void SetRewindEnabled(bool bEnabled, size_t nBudget = PANE_REWIND_DEFAULT_BUDGET, uint32_t nInterval = 1);
+	const RewindBuffer* GetRewindBuffer() const { return m_pRewind.get(); }
+
+	// Frames run ahead of the one presented, see Machine::RunFrameAhead.
+	// Each costs one extra emulated frame per host frame.
+	void SetRunAhead(uint32_t nFrames) { m_nRunAhead = nFrames; }
+	uint32_t GetRunAhead() const { return m_nRunAhead; }
+
+	// Records the buttons of every frame from the next run on, written to
+	// sPath when the run returns.
+	void RecordMovie(const std::string& sPath);
+	// Replays a movie from the next run on in place of the keyboard, live
+	// input takes over after its last frame. RunHeadless(0) stops there.
+	// Throws if the movie can't be read or was recorded on another ROM.
+	void PlayMovie(const std::string& sPath);
+	// Whether a movie played to its end left the machine in the state it was
+	// recorded in. Throws if it hasn't been played to the end or has no end
+	// state to compare with.
+	bool VerifyMovie();
+	// While a movie records or plays, saves the state every nInterval-th
+	// movie frame to the movie path plus PANE_KEYFRAME_SUFFIX, 0 turns it
+	// off. Replays add keyframes the index lacks.
+	void SetKeyframeInterval(uint32_t nInterval) { m_nKeyframeInterval = nInterval; }
+	// Starts the next playback at movie frame nFrame, restored from the
+	// latest usable keyframe before it so only the rest is emulated.
+	void SetMovieSeek(uint64_t nFrame) { m_nSeekFrame = nFrame; }
+	const SeekStats& GetSeekStats() const { return m_xSeekStats; }
+	// Checks the movie given to PlayMovie replays as recorded, cut at its
+	// keyframes and spread over nThreads threads (0 for all), see
+	// MovieVerifier. Independent of Run and RunHeadless.
+	VerifyResult VerifyMovieSegments(size_t nThreads = 0);
+	MovieMode GetMovieMode() const { return m_eMovieMode; }
+	const Movie* GetMovie() const { return m_pMovie.get(); }
+	// Frames into the movie the machine is
+	uint64_t GetMovieFrame() const { return m_pMachine->GetPPU()->GetFrameCount() - m_nMovieStart; }
+
+	// Identifies the cartridge for movies
+	uint64_t GetROMHash() const;
+
+	std::shared_ptr<Machine> GetMachine() const { return m_pMachine; }
+
+private:
+	// Real frame plus run-ahead and rewind recording
+	StopReason StepFrame();
+	void HandleKey(uint32_t nKeycode, bool bPressed);
+	// Buttons from the movie or the keyboard, records and saves keyframes
+	void SetInput();
+	// Around every run, right after Machine::Start and before returning
+	void StartMovie();
+	void FinishMovie();
+	void SeekMovie();
 
 private:
-	std::shared_ptr<MMU> m_pMMU;
-	std::shared_ptr<CPU> m_pCPU;
-	std::shared_ptr<PPU> m_pPPU;
+	std::shared_ptr<Machine> m_pMachine;
 
 	std::shared_ptr<Window> m_pWindow;
 	std::unique_ptr<Renderer> m_pRenderer;
+	std::unique_ptr<RewindBuffer> m_pRewind;
+	std::unique_ptr<Movie> m_pMovie;
+	std::string m_sMoviePath;
+	MovieMode m_eMovieMode;
+	// PPU frame count at frame 0 of the movie
+	uint64_t m_nMovieStart;
+	std::unique_ptr<KeyframeWriter> m_pKeyframeWriter;
+	KeyframeIndex m_xKeyframes;
+	uint32_t m_nKeyframeInterval;
+	uint64_t m_nSeekFrame;
+	SeekStats m_xSeekStats;
+	std::shared_ptr<Cartridge> m_pCartridge;
+
+	bool m_bHeadless;
+	bool m_bRewinding;
+	uint32_t m_nRunAhead;
+	uint8_t m_nButtons;
 };
 }
 
@@ -0,0 +1,32 @@
+#ifndef CEE_PANE_HASH_H_
+#define CEE_PANE_HASH_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#define PANE_HASH_SEED   0xCBF29CE484222325ULL
+#define PANE_HASH_PRIME  0x00000100000001B3ULL
+
+namespace pane {
+// FNV-1a over 64-bit words with a shift to fold the high bits back down.
+// Every step is invertible, so changing any one word always changes the
+// hash. Cheap enough to hash a whole MachineState every frame, not meant
+// to resist anyone crafting collisions.
+inline uint64_t HashBytes(const void* pData, size_t nSize, uint64_t nHash = PANE_HASH_SEED) {
+	const uint8_t* pBytes = reinterpret_cast<const uint8_t*>(pData);
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= nSize; i += sizeof(uint64_t)) {
+		uint64_t nWord;
+		std::memcpy(&nWord, pBytes + i, sizeof(nWord));
+		nHash = (nHash ^ nWord) * PANE_HASH_PRIME;
+		nHash ^= nHash >> 29;
+	}
+	for (; i < nSize; i++) {
+		nHash = (nHash ^ pBytes[i]) * PANE_HASH_PRIME;
+	}
+	return nHash ^ (nHash >> 32);
+}
+}
+
+#endif
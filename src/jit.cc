@@ -0,0 +1,324 @@
+#include "jit.h"
+
+#include <stdexcept>
+
+#include <cstring>
+
+#ifdef PANE_JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace pane {
+CodeBuffer::CodeBuffer()
+ : m_pCode(nullptr), m_nSize(0), m_nPosition(0), m_nFunctionStart(0), m_pPerfMap(nullptr)
+{
+
+}
+
+CodeBuffer::~CodeBuffer() {
+	if (m_pPerfMap != nullptr) {
+		std::fclose(m_pPerfMap);
+	}
+#ifdef PANE_JIT_SUPPORTED
+	if (m_pCode != nullptr) {
+		munmap(m_pCode, m_nSize);
+	}
+#endif
+}
+
+void CodeBuffer::Init(size_t nSize) {
+#ifdef PANE_JIT_SUPPORTED
+	void* pCode = mmap(nullptr, nSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pCode == MAP_FAILED) {
+		throw std::runtime_error("Failed to map JIT code buffer!");
+	}
+	m_pCode = reinterpret_cast<uint8_t*>(pCode);
+	m_nSize = nSize;
+	m_nPosition = 0;
+#else
+	throw std::runtime_error("JIT is not supported on this platform!");
+#endif
+}
+
+void CodeBuffer::Reset() {
+	m_nPosition = 0;
+	m_nFunctionStart = 0;
+}
+
+void CodeBuffer::SetPerfMapEnabled(bool bEnabled) {
+	if (bEnabled && m_pPerfMap == nullptr) {
+#ifdef PANE_JIT_SUPPORTED
+		char sPath[64];
+		std::snprintf(sPath, sizeof(sPath), "/tmp/perf-%d.map", static_cast<int>(getpid()));
+		// Every CPU in the process shares the file, so append
+		m_pPerfMap = std::fopen(sPath, "a");
+		if (m_pPerfMap == nullptr) {
+			throw std::runtime_error("Failed to open perf map!");
+		}
+#endif
+	} else if (!bEnabled && m_pPerfMap != nullptr) {
+		std::fclose(m_pPerfMap);
+		m_pPerfMap = nullptr;
+	}
+}
+
+void CodeBuffer::BeginFunction() {
+	m_nFunctionStart = m_nPosition;
+}
+
+void* CodeBuffer::EndFunction(const char* sName) {
+	uint8_t* pEntry = m_pCode + m_nFunctionStart;
+	if (m_pPerfMap != nullptr) {
+		std::fprintf(m_pPerfMap, "%lx %zx %s\n", reinterpret_cast<unsigned long>(pEntry), m_nPosition - m_nFunctionStart, sName);
+		std::fflush(m_pPerfMap);
+	}
+	return pEntry;
+}
+
+void CodeBuffer::Emit8(uint8_t nVal) {
+	m_pCode[m_nPosition++] = nVal;
+}
+
+void CodeBuffer::Emit16(uint16_t nVal) {
+	std::memcpy(m_pCode + m_nPosition, &nVal, sizeof(nVal));
+	m_nPosition += sizeof(nVal);
+}
+
+void CodeBuffer::Emit32(uint32_t nVal) {
+	std::memcpy(m_pCode + m_nPosition, &nVal, sizeof(nVal));
+	m_nPosition += sizeof(nVal);
+}
+
+void CodeBuffer::Emit64(uint64_t nVal) {
+	std::memcpy(m_pCode + m_nPosition, &nVal, sizeof(nVal));
+	m_nPosition += sizeof(nVal);
+}
+
+void CodeBuffer::EmitRBXOperand(uint8_t nReg, int32_t nDisp) {
+	// mod=10 (disp32), rm=rbx
+	this->Emit8(0x80 | (nReg << 3) | X64_RBX);
+	this->Emit32(static_cast<uint32_t>(nDisp));
+}
+
+void CodeBuffer::Push(X64Register eReg) {
+	this->Emit8(0x50 + eReg);
+}
+
+void CodeBuffer::Pop(X64Register eReg) {
+	this->Emit8(0x58 + eReg);
+}
+
+void CodeBuffer::Ret() {
+	this->Emit8(0xC3);
+}
+
+void CodeBuffer::MovRegReg64(X64Register eDst, X64Register eSrc) {
+	this->Emit8(0x48);
+	this->Emit8(0x89);
+	this->Emit8(0xC0 | (eSrc << 3) | eDst);
+}
+
+void CodeBuffer::MovRegImm32(X64Register eDst, uint32_t nVal) {
+	this->Emit8(0xB8 + eDst);
+	this->Emit32(nVal);
+}
+
+void CodeBuffer::MovRegImm64(X64Register eDst, uint64_t nVal) {
+	this->Emit8(0x48);
+	this->Emit8(0xB8 + eDst);
+	this->Emit64(nVal);
+}
+
+void CodeBuffer::LoadPointer(X64Register eDst, X64Register eBase) {
+	if (eBase == X64_RSP || eBase == X64_RBP) {
+		throw std::runtime_error("Unsupported base register!");
+	}
+	this->Emit8(0x48);
+	this->Emit8(0x8B);
+	this->Emit8((eDst << 3) | eBase);
+}
+
+void CodeBuffer::TestRegReg64(X64Register eLhs, X64Register eRhs) {
+	this->Emit8(0x48);
+	this->Emit8(0x85);
+	this->Emit8(0xC0 | (eRhs << 3) | eLhs);
+}
+
+void CodeBuffer::CallRegister(X64Register eReg) {
+	this->Emit8(0xFF);
+	this->Emit8(0xD0 | eReg);
+}
+
+void CodeBuffer::ZeroExtendByte(X64Register eDst, X64ByteRegister eSrc) {
+	this->Emit8(0x0F);
+	this->Emit8(0xB6);
+	this->Emit8(0xC0 | (eDst << 3) | eSrc);
+}
+
+void CodeBuffer::LoadByte(X64Register eDst, int32_t nDisp) {
+	this->Emit8(0x0F);
+	this->Emit8(0xB6);
+	this->EmitRBXOperand(eDst, nDisp);
+}
+
+void CodeBuffer::StoreByte(int32_t nDisp, X64ByteRegister eSrc) {
+	this->Emit8(0x88);
+	this->EmitRBXOperand(eSrc, nDisp);
+}
+
+void CodeBuffer::StoreWord(int32_t nDisp, X64Register eSrc) {
+	this->Emit8(0x66);
+	this->Emit8(0x89);
+	this->EmitRBXOperand(eSrc, nDisp);
+}
+
+void CodeBuffer::StoreImm8(int32_t nDisp, uint8_t nVal) {
+	this->Emit8(0xC6);
+	this->EmitRBXOperand(0, nDisp);
+	this->Emit8(nVal);
+}
+
+void CodeBuffer::StoreImm16(int32_t nDisp, uint16_t nVal) {
+	this->Emit8(0x66);
+	this->Emit8(0xC7);
+	this->EmitRBXOperand(0, nDisp);
+	this->Emit16(nVal);
+}
+
+void CodeBuffer::AddImm32(int32_t nDisp, int32_t nVal) {
+	this->Emit8(0x81);
+	this->EmitRBXOperand(0, nDisp);
+	this->Emit32(static_cast<uint32_t>(nVal));
+}
+
+void CodeBuffer::AddImm64(int32_t nDisp, int32_t nVal) {
+	this->Emit8(0x48);
+	this->Emit8(0x81);
+	this->EmitRBXOperand(0, nDisp);
+	this->Emit32(static_cast<uint32_t>(nVal));
+}
+
+void CodeBuffer::AndImm8(int32_t nDisp, uint8_t nVal) {
+	this->Emit8(0x80);
+	this->EmitRBXOperand(4, nDisp);
+	this->Emit8(nVal);
+}
+
+void CodeBuffer::OrImm8(int32_t nDisp, uint8_t nVal) {
+	this->Emit8(0x80);
+	this->EmitRBXOperand(1, nDisp);
+	this->Emit8(nVal);
+}
+
+void CodeBuffer::CmpImm8(int32_t nDisp, uint8_t nVal) {
+	this->Emit8(0x80);
+	this->EmitRBXOperand(7, nDisp);
+	this->Emit8(nVal);
+}
+
+void CodeBuffer::AndAlMem(int32_t nDisp) {
+	this->Emit8(0x22);
+	this->EmitRBXOperand(X64_AL, nDisp);
+}
+
+void CodeBuffer::OrAlMem(int32_t nDisp) {
+	this->Emit8(0x0A);
+	this->EmitRBXOperand(X64_AL, nDisp);
+}
+
+void CodeBuffer::XorAlMem(int32_t nDisp) {
+	this->Emit8(0x32);
+	this->EmitRBXOperand(X64_AL, nDisp);
+}
+
+void CodeBuffer::LoadByteIndirect(X64Register eDst, X64Register eBase, int32_t nDisp) {
+	if (eBase == X64_RSP) {
+		throw std::runtime_error("Unsupported base register!");
+	}
+	this->Emit8(0x0F);
+	this->Emit8(0xB6);
+	this->Emit8(0x80 | (eDst << 3) | eBase);
+	this->Emit32(static_cast<uint32_t>(nDisp));
+}
+
+void CodeBuffer::StoreByteIndirect(X64Register eBase, int32_t nDisp, X64ByteRegister eSrc) {
+	if (eBase == X64_RSP) {
+		throw std::runtime_error("Unsupported base register!");
+	}
+	this->Emit8(0x88);
+	this->Emit8(0x80 | (eSrc << 3) | eBase);
+	this->Emit32(static_cast<uint32_t>(nDisp));
+}
+
+void CodeBuffer::MovByteImm8(X64ByteRegister eDst, uint8_t nVal) {
+	this->Emit8(0xB0 + eDst);
+	this->Emit8(nVal);
+}
+
+void CodeBuffer::MovByteReg(X64ByteRegister eDst, X64ByteRegister eSrc) {
+	this->Emit8(0x88);
+	this->Emit8(0xC0 | (eSrc << 3) | eDst);
+}
+
+void CodeBuffer::AdcByteReg(X64ByteRegister eDst, X64ByteRegister eSrc) {
+	this->Emit8(0x10);
+	this->Emit8(0xC0 | (eSrc << 3) | eDst);
+}
+
+void CodeBuffer::SubByteReg(X64ByteRegister eDst, X64ByteRegister eSrc) {
+	this->Emit8(0x28);
+	this->Emit8(0xC0 | (eSrc << 3) | eDst);
+}
+
+void CodeBuffer::ShrByte1(X64ByteRegister eDst) {
+	this->Emit8(0xD0);
+	this->Emit8(0xE8 | eDst);
+}
+
+void CodeBuffer::IncByte(X64ByteRegister eDst) {
+	this->Emit8(0xFE);
+	this->Emit8(0xC0 | eDst);
+}
+
+void CodeBuffer::DecByte(X64ByteRegister eDst) {
+	this->Emit8(0xFE);
+	this->Emit8(0xC8 | eDst);
+}
+
+void CodeBuffer::NotByte(X64ByteRegister eDst) {
+	this->Emit8(0xF6);
+	this->Emit8(0xD0 | eDst);
+}
+
+void CodeBuffer::SetCondition(X64Condition eCondition, X64ByteRegister eDst) {
+	this->Emit8(0x0F);
+	this->Emit8(0x90 + eCondition);
+	this->Emit8(0xC0 | eDst);
+}
+
+size_t CodeBuffer::JumpIf(X64Condition eCondition) {
+	this->Emit8(0x0F);
+	this->Emit8(0x80 + eCondition);
+	size_t nFixup = m_nPosition;
+	this->Emit32(0);
+	return nFixup;
+}
+
+size_t CodeBuffer::Jump() {
+	this->Emit8(0xE9);
+	size_t nFixup = m_nPosition;
+	this->Emit32(0);
+	return nFixup;
+}
+
+void CodeBuffer::BindLabel(size_t nFixup) {
+	this->BindLabel(nFixup, m_nPosition);
+}
+
+void CodeBuffer::BindLabel(size_t nFixup, size_t nTarget) {
+	int32_t nRelative = static_cast<int32_t>(nTarget - (nFixup + 4));
+	std::memcpy(m_pCode + nFixup, &nRelative, sizeof(nRelative));
+}
+}
+
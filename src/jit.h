@@ -0,0 +1,139 @@
+#ifndef CEE_PANE_JIT_H_
+#define CEE_PANE_JIT_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(PANE_NO_JIT)
+#define PANE_JIT_SUPPORTED
+#endif
+
+#define PANE_JIT_CODE_BUFFER_SIZE   (4 * 1024 * 1024)
+// Largest translated block, checked before every translation
+#define PANE_JIT_MAX_BLOCK_SIZE     4096
+
+namespace pane {
+// Registers the emitter knows about. Only the low eight are used so no
+// instruction needs a REX.B/REX.R prefix.
+enum X64Register {
+	X64_RAX = 0,
+	X64_RCX = 1,
+	X64_RDX = 2,
+	X64_RBX = 3,
+	X64_RSP = 4,
+	X64_RBP = 5,
+	X64_RSI = 6,
+	X64_RDI = 7
+};
+
+// Byte registers, without a REX prefix 4-7 name the high halves.
+enum X64ByteRegister {
+	X64_AL = 0,
+	X64_CL = 1,
+	X64_DL = 2,
+	X64_BL = 3,
+	X64_AH = 4,
+	X64_CH = 5,
+	X64_DH = 6,
+	X64_BH = 7
+};
+
+enum X64Condition {
+	X64_CC_O  = 0x0,
+	X64_CC_B  = 0x2,
+	X64_CC_AE = 0x3,
+	X64_CC_E  = 0x4,
+	X64_CC_NE = 0x5
+};
+
+// Executable memory plus the handful of x86-64 instructions the CPU block
+// translator needs. Memory operands are always [rbx + disp32], translated
+// code keeps the CPU pointer in rbx.
+class CodeBuffer {
+public:
+	CodeBuffer();
+	~CodeBuffer();
+
+	void Init(size_t nSize = PANE_JIT_CODE_BUFFER_SIZE);
+	// Drops all translated code, callers must forget every entry point.
+	void Reset();
+	bool HasSpace(size_t nBytes) const { return m_nPosition + nBytes <= m_nSize; }
+
+	// Writes /tmp/perf-<pid>.map so perf can symbolize translated code.
+	void SetPerfMapEnabled(bool bEnabled);
+
+	void BeginFunction();
+	// Returns the entry point of the function started by BeginFunction.
+	void* EndFunction(const char* sName);
+
+	size_t GetPosition() const { return m_nPosition; }
+
+	void Emit8(uint8_t nVal);
+	void Emit16(uint16_t nVal);
+	void Emit32(uint32_t nVal);
+	void Emit64(uint64_t nVal);
+
+	void Push(X64Register eReg);
+	void Pop(X64Register eReg);
+	void Ret();
+	void MovRegReg64(X64Register eDst, X64Register eSrc);
+	void MovRegImm32(X64Register eDst, uint32_t nVal);
+	void MovRegImm64(X64Register eDst, uint64_t nVal);
+	// mov r64, [r64]
+	void LoadPointer(X64Register eDst, X64Register eBase);
+	void TestRegReg64(X64Register eLhs, X64Register eRhs);
+	void CallRegister(X64Register eReg);
+	// movzx r32, r8
+	void ZeroExtendByte(X64Register eDst, X64ByteRegister eSrc);
+
+	// [rbx + disp32] operands
+	void LoadByte(X64Register eDst, int32_t nDisp);
+	void StoreByte(int32_t nDisp, X64ByteRegister eSrc);
+	void StoreWord(int32_t nDisp, X64Register eSrc);
+	void StoreImm8(int32_t nDisp, uint8_t nVal);
+	void StoreImm16(int32_t nDisp, uint16_t nVal);
+	void AddImm32(int32_t nDisp, int32_t nVal);
+	void AddImm64(int32_t nDisp, int32_t nVal);
+	void AndImm8(int32_t nDisp, uint8_t nVal);
+	void OrImm8(int32_t nDisp, uint8_t nVal);
+	void CmpImm8(int32_t nDisp, uint8_t nVal);
+	void AndAlMem(int32_t nDisp);
+	void OrAlMem(int32_t nDisp);
+	void XorAlMem(int32_t nDisp);
+
+	// [r64 + disp32] operands, for host pages
+	void LoadByteIndirect(X64Register eDst, X64Register eBase, int32_t nDisp);
+	void StoreByteIndirect(X64Register eBase, int32_t nDisp, X64ByteRegister eSrc);
+
+	// Byte register arithmetic
+	void MovByteImm8(X64ByteRegister eDst, uint8_t nVal);
+	void MovByteReg(X64ByteRegister eDst, X64ByteRegister eSrc);
+	void AdcByteReg(X64ByteRegister eDst, X64ByteRegister eSrc);
+	void SubByteReg(X64ByteRegister eDst, X64ByteRegister eSrc);
+	void ShrByte1(X64ByteRegister eDst);
+	void IncByte(X64ByteRegister eDst);
+	void DecByte(X64ByteRegister eDst);
+	void NotByte(X64ByteRegister eDst);
+	void SetCondition(X64Condition eCondition, X64ByteRegister eDst);
+
+	// Forward branches, return a fixup to pass to BindLabel
+	size_t JumpIf(X64Condition eCondition);
+	size_t Jump();
+	void BindLabel(size_t nFixup);
+	void BindLabel(size_t nFixup, size_t nTarget);
+
+private:
+	void EmitRBXOperand(uint8_t nReg, int32_t nDisp);
+
+private:
+	uint8_t* m_pCode;
+	size_t m_nSize;
+	size_t m_nPosition;
+	size_t m_nFunctionStart;
+	FILE* m_pPerfMap;
+};
+}
+
+#endif
+
@@ -0,0 +1,212 @@
+#include "keyframes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+
+#include <cstring>
+
+namespace pane {
+static_assert(sizeof(KeyframeHeader) % alignof(KeyframeEntry) == 0, "Keyframe entries must stay aligned in a mapped file");
+
+KeyframeWriter::KeyframeWriter()
+ : m_pFile(nullptr), m_bStopping(false), m_bFailed(false), m_nAppends(0), m_nAppendSeconds(0.0)
+{
+
+}
+
+KeyframeWriter::~KeyframeWriter() {
+	this->Stop();
+}
+
+void KeyframeWriter::Open(const std::string& sPath, uint64_t nROMHash, bool bAppend) {
+	this->Close();
+
+	if (bAppend) {
+		// Drop a torn entry so appended ones line up
+		std::error_code xError;
+		uintmax_t nSize = std::filesystem::file_size(sPath, xError);
+		if (!xError && nSize >= sizeof(KeyframeHeader)) {
+			nSize -= (nSize - sizeof(KeyframeHeader)) % sizeof(KeyframeEntry);
+			std::filesystem::resize_file(sPath, nSize, xError);
+		}
+		bAppend = !xError && nSize >= sizeof(KeyframeHeader);
+	}
+
+	m_pFile = std::fopen(sPath.c_str(), bAppend ? "ab" : "wb");
+	if (m_pFile == nullptr) {
+		throw std::runtime_error("Failed to open keyframes for writing!");
+	}
+	if (!bAppend) {
+		KeyframeHeader xHeader = {};
+		xHeader.nMagic = PANE_KEYFRAME_MAGIC;
+		xHeader.nVersion = PANE_KEYFRAME_VERSION;
+		xHeader.nStateVersion = PANE_STATE_VERSION;
+		xHeader.nEntrySize = sizeof(KeyframeEntry);
+		xHeader.nROMHash = nROMHash;
+		if (std::fwrite(&xHeader, sizeof(KeyframeHeader), 1, m_pFile) != 1 || std::fflush(m_pFile) != 0) {
+			std::fclose(m_pFile);
+			m_pFile = nullptr;
+			throw std::runtime_error("Failed to write keyframes!");
+		}
+	}
+
+	m_bStopping = false;
+	m_bFailed = false;
+	m_nAppends = 0;
+	m_nAppendSeconds = 0.0;
+	m_xThread = std::thread(&KeyframeWriter::RunWriter, this);
+}
+
+void KeyframeWriter::Close() {
+	if (!this->Stop()) {
+		throw std::runtime_error("Failed to write keyframes!");
+	}
+}
+
+// Returns false if anything failed to write
+bool KeyframeWriter::Stop() {
+	if (m_pFile == nullptr) {
+		return true;
+	}
+
+	{
+		std::lock_guard<std::mutex> xGuard(m_xLock);
+		m_bStopping = true;
+	}
+	m_xWake.notify_one();
+	m_xThread.join();
+
+	bool bFailed = std::fclose(m_pFile) != 0 || m_bFailed;
+	m_pFile = nullptr;
+	m_xPending.clear();
+	m_vFree.clear();
+	return !bFailed;
+}
+
+void KeyframeWriter::Append(uint64_t nFrame, uint64_t nInputHash, const MachineState& xState) {
+	auto tStart = std::chrono::steady_clock::now();
+
+	std::unique_ptr<KeyframeEntry> pEntry;
+	{
+		std::lock_guard<std::mutex> xGuard(m_xLock);
+		if (!m_vFree.empty()) {
+			pEntry = std::move(m_vFree.back());
+			m_vFree.pop_back();
+		}
+	}
+	if (!pEntry) {
+		pEntry = std::make_unique<KeyframeEntry>();
+	}
+	pEntry->nFrame = nFrame;
+	pEntry->nInputHash = nInputHash;
+	std::memcpy(&pEntry->xState, &xState, sizeof(MachineState));
+
+	{
+		std::lock_guard<std::mutex> xGuard(m_xLock);
+		m_xPending.push_back(std::move(pEntry));
+	}
+	m_nAppends++;
+	m_nAppendSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	m_xWake.notify_one();
+}
+
+void KeyframeWriter::RunWriter() {
+	std::unique_lock<std::mutex> xGuard(m_xLock);
+	while (true) {
+		m_xWake.wait(xGuard, [this] { return m_bStopping || !m_xPending.empty(); });
+		if (m_xPending.empty()) {
+			return;
+		}
+
+		std::unique_ptr<KeyframeEntry> pEntry = std::move(m_xPending.front());
+		m_xPending.pop_front();
+		xGuard.unlock();
+		// Flushed per entry so readers and crashes see whole entries
+		bool bWritten = std::fwrite(pEntry.get(), sizeof(KeyframeEntry), 1, m_pFile) == 1 && std::fflush(m_pFile) == 0;
+		xGuard.lock();
+
+		m_bFailed = m_bFailed || !bWritten;
+		m_vFree.push_back(std::move(pEntry));
+	}
+}
+
+KeyframeIndex::KeyframeIndex()
+ : m_nEntries(0)
+{
+
+}
+
+KeyframeIndex::~KeyframeIndex() {
+
+}
+
+bool KeyframeIndex::Open(const std::string& sPath, uint64_t nROMHash) {
+	this->Close();
+	std::error_code xError;
+	if (!std::filesystem::exists(sPath, xError)) {
+		return false;
+	}
+	m_xFile.Open(sPath);
+
+	KeyframeHeader xHeader;
+	if (m_xFile.GetSize() < sizeof(KeyframeHeader)) {
+		this->Close();
+		return false;
+	}
+	std::memcpy(&xHeader, m_xFile.GetData(), sizeof(KeyframeHeader));
+	if (xHeader.nMagic != PANE_KEYFRAME_MAGIC || xHeader.nVersion != PANE_KEYFRAME_VERSION || xHeader.nStateVersion != PANE_STATE_VERSION
+	    || xHeader.nEntrySize != sizeof(KeyframeEntry) || xHeader.nROMHash != nROMHash) {
+		this->Close();
+		return false;
+	}
+
+	m_nEntries = (m_xFile.GetSize() - sizeof(KeyframeHeader)) / sizeof(KeyframeEntry);
+	return true;
+}
+
+void KeyframeIndex::Close() {
+	m_xFile.Close();
+	m_nEntries = 0;
+}
+
+const KeyframeEntry& KeyframeIndex::GetEntry(size_t nEntry) const {
+	return reinterpret_cast<const KeyframeEntry*>(m_xFile.GetData() + sizeof(KeyframeHeader))[nEntry];
+}
+
+bool KeyframeIndex::Contains(uint64_t nFrame, uint64_t nInputHash) const {
+	for (size_t i = 0; i < m_nEntries; i++) {
+		const KeyframeEntry& xEntry = this->GetEntry(i);
+		if (xEntry.nFrame == nFrame && xEntry.nInputHash == nInputHash) {
+			return true;
+		}
+	}
+	return false;
+}
+
+const KeyframeEntry* KeyframeIndex::Find(const Movie& xMovie, uint64_t nFrame) const {
+	nFrame = std::min(nFrame, xMovie.GetFrameCount());
+
+	// Closest first, newest first among equals since re-recording appends
+	// fresh keyframes, so usually only one input hash is needed
+	std::vector<size_t> vCandidates;
+	for (size_t i = 0; i < m_nEntries; i++) {
+		if (this->GetEntry(i).nFrame <= nFrame) {
+			vCandidates.push_back(i);
+		}
+	}
+	std::stable_sort(vCandidates.begin(), vCandidates.end(), [this](size_t a, size_t b) {
+		return this->GetEntry(a).nFrame > this->GetEntry(b).nFrame || (this->GetEntry(a).nFrame == this->GetEntry(b).nFrame && a > b);
+	});
+
+	for (size_t i : vCandidates) {
+		const KeyframeEntry& xEntry = this->GetEntry(i);
+		if (xEntry.nInputHash == xMovie.GetInputHash(xEntry.nFrame)) {
+			return &xEntry;
+		}
+	}
+	return nullptr;
+}
+}
@@ -0,0 +1,112 @@
+#ifndef CEE_PANE_KEYFRAMES_H_
+#define CEE_PANE_KEYFRAMES_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+#include "mappedfile.h"
+#include "movie.h"
+#include "state.h"
+
+// "PNKF" little endian
+#define PANE_KEYFRAME_MAGIC             0x464B4E50
+// Bump whenever the layout of the header or KeyframeEntry changes
+#define PANE_KEYFRAME_VERSION           1
+#define PANE_KEYFRAME_DEFAULT_INTERVAL  600
+// Appended to the movie path
+#define PANE_KEYFRAME_SUFFIX            ".keyframes"
+
+namespace pane {
+// Keyframe files are this header followed by fixed size entries, in the
+// order they were written, so they can be appended to without rewriting
+// anything and mapped to be read in place. A torn entry at the end is
+// ignored.
+struct alignas(64) KeyframeHeader {
+	uint32_t nMagic;
+	uint32_t nVersion;
+	uint32_t nStateVersion;
+	uint32_t nEntrySize;
+	uint64_t nROMHash;
+};
+
+struct KeyframeEntry {
+	// Movie frame the state is at the start of
+	uint64_t nFrame;
+	// Movie::GetInputHash(nFrame) of the movie it was saved from
+	uint64_t nInputHash;
+	MachineState xState;
+};
+
+// Writes keyframes from a background thread, the caller only pays for a
+// copy of the state.
+class KeyframeWriter {
+public:
+	KeyframeWriter();
+	~KeyframeWriter();
+
+	// Appends to the index at sPath if bAppend is set, otherwise starts it
+	// over. Throws if the file can't be opened.
+	void Open(const std::string& sPath, uint64_t nROMHash, bool bAppend);
+	// Waits for pending entries, throws if any failed to write
+	void Close();
+
+	void Append(uint64_t nFrame, uint64_t nInputHash, const MachineState& xState);
+
+	uint64_t GetAppendCount() const { return m_nAppends; }
+	// Time spent copying and queueing in Append, on the caller's thread
+	double GetAppendSeconds() const { return m_nAppendSeconds; }
+
+private:
+	void RunWriter();
+	bool Stop();
+
+private:
+	std::FILE* m_pFile;
+	std::thread m_xThread;
+	std::mutex m_xLock;
+	std::condition_variable m_xWake;
+	std::deque<std::unique_ptr<KeyframeEntry>> m_xPending;
+	// Written entries kept for reuse
+	std::vector<std::unique_ptr<KeyframeEntry>> m_vFree;
+	bool m_bStopping;
+	bool m_bFailed;
+
+	uint64_t m_nAppends;
+	double m_nAppendSeconds;
+};
+
+// Read side of a keyframe file, mapped as it was when opened.
+class KeyframeIndex {
+public:
+	KeyframeIndex();
+	~KeyframeIndex();
+
+	// False, with the index closed, if there is no index at sPath or it
+	// was written by another version or for another ROM
+	bool Open(const std::string& sPath, uint64_t nROMHash);
+	void Close();
+	bool IsOpen() const { return m_xFile.IsOpen(); }
+
+	size_t GetEntryCount() const { return m_nEntries; }
+	const KeyframeEntry& GetEntry(size_t nEntry) const;
+	bool Contains(uint64_t nFrame, uint64_t nInputHash) const;
+	// Latest keyframe at or before nFrame saved from a replay of xMovie,
+	// nullptr if there is none
+	const KeyframeEntry* Find(const Movie& xMovie, uint64_t nFrame) const;
+
+private:
+	MappedFile m_xFile;
+	size_t m_nEntries;
+};
+}
+
+#endif
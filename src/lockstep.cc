@@ -0,0 +1,584 @@
+#include "lockstep.h"
+#include "ram.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace pane {
+static inline uint8_t SetZN(uint8_t sr, uint8_t cVal) {
+	return (sr & ~(SR_ZERO | SR_NEGATIVE)) | (cVal == 0 ? SR_ZERO : 0) | (cVal & SR_NEGATIVE);
+}
+
+// How an instruction touches its effective address
+enum LaneAccess {
+	LANE_ACCESS_NONE = 0,
+	LANE_ACCESS_READ,
+	LANE_ACCESS_WRITE,
+	LANE_ACCESS_MODIFY
+};
+
+static constexpr LaneAccess GetLaneAccess(Instruction xInstruction) {
+	switch (xInstruction.oc) {
+	case OC_ADC:
+	case OC_AND:
+	case OC_BIT:
+	case OC_CMP:
+	case OC_CPX:
+	case OC_CPY:
+	case OC_EOR:
+	case OC_LDA:
+	case OC_LDX:
+	case OC_LDY:
+	case OC_ORA:
+	case OC_SBC:
+		return LANE_ACCESS_READ;
+	case OC_STA:
+	case OC_STX:
+	case OC_STY:
+		return LANE_ACCESS_WRITE;
+	case OC_ASL:
+	case OC_DEC:
+	case OC_INC:
+	case OC_LSR:
+	case OC_ROL:
+	case OC_ROR:
+		return xInstruction.am == AM_ACC ? LANE_ACCESS_NONE : LANE_ACCESS_MODIFY;
+	default:
+		return LANE_ACCESS_NONE;
+	}
+}
+
+template <size_t nLanes>
+LockstepCPU<nLanes>::LockstepCPU()
+ : m_pPRG(nullptr), m_nPRGMask(0), m_nSteps(0)
+{
+	std::memset(m_pRAM, 0, sizeof(m_pRAM));
+	std::memset(m_pState, LANE_JAMMED, sizeof(m_pState));
+}
+
+template <size_t nLanes>
+LockstepCPU<nLanes>::~LockstepCPU() {
+
+}
+
+template <size_t nLanes>
+void LockstepCPU<nLanes>::SetPRG(const uint8_t* pPRG, size_t nSize) {
+	if (nSize == 0 || nSize > 0x8000 || (nSize & (nSize - 1)) != 0) {
+		throw std::runtime_error("PRG size must be a power of two up to 32K!");
+	}
+	m_pPRG = pPRG;
+	m_nPRGMask = nSize - 1;
+}
+
+template <size_t nLanes>
+void LockstepCPU<nLanes>::Start() {
+	uint16_t pReset = this->ReadPRG(RESET_ADDRESS) | (static_cast<uint16_t>(this->ReadPRG(RESET_ADDRESS + 1)) << 8);
+	for (size_t l = 0; l < nLanes; l++) {
+		m_pPC[l] = pReset;
+		m_pA[l] = m_pX[l] = m_pY[l] = 0;
+		m_pSR[l] = 0x24;
+		m_pSP[l] = 0xFD;
+		m_pState[l] = LANE_RUNNING;
+		m_pCycles[l] = 0;
+		m_pTotalCycles[l] = 0;
+		m_pInstructions[l] = 0;
+	}
+	m_nSteps = 0;
+}
+
+template <size_t nLanes>
+void LockstepCPU<nLanes>::RunCycles(int32_t nBudget) {
+	for (size_t l = 0; l < nLanes; l++) {
+		m_pCycles[l] = 0;
+		m_pRunInstructions[l] = 0;
+	}
+
+	for (;;) {
+		// Lowest PC first: loops branch backwards, so lanes that fell behind
+		// catch up with the rest and the group merges again
+		uint8_t pRunnable[nLanes];
+		uint32_t nPC = 0x10000;
+		for (size_t l = 0; l < nLanes; l++) {
+			pRunnable[l] = m_pState[l] == LANE_RUNNING && m_pCycles[l] < nBudget;
+			if (pRunnable[l] && m_pPC[l] < nPC) {
+				nPC = m_pPC[l];
+			}
+		}
+		if (nPC == 0x10000) {
+			break;
+		}
+
+		uint8_t pMask[nLanes];
+		for (size_t l = 0; l < nLanes; l++) {
+			pMask[l] = pRunnable[l] && m_pPC[l] == nPC;
+		}
+		m_nSteps++;
+		// Code has to come from the shared PRG, lanes running out of RAM
+		// would each see different instructions
+		if (nPC < 0x8000) {
+			for (size_t l = 0; l < nLanes; l++) {
+				m_pState[l] = pMask[l] ? LANE_FAULTED : m_pState[l];
+			}
+			continue;
+		}
+		s_pHandlers[this->ReadPRG(nPC)](this, static_cast<uint16_t>(nPC), pMask);
+	}
+
+	for (size_t l = 0; l < nLanes; l++) {
+		m_pTotalCycles[l] += m_pCycles[l];
+		m_pInstructions[l] += m_pRunInstructions[l];
+	}
+}
+
+template <size_t nLanes>
+LaneRegisters LockstepCPU<nLanes>::GetRegisters(size_t nLane) const {
+	return { m_pPC[nLane], m_pA[nLane], m_pX[nLane], m_pY[nLane], m_pSR[nLane], m_pSP[nLane] };
+}
+
+template <size_t nLanes>
+void LockstepCPU<nLanes>::Push(size_t nLane, uint8_t cVal) {
+	this->WriteRAM(nLane, 0x0100 | m_pSP[nLane], cVal);
+	m_pSP[nLane]--;
+}
+
+template <size_t nLanes>
+uint8_t LockstepCPU<nLanes>::Pull(size_t nLane) {
+	m_pSP[nLane]++;
+	return this->ReadRAM(nLane, 0x0100 | m_pSP[nLane]);
+}
+
+template <size_t nLanes>
+template <size_t... nOpCodes>
+constexpr std::array<typename LockstepCPU<nLanes>::Handler, 256> LockstepCPU<nLanes>::MakeHandlerTable(std::index_sequence<nOpCodes...>) {
+	return {{ &LockstepCPU<nLanes>::template Dispatch<static_cast<uint8_t>(nOpCodes)>... }};
+}
+
+template <size_t nLanes>
+const std::array<typename LockstepCPU<nLanes>::Handler, 256> LockstepCPU<nLanes>::s_pHandlers = LockstepCPU<nLanes>::MakeHandlerTable(std::make_index_sequence<256>());
+
+template <size_t nLanes>
+template <uint8_t nOpCode>
+void LockstepCPU<nLanes>::Dispatch(LockstepCPU* pCPU, uint16_t pc, const uint8_t* pMask) {
+	pCPU->template Step<nOpCode>(pc, pMask);
+}
+
+// Specialized per opcode like CPU's handlers, so every branch on the
+// instruction below folds away and the lane loops are straight line code.
+template <size_t nLanes>
+template <uint8_t nOpCode>
+void LockstepCPU<nLanes>::Step(uint16_t pc, const uint8_t* pMask) {
+	// A local copy can't alias the lane arrays, which keeps the loops below
+	// vectorizable
+	uint8_t pActive[nLanes];
+	std::memcpy(pActive, pMask, nLanes);
+
+	constexpr Instruction xInstruction = g_xInstructionLUT[nOpCode];
+	constexpr uint8_t nLength = GetInstructionLength(xInstruction.am);
+	if (static_cast<uint32_t>(pc) + nLength > 0x10000) {
+		for (size_t l = 0; l < nLanes; l++) {
+			m_pState[l] = pActive[l] ? LANE_FAULTED : m_pState[l];
+		}
+		return;
+	}
+	if constexpr (xInstruction.oc == OC_NONE) {
+		for (size_t l = 0; l < nLanes; l++) {
+			m_pState[l] = pActive[l] ? LANE_JAMMED : m_pState[l];
+			m_pRunInstructions[l] += pActive[l];
+		}
+		return;
+	}
+
+	uint16_t nOperand = 0;
+	if (nLength >= 2) {
+		nOperand = this->ReadPRG(pc + 1);
+	}
+	if (nLength == 3) {
+		nOperand |= static_cast<uint16_t>(this->ReadPRG(pc + 2)) << 8;
+	}
+	uint16_t pNext = pc + nLength;
+
+	// Effective address and page crossing penalty per lane
+	uint16_t pAddress[nLanes];
+	uint8_t pPenalty[nLanes];
+	std::memset(pPenalty, 0, sizeof(pPenalty));
+	bool bUniform = false;
+	const bool bPageCrossPenalty = HasPageCrossPenalty(xInstruction.oc);
+	switch (xInstruction.am) {
+	case AM_IMM:
+		bUniform = true;
+		for (size_t l = 0; l < nLanes; l++) {
+			pAddress[l] = pc + 1;
+		}
+		break;
+	case AM_ZPG:
+	case AM_ABS:
+		bUniform = true;
+		for (size_t l = 0; l < nLanes; l++) {
+			pAddress[l] = nOperand;
+		}
+		break;
+	case AM_ZPGX:
+		for (size_t l = 0; l < nLanes; l++) {
+			pAddress[l] = static_cast<uint8_t>(nOperand + m_pX[l]);
+		}
+		break;
+	case AM_ZPGY:
+		for (size_t l = 0; l < nLanes; l++) {
+			pAddress[l] = static_cast<uint8_t>(nOperand + m_pY[l]);
+		}
+		break;
+	case AM_ABSX:
+	case AM_ABSY:
+		for (size_t l = 0; l < nLanes; l++) {
+			pAddress[l] = nOperand + (xInstruction.am == AM_ABSX ? m_pX[l] : m_pY[l]);
+			pPenalty[l] = bPageCrossPenalty && ((nOperand ^ pAddress[l]) & 0xFF00) != 0;
+		}
+		break;
+	case AM_REL:
+		bUniform = true;
+		for (size_t l = 0; l < nLanes; l++) {
+			pAddress[l] = pNext + static_cast<int8_t>(nOperand);
+		}
+		break;
+	case AM_IND: {
+		// The pointer's high byte is fetched without carrying into the next page
+		uint16_t pHigh = (nOperand & 0xFF00) | ((nOperand + 1) & 0x00FF);
+		if (!this->IsReadable(nOperand) || !this->IsReadable(pHigh)) {
+			for (size_t l = 0; l < nLanes; l++) {
+				m_pState[l] = pActive[l] ? LANE_FAULTED : m_pState[l];
+			}
+			return;
+		}
+		for (size_t l = 0; l < nLanes; l++) {
+			pAddress[l] = this->Read(l, nOperand) | (static_cast<uint16_t>(this->Read(l, pHigh)) << 8);
+		}
+		break;
+	}
+	case AM_XIND:
+		for (size_t l = 0; l < nLanes; l++) {
+			uint8_t pPointer = nOperand + m_pX[l];
+			pAddress[l] = this->ReadRAM(l, pPointer) | (static_cast<uint16_t>(this->ReadRAM(l, static_cast<uint8_t>(pPointer + 1))) << 8);
+		}
+		break;
+	case AM_INDY:
+		for (size_t l = 0; l < nLanes; l++) {
+			uint16_t pBase = this->ReadRAM(l, nOperand) | (static_cast<uint16_t>(this->ReadRAM(l, static_cast<uint8_t>(nOperand + 1))) << 8);
+			pAddress[l] = pBase + m_pY[l];
+			pPenalty[l] = bPageCrossPenalty && ((pBase ^ pAddress[l]) & 0xFF00) != 0;
+		}
+		break;
+	default:
+		std::memset(pAddress, 0, sizeof(pAddress));
+		break;
+	}
+	if (!bUniform && xInstruction.am != AM_IMPL && xInstruction.am != AM_ACC) {
+		// Indexed lanes usually share their index registers, which makes the
+		// access one row of RAM after all
+		uint16_t nDifference = 0;
+		for (size_t l = 1; l < nLanes; l++) {
+			nDifference |= pAddress[l] ^ pAddress[0];
+		}
+		bUniform = nDifference == 0;
+	}
+
+	// Lanes that would touch I/O or write PRG stop before changing anything
+	constexpr LaneAccess eAccess = GetLaneAccess(xInstruction);
+	if (eAccess != LANE_ACCESS_NONE) {
+		for (size_t l = 0; l < nLanes; l++) {
+			bool bOk = eAccess == LANE_ACCESS_READ ? this->IsReadable(pAddress[l]) : this->IsWritable(pAddress[l]);
+			uint8_t bFault = pActive[l] & !bOk;
+			m_pState[l] = bFault ? LANE_FAULTED : m_pState[l];
+			pActive[l] &= !bFault;
+		}
+	}
+
+	uint8_t pValue[nLanes];
+	if (eAccess == LANE_ACCESS_READ || eAccess == LANE_ACCESS_MODIFY) {
+		if (bUniform && pAddress[0] < 0x2000) {
+			// Same RAM byte in every lane, one contiguous row
+			std::memcpy(pValue, &m_pRAM[(pAddress[0] & (PANE_LOCKSTEP_RAM_SIZE - 1)) * nLanes], nLanes);
+		} else if (bUniform) {
+			std::memset(pValue, this->ReadPRG(pAddress[0]), nLanes);
+		} else {
+			for (size_t l = 0; l < nLanes; l++) {
+				pValue[l] = pActive[l] ? this->Read(l, pAddress[l]) : 0;
+			}
+		}
+	}
+
+	uint16_t pTarget[nLanes];
+	for (size_t l = 0; l < nLanes; l++) {
+		pTarget[l] = pNext;
+	}
+
+	// Register and flag updates are written as selects on the lane mask so
+	// they vectorize, memory and stack traffic is per lane.
+	switch (xInstruction.oc) {
+	case OC_ADC:
+	case OC_SBC:
+		for (size_t l = 0; l < nLanes; l++) {
+			// A - M - !C is A + ~M + C
+			uint8_t nOperandValue = xInstruction.oc == OC_SBC ? static_cast<uint8_t>(~pValue[l]) : pValue[l];
+			uint16_t nResult = m_pA[l] + nOperandValue + (m_pSR[l] & SR_CARRY);
+			uint8_t nOverflow = (nResult ^ m_pA[l]) & (nResult ^ nOperandValue) & 0x80;
+			uint8_t sr = SetZN(m_pSR[l], static_cast<uint8_t>(nResult));
+			sr = (sr & ~(SR_CARRY | SR_OVERFLOW)) | (nResult >> 8) | (nOverflow ? SR_OVERFLOW : 0);
+			m_pSR[l] = pActive[l] ? sr : m_pSR[l];
+			m_pA[l] = pActive[l] ? static_cast<uint8_t>(nResult) : m_pA[l];
+		}
+		break;
+	case OC_AND:
+	case OC_ORA:
+	case OC_EOR:
+		for (size_t l = 0; l < nLanes; l++) {
+			uint8_t nResult = xInstruction.oc == OC_AND ? (m_pA[l] & pValue[l]) : xInstruction.oc == OC_ORA ? (m_pA[l] | pValue[l]) : (m_pA[l] ^ pValue[l]);
+			m_pSR[l] = pActive[l] ? SetZN(m_pSR[l], nResult) : m_pSR[l];
+			m_pA[l] = pActive[l] ? nResult : m_pA[l];
+		}
+		break;
+	case OC_BIT:
+		for (size_t l = 0; l < nLanes; l++) {
+			// Z comes from the AND, N and V straight from the operand
+			uint8_t sr = (m_pSR[l] & ~(SR_ZERO | SR_NEGATIVE | SR_OVERFLOW)) | ((m_pA[l] & pValue[l]) == 0 ? SR_ZERO : 0) | (pValue[l] & (SR_NEGATIVE | SR_OVERFLOW));
+			m_pSR[l] = pActive[l] ? sr : m_pSR[l];
+		}
+		break;
+	case OC_CMP:
+	case OC_CPX:
+	case OC_CPY:
+		for (size_t l = 0; l < nLanes; l++) {
+			uint8_t nRegister = xInstruction.oc == OC_CMP ? m_pA[l] : xInstruction.oc == OC_CPX ? m_pX[l] : m_pY[l];
+			uint8_t sr = SetZN(m_pSR[l], static_cast<uint8_t>(nRegister - pValue[l]));
+			sr = (sr & ~SR_CARRY) | (nRegister >= pValue[l] ? SR_CARRY : 0);
+			m_pSR[l] = pActive[l] ? sr : m_pSR[l];
+		}
+		break;
+	case OC_LDA:
+	case OC_TXA:
+	case OC_TYA:
+	case OC_PLA:
+		for (size_t l = 0; l < nLanes; l++) {
+			uint8_t nResult;
+			if (xInstruction.oc == OC_PLA) {
+				nResult = pActive[l] ? this->Pull(l) : 0;
+			} else {
+				nResult = xInstruction.oc == OC_LDA ? pValue[l] : xInstruction.oc == OC_TXA ? m_pX[l] : m_pY[l];
+			}
+			m_pSR[l] = pActive[l] ? SetZN(m_pSR[l], nResult) : m_pSR[l];
+			m_pA[l] = pActive[l] ? nResult : m_pA[l];
+		}
+		break;
+	case OC_LDX:
+	case OC_TAX:
+	case OC_TSX:
+	case OC_INX:
+	case OC_DEX:
+		for (size_t l = 0; l < nLanes; l++) {
+			uint8_t nResult;
+			switch (xInstruction.oc) {
+			case OC_LDX: nResult = pValue[l]; break;
+			case OC_TAX: nResult = m_pA[l]; break;
+			case OC_TSX: nResult = m_pSP[l]; break;
+			case OC_INX: nResult = m_pX[l] + 1; break;
+			default:     nResult = m_pX[l] - 1; break;
+			}
+			m_pSR[l] = pActive[l] ? SetZN(m_pSR[l], nResult) : m_pSR[l];
+			m_pX[l] = pActive[l] ? nResult : m_pX[l];
+		}
+		break;
+	case OC_LDY:
+	case OC_TAY:
+	case OC_INY:
+	case OC_DEY:
+		for (size_t l = 0; l < nLanes; l++) {
+			uint8_t nResult;
+			switch (xInstruction.oc) {
+			case OC_LDY: nResult = pValue[l]; break;
+			case OC_TAY: nResult = m_pA[l]; break;
+			case OC_INY: nResult = m_pY[l] + 1; break;
+			default:     nResult = m_pY[l] - 1; break;
+			}
+			m_pSR[l] = pActive[l] ? SetZN(m_pSR[l], nResult) : m_pSR[l];
+			m_pY[l] = pActive[l] ? nResult : m_pY[l];
+		}
+		break;
+	case OC_TXS:
+		for (size_t l = 0; l < nLanes; l++) {
+			m_pSP[l] = pActive[l] ? m_pX[l] : m_pSP[l];
+		}
+		break;
+	case OC_ASL:
+	case OC_LSR:
+	case OC_ROL:
+	case OC_ROR:
+		for (size_t l = 0; l < nLanes; l++) {
+			uint8_t nInput = xInstruction.am == AM_ACC ? m_pA[l] : pValue[l];
+			uint8_t nCarryIn = m_pSR[l] & SR_CARRY;
+			uint8_t nResult, nCarryOut;
+			switch (xInstruction.oc) {
+			case OC_ASL: nResult = nInput << 1; nCarryOut = nInput >> 7; break;
+			case OC_LSR: nResult = nInput >> 1; nCarryOut = nInput & 1; break;
+			case OC_ROL: nResult = (nInput << 1) | nCarryIn; nCarryOut = nInput >> 7; break;
+			default:     nResult = (nInput >> 1) | (nCarryIn << 7); nCarryOut = nInput & 1; break;
+			}
+			uint8_t sr = (SetZN(m_pSR[l], nResult) & ~SR_CARRY) | nCarryOut;
+			m_pSR[l] = pActive[l] ? sr : m_pSR[l];
+			if (xInstruction.am == AM_ACC) {
+				m_pA[l] = pActive[l] ? nResult : m_pA[l];
+			} else {
+				pValue[l] = nResult;
+			}
+		}
+		break;
+	case OC_INC:
+	case OC_DEC:
+		for (size_t l = 0; l < nLanes; l++) {
+			uint8_t nResult = pValue[l] + (xInstruction.oc == OC_INC ? 1 : -1);
+			m_pSR[l] = pActive[l] ? SetZN(m_pSR[l], nResult) : m_pSR[l];
+			pValue[l] = nResult;
+		}
+		break;
+	case OC_STA:
+		std::memcpy(pValue, m_pA, nLanes);
+		break;
+	case OC_STX:
+		std::memcpy(pValue, m_pX, nLanes);
+		break;
+	case OC_STY:
+		std::memcpy(pValue, m_pY, nLanes);
+		break;
+	case OC_CLC:
+	case OC_SEC:
+	case OC_CLI:
+	case OC_SEI:
+	case OC_CLD:
+	case OC_SED:
+	case OC_CLV: {
+		uint8_t nClear = 0, nSet = 0;
+		switch (xInstruction.oc) {
+		case OC_CLC: nClear = SR_CARRY; break;
+		case OC_SEC: nSet = SR_CARRY; break;
+		case OC_CLI: nClear = SR_INTERRUPT; break;
+		case OC_SEI: nSet = SR_INTERRUPT; break;
+		case OC_CLD: nClear = SR_DECIMAL; break;
+		case OC_SED: nSet = SR_DECIMAL; break;
+		default:     nClear = SR_OVERFLOW; break;
+		}
+		for (size_t l = 0; l < nLanes; l++) {
+			m_pSR[l] = pActive[l] ? ((m_pSR[l] & ~nClear) | nSet) : m_pSR[l];
+		}
+		break;
+	}
+	case OC_BCC:
+	case OC_BCS:
+	case OC_BEQ:
+	case OC_BMI:
+	case OC_BNE:
+	case OC_BPL:
+	case OC_BVC:
+	case OC_BVS: {
+		uint8_t nFlag, nWanted;
+		switch (xInstruction.oc) {
+		case OC_BCC: nFlag = SR_CARRY;    nWanted = 0; break;
+		case OC_BCS: nFlag = SR_CARRY;    nWanted = SR_CARRY; break;
+		case OC_BNE: nFlag = SR_ZERO;     nWanted = 0; break;
+		case OC_BEQ: nFlag = SR_ZERO;     nWanted = SR_ZERO; break;
+		case OC_BPL: nFlag = SR_NEGATIVE; nWanted = 0; break;
+		case OC_BMI: nFlag = SR_NEGATIVE; nWanted = SR_NEGATIVE; break;
+		case OC_BVC: nFlag = SR_OVERFLOW; nWanted = 0; break;
+		default:     nFlag = SR_OVERFLOW; nWanted = SR_OVERFLOW; break;
+		}
+		// One extra cycle for a taken branch, another if it lands on a new page
+		uint8_t nTakenPenalty = 1 + (((pNext ^ pAddress[0]) & 0xFF00) != 0);
+		for (size_t l = 0; l < nLanes; l++) {
+			bool bTaken = (m_pSR[l] & nFlag) == nWanted;
+			pTarget[l] = bTaken ? pAddress[l] : pNext;
+			pPenalty[l] = bTaken ? nTakenPenalty : 0;
+		}
+		break;
+	}
+	case OC_JMP:
+		std::memcpy(pTarget, pAddress, sizeof(pTarget));
+		break;
+	case OC_JSR:
+		for (size_t l = 0; l < nLanes; l++) {
+			if (pActive[l]) {
+				// Return address pushed is the last byte of the JSR instruction
+				this->Push(l, (pNext - 1) >> 8);
+				this->Push(l, (pNext - 1) & 0xFF);
+			}
+			pTarget[l] = nOperand;
+		}
+		break;
+	case OC_RTS:
+	case OC_RTI:
+		for (size_t l = 0; l < nLanes; l++) {
+			if (pActive[l]) {
+				if (xInstruction.oc == OC_RTI) {
+					m_pSR[l] = (this->Pull(l) & ~SR_BREAK) | 1 << 5;
+				}
+				uint8_t lo = this->Pull(l);
+				uint8_t hi = this->Pull(l);
+				pTarget[l] = ((static_cast<uint16_t>(hi) << 8) | lo) + (xInstruction.oc == OC_RTS ? 1 : 0);
+			}
+		}
+		break;
+	case OC_PHA:
+	case OC_PHP:
+		for (size_t l = 0; l < nLanes; l++) {
+			if (pActive[l]) {
+				this->Push(l, xInstruction.oc == OC_PHA ? m_pA[l] : (m_pSR[l] | SR_BREAK | 1 << 5));
+			}
+		}
+		break;
+	case OC_PLP:
+		for (size_t l = 0; l < nLanes; l++) {
+			if (pActive[l]) {
+				m_pSR[l] = (this->Pull(l) & ~SR_BREAK) | 1 << 5;
+			}
+		}
+		break;
+	case OC_BRK: {
+		uint16_t pVector = this->ReadPRG(IRQ_ADDRESS) | (static_cast<uint16_t>(this->ReadPRG(IRQ_ADDRESS + 1)) << 8);
+		for (size_t l = 0; l < nLanes; l++) {
+			if (pActive[l]) {
+				// BRK has a padding byte after the opcode
+				this->Push(l, (pNext + 1) >> 8);
+				this->Push(l, (pNext + 1) & 0xFF);
+				this->Push(l, m_pSR[l] | SR_BREAK | 1 << 5);
+				m_pSR[l] |= SR_INTERRUPT;
+			}
+			pTarget[l] = pVector;
+		}
+		break;
+	}
+	default: // NOP
+		break;
+	}
+
+	if (eAccess == LANE_ACCESS_WRITE || eAccess == LANE_ACCESS_MODIFY) {
+		if (bUniform) {
+			uint8_t* pRow = &m_pRAM[(pAddress[0] & (PANE_LOCKSTEP_RAM_SIZE - 1)) * nLanes];
+			for (size_t l = 0; l < nLanes; l++) {
+				pRow[l] = pActive[l] ? pValue[l] : pRow[l];
+			}
+		} else {
+			for (size_t l = 0; l < nLanes; l++) {
+				if (pActive[l]) {
+					this->WriteRAM(l, pAddress[l], pValue[l]);
+				}
+			}
+		}
+	}
+
+	constexpr int32_t nCycles = g_nCyclesLUT[nOpCode];
+	for (size_t l = 0; l < nLanes; l++) {
+		m_pPC[l] = pActive[l] ? pTarget[l] : m_pPC[l];
+		m_pCycles[l] += pActive[l] ? nCycles + pPenalty[l] : 0;
+		m_pRunInstructions[l] += pActive[l];
+	}
+}
+
+template class LockstepCPU<8>;
+template class LockstepCPU<16>;
+}
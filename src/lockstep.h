@@ -0,0 +1,112 @@
+#ifndef CEE_PANE_LOCKSTEP_H_
+#define CEE_PANE_LOCKSTEP_H_
+
+#include <array>
+#include <utility>
+
+#include <cstdint>
+#include <cstddef>
+
+#include "cpu.h"
+
+#define PANE_LOCKSTEP_RAM_SIZE  0x0800
+
+namespace pane {
+enum LaneState {
+	LANE_RUNNING = 0,
+	// Hit an illegal opcode, pc is left on it like CPU::IsJammed
+	LANE_JAMMED,
+	// Needed memory other than RAM and PRG. Nothing of the instruction was
+	// executed, so the lane can be finished on the scalar CPU.
+	LANE_FAULTED
+};
+
+struct LaneRegisters {
+	uint16_t pc;
+	uint8_t ac, x, y, sr, sp;
+};
+
+// Experimental batch CPU that runs nLanes copies of one program in lockstep,
+// each with its own registers and 2K of RAM, sharing read-only PRG at
+// 0x8000. State is stored structure-of-arrays so every instruction is
+// decoded once and applied to all lanes with plain loops the compiler can
+// vectorize. Lanes that branch differently are peeled off into their own
+// group and run separately, lowest PC first so loops reconverge.
+//
+// Only the CPU and RAM are modelled: no interrupts, no I/O. Instruction
+// results, flags and cycle counts match CPU lane by lane.
+template <size_t nLanes>
+class LockstepCPU {
+public:
+	LockstepCPU();
+	~LockstepCPU();
+
+	// Mirrored through 0x8000 - 0xFFFF, nSize must be a power of two no
+	// larger than 32K. The data must outlive the CPU.
+	void SetPRG(const uint8_t* pPRG, size_t nSize);
+
+	// Resets every lane like CPU::Start, RAM is left alone.
+	void Start();
+	// Every running lane executes whole instructions until at least nBudget
+	// cycles have elapsed for it.
+	void RunCycles(int32_t nBudget);
+
+	uint8_t ReadRAM(size_t nLane, uint16_t pAddress) const { return m_pRAM[(pAddress & (PANE_LOCKSTEP_RAM_SIZE - 1)) * nLanes + nLane]; }
+	void WriteRAM(size_t nLane, uint16_t pAddress, uint8_t cVal) { m_pRAM[(pAddress & (PANE_LOCKSTEP_RAM_SIZE - 1)) * nLanes + nLane] = cVal; }
+
+	LaneRegisters GetRegisters(size_t nLane) const;
+	LaneState GetLaneState(size_t nLane) const { return static_cast<LaneState>(m_pState[nLane]); }
+	uint64_t GetTotalCycles(size_t nLane) const { return m_pTotalCycles[nLane]; }
+	uint64_t GetInstructionCount(size_t nLane) const { return m_pInstructions[nLane]; }
+	// Instructions dispatched, each applied to one group of lanes. Lane
+	// instructions over steps * nLanes is the SIMD utilisation.
+	uint64_t GetStepCount() const { return m_nSteps; }
+
+private:
+	// Applies one instruction to the lanes set in pMask
+	typedef void (*Handler)(LockstepCPU* pCPU, uint16_t pc, const uint8_t* pMask);
+
+	template <uint8_t nOpCode>
+	static void Dispatch(LockstepCPU* pCPU, uint16_t pc, const uint8_t* pMask);
+	template <size_t... nOpCodes>
+	static constexpr std::array<Handler, 256> MakeHandlerTable(std::index_sequence<nOpCodes...>);
+
+	static const std::array<Handler, 256> s_pHandlers;
+
+	template <uint8_t nOpCode>
+	void Step(uint16_t pc, const uint8_t* pMask);
+
+	bool IsReadable(uint16_t pAddress) const { return pAddress < 0x2000 || pAddress >= 0x8000; }
+	bool IsWritable(uint16_t pAddress) const { return pAddress < 0x2000; }
+	uint8_t ReadPRG(uint16_t pAddress) const { return m_pPRG[(pAddress - 0x8000) & m_nPRGMask]; }
+	// Callers check IsReadable/IsWritable first
+	uint8_t Read(size_t nLane, uint16_t pAddress) const { return pAddress < 0x2000 ? this->ReadRAM(nLane, pAddress) : this->ReadPRG(pAddress); }
+	void Push(size_t nLane, uint8_t cVal);
+	uint8_t Pull(size_t nLane);
+
+private:
+	alignas(64) uint16_t m_pPC[nLanes];
+	alignas(64) uint8_t m_pA[nLanes];
+	alignas(64) uint8_t m_pX[nLanes];
+	alignas(64) uint8_t m_pY[nLanes];
+	// Full status byte as CPU::GetStatus returns it
+	alignas(64) uint8_t m_pSR[nLanes];
+	alignas(64) uint8_t m_pSP[nLanes];
+	alignas(64) uint8_t m_pState[nLanes];
+	// Cycles and instructions of the current RunCycles, folded into the
+	// totals at the end so the per step update stays 32-bit
+	alignas(64) int32_t m_pCycles[nLanes];
+	alignas(64) int32_t m_pRunInstructions[nLanes];
+	alignas(64) uint64_t m_pTotalCycles[nLanes];
+	alignas(64) uint64_t m_pInstructions[nLanes];
+	// Byte n of every lane is contiguous, so lanes touching the same address
+	// read and write one vector.
+	alignas(64) uint8_t m_pRAM[PANE_LOCKSTEP_RAM_SIZE * nLanes];
+
+	const uint8_t* m_pPRG;
+	size_t m_nPRGMask;
+	uint64_t m_nSteps;
+};
+}
+
+#endif
@@ -0,0 +1,279 @@
+#include "machine.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <cstddef>
+#include <cstring>
+
+namespace pane {
+uint64_t HashMachineState(const MachineState& xState) {
+	CPUState xCPU;
+	std::memcpy(&xCPU, &xState.xCPU, sizeof(CPUState));
+	xCPU.nIdleCycles = 0;
+	uint64_t nHash = HashBytes(&xCPU, sizeof(CPUState));
+	return HashBytes(&xState.xPPU, sizeof(MachineState) - offsetof(MachineState, xPPU), nHash);
+}
+
+Machine::Machine()
+ : m_bStopRequested(false), m_nFrameIdleStart(0), m_nFrameIdleCycles(0)
+{
+
+}
+
+Machine::~Machine() {
+
+}
+
+void Machine::Init() {
+	std::shared_ptr<MachineState> pState = std::make_shared<MachineState>();
+	pState->nMagic = PANE_STATE_MAGIC;
+	pState->nVersion = PANE_STATE_VERSION;
+	pState->nSize = sizeof(MachineState);
+	this->Build(pState, true);
+}
+
+void Machine::Build(std::shared_ptr<MachineState> pState, bool bBlockCache) {
+	m_pMMU = std::make_shared<MMU>();
+	m_pCPU = std::make_shared<CPU>();
+	m_pPPU = std::make_shared<PPU>();
+	m_pControllers = std::make_shared<Controllers>();
+
+	m_pState = pState;
+	m_pMMU->Init(&m_pState->xMemory);
+
+	m_pCPU->SetBus(m_pMMU.get());
+	m_pCPU->SetBlockCacheEnabled(bBlockCache);
+	m_pPPU->SetMMU(m_pMMU);
+	m_pPPU->SetCPU(m_pCPU);
+	m_pPPU->SetScheduler(&m_xScheduler);
+	m_pPPU->SetMemory(&m_pState->xVideo);
+	m_pControllers->SetMMU(m_pMMU);
+	m_pControllers->SetState(&m_pState->xInput);
+}
+
+void Machine::Shutdown() {
+	m_pMapper.reset();
+	m_pControllers.reset();
+	m_pCartridge.reset();
+	m_pPPU.reset();
+	m_pCPU->Reset();
+	m_pCPU.reset();
+
+	m_pMMU->Shutdown();
+
+	m_pMMU.reset();
+	m_pState.reset();
+	m_pRunAheadState.reset();
+}
+
+void Machine::Reset() {
+	if (!m_pMMU) {
+		this->Init();
+		return;
+	}
+
+	m_pMapper.reset();
+	m_pCartridge.reset();
+	// Forks may still map pages of the block, only a block of our own can
+	// be cleared in place
+	if (m_pMMU->IsShared()) {
+		this->Unshare();
+	}
+	std::memset(m_pState.get(), 0, sizeof(MachineState));
+	m_pState->nMagic = PANE_STATE_MAGIC;
+	m_pState->nVersion = PANE_STATE_VERSION;
+	m_pState->nSize = sizeof(MachineState);
+
+	// Drops the callbacks the old mapper registered
+	m_xScheduler = Scheduler();
+	m_pMMU->Reset();
+	m_pCPU->SetJITEnabled(false);
+	m_pCPU->SetBlockCacheEnabled(true);
+	m_pCPU->SetIdleLoopSkipEnabled(true);
+	m_pCPU->ClearBreakpoints();
+	m_pCPU->FlushBlockCache();
+	// Registers of the last job, until Start or LoadState
+	m_pCPU->LoadState(m_pState->xCPU);
+	m_pPPU->Reset();
+	// The MMU's map lost the register windows along with the mapper's
+	m_pPPU->SetMMU(m_pMMU);
+	m_pPPU->SetScheduler(&m_xScheduler);
+	m_pControllers->SetMMU(m_pMMU);
+
+	m_bStopRequested.store(false, std::memory_order_relaxed);
+	m_nFrameIdleStart = m_nFrameIdleCycles = 0;
+}
+
+void Machine::InsertCartridge(std::shared_ptr<const Cartridge> pCartridge) {
+	std::unique_ptr<Mapper> pMapper = Mapper::Create(pCartridge);
+	pMapper->Attach(m_pMMU, m_pCPU, m_pPPU, &m_xScheduler);
+	pMapper->SetState(&m_pState->xMapper);
+	// Banks the registers select, forks come in with their parent's
+	pMapper->Restore();
+	m_pMapper = std::move(pMapper);
+	m_pCartridge = pCartridge;
+}
+
+void Machine::Start() {
+	m_xScheduler.Reset();
+	// The reset vector is read from the banks it maps
+	if (m_pMapper) {
+		m_pMapper->Reset();
+	}
+	m_pCPU->Start();
+	m_pPPU->Start(m_xScheduler.GetTimestamp());
+	m_pControllers->Start();
+	m_bStopRequested.store(false, std::memory_order_relaxed);
+	m_nFrameIdleStart = m_nFrameIdleCycles = 0;
+}
+
+void Machine::SaveState(MachineState* pState) {
+	std::memcpy(pState, &this->SyncState(), sizeof(MachineState));
+}
+
+const MachineState& Machine::SyncState() {
+	if (m_pMMU->IsShared()) {
+		this->Unshare();
+	}
+	this->SaveRegisters();
+	return *m_pState;
+}
+
+uint64_t Machine::GetStateHash() {
+	return HashMachineState(this->SyncState());
+}
+
+void Machine::SaveRegisters() {
+	m_pCPU->SaveState(&m_pState->xCPU);
+	m_pPPU->SaveState(&m_pState->xPPU);
+	m_xScheduler.SaveState(&m_pState->xScheduler);
+}
+
+void Machine::LoadState(const MachineState& xState) {
+	if (xState.nMagic != PANE_STATE_MAGIC || xState.nVersion != PANE_STATE_VERSION || xState.nSize != sizeof(MachineState)) {
+		throw std::runtime_error("Saved state is not compatible with this version!");
+	}
+
+	// Forks may still be reading the current block
+	if (m_pMMU->IsShared()) {
+		this->Unshare();
+	}
+	std::memcpy(m_pState.get(), &xState, offsetof(MachineState, xMemory));
+	m_pMMU->LoadMemory(xState.xMemory);
+	this->LoadRegisters();
+}
+
+void Machine::LoadRegisters() {
+	m_xScheduler.LoadState(m_pState->xScheduler);
+	m_pPPU->LoadState(m_pState->xPPU);
+	m_pCPU->LoadState(m_pState->xCPU);
+	if (m_pMapper) {
+		m_pMapper->Restore();
+	}
+
+	m_bStopRequested.store(false, std::memory_order_relaxed);
+	m_nFrameIdleStart = m_pState->xCPU.nIdleCycles;
+	m_nFrameIdleCycles = 0;
+}
+
+std::unique_ptr<Machine> Machine::Fork() {
+	this->SaveRegisters();
+
+	// Left uninitialized, Share copies the parts of the memory section it
+	// doesn't map elsewhere
+	std::shared_ptr<MachineState> pState(new MachineState);
+	std::memcpy(pState.get(), m_pState.get(), offsetof(MachineState, xMemory));
+
+	std::unique_ptr<Machine> pChild = std::make_unique<Machine>();
+	pChild->Build(pState, false);
+	// ROM is mapped in place, not shared through the MMU
+	if (m_pCartridge) {
+		pChild->InsertCartridge(m_pCartridge);
+	}
+	pChild->m_pMMU->Share(*m_pMMU, m_pState);
+	pChild->LoadRegisters();
+	return pChild;
+}
+
+// Moves this machine onto a block of its own, the old one stays alive for
+// as long as forks map pages of it
+void Machine::Unshare() {
+	std::shared_ptr<MachineState> pState(new MachineState);
+	std::memcpy(pState.get(), m_pState.get(), offsetof(MachineState, xMemory));
+	m_pMMU->Unshare(&pState->xMemory);
+	m_pPPU->SetMemory(&pState->xVideo);
+	m_pControllers->SetState(&pState->xInput);
+	if (m_pMapper) {
+		m_pMapper->SetState(&pState->xMapper);
+	}
+	m_pState = pState;
+	// Cached blocks are keyed by host pages that may now be freed and reused
+	m_pCPU->FlushBlockCache();
+}
+
+StopReason Machine::RunFrame() {
+	return this->RunUntil(UINT64_MAX);
+}
+
+StopReason Machine::RunFrameAhead(uint32_t nFrames) {
+	StopReason eStopReason = this->RunFrame();
+	if (eStopReason != STOP_FRAME || nFrames == 0) {
+		return eStopReason;
+	}
+
+	if (!m_pRunAheadState) {
+		m_pRunAheadState = std::make_unique<MachineState>();
+	}
+	uint64_t nFrameIdleCycles = m_nFrameIdleCycles;
+	this->SaveState(m_pRunAheadState.get());
+	for (uint32_t i = 0; i < nFrames && this->RunFrame() == STOP_FRAME; i++) {
+	}
+	this->LoadState(*m_pRunAheadState);
+	// Stats describe the real frame
+	m_nFrameIdleCycles = nFrameIdleCycles;
+	return eStopReason;
+}
+
+StopReason Machine::RunUntil(uint64_t nCycle) {
+	while (!m_pPPU->ShouldRender()) {
+		if (m_bStopRequested.exchange(false, std::memory_order_relaxed)) {
+			return STOP_REQUESTED;
+		}
+		uint64_t nTotalCycles = m_pCPU->GetTotalCycles();
+		if (nTotalCycles >= nCycle) {
+			return STOP_CYCLES;
+		}
+
+		// Run the CPU up to the next scheduled event and fire whatever is due.
+		// The PPU is not stepped here, it catches up on register access and in
+		// its own event callbacks.
+		uint64_t nNow = m_xScheduler.GetTimestamp();
+		uint64_t nNext = m_xScheduler.GetNextEventTimestamp();
+		if (nNext > nNow) {
+			uint64_t nBudget = (nNext - nNow + PANE_MASTER_CLOCKS_PER_CPU_CYCLE - 1) / PANE_MASTER_CLOCKS_PER_CPU_CYCLE;
+			nBudget = std::min(nBudget, nCycle - nTotalCycles);
+			int32_t nCycles = static_cast<int32_t>(nBudget) + m_pCPU->RunCycles(static_cast<int32_t>(nBudget));
+			m_xScheduler.Advance(static_cast<uint64_t>(nCycles) * PANE_MASTER_CLOCKS_PER_CPU_CYCLE);
+
+			// Stopped short of the budget, so nothing is due yet
+			if (m_pCPU->IsStopped()) {
+				if (m_pCPU->IsJammed()) {
+					return STOP_JAMMED;
+				}
+				return m_pCPU->IsAtBreakpoint() ? STOP_BREAKPOINT : STOP_REQUESTED;
+			}
+		}
+
+		m_xScheduler.RunDueEvents();
+	}
+	m_pPPU->Rendered();
+
+	uint64_t nIdleCycles = m_pCPU->GetIdleCycles();
+	m_nFrameIdleCycles = nIdleCycles - m_nFrameIdleStart;
+	m_nFrameIdleStart = nIdleCycles;
+	return STOP_FRAME;
+}
+}
+
@@ -0,0 +1,125 @@
+#ifndef CEE_PANE_MACHINE_H_
+#define CEE_PANE_MACHINE_H_
+
+#include <atomic>
+#include <memory>
+
+#include <cstdint>
+
+#include "mmu.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "controllers.h"
+#include "cartridge.h"
+#include "mapper.h"
+#include "state.h"
+
+namespace pane {
+enum StopReason {
+	STOP_NONE = 0,
+	STOP_FRAME,      // The PPU finished a frame
+	STOP_CYCLES,     // The cycle passed to RunUntil was reached
+	STOP_JAMMED,     // The CPU hit an illegal opcode and halted
+	STOP_BREAKPOINT, // The CPU is about to execute a breakpoint
+	STOP_REQUESTED   // RequestStop or CPU::RequestStop was called
+};
+
+// Hash of everything in a state that decides how a machine runs on, see
+// Machine::GetStateHash
+uint64_t HashMachineState(const MachineState& xState);
+
+// Frontend-free emulation driver. Owns and wires the core components, has no
+// dependency on a window or graphics API.
+class Machine {
+public:
+	Machine();
+	~Machine();
+
+	void Init();
+	void Shutdown();
+	// Back to a machine fresh from Init without reallocating it: zeroed
+	// state, no cartridge or mapper, default CPU settings and no
+	// breakpoints. Inits a machine that wasn't yet.
+	void Reset();
+
+	// Maps the cartridge's PRG and CHR straight from its image through a
+	// mapper for its board, before Start. Throws if the board isn't
+	// supported.
+	void InsertCartridge(std::shared_ptr<const Cartridge> pCartridge);
+	std::shared_ptr<const Cartridge> GetCartridge() const { return m_pCartridge; }
+
+	void Start();
+	// Runs until the current frame completes or something stops it first.
+	StopReason RunFrame();
+	// Runs-ahead to hide input lag: runs the frame like RunFrame, then
+	// nFrames more with the same input, and restores the state after the
+	// first. The pixels are left from the last one.
+	StopReason RunFrameAhead(uint32_t nFrames);
+	// Runs until the CPU has executed nCycle cycles in total (STOP_CYCLES),
+	// stopping early at the end of a frame like RunFrame. Never throws, a
+	// jammed CPU keeps returning STOP_JAMMED until Start.
+	StopReason RunUntil(uint64_t nCycle);
+	// Safe from other threads, takes effect at the next scheduled event.
+	void RequestStop() { m_bStopRequested.store(true, std::memory_order_relaxed); }
+
+	// Snapshots of everything but the pixel buffer, only valid between runs.
+	// LoadState throws if the state comes from an incompatible version.
+	void SaveState(MachineState* pState);
+	void LoadState(const MachineState& xState);
+	// The live block with registers brought up to date, for readers that
+	// want to avoid a copy. Stale as soon as the machine runs again.
+	const MachineState& SyncState();
+	// Hash of everything that decides how the machine runs on, for checking
+	// replays against recordings. Counters that depend on how it was run
+	// (idle cycles skipped) are left out, so runs with and without the
+	// block cache or JIT hash the same.
+	uint64_t GetStateHash();
+
+	// A new machine in the exact same state, for searching a tree of inputs.
+	// Its RAM and cartridge memory is mapped onto this machine's
+	// copy-on-write a page at a time, so a fork costs a copy of the
+	// registers and video memory plus one page per page either side writes.
+	// Forks start without the block cache (enable it on the child's CPU if it
+	// runs long) and may outlive this machine. Saving or loading state
+	// gathers a machine's memory back into one block first.
+	std::unique_ptr<Machine> Fork();
+
+	// CPU cycles fast-forwarded through polling loops during the last frame
+	uint64_t GetIdleCycles() const { return m_nFrameIdleCycles; }
+
+	const uint8_t* GetPixels() const { return m_pPPU->GetPixels(); }
+
+	std::shared_ptr<MMU> GetMMU() const { return m_pMMU; }
+	std::shared_ptr<CPU> GetCPU() const { return m_pCPU; }
+	std::shared_ptr<PPU> GetPPU() const { return m_pPPU; }
+	std::shared_ptr<Controllers> GetControllers() const { return m_pControllers; }
+	Scheduler* GetScheduler() { return &m_xScheduler; }
+
+private:
+	void Build(std::shared_ptr<MachineState> pState, bool bBlockCache);
+	void SaveRegisters();
+	void LoadRegisters();
+	void Unshare();
+
+private:
+	std::shared_ptr<MMU> m_pMMU;
+	std::shared_ptr<CPU> m_pCPU;
+	std::shared_ptr<PPU> m_pPPU;
+	std::shared_ptr<Controllers> m_pControllers;
+	std::shared_ptr<const Cartridge> m_pCartridge;
+	std::unique_ptr<Mapper> m_pMapper;
+
+	Scheduler m_xScheduler;
+	// Memory of every component lives here, see MachineState. Shared with
+	// forks that still map pages of it.
+	std::shared_ptr<MachineState> m_pState;
+	std::unique_ptr<MachineState> m_pRunAheadState;
+	std::atomic<bool> m_bStopRequested;
+	uint64_t m_nFrameIdleStart;
+	uint64_t m_nFrameIdleCycles;
+};
+}
+
+#endif
+
@@ -1,23 +1,191 @@
 #include <stdexcept>
 #include <iostream>
+#include <string>
 
 #include <cstdlib>
+#include <cstring>
 
 #include "emulator.h"
 
+static void PrintUsage(const char* sProgram) {
+	std::cout << "Usage: " << sProgram << " [--rom FILE] [--headless] [--frames N] [--jit [--perf-map]] [--rewind] [--run-ahead N] [--record FILE | --play FILE [--seek N]] [--keyframes N] [--verify FILE [--threads N]]" << std::endl;
+	std::cout << "  --rom FILE  Insert an iNES or NES 2.0 cartridge image" << std::endl;
+	std::cout << "  --headless  Run without a window or GL context, uncapped" << std::endl;
+	std::cout << "  --frames N  Exit after N emulated frames (headless only)" << std::endl;
+	std::cout << "  --jit       Translate hot CPU blocks to host code" << std::endl;
+	std::cout << "  --perf-map  Write /tmp/perf-<pid>.map for translated code" << std::endl;
+	std::cout << "  --rewind    Record every frame, hold backspace to step back" << std::endl;
+	std::cout << "  --run-ahead N  Present N frames ahead to hide input lag" << std::endl;
+	std::cout << "  --record FILE  Record the input of every frame to a movie" << std::endl;
+	std::cout << "  --play FILE    Replay a movie, headless runs it to the end and checks the end state" << std::endl;
+	std::cout << "  --seek N       Start the replay at frame N, from the nearest keyframe" << std::endl;
+	std::cout << "  --keyframes N  Save a keyframe to FILE.keyframes every N movie frames, 0 for none (default 600)" << std::endl;
+	std::cout << "  --verify FILE  Check a movie replays as recorded, its keyframe segments in parallel" << std::endl;
+	std::cout << "  --threads N    Threads for --verify, 0 for all (default)" << std::endl;
+}
+
 int main(int argc, char** argv) {
+	bool bHeadless = false;
+	bool bJIT = false;
+	bool bPerfMap = false;
+	bool bRewind = false;
+	uint32_t nRunAhead = 0;
+	uint64_t nFrames = 0;
+	bool bFrames = false;
+	const char* sROM = nullptr;
+	const char* sRecord = nullptr;
+	const char* sPlay = nullptr;
+	uint64_t nSeek = 0;
+	const char* sVerify = nullptr;
+	size_t nThreads = 0;
+	uint32_t nKeyframeInterval = PANE_KEYFRAME_DEFAULT_INTERVAL;
+
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--headless") == 0) {
+			bHeadless = true;
+		} else if (std::strcmp(argv[i], "--jit") == 0) {
+			bJIT = true;
+		} else if (std::strcmp(argv[i], "--perf-map") == 0) {
+			bPerfMap = true;
+		} else if (std::strcmp(argv[i], "--rewind") == 0) {
+			bRewind = true;
+		} else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			try {
+				nFrames = std::stoull(argv[++i]);
+				bFrames = true;
+			} catch (const std::exception&) {
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+			}
+		} else if (std::strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc) {
+			try {
+				nRunAhead = static_cast<uint32_t>(std::stoul(argv[++i]));
+			} catch (const std::exception&) {
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+			}
+		} else if (std::strcmp(argv[i], "--seek") == 0 && i + 1 < argc) {
+			try {
+				nSeek = std::stoull(argv[++i]);
+			} catch (const std::exception&) {
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+			}
+		} else if (std::strcmp(argv[i], "--keyframes") == 0 && i + 1 < argc) {
+			try {
+				nKeyframeInterval = static_cast<uint32_t>(std::stoul(argv[++i]));
+			} catch (const std::exception&) {
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+			}
+		} else if (std::strcmp(argv[i], "--rom") == 0 && i + 1 < argc) {
+			sROM = argv[++i];
+		} else if (std::strcmp(argv[i], "--verify") == 0 && i + 1 < argc) {
+			sVerify = argv[++i];
+		} else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			try {
+				nThreads = std::stoul(argv[++i]);
+			} catch (const std::exception&) {
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+			}
+		} else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc && sPlay == nullptr) {
+			sRecord = argv[++i];
+		} else if (std::strcmp(argv[i], "--play") == 0 && i + 1 < argc && sRecord == nullptr) {
+			sPlay = argv[++i];
+		} else {
+			PrintUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// The windowed loop runs until it is closed
+	if (bFrames && !bHeadless && sVerify == nullptr) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
 
 	pane::Emulator emu;
+	if (sVerify != nullptr) {
+		bHeadless = true;
+		sPlay = sVerify;
+		sRecord = nullptr;
+	}
 
 	try {
-		emu.Init();
+		emu.Init(bHeadless);
+		if (sROM != nullptr) {
+			emu.LoadROM(sROM);
+		}
+		if (bJIT) {
+			emu.GetMachine()->GetCPU()->SetJITEnabled(true);
+			emu.GetMachine()->GetCPU()->SetJITPerfMapEnabled(bPerfMap);
+		}
+		emu.SetRewindEnabled(bRewind);
+		emu.SetRunAhead(nRunAhead);
+		emu.SetKeyframeInterval(nKeyframeInterval);
+		emu.SetMovieSeek(nSeek);
+		if (sRecord != nullptr) {
+			emu.RecordMovie(sRecord);
+		} else if (sPlay != nullptr) {
+			emu.PlayMovie(sPlay);
+		}
 	} catch (const std::runtime_error& e) {
 		std::cout << "Initialization error: " << e.what() << std::endl;
 		return EXIT_FAILURE;
 	}
 
 	try {
-		emu.Run();
+		if (sVerify != nullptr) {
+			pane::VerifyResult xResult = emu.VerifyMovieSegments(nThreads);
+			std::cout << "Verified " << xResult.nFrames << " frames as " << xResult.nSegments << " segments in "
+			          << xResult.nSeconds << "s (" << (xResult.nSeconds > 0.0 ? xResult.nFrames / xResult.nSeconds : 0.0)
+			          << " fps)" << std::endl;
+			if (!xResult.bMatch) {
+				std::cout << "Movie diverges from the recording at frame " << xResult.nDivergedFrame << std::endl;
+				emu.Shutdown();
+				return EXIT_FAILURE;
+			}
+			std::cout << "Movie replays as recorded" << std::endl;
+		} else if (bHeadless) {
+			pane::RunStats xStats = emu.RunHeadless(nFrames);
+			if (emu.GetMovieMode() == pane::MOVIE_MODE_PLAY && nSeek > 0) {
+				const pane::SeekStats& xSeek = emu.GetSeekStats();
+				std::cout << "Seeked to frame " << xSeek.nFrame << " from the keyframe at " << xSeek.nKeyframe << " in "
+				          << xSeek.nSeconds * 1e3 << " ms" << std::endl;
+			}
+			std::cout << "Emulated " << xStats.nFrames << " frames in " << xStats.nSeconds << "s ("
+			          << xStats.GetFramesPerSecond() << " fps)" << std::endl;
+			if (xStats.nFrames != 0) {
+				std::cout << "Skipped " << xStats.nIdleCycles / xStats.nFrames << " idle CPU cycles per frame" << std::endl;
+			}
+			if (emu.GetRewindBuffer() != nullptr) {
+				pane::RewindStats xRewind = emu.GetRewindBuffer()->GetStats();
+				std::cout << "Rewind: " << xRewind.nSnapshots << " steps in " << xRewind.nBytesUsed << " bytes, "
+				          << xRewind.GetBytesPerSnapshot() << " bytes and " << xRewind.GetSecondsPerSnapshot() * 1e6
+				          << " us per snapshot" << std::endl;
+			}
+			// Scripted runs rely on anything short of the requested frames failing
+			if (xStats.eStopReason != pane::STOP_FRAME) {
+				if (xStats.eStopReason == pane::STOP_JAMMED) {
+					std::cout << "CPU jammed on an illegal opcode" << std::endl;
+				} else {
+					std::cout << "Emulation stopped early after " << xStats.nFrames << " frames" << std::endl;
+				}
+				emu.Shutdown();
+				return EXIT_FAILURE;
+			}
+			if (emu.GetMovieMode() == pane::MOVIE_MODE_PLAY && nFrames == 0) {
+				if (!emu.VerifyMovie()) {
+					std::cout << "Movie desynced, end state differs from the recording" << std::endl;
+					emu.Shutdown();
+					return EXIT_FAILURE;
+				}
+				std::cout << "Movie verified, " << emu.GetMovie()->GetFrameCount() << " frames end in the recorded state" << std::endl;
+			}
+		} else {
+			emu.Run();
+		}
 	} catch (const std::runtime_error& e) {
 		std::cout << "Emulation error: " << e.what() << std::endl;
 		emu.Shutdown();
@@ -0,0 +1,88 @@
+#include "mappedfile.h"
+
+#include <stdexcept>
+
+#include <cstdio>
+
+#ifdef PANE_MMAP_SUPPORTED
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace pane {
+// Empty files still get a valid pointer so IsOpen holds
+static const uint8_t s_pEmpty[1] = { 0 };
+
+MappedFile::MappedFile()
+ : m_pData(nullptr), m_nSize(0)
+{
+
+}
+
+MappedFile::~MappedFile() {
+	this->Close();
+}
+
+void MappedFile::Open(const std::string& sPath) {
+	this->Close();
+
+#ifdef PANE_MMAP_SUPPORTED
+	int nFile = open(sPath.c_str(), O_RDONLY);
+	if (nFile < 0) {
+		throw std::runtime_error("Failed to open " + sPath + "!");
+	}
+	struct stat xStat;
+	if (fstat(nFile, &xStat) != 0) {
+		close(nFile);
+		throw std::runtime_error("Failed to stat " + sPath + "!");
+	}
+
+	m_nSize = static_cast<size_t>(xStat.st_size);
+	if (m_nSize == 0) {
+		m_pData = s_pEmpty;
+	} else {
+		void* pData = mmap(nullptr, m_nSize, PROT_READ, MAP_PRIVATE, nFile, 0);
+		if (pData == MAP_FAILED) {
+			close(nFile);
+			m_nSize = 0;
+			throw std::runtime_error("Failed to map " + sPath + "!");
+		}
+		m_pData = reinterpret_cast<const uint8_t*>(pData);
+	}
+	// The mapping keeps the file alive
+	close(nFile);
+#else
+	std::FILE* pFile = std::fopen(sPath.c_str(), "rb");
+	if (pFile == nullptr) {
+		throw std::runtime_error("Failed to open " + sPath + "!");
+	}
+	long nSize = std::fseek(pFile, 0, SEEK_END) == 0 ? std::ftell(pFile) : -1;
+	bool bRead = nSize >= 0 && std::fseek(pFile, 0, SEEK_SET) == 0;
+	if (bRead && nSize > 0) {
+		m_pBuffer = std::make_unique<uint8_t[]>(static_cast<size_t>(nSize));
+		bRead = std::fread(m_pBuffer.get(), static_cast<size_t>(nSize), 1, pFile) == 1;
+	}
+	std::fclose(pFile);
+	if (!bRead) {
+		m_pBuffer.reset();
+		throw std::runtime_error("Failed to read " + sPath + "!");
+	}
+	m_nSize = static_cast<size_t>(nSize);
+	m_pData = m_nSize > 0 ? m_pBuffer.get() : s_pEmpty;
+#endif
+}
+
+void MappedFile::Close() {
+#ifdef PANE_MMAP_SUPPORTED
+	if (m_pData != nullptr && m_pData != s_pEmpty) {
+		munmap(const_cast<uint8_t*>(m_pData), m_nSize);
+	}
+#else
+	m_pBuffer.reset();
+#endif
+	m_pData = nullptr;
+	m_nSize = 0;
+}
+}
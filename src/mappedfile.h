@@ -0,0 +1,40 @@
+#ifndef CEE_PANE_MAPPEDFILE_H_
+#define CEE_PANE_MAPPEDFILE_H_
+
+#include <memory>
+#include <string>
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PANE_MMAP_SUPPORTED
+#endif
+
+namespace pane {
+// Read-only view of a whole file. Mapped where the platform can, so opening
+// costs nothing up front and pages come in as they are touched, otherwise
+// read into memory.
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	// Throws if the file can't be opened or mapped
+	void Open(const std::string& sPath);
+	void Close();
+
+	bool IsOpen() const { return m_pData != nullptr; }
+	const uint8_t* GetData() const { return m_pData; }
+	size_t GetSize() const { return m_nSize; }
+
+private:
+	const uint8_t* m_pData;
+	size_t m_nSize;
+#ifndef PANE_MMAP_SUPPORTED
+	std::unique_ptr<uint8_t[]> m_pBuffer;
+#endif
+};
+}
+
+#endif
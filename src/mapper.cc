@@ -0,0 +1,491 @@
+#include "mapper.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include <cstring>
+
+namespace pane {
+// Splits a window that runs past the end of the ROM, or is larger than it,
+// into pieces that don't
+template <typename MapFunction>
+static void MapWrapped(uint16_t pAddress, size_t nSize, uint32_t nBank, size_t nROMSize, MapFunction fnMap) {
+	size_t nOffset = (static_cast<size_t>(nBank) * nSize) % nROMSize;
+	for (size_t nDone = 0; nDone < nSize; ) {
+		size_t nChunk = std::min(nSize - nDone, nROMSize - nOffset);
+		fnMap(static_cast<uint16_t>(pAddress + nDone), nChunk, nOffset);
+		nDone += nChunk;
+		nOffset = (nOffset + nChunk) % nROMSize;
+	}
+}
+
+Mapper::Mapper(std::shared_ptr<const Cartridge> pCartridge)
+ : m_pCartridge(pCartridge)
+{
+
+}
+
+void Mapper::Attach(std::shared_ptr<MMU> pMMU, std::shared_ptr<CPU> pCPU, std::shared_ptr<PPU> pPPU, Scheduler* pScheduler) {
+	m_pMMU = pMMU;
+	m_pCPU = pCPU;
+	m_pPPU = pPPU;
+	m_pScheduler = pScheduler;
+	this->OnAttach();
+}
+
+void Mapper::Reset() {
+	std::memset(m_pState, 0, sizeof(MapperState));
+	this->Restore();
+}
+
+void Mapper::MapPRG(uint16_t pAddress, size_t nSize, uint32_t nBank) {
+	const uint8_t* pPRG = m_pCartridge->GetPRG();
+	MapWrapped(pAddress, nSize, nBank, m_pCartridge->GetPRGSize(), [&](uint16_t pStart, size_t nChunk, size_t nOffset) {
+		m_pMMU->MapROM(pStart, nChunk, pPRG + nOffset, Mapper::WriteRegister, this);
+	});
+}
+
+void Mapper::MapCHR(uint16_t pAddress, size_t nSize, uint32_t nBank) {
+	const uint8_t* pCHR = m_pCartridge->GetCHR();
+	if (pCHR == nullptr) {
+		MapWrapped(pAddress, nSize, nBank, 0x2000, [&](uint16_t pStart, size_t nChunk, size_t nOffset) {
+			m_pPPU->MapPatternRAM(pStart, nChunk, nOffset);
+		});
+		return;
+	}
+	MapWrapped(pAddress, nSize, nBank, m_pCartridge->GetCHRSize(), [&](uint16_t pStart, size_t nChunk, size_t nOffset) {
+		m_pPPU->MapPatterns(pStart, nChunk, pCHR + nOffset);
+	});
+}
+
+void Mapper::WriteRegister(void* pUserData, uint16_t pAddress, uint8_t cVal) {
+	reinterpret_cast<Mapper*>(pUserData)->Write(pAddress, cVal);
+}
+
+// Mapper 0, 16K or 32K of PRG and 8K of CHR with nothing to switch. Mapper
+// 3 (CNROM) is the same board with a CHR bank register.
+class NROM : public Mapper {
+public:
+	NROM(std::shared_ptr<const Cartridge> pCartridge) : Mapper(pCartridge) {}
+
+	virtual void Restore() {
+		// NROM-128 mirrors its 16K at 0xC000
+		this->MapPRG(0x8000, 0x4000, 0);
+		this->MapPRG(0xC000, 0x4000, this->GetPRGBankCount(0x4000) - 1);
+		this->MapCHR(0x0000, 0x2000, m_pState->pRegisters[0]);
+		m_pPPU->SetMirroring(m_pCartridge->GetMirroring());
+	}
+};
+
+class CNROM : public NROM {
+public:
+	CNROM(std::shared_ptr<const Cartridge> pCartridge) : NROM(pCartridge) {}
+
+protected:
+	virtual void Write(uint16_t pAddress, uint8_t cVal) {
+		m_pState->pRegisters[0] = cVal;
+		this->MapCHR(0x0000, 0x2000, cVal);
+	}
+};
+
+// Mapper 2, a switchable 16K PRG bank at 0x8000 and the last one fixed at
+// 0xC000. CHR is usually RAM.
+class UxROM : public Mapper {
+public:
+	UxROM(std::shared_ptr<const Cartridge> pCartridge) : Mapper(pCartridge) {}
+
+	virtual void Restore() {
+		this->MapPRG(0x8000, 0x4000, m_pState->pRegisters[0]);
+		this->MapPRG(0xC000, 0x4000, this->GetPRGBankCount(0x4000) - 1);
+		this->MapCHR(0x0000, 0x2000, 0);
+		m_pPPU->SetMirroring(m_pCartridge->GetMirroring());
+	}
+
+protected:
+	virtual void Write(uint16_t pAddress, uint8_t cVal) {
+		m_pState->pRegisters[0] = cVal;
+		this->MapPRG(0x8000, 0x4000, cVal);
+	}
+};
+
+// Mapper 1, registers are loaded a bit at a time through a serial port.
+// Boards with 512K of PRG (SUROM) pick the 256K half with CHR bank 0 bit 4.
+class MMC1 : public Mapper {
+public:
+	MMC1(std::shared_ptr<const Cartridge> pCartridge) : Mapper(pCartridge) {}
+
+	virtual void Reset() {
+		std::memset(m_pState, 0, sizeof(MapperState));
+		// 16K PRG mode with the last bank fixed at 0xC000
+		m_pState->pRegisters[MMC1_CONTROL] = 0x0C;
+		this->Restore();
+	}
+
+	virtual void Restore() {
+		this->MapPRGBanks();
+		this->MapCHRBanks();
+		this->MapMirroring();
+	}
+
+protected:
+	virtual void Write(uint16_t pAddress, uint8_t cVal) {
+		uint8_t* pRegisters = m_pState->pRegisters;
+		if (cVal & 0x80) {
+			pRegisters[MMC1_SHIFT] = pRegisters[MMC1_SHIFT_COUNT] = 0;
+			pRegisters[MMC1_CONTROL] |= 0x0C;
+			this->MapPRGBanks();
+			return;
+		}
+
+		pRegisters[MMC1_SHIFT] |= (cVal & 0x01) << pRegisters[MMC1_SHIFT_COUNT];
+		if (++pRegisters[MMC1_SHIFT_COUNT] < 5) {
+			return;
+		}
+		// The fifth write picks the register with its address
+		uint8_t nRegister = MMC1_CONTROL + ((pAddress >> 13) & 0x03);
+		uint8_t nChanged = pRegisters[nRegister] ^ pRegisters[MMC1_SHIFT];
+		pRegisters[nRegister] = pRegisters[MMC1_SHIFT];
+		pRegisters[MMC1_SHIFT] = pRegisters[MMC1_SHIFT_COUNT] = 0;
+
+		switch (nRegister) {
+		case MMC1_CONTROL:
+			this->Restore();
+			break;
+		case MMC1_CHR0:
+			this->MapCHRBanks();
+			if ((nChanged & 0x10) && m_pCartridge->GetPRGSize() > 0x40000) {
+				this->MapPRGBanks();
+			}
+			break;
+		case MMC1_CHR1:
+			this->MapCHRBanks();
+			break;
+		case MMC1_PRG:
+			this->MapPRGBanks(false);
+			break;
+		}
+	}
+
+private:
+	enum Register {
+		MMC1_SHIFT = 0,
+		MMC1_SHIFT_COUNT,
+		MMC1_CONTROL,
+		MMC1_CHR0,
+		MMC1_CHR1,
+		MMC1_PRG
+	};
+
+	// bFixed = false leaves the fixed 16K bank where it is
+	void MapPRGBanks(bool bFixed = true) {
+		const uint8_t* pRegisters = m_pState->pRegisters;
+		uint32_t nOuter = m_pCartridge->GetPRGSize() > 0x40000 ? pRegisters[MMC1_CHR0] & 0x10 : 0;
+		uint32_t nBank = pRegisters[MMC1_PRG] & 0x0F;
+		switch ((pRegisters[MMC1_CONTROL] >> 2) & 0x03) {
+		case 0:
+		case 1:
+			this->MapPRG(0x8000, 0x8000, (nOuter | nBank) >> 1);
+			break;
+		case 2:
+			if (bFixed) {
+				this->MapPRG(0x8000, 0x4000, nOuter);
+			}
+			this->MapPRG(0xC000, 0x4000, nOuter | nBank);
+			break;
+		case 3:
+			this->MapPRG(0x8000, 0x4000, nOuter | nBank);
+			if (bFixed) {
+				this->MapPRG(0xC000, 0x4000, nOuter | 0x0F);
+			}
+			break;
+		}
+	}
+
+	void MapCHRBanks() {
+		const uint8_t* pRegisters = m_pState->pRegisters;
+		if (pRegisters[MMC1_CONTROL] & 0x10) {
+			this->MapCHR(0x0000, 0x1000, pRegisters[MMC1_CHR0]);
+			this->MapCHR(0x1000, 0x1000, pRegisters[MMC1_CHR1]);
+		} else {
+			this->MapCHR(0x0000, 0x2000, pRegisters[MMC1_CHR0] >> 1);
+		}
+	}
+
+	void MapMirroring() {
+		static const NametableMirroring s_pMirroring[] = { MIRROR_SINGLE_LOWER, MIRROR_SINGLE_UPPER, MIRROR_VERTICAL, MIRROR_HORIZONTAL };
+		m_pPPU->SetMirroring(s_pMirroring[m_pState->pRegisters[MMC1_CONTROL] & 0x03]);
+	}
+};
+
+// Mapper 4, two switchable 8K PRG banks, 2K and 1K CHR banks and a scanline
+// counter. The real counter is clocked by A12 rising as the PPU fetches
+// sprite patterns near dot 260 of every visible and pre-render scanline
+// with rendering on. Rather than clocking it per scanline, the mapper
+// works out when it will next reach zero and schedules the IRQ for then,
+// catching the counter up only when its registers or rendering change.
+class MMC3 : public Mapper {
+public:
+	MMC3(std::shared_ptr<const Cartridge> pCartridge) : Mapper(pCartridge) {}
+
+	virtual void Restore() {
+		this->MapPRGBanks();
+		this->MapCHRBanks();
+		this->MapMirroring();
+	}
+
+protected:
+	virtual void OnAttach() {
+		m_pScheduler->SetCallback(SCHEDULED_EVENT_MAPPER_IRQ, MMC3::OnIRQ, this);
+		m_pPPU->SetRenderingCallback(MMC3::OnRenderingChanged, this);
+	}
+
+	virtual void Write(uint16_t pAddress, uint8_t cVal) {
+		uint8_t* pRegisters = m_pState->pRegisters;
+		switch (pAddress & 0xE001) {
+		case 0x8000: {
+			uint8_t nModes = (pRegisters[MMC3_BANK_SELECT] ^ cVal) & 0xC0;
+			pRegisters[MMC3_BANK_SELECT] = cVal;
+			if (nModes & 0x40) {
+				this->MapPRGBanks();
+			}
+			if (nModes & 0x80) {
+				this->MapCHRBanks();
+			}
+			break;
+		}
+		case 0x8001: {
+			uint8_t nBank = pRegisters[MMC3_BANK_SELECT] & 0x07;
+			pRegisters[MMC3_BANK_DATA + nBank] = cVal;
+			// Only the window of the register moves
+			if (nBank >= 6) {
+				this->MapPRGBank(nBank);
+			} else {
+				this->MapCHRBank(nBank);
+			}
+			break;
+		}
+		case 0xA000:
+			pRegisters[MMC3_MIRRORING] = cVal & 0x01;
+			this->MapMirroring();
+			break;
+		case 0xA001:
+			// PRG RAM protect, the RAM is always enabled here
+			break;
+		case 0xC000:
+			this->SyncCounter(this->GetCPUTimestamp());
+			pRegisters[MMC3_IRQ_LATCH] = cVal;
+			this->ScheduleIRQ();
+			break;
+		case 0xC001:
+			this->SyncCounter(this->GetCPUTimestamp());
+			pRegisters[MMC3_IRQ_COUNTER] = 0;
+			pRegisters[MMC3_IRQ_RELOAD] = 1;
+			this->ScheduleIRQ();
+			break;
+		case 0xE000:
+			this->SyncCounter(this->GetCPUTimestamp());
+			pRegisters[MMC3_IRQ_ENABLED] = 0;
+			m_pCPU->CancelInterrupt(INT_IRQ);
+			this->ScheduleIRQ();
+			break;
+		case 0xE001:
+			this->SyncCounter(this->GetCPUTimestamp());
+			pRegisters[MMC3_IRQ_ENABLED] = 1;
+			this->ScheduleIRQ();
+			break;
+		}
+	}
+
+private:
+	enum Register {
+		MMC3_BANK_SELECT = 0,
+		// R0 - R7
+		MMC3_BANK_DATA,
+		MMC3_MIRRORING = MMC3_BANK_DATA + 8,
+		MMC3_IRQ_LATCH,
+		MMC3_IRQ_COUNTER,
+		MMC3_IRQ_RELOAD,
+		MMC3_IRQ_ENABLED,
+		// Rendering was on when the counter was last caught up
+		MMC3_IRQ_CLOCKING
+	};
+
+	static const uint32_t s_nCounterDot = 260;
+	static const uint32_t s_nClocksPerFrame = PANE_NES_VISIBLE_IMAGE_HEIGHT + 1;
+	static const uint64_t s_nFrameLength = static_cast<uint64_t>(PANE_NES_DOTS_PER_FRAME) * PANE_MASTER_CLOCKS_PER_PPU_DOT;
+
+	// R6 at 0x8000 or 0xC000 with the second last bank in the other, R7 at
+	// 0xA000 and the last bank fixed at 0xE000
+	void MapPRGBanks() {
+		uint32_t nSecondLast = this->GetPRGBankCount(0x2000) - 2;
+		bool bSwapped = (m_pState->pRegisters[MMC3_BANK_SELECT] & 0x40) != 0;
+		this->MapPRG(bSwapped ? 0x8000 : 0xC000, 0x2000, nSecondLast);
+		this->MapPRG(0xE000, 0x2000, nSecondLast + 1);
+		this->MapPRGBank(6);
+		this->MapPRGBank(7);
+	}
+
+	void MapPRGBank(uint8_t nBank) {
+		bool bSwapped = (m_pState->pRegisters[MMC3_BANK_SELECT] & 0x40) != 0;
+		uint16_t pWindow = nBank == 7 ? 0xA000 : (bSwapped ? 0xC000 : 0x8000);
+		this->MapPRG(pWindow, 0x2000, m_pState->pRegisters[MMC3_BANK_DATA + nBank]);
+	}
+
+	void MapCHRBanks() {
+		for (uint8_t nBank = 0; nBank < 6; nBank++) {
+			this->MapCHRBank(nBank);
+		}
+	}
+
+	// R0 and R1 are 2K banks at 0x0000 and 0x0800, R2 - R5 1K banks from
+	// 0x1000. Bank select bit 7 swaps the halves.
+	void MapCHRBank(uint8_t nBank) {
+		uint8_t nValue = m_pState->pRegisters[MMC3_BANK_DATA + nBank];
+		uint16_t nInvert = (m_pState->pRegisters[MMC3_BANK_SELECT] & 0x80) ? 0x1000 : 0x0000;
+		if (nBank < 2) {
+			this->MapCHR((nBank * 0x0800) ^ nInvert, 0x0800, nValue >> 1);
+		} else {
+			this->MapCHR((0x1000 + (nBank - 2) * 0x0400) ^ nInvert, 0x0400, nValue);
+		}
+	}
+
+	void MapMirroring() {
+		m_pPPU->SetMirroring(m_pState->pRegisters[MMC3_MIRRORING] ? MIRROR_HORIZONTAL : MIRROR_VERTICAL);
+	}
+
+	// Frames are all the same length, so counter clocks fall on a fixed grid
+	// from where the PPU started
+	uint64_t GetCounterOrigin() const {
+		return m_pPPU->GetFrameStart() - m_pPPU->GetFrameCount() * s_nFrameLength;
+	}
+
+	// Counter clocks at or before nTimestamp, whether rendering was on or not
+	uint64_t CountClocks(uint64_t nTimestamp) const {
+		uint64_t nOrigin = this->GetCounterOrigin();
+		if (nTimestamp < nOrigin) {
+			return 0;
+		}
+		uint64_t nElapsed = nTimestamp - nOrigin;
+		uint64_t nDot = (nElapsed % s_nFrameLength) / PANE_MASTER_CLOCKS_PER_PPU_DOT;
+		uint64_t nClocks = (nElapsed / s_nFrameLength) * s_nClocksPerFrame;
+		if (nDot >= s_nCounterDot) {
+			nClocks += std::min<uint64_t>((nDot - s_nCounterDot) / PANE_NES_DOTS_PER_SCANLINE + 1, PANE_NES_VISIBLE_IMAGE_HEIGHT);
+		}
+		if (nDot >= PANE_NES_PRERENDER_SCANLINE * PANE_NES_DOTS_PER_SCANLINE + s_nCounterDot) {
+			nClocks++;
+		}
+		return nClocks;
+	}
+
+	// Timestamp of the nClock-th counter clock, counting from 1
+	uint64_t GetClockTimestamp(uint64_t nClock) const {
+		uint64_t nIndex = nClock - 1;
+		uint64_t nScanline = nIndex % s_nClocksPerFrame;
+		if (nScanline == PANE_NES_VISIBLE_IMAGE_HEIGHT) {
+			nScanline = PANE_NES_PRERENDER_SCANLINE;
+		}
+		uint64_t nDot = nScanline * PANE_NES_DOTS_PER_SCANLINE + s_nCounterDot;
+		return this->GetCounterOrigin() + (nIndex / s_nClocksPerFrame) * s_nFrameLength + nDot * PANE_MASTER_CLOCKS_PER_PPU_DOT;
+	}
+
+	// Applies the clocks since the counter was last caught up, if rendering
+	// was on for them
+	void SyncCounter(uint64_t nTimestamp) {
+		uint8_t* pRegisters = m_pState->pRegisters;
+		uint64_t nClocks = this->CountClocks(nTimestamp);
+		if (nClocks > m_pState->nCounterClocks) {
+			if (pRegisters[MMC3_IRQ_CLOCKING]) {
+				this->ClockCounter(nClocks - m_pState->nCounterClocks);
+			}
+			m_pState->nCounterClocks = nClocks;
+		}
+		pRegisters[MMC3_IRQ_CLOCKING] = m_pPPU->IsRenderingEnabled();
+	}
+
+	// Each clock reloads a counter that is zero or due a reload and
+	// decrements it otherwise
+	void ClockCounter(uint64_t nClocks) {
+		uint8_t* pRegisters = m_pState->pRegisters;
+		uint8_t nLatch = pRegisters[MMC3_IRQ_LATCH];
+		uint8_t& nCounter = pRegisters[MMC3_IRQ_COUNTER];
+		if (nCounter == 0 || pRegisters[MMC3_IRQ_RELOAD]) {
+			nCounter = nLatch;
+		} else {
+			nCounter--;
+		}
+		pRegisters[MMC3_IRQ_RELOAD] = 0;
+		nClocks--;
+
+		if (nClocks <= nCounter) {
+			nCounter -= static_cast<uint8_t>(nClocks);
+			return;
+		}
+		// From zero it goes round every nLatch + 1 clocks
+		nClocks -= nCounter;
+		nCounter = nLatch == 0 ? 0 : static_cast<uint8_t>(nLatch - (nClocks - 1) % (nLatch + 1));
+	}
+
+	void ScheduleIRQ() {
+		const uint8_t* pRegisters = m_pState->pRegisters;
+		if (!pRegisters[MMC3_IRQ_ENABLED] || !pRegisters[MMC3_IRQ_CLOCKING]) {
+			m_pScheduler->Cancel(SCHEDULED_EVENT_MAPPER_IRQ);
+			return;
+		}
+
+		// Clocks until the counter next ends up at zero
+		uint32_t nClocks = pRegisters[MMC3_IRQ_COUNTER];
+		if (nClocks == 0 || pRegisters[MMC3_IRQ_RELOAD]) {
+			nClocks = pRegisters[MMC3_IRQ_LATCH] + 1;
+		}
+		m_pScheduler->Schedule(SCHEDULED_EVENT_MAPPER_IRQ, this->GetClockTimestamp(m_pState->nCounterClocks + nClocks), MMC3::OnIRQ, this);
+		// Registers are written mid-run, the CPU's budget was set without the
+		// IRQ in mind
+		m_pCPU->EndRun();
+	}
+
+	static void OnIRQ(void* pUserData, uint64_t nTimestamp) {
+		MMC3* pMMC3 = reinterpret_cast<MMC3*>(pUserData);
+		pMMC3->SyncCounter(nTimestamp);
+		const uint8_t* pRegisters = pMMC3->m_pState->pRegisters;
+		if (pRegisters[MMC3_IRQ_COUNTER] == 0 && pRegisters[MMC3_IRQ_ENABLED]) {
+			pMMC3->m_pCPU->Interrupt(INT_IRQ);
+		}
+		pMMC3->ScheduleIRQ();
+	}
+
+	static void OnRenderingChanged(void* pUserData, uint64_t nTimestamp) {
+		MMC3* pMMC3 = reinterpret_cast<MMC3*>(pUserData);
+		pMMC3->SyncCounter(nTimestamp);
+		pMMC3->ScheduleIRQ();
+	}
+};
+
+std::unique_ptr<Mapper> Mapper::Create(std::shared_ptr<const Cartridge> pCartridge) {
+	if (pCartridge->GetPRG() == nullptr) {
+		throw std::runtime_error("No cartridge loaded!");
+	}
+	if (pCartridge->HasFourScreenVRAM()) {
+		throw std::runtime_error("Four-screen VRAM is not supported!");
+	}
+	// Banks are mapped in 8K and 1K units at the smallest
+	if (pCartridge->GetPRGSize() % 0x2000 != 0 || pCartridge->GetCHRSize() % PANE_PPU_PAGE_SIZE != 0) {
+		throw std::runtime_error("ROM sizes don't fill whole banks!");
+	}
+
+	switch (pCartridge->GetMapper()) {
+	case 0:
+		return std::make_unique<NROM>(pCartridge);
+	case 1:
+		return std::make_unique<MMC1>(pCartridge);
+	case 2:
+		return std::make_unique<UxROM>(pCartridge);
+	case 3:
+		return std::make_unique<CNROM>(pCartridge);
+	case 4:
+		return std::make_unique<MMC3>(pCartridge);
+	default:
+		throw std::runtime_error("Unsupported mapper " + std::to_string(pCartridge->GetMapper()) + "!");
+	}
+}
+}
@@ -0,0 +1,66 @@
+#ifndef CEE_PANE_MAPPER_H_
+#define CEE_PANE_MAPPER_H_
+
+#include <memory>
+
+#include <cstdint>
+#include <cstddef>
+
+#include "mmu.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "cartridge.h"
+#include "state.h"
+
+namespace pane {
+// The board logic of a cartridge. Every bank is mapped in place from the
+// image, so a bank switch only points the CPU or PPU pages it covers at
+// another part of PRG or CHR, its cost depends on the pages of the window
+// and never on how much is behind it. Registers live in MapperState, so
+// states and forks carry them and Restore maps the banks back.
+class Mapper {
+public:
+	// Throws if the board isn't supported
+	static std::unique_ptr<Mapper> Create(std::shared_ptr<const Cartridge> pCartridge);
+	virtual ~Mapper() {}
+
+	// Nothing is mapped until Reset or Restore, which need the state.
+	// PRG windows route writes to the mapper's registers.
+	void Attach(std::shared_ptr<MMU> pMMU, std::shared_ptr<CPU> pCPU, std::shared_ptr<PPU> pPPU, Scheduler* pScheduler);
+	void SetState(MapperState* pState) { m_pState = pState; }
+
+	// Power-on registers and banks
+	virtual void Reset();
+	// Maps the banks the registers select, after they were loaded
+	virtual void Restore() = 0;
+
+protected:
+	Mapper(std::shared_ptr<const Cartridge> pCartridge);
+
+	virtual void Write(uint16_t pAddress, uint8_t cVal) {}
+	virtual void OnAttach() {}
+
+	// Maps nSize bytes at pAddress onto bank nBank of PRG (or CHR), counted
+	// in units of nSize and wrapping around the end of the ROM. CHR RAM is
+	// banked the same way.
+	void MapPRG(uint16_t pAddress, size_t nSize, uint32_t nBank);
+	void MapCHR(uint16_t pAddress, size_t nSize, uint32_t nBank);
+	uint32_t GetPRGBankCount(size_t nSize) const { return static_cast<uint32_t>(m_pCartridge->GetPRGSize() / nSize); }
+
+	uint64_t GetCPUTimestamp() const { return m_pCPU->GetCycleCount() * PANE_MASTER_CLOCKS_PER_CPU_CYCLE; }
+
+private:
+	static void WriteRegister(void* pUserData, uint16_t pAddress, uint8_t cVal);
+
+protected:
+	std::shared_ptr<const Cartridge> m_pCartridge;
+	std::shared_ptr<MMU> m_pMMU;
+	std::shared_ptr<CPU> m_pCPU;
+	std::shared_ptr<PPU> m_pPPU;
+	Scheduler* m_pScheduler = nullptr;
+	MapperState* m_pState = nullptr;
+};
+}
+
+#endif
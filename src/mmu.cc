@@ -1,13 +1,17 @@
 #include "mmu.h"
 
+#include <algorithm>
+#include <bitset>
+#include <stdexcept>
+
 #include <cstring>
 #include <cstdlib>
-#include <stdexcept>
 
 namespace pane {
 MMU::MMU()
- : m_pRAM(nullptr), m_pCartridge(nullptr), m_pPPURegs(nullptr), m_pAPURegs(nullptr), m_pAPURegsUnused(nullptr), m_bInitialized(false)
+ : m_fnCodeWriteCallback(nullptr), m_pCodeWriteUserData(nullptr), m_xInputHandler{ nullptr, nullptr, nullptr }, m_pMemory(nullptr), m_bOwnsMemory(false), m_bShared(false), m_nChunkPages(0), m_nPrivatePages(0), m_bInitialized(false)
 {
+	this->ResetMap();
 }	
 
 MMU::~MMU() {
@@ -16,164 +20,375 @@ MMU::~MMU() {
 	}
 }
 
-void MMU::Init() {
-	m_pRAM = reinterpret_cast<uint8_t*>(std::calloc(1, 0x0800));
-	m_pCartridge = reinterpret_cast<uint8_t*>(std::calloc(1, 0xFFFF - 0x4020));
-	m_pPPURegs = reinterpret_cast<uint8_t*>(std::calloc(1, 0x0008));
-	m_pAPURegs = reinterpret_cast<uint8_t*>(std::calloc(1, 0x0018));
-	m_pAPURegsUnused = reinterpret_cast<uint8_t*>(std::calloc(1, 0x0008));
-
+void MMU::Init(MMUMemory* pMemory) {
+	m_bOwnsMemory = pMemory == nullptr;
+	m_pMemory = m_bOwnsMemory ? reinterpret_cast<MMUMemory*>(std::calloc(1, sizeof(MMUMemory))) : pMemory;
+	if (m_pMemory == nullptr) {
+		throw std::runtime_error("Failed to allocate memory for MMU.");
+	}
+	this->MapDefault();
 	m_bInitialized = true;
 }
 
-void MMU::Shutdown() {
-	if (m_pRAM) {
-		std::free(m_pRAM);
-		m_pRAM = nullptr;
+void MMU::Reset() {
+	if (m_bShared) {
+		throw std::runtime_error("Can't reset memory shared with another MMU!");
 	}
-	if (m_pCartridge) {
-		std::free(m_pCartridge);
-		m_pCartridge = nullptr;
+	this->ResetMap();
+	this->MapDefault();
+	m_nPrivatePages = 0;
+	this->NotifyMapChanged();
+}
+
+void MMU::MapDefault() {
+	uint8_t* pRAM = m_pMemory->pRAM;
+	uint8_t* pCartridge = m_pMemory->pCartridge;
+
+	// 0x0000 - 0x07FF Internal RAM
+	// 0x0800 - 0x0FFF Mirrors 0x0000 - 0x07FF
+	// 0x1000 - 0x17FF Mirrors 0x0000 - 0x07FF
+	// 0x1800 - 0x1FFF Mirrors 0x0000 - 0x07FF
+	for (uint32_t pMirror = 0x0000; pMirror < 0x2000; pMirror += 0x0800) {
+		this->MapMemory(pMirror, PANE_RAM_SIZE, pRAM);
 	}
-	if (m_pPPURegs) {
-		std::free(m_pPPURegs);
-		m_pPPURegs = nullptr;
+	// 0x2000 - 0x3FFF PPU registers, mapped by the PPU when it is attached
+	// 0x4000 - 0x40FF APU and I/O registers, start of cartridge space
+	this->MapHandler(0x4000, 0x0100, MMU::ReadIO, MMU::WriteIO, this);
+	// 0x4100 - 0xFFFF Cartridge space
+	this->MapMemory(0x4100, 0x10000 - 0x4100, pCartridge + (0x4100 - 0x4020));
+}
+
+void MMU::Shutdown() {
+	this->ResetMap();
+	m_vChunks.clear();
+	m_vSharedMemory.clear();
+	m_bShared = false;
+
+	if (m_pMemory && m_bOwnsMemory) {
+		std::free(m_pMemory);
 	}
-	if (m_pAPURegs) {
-		std::free(m_pAPURegs);
-		m_pAPURegs = nullptr;
+	m_pMemory = nullptr;
+	m_bInitialized = false;
+}
+
+void MMU::LoadROM(const void* src, uintptr_t dst, size_t size) {
+	const uint8_t* pSrc = reinterpret_cast<const uint8_t*>(src);
+	while (size > 0 && dst <= 0xFFFF) {
+		size_t nChunk = PANE_MMU_PAGE_SIZE - (dst & PANE_MMU_PAGE_MASK);
+		if (nChunk > size) {
+			nChunk = size;
+		}
+
+		uint8_t* pPage = m_pWritePages[dst >> PANE_MMU_PAGE_SHIFT];
+		if (pPage != nullptr) {
+			std::memcpy(pPage + (dst & PANE_MMU_PAGE_MASK), pSrc, nChunk);
+		} else {
+			for (size_t i = 0; i < nChunk; i++) {
+				this->Write(dst + i, pSrc[i]);
+			}
+		}
+
+		pSrc += nChunk;
+		dst += nChunk;
+		size -= nChunk;
 	}
-	if (m_pAPURegsUnused) {
-		std::free(m_pAPURegsUnused);
-		m_pAPURegsUnused = nullptr;
+}
+
+void MMU::ClearMemory() {
+	if (m_bShared) {
+		throw std::runtime_error("Can't clear memory shared with another MMU!");
 	}
-	m_bInitialized = false;
+	std::memset(m_pMemory, 0, sizeof(MMUMemory));
 }
 
-uint8_t MMU::Read(uint16_t pAddress) {
-	if (!m_bInitialized) {
-		return 0xFF;
+void MMU::MapMemory(uint16_t pAddress, size_t nSize, uint8_t* pData, bool bWritable) {
+	if ((pAddress & PANE_MMU_PAGE_MASK) || (nSize & PANE_MMU_PAGE_MASK) || pAddress + nSize > 0x10000) {
+		throw std::runtime_error("Memory mapping must be page aligned!");
+	}
+
+	const uint8_t* pBase = reinterpret_cast<const uint8_t*>(m_pMemory);
+	uint32_t nFirst = pAddress >> PANE_MMU_PAGE_SHIFT;
+	uint32_t nCount = nSize >> PANE_MMU_PAGE_SHIFT;
+	for (uint32_t i = 0; i < nCount; i++) {
+		uint8_t* pPage = pData + (i << PANE_MMU_PAGE_SHIFT);
+		m_pReadPages[nFirst + i] = pPage;
+		m_pWritePages[nFirst + i] = bWritable ? pPage : nullptr;
+		m_pProtectedPages[nFirst + i] = nullptr;
+		m_xSharedPages[nFirst + i] = false;
+		bool bInMemory = pBase != nullptr && pPage >= pBase && pPage < pBase + sizeof(MMUMemory);
+		m_pPageOffsets[nFirst + i] = bInMemory ? static_cast<int32_t>(pPage - pBase) : -1;
 	}
+	this->NotifyMapChanged();
+}
 
-	if (pAddress < 0x2000) { // Internal RAM
-		// 0x0800 - 0x0FFF Mirrors 0x0000 - 0x007FF
-		// 0x1000 - 0x07FF Mirrors 0x0000 - 0x007FF
-		// 0x1800 - 0x1FFF Mirrors 0x0000 - 0x007FF
-		pAddress %= 0x0800;
+void MMU::MapROM(uint16_t pAddress, size_t nSize, const uint8_t* pData, WriteHandler fnWrite, void* pUserData) {
+	// Without a write pointer nothing is ever stored through pData
+	this->MapMemory(pAddress, nSize, const_cast<uint8_t*>(pData), false);
 
-		return *(m_pRAM + pAddress);
-	} else if (pAddress < 0x4000) {
-		pAddress -= 0x2000;
-		pAddress %= 0x0008;
-		return *(m_pPPURegs + pAddress);
-	} else if (pAddress < 0x4018) {
-		pAddress -= 0x4000;
-		return *(m_pAPURegs + pAddress);
-	} else if (pAddress < 0x4020) {
-		pAddress -= 0x4018;
-		return *(m_pAPURegsUnused + pAddress);
-	} else if (pAddress <= 0xFFFF) {
-		pAddress -= 0x4020;
-		return *(m_pCartridge + pAddress);
+	uint32_t nFirst = pAddress >> PANE_MMU_PAGE_SHIFT;
+	uint32_t nCount = nSize >> PANE_MMU_PAGE_SHIFT;
+	for (uint32_t i = 0; i < nCount; i++) {
+		m_xHandlers[nFirst + i] = { MMU::ReadOpenBus, fnWrite != nullptr ? fnWrite : MMU::WriteOpenBus, pUserData };
 	}
-	return 0xFF;
 }
 
-void MMU::Write(uint16_t pAddress, uint8_t cVal) {
-	if (!m_bInitialized) {
-		return;
+void MMU::MapHandler(uint16_t pAddress, size_t nSize, ReadHandler fnRead, WriteHandler fnWrite, void* pUserData) {
+	if ((pAddress & PANE_MMU_PAGE_MASK) || (nSize & PANE_MMU_PAGE_MASK) || pAddress + nSize > 0x10000) {
+		throw std::runtime_error("Handler mapping must be page aligned!");
 	}
 
-	if (pAddress < 0x2000) { // Internal RAM
-		// 0x0800 - 0x0FFF Mirrors 0x0000 - 0x007FF
-		// 0x1000 - 0x07FF Mirrors 0x0000 - 0x007FF
-		// 0x1800 - 0x1FFF Mirrors 0x0000 - 0x007FF
-		pAddress %= 0x0800;
-		*(m_pRAM + pAddress) = cVal;
-	} else if (pAddress < 0x4000) {
-		pAddress -= 0x2000;
-		pAddress %= 0x0008;
-		*(m_pPPURegs + pAddress) = cVal;
-	} else if (pAddress < 0x4018) {
-		pAddress -= 0x4000;
-		*(m_pAPURegs + pAddress) = cVal;
-	} else if (pAddress < 0x4020) {
-		pAddress -= 0x4018;
-		*(m_pAPURegsUnused + pAddress) = cVal;
-	} else if (pAddress <= 0xFFFF) {
-		pAddress -= 0x4020;
-		*(m_pCartridge + pAddress) = cVal;
+	uint32_t nFirst = pAddress >> PANE_MMU_PAGE_SHIFT;
+	uint32_t nCount = nSize >> PANE_MMU_PAGE_SHIFT;
+	for (uint32_t i = 0; i < nCount; i++) {
+		m_pReadPages[nFirst + i] = nullptr;
+		m_pWritePages[nFirst + i] = nullptr;
+		m_pProtectedPages[nFirst + i] = nullptr;
+		m_xSharedPages[nFirst + i] = false;
+		m_pPageOffsets[nFirst + i] = -1;
+		m_xHandlers[nFirst + i] = { fnRead, fnWrite, pUserData };
 	}
+	for (size_t i = 0; i < nSize; i++) {
+		m_xPollable[pAddress + i] = false;
+	}
+	this->NotifyMapChanged();
+}
+
+void MMU::SetInputHandlers(ReadHandler fnRead, WriteHandler fnWrite, void* pUserData) {
+	m_xInputHandler = { fnRead, fnWrite, pUserData };
 }
 
-uint16_t MMU::ReadAddress(uint16_t pAddress) {
-	if (!m_bInitialized) {
-		return 0xFFFF;
+void MMU::LoadMemory(const MMUMemory& xMemory) {
+	// Find changed code before the copy, then lift protection and report
+	// each host page once
+	const uint8_t* pBase = reinterpret_cast<const uint8_t*>(m_pMemory);
+	const uint8_t* pNew = reinterpret_cast<const uint8_t*>(&xMemory);
+	std::bitset<PANE_MMU_PAGE_COUNT> xChanged;
+	for (uint32_t i = 0; i < PANE_MMU_PAGE_COUNT; i++) {
+		// Memory outside the block (ROM) is not replaced
+		if (m_pProtectedPages[i] == nullptr || m_pReadPages[i] < pBase || m_pReadPages[i] >= pBase + sizeof(MMUMemory)) {
+			continue;
+		}
+		size_t nOffset = m_pReadPages[i] - pBase;
+		xChanged[i] = std::memcmp(pBase + nOffset, pNew + nOffset, PANE_MMU_PAGE_SIZE) != 0;
+	}
+
+	std::memcpy(m_pMemory, &xMemory, sizeof(MMUMemory));
+
+	for (uint32_t i = 0; i < PANE_MMU_PAGE_COUNT; i++) {
+		if (xChanged[i] && m_pProtectedPages[i] != nullptr) {
+			this->UnprotectCode(m_pReadPages[i]);
+		}
 	}
-	uint8_t lo = this->Read(pAddress);
-	uint8_t hi = this->Read(pAddress + 1);
-	
-	return (static_cast<uint16_t>(hi) << 8) | lo;
 }
 
-void MMU::WriteAddress(uint16_t pAddress, uint16_t pVal) {
-	if (!m_bInitialized) {
-		return;
+void MMU::Share(MMU& xSource, std::shared_ptr<const void> pSourceMemory) {
+	// Everything xSource's pages may point into, now and after it copies
+	// further pages of its own
+	m_vSharedMemory = xSource.m_vSharedMemory;
+	m_vSharedMemory.push_back(pSourceMemory);
+	m_vSharedMemory.insert(m_vSharedMemory.end(), xSource.m_vChunks.begin(), xSource.m_vChunks.end());
+
+	int32_t pShared[PANE_MMU_PAGE_COUNT];
+	uint32_t nShared = 0;
+	for (uint32_t i = 0; i < PANE_MMU_PAGE_COUNT; i++) {
+		if (xSource.m_pPageOffsets[i] < 0 || m_pPageOffsets[i] != xSource.m_pPageOffsets[i]) {
+			continue;
+		}
+		pShared[nShared++] = m_pPageOffsets[i];
+		bool bWritable = xSource.m_pWritePages[i] != nullptr || xSource.m_pProtectedPages[i] != nullptr || xSource.m_xSharedPages[i];
+		if (bWritable) {
+			xSource.MakeShared(i, xSource.m_pReadPages[i]);
+			this->MakeShared(i, xSource.m_pReadPages[i]);
+		} else {
+			// Never written by either side, read in place
+			m_pReadPages[i] = xSource.m_pReadPages[i];
+		}
+	}
+
+	// Bytes of the block no shared page reaches, like the registers behind
+	// the I/O handlers or cartridge space under a mapper's ROM, are still
+	// saved and hashed, so they are copied from xSource's block
+	std::sort(pShared, pShared + nShared);
+	const uint8_t* pSource = reinterpret_cast<const uint8_t*>(xSource.m_pMemory);
+	uint8_t* pBase = reinterpret_cast<uint8_t*>(m_pMemory);
+	size_t nCopied = 0;
+	for (uint32_t i = 0; i <= nShared; i++) {
+		size_t nEnd = i < nShared ? static_cast<size_t>(pShared[i]) : sizeof(MMUMemory);
+		if (nEnd > nCopied) {
+			std::memcpy(pBase + nCopied, pSource + nCopied, nEnd - nCopied);
+		}
+		// Mirrors reach the same offset more than once
+		nCopied = i < nShared ? std::max(nCopied, nEnd + PANE_MMU_PAGE_SIZE) : nEnd;
 	}
-	uint8_t lo = pVal & 0x00FF;
-	uint8_t hi = (pVal & 0xFF00) >> 8;
-	
-	this->Write(pAddress, lo);
-	this->Write(pAddress + 1, hi);
+	xSource.m_bShared = m_bShared = true;
+	this->NotifyMapChanged();
 }
 
-void MMU::Push(uint8_t* ppSp, uint8_t cVal) {
-	if (!m_bInitialized) {
-		return;
+void MMU::MakeShared(uint32_t nPage, const uint8_t* pHost) {
+	m_pReadPages[nPage] = const_cast<uint8_t*>(pHost);
+	m_pWritePages[nPage] = nullptr;
+	m_pProtectedPages[nPage] = nullptr;
+	m_xSharedPages[nPage] = true;
+	m_xHandlers[nPage] = { MMU::ReadOpenBus, MMU::WriteShared, this };
+}
+
+void MMU::Unshare(MMUMemory* pMemory) {
+	// Whatever isn't mapped comes from the block itself, mapped pages from
+	// wherever they live now
+	std::memcpy(pMemory, m_pMemory, sizeof(MMUMemory));
+	uint8_t* pBase = reinterpret_cast<uint8_t*>(pMemory);
+	for (uint32_t i = 0; i < PANE_MMU_PAGE_COUNT; i++) {
+		if (m_pPageOffsets[i] < 0) {
+			continue;
+		}
+		uint8_t* pPage = pBase + m_pPageOffsets[i];
+		// Mirrors copy the same bytes again, harmless
+		std::memcpy(pPage, m_pReadPages[i], PANE_MMU_PAGE_SIZE);
+		bool bWritable = m_pWritePages[i] != nullptr || m_pProtectedPages[i] != nullptr || m_xSharedPages[i];
+		m_pReadPages[i] = pPage;
+		m_pWritePages[i] = bWritable ? pPage : nullptr;
+		m_pProtectedPages[i] = nullptr;
+		m_xSharedPages[i] = false;
+	}
+
+	if (m_bOwnsMemory) {
+		std::free(m_pMemory);
+		m_bOwnsMemory = false;
 	}
+	m_pMemory = pMemory;
+	m_vChunks.clear();
+	m_vSharedMemory.clear();
+	m_nChunkPages = 0;
+	m_nPrivatePages = 0;
+	m_bShared = false;
+	this->NotifyMapChanged();
+}
 
-	// Stack is 0x0100 - 0x01FF, stack pointer is  bit so we can offset into RAM
-	// by 0x0100 and guarantee we stick to space in the stack
-	*(m_pRAM + 0x0100 + (*ppSp)) = cVal;
-	--(*ppSp);
+uint8_t* MMU::AllocatePage() {
+	if (m_vChunks.empty() || m_nChunkPages == PANE_MMU_COW_CHUNK_PAGES) {
+		m_vChunks.push_back(std::shared_ptr<uint8_t[]>(new uint8_t[PANE_MMU_COW_CHUNK_PAGES * PANE_MMU_PAGE_SIZE]));
+		m_nChunkPages = 0;
+	}
+	m_nPrivatePages++;
+	return m_vChunks.back().get() + (m_nChunkPages++ << PANE_MMU_PAGE_SHIFT);
 }
 
-uint8_t MMU::Pull(uint8_t* ppSp) {
-	if (!m_bInitialized) {
-		return 0xFF;
+void MMU::WriteShared(void* pUserData, uint16_t pAddress, uint8_t cVal) {
+	MMU* pMMU = reinterpret_cast<MMU*>(pUserData);
+	const uint8_t* pShared = pMMU->m_pReadPages[pAddress >> PANE_MMU_PAGE_SHIFT];
+
+	uint8_t* pPage = pMMU->AllocatePage();
+	std::memcpy(pPage, pShared, PANE_MMU_PAGE_SIZE);
+	for (uint32_t i = 0; i < PANE_MMU_PAGE_COUNT; i++) {
+		if (pMMU->m_xSharedPages[i] && pMMU->m_pReadPages[i] == pShared) {
+			pMMU->m_pReadPages[i] = pMMU->m_pWritePages[i] = pPage;
+			pMMU->m_xSharedPages[i] = false;
+		}
 	}
+	pPage[pAddress & PANE_MMU_PAGE_MASK] = cVal;
 
-	// Stack is 0x0100 - 0x01FF, stack pointer is  bit so we can offset into RAM
-	// by 0x0100 and guarantee we stick to space in the stack
-	++(*ppSp);
-	return *(m_pRAM + 0x0100 + (*ppSp));
+	// Blocks decoded from the shared copy are stale for this MMU now
+	if (pMMU->m_fnCodeWriteCallback != nullptr) {
+		pMMU->m_fnCodeWriteCallback(pMMU->m_pCodeWriteUserData, pShared);
+	}
 }
 
-void MMU::PushAddress(uint8_t* ppSp, uint16_t pVal) {
-	if (!m_bInitialized) {
+void MMU::ProtectCode(uint16_t pAddress) {
+	const uint8_t* pHost = m_pReadPages[pAddress >> PANE_MMU_PAGE_SHIFT];
+	if (pHost == nullptr) {
 		return;
 	}
-	uint8_t lo = pVal & 0x00FF;
-	uint8_t hi = (pVal & 0xFF00) >> 8;
 
-	this->Push(ppSp, hi);
-	this->Push(ppSp, lo);
+	for (uint32_t i = 0; i < PANE_MMU_PAGE_COUNT; i++) {
+		if (m_pReadPages[i] == pHost && m_pWritePages[i] != nullptr) {
+			m_pProtectedPages[i] = m_pWritePages[i];
+			m_pWritePages[i] = nullptr;
+			m_xHandlers[i] = { MMU::ReadOpenBus, MMU::WriteProtectedCode, this };
+		}
+	}
+}
+
+void MMU::SetCodeWriteCallback(CodeWriteCallback fnCallback, void* pUserData) {
+	m_fnCodeWriteCallback = fnCallback;
+	m_pCodeWriteUserData = pUserData;
 }
 
-uint16_t MMU::PullAddress(uint8_t* ppSp) {
-	if (!m_bInitialized) {
-		return 0xFFFF;
+// A null page tells listeners the mapping itself changed (bank switch)
+void MMU::NotifyMapChanged() {
+	if (m_fnCodeWriteCallback != nullptr) {
+		m_fnCodeWriteCallback(m_pCodeWriteUserData, nullptr);
 	}
+}
 
-	uint8_t lo = this->Pull(ppSp);
-	uint8_t hi = this->Pull(ppSp);
+void MMU::ResetMap() {
+	for (uint32_t i = 0; i < PANE_MMU_PAGE_COUNT; i++) {
+		m_pReadPages[i] = nullptr;
+		m_pWritePages[i] = nullptr;
+		m_pProtectedPages[i] = nullptr;
+		m_pPageOffsets[i] = -1;
+		m_xHandlers[i] = { MMU::ReadOpenBus, MMU::WriteOpenBus, nullptr };
+	}
+	m_xSharedPages.reset();
+	m_xPollable.reset();
+}
 
-	return (static_cast<int16_t>(hi) << 8) | lo;
+uint8_t MMU::ReadOpenBus(void* pUserData, uint16_t pAddress) {
+	return 0xFF;
 }
 
-void MMU::LoadROM(const void* src, uintptr_t dst, size_t size) {
-	for (uint32_t i = 0; i < size; i++) {
-		this->Write(dst + i, *(reinterpret_cast<const uint8_t*>(src) + i));
+void MMU::WriteOpenBus(void* pUserData, uint16_t pAddress, uint8_t cVal) {
+}
+
+void MMU::WriteProtectedCode(void* pUserData, uint16_t pAddress, uint8_t cVal) {
+	MMU* pMMU = reinterpret_cast<MMU*>(pUserData);
+	uint32_t nPage = pAddress >> PANE_MMU_PAGE_SHIFT;
+	const uint8_t* pHost = pMMU->m_pReadPages[nPage];
+
+	pMMU->m_pProtectedPages[nPage][pAddress & PANE_MMU_PAGE_MASK] = cVal;
+	pMMU->UnprotectCode(pHost);
+}
+
+void MMU::UnprotectCode(const uint8_t* pHost) {
+	for (uint32_t i = 0; i < PANE_MMU_PAGE_COUNT; i++) {
+		if (m_pProtectedPages[i] != nullptr && m_pReadPages[i] == pHost) {
+			m_pWritePages[i] = m_pProtectedPages[i];
+			m_pProtectedPages[i] = nullptr;
+		}
+	}
+
+	if (m_fnCodeWriteCallback != nullptr) {
+		m_fnCodeWriteCallback(m_pCodeWriteUserData, pHost);
+	}
+}
+
+uint8_t MMU::ReadIO(void* pUserData, uint16_t pAddress) {
+	MMU* pMMU = reinterpret_cast<MMU*>(pUserData);
+
+	if ((pAddress == 0x4016 || pAddress == 0x4017) && pMMU->m_xInputHandler.fnRead != nullptr) {
+		return pMMU->m_xInputHandler.fnRead(pMMU->m_xInputHandler.pUserData, pAddress);
+	}
+	if (pAddress < 0x4018) {
+		return pMMU->m_pMemory->pAPURegs[pAddress - 0x4000];
+	} else if (pAddress < 0x4020) {
+		return pMMU->m_pMemory->pAPURegsUnused[pAddress - 0x4018];
+	}
+	return pMMU->m_pMemory->pCartridge[pAddress - 0x4020];
+}
+
+void MMU::WriteIO(void* pUserData, uint16_t pAddress, uint8_t cVal) {
+	MMU* pMMU = reinterpret_cast<MMU*>(pUserData);
+
+	// $4017 writes go to the APU frame counter
+	if (pAddress == 0x4016 && pMMU->m_xInputHandler.fnWrite != nullptr) {
+		pMMU->m_xInputHandler.fnWrite(pMMU->m_xInputHandler.pUserData, pAddress, cVal);
+		return;
+	}
+	if (pAddress < 0x4018) {
+		pMMU->m_pMemory->pAPURegs[pAddress - 0x4000] = cVal;
+	} else if (pAddress < 0x4020) {
+		pMMU->m_pMemory->pAPURegsUnused[pAddress - 0x4018] = cVal;
+	} else {
+		pMMU->m_pMemory->pCartridge[pAddress - 0x4020] = cVal;
 	}
 }
 }
@@ -1,39 +1,204 @@
 #ifndef CEE_PANE_MMU_H_
 #define CEE_PANE_MMU_H_
 
+#include <bitset>
+#include <memory>
+#include <vector>
+
 #include <cstdint>
 #include <cstddef>
 
+#include "state.h"
+
+#define PANE_MMU_PAGE_SHIFT   8
+#define PANE_MMU_PAGE_SIZE    (1 << PANE_MMU_PAGE_SHIFT)
+#define PANE_MMU_PAGE_MASK    (PANE_MMU_PAGE_SIZE - 1)
+#define PANE_MMU_PAGE_COUNT   (0x10000 >> PANE_MMU_PAGE_SHIFT)
+// Pages copied on write are carved out of chunks this many pages long
+#define PANE_MMU_COW_CHUNK_PAGES  16
+
 namespace pane {
+typedef uint8_t (*ReadHandler)(void* pUserData, uint16_t pAddress);
+typedef void (*WriteHandler)(void* pUserData, uint16_t pAddress, uint8_t cVal);
+typedef void (*CodeWriteCallback)(void* pUserData, const uint8_t* pPage);
+
 class MMU {
 public:
 	MMU();
 	~MMU();
 
-	void Init();
+	// Works on pMemory in place if given (a MachineState section), otherwise
+	// allocates its own.
+	void Init(MMUMemory* pMemory = nullptr);
 	void Shutdown();
+	// Maps memory like Init did on the same block, dropping every handler,
+	// pollable address and protected page added since. Throws while shared.
+	void Reset();
+
+	// Every page either has a direct host pointer (RAM, PRG) or falls back to
+	// the handler registered for it (I/O registers, open bus). Mirrors are
+	// resolved when the map is built so the common case is a single table
+	// lookup and a load.
+	inline uint8_t Read(uint16_t pAddress) {
+		const uint8_t* pPage = m_pReadPages[pAddress >> PANE_MMU_PAGE_SHIFT];
+		if (pPage != nullptr) [[likely]] {
+			return pPage[pAddress & PANE_MMU_PAGE_MASK];
+		}
+		const IOHandler& xHandler = m_xHandlers[pAddress >> PANE_MMU_PAGE_SHIFT];
+		return xHandler.fnRead(xHandler.pUserData, pAddress);
+	}
+
+	inline void Write(uint16_t pAddress, uint8_t cVal) {
+		uint8_t* pPage = m_pWritePages[pAddress >> PANE_MMU_PAGE_SHIFT];
+		if (pPage != nullptr) [[likely]] {
+			pPage[pAddress & PANE_MMU_PAGE_MASK] = cVal;
+			return;
+		}
+		const IOHandler& xHandler = m_xHandlers[pAddress >> PANE_MMU_PAGE_SHIFT];
+		xHandler.fnWrite(xHandler.pUserData, pAddress, cVal);
+	}
 
-	uint8_t Read(uint16_t pAddress);
-	void Write(uint16_t pAddress, uint8_t cVal);
+	inline uint16_t ReadAddress(uint16_t pAddress) {
+		uint8_t lo = this->Read(pAddress);
+		uint8_t hi = this->Read(pAddress + 1);
 
-	uint16_t ReadAddress(uint16_t pAddress);
-	void WriteAddress(uint16_t pAddress, uint16_t pVal);
+		return (static_cast<uint16_t>(hi) << 8) | lo;
+	}
 
-	void Push(uint8_t* ppSp, uint8_t cVal);
-	uint8_t Pull(uint8_t* ppSp);
+	inline void WriteAddress(uint16_t pAddress, uint16_t pVal) {
+		this->Write(pAddress, pVal & 0x00FF);
+		this->Write(pAddress + 1, (pVal & 0xFF00) >> 8);
+	}
 
-	void PushAddress(uint8_t* ppSp, uint16_t pVal);
-	uint16_t PullAddress(uint8_t* ppSp);
+	// Stack is 0x0100 - 0x01FF, stack pointer is 8 bit so we can offset into
+	// the stack page and guarantee we stick to space in the stack
+	inline void Push(uint8_t* ppSp, uint8_t cVal) {
+		this->Write(0x0100 | *ppSp, cVal);
+		--(*ppSp);
+	}
+
+	inline uint8_t Pull(uint8_t* ppSp) {
+		++(*ppSp);
+		return this->Read(0x0100 | *ppSp);
+	}
+
+	inline void PushAddress(uint8_t* ppSp, uint16_t pVal) {
+		this->Push(ppSp, (pVal & 0xFF00) >> 8);
+		this->Push(ppSp, pVal & 0x00FF);
+	}
+
+	inline uint16_t PullAddress(uint8_t* ppSp) {
+		uint8_t lo = this->Pull(ppSp);
+		uint8_t hi = this->Pull(ppSp);
+
+		return (static_cast<uint16_t>(hi) << 8) | lo;
+	}
 
 	void LoadROM(const void* src, uintptr_t dst, size_t size);
+	// Zeroes RAM, cartridge space and I/O registers so an instance can be
+	// reused for another run without reallocating.
+	void ClearMemory();
+
+	// Map nSize bytes (a multiple of the page size) at pAddress straight onto
+	// host memory. Passing bWritable = false leaves writes to the handler.
+	void MapMemory(uint16_t pAddress, size_t nSize, uint8_t* pData, bool bWritable = true);
+	// Maps read-only memory such as cartridge ROM, reads go straight to pData
+	// and writes to fnWrite (ignored if null). pData must outlive the mapping.
+	void MapROM(uint16_t pAddress, size_t nSize, const uint8_t* pData, WriteHandler fnWrite = nullptr, void* pUserData = nullptr);
+	// Route nSize bytes (a multiple of the page size) at pAddress through the
+	// given handlers.
+	void MapHandler(uint16_t pAddress, size_t nSize, ReadHandler fnRead, WriteHandler fnWrite, void* pUserData);
+	// Controller ports $4016 (read and strobe write) and $4017 (read), the
+	// rest of the I/O page stays plain registers.
+	void SetInputHandlers(ReadHandler fnRead, WriteHandler fnWrite, void* pUserData);
+
+	// Replaces all of memory with xMemory. Code-protected pages whose bytes
+	// differ are reported to the code write callback like a write would,
+	// so cached code elsewhere survives.
+	void LoadMemory(const MMUMemory& xMemory);
+
+	// Maps this MMU's memory onto xSource's copy-on-write, at page
+	// granularity. xSource's own pages become copy-on-write as well, from
+	// then on neither side ever writes a page the other can see.
+	// pSourceMemory must keep xSource's MMUMemory alive. Both MMUs need the
+	// same layout.
+	void Share(MMU& xSource, std::shared_ptr<const void> pSourceMemory);
+	// Gathers memory back into pMemory and maps it like Init did, dropping
+	// every shared page.
+	void Unshare(MMUMemory* pMemory);
+	bool IsShared() const { return m_bShared; }
+	// Pages copied on write so far
+	size_t GetPrivatePageCount() const { return m_nPrivatePages; }
+
+	// Host memory backing a page, nullptr if the page is handled.
+	inline const uint8_t* GetReadPage(uint8_t nPage) const { return m_pReadPages[nPage]; }
+	// Marks a handled address whose reads have no further effect when
+	// repeated and whose value only changes on scheduled events, so the CPU
+	// may skip loops polling it. Direct pages always qualify.
+	void SetPollable(uint16_t pAddress, bool bPollable) { m_xPollable[pAddress] = bPollable; }
+	inline bool IsPollable(uint16_t pAddress) const {
+		return m_pReadPages[pAddress >> PANE_MMU_PAGE_SHIFT] != nullptr || m_xPollable[pAddress];
+	}
+
+	// Raw page tables for translated code, entries change whenever the map
+	// does so callers must index them at run time.
+	inline uint8_t* const* GetReadPageTable() const { return m_pReadPages; }
+	inline uint8_t* const* GetWritePageTable() const { return m_pWritePages; }
+	// Write-protects every page aliasing the host memory at pAddress because
+	// code decoded from it is cached. The first write to any alias goes
+	// through, lifts the protection and reports the host page to the code
+	// write callback.
+	void ProtectCode(uint16_t pAddress);
+	void SetCodeWriteCallback(CodeWriteCallback fnCallback, void* pUserData);
 
 private:
-	uint8_t* m_pRAM;
-	uint8_t* m_pCartridge;
+	struct IOHandler {
+		ReadHandler fnRead;
+		WriteHandler fnWrite;
+		void* pUserData;
+	};
+
+	void ResetMap();
+	void MapDefault();
+	void NotifyMapChanged();
+
+	static uint8_t ReadOpenBus(void* pUserData, uint16_t pAddress);
+	static void WriteOpenBus(void* pUserData, uint16_t pAddress, uint8_t cVal);
+	static uint8_t ReadIO(void* pUserData, uint16_t pAddress);
+	static void WriteIO(void* pUserData, uint16_t pAddress, uint8_t cVal);
+	static void WriteProtectedCode(void* pUserData, uint16_t pAddress, uint8_t cVal);
+	void UnprotectCode(const uint8_t* pHost);
+	static void WriteShared(void* pUserData, uint16_t pAddress, uint8_t cVal);
+	void MakeShared(uint32_t nPage, const uint8_t* pHost);
+	uint8_t* AllocatePage();
+
+private:
+	uint8_t* m_pReadPages[PANE_MMU_PAGE_COUNT];
+	uint8_t* m_pWritePages[PANE_MMU_PAGE_COUNT];
+	IOHandler m_xHandlers[PANE_MMU_PAGE_COUNT];
+	// Write pointers of code-protected pages, nullptr when unprotected
+	uint8_t* m_pProtectedPages[PANE_MMU_PAGE_COUNT];
+	// Where each page lives in MMUMemory, -1 if it maps something else
+	int32_t m_pPageOffsets[PANE_MMU_PAGE_COUNT];
+	// Pages that must be copied before they are written
+	std::bitset<PANE_MMU_PAGE_COUNT> m_xSharedPages;
+	std::bitset<0x10000> m_xPollable;
+
+	CodeWriteCallback m_fnCodeWriteCallback;
+	void* m_pCodeWriteUserData;
+
+	IOHandler m_xInputHandler;
+
+	MMUMemory* m_pMemory;
+	bool m_bOwnsMemory;
 
-	uint8_t* m_pPPURegs;
-	uint8_t* m_pAPURegs;
-	uint8_t* m_pAPURegsUnused;
+	// Copy-on-write
+	bool m_bShared;
+	std::vector<std::shared_ptr<uint8_t[]>> m_vChunks;
+	size_t m_nChunkPages;
+	size_t m_nPrivatePages;
+	// Memory of other MMUs that pages here may point into
+	std::vector<std::shared_ptr<const void>> m_vSharedMemory;
 
 	bool m_bInitialized;
 };
@@ -0,0 +1,150 @@
+#include "movie.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <cstdio>
+#include <cstring>
+
+namespace pane {
+Movie::Movie() {
+	this->Reset(0);
+}
+
+Movie::~Movie() {
+
+}
+
+void Movie::Reset(uint64_t nROMHash) {
+	m_xHeader = { PANE_MOVIE_MAGIC, PANE_MOVIE_VERSION, PANE_STATE_VERSION, 0, nROMHash, 0, 0 };
+	m_pStartState.reset();
+	m_vInput.clear();
+	m_vHashes.clear();
+	m_nHashedFrames = 0;
+}
+
+void Movie::SetStartState(const MachineState& xState) {
+	if (!m_pStartState) {
+		m_pStartState = std::make_unique<MachineState>();
+	}
+	std::memcpy(m_pStartState.get(), &xState, sizeof(MachineState));
+	m_xHeader.nFlags |= MOVIE_FLAG_START_STATE;
+}
+
+void Movie::SetFrame(uint64_t nFrame, const uint8_t* pButtons) {
+	// Frames skipped over hold no buttons
+	m_vInput.resize(nFrame * PANE_CONTROLLER_PORTS);
+	m_vInput.insert(m_vInput.end(), pButtons, pButtons + PANE_CONTROLLER_PORTS);
+	m_vHashes.resize(nFrame + 1);
+	m_nHashedFrames = std::min(m_nHashedFrames, nFrame);
+	m_xHeader.nFrames = nFrame + 1;
+	m_xHeader.nFlags &= ~MOVIE_FLAG_END_HASH;
+}
+
+void Movie::SetFrameHash(uint64_t nFrame, uint64_t nHash) {
+	m_vHashes[nFrame] = nHash;
+	if (nFrame == m_nHashedFrames) {
+		m_nHashedFrames++;
+	}
+}
+
+void Movie::SetEndHash(uint64_t nHash) {
+	m_xHeader.nEndHash = nHash;
+	m_xHeader.nFlags |= MOVIE_FLAG_END_HASH;
+}
+
+uint64_t Movie::GetInputHash(uint64_t nFrames) const {
+	uint64_t nHash = m_xHeader.nROMHash;
+	if (m_pStartState) {
+		nHash = HashBytes(m_pStartState.get(), sizeof(MachineState), nHash);
+	}
+	return HashBytes(m_vInput.data(), nFrames * PANE_CONTROLLER_PORTS, nHash);
+}
+
+void Movie::Save(const std::string& sPath) const {
+	std::FILE* pFile = std::fopen(sPath.c_str(), "wb");
+	if (pFile == nullptr) {
+		throw std::runtime_error("Failed to open movie for writing!");
+	}
+
+	MovieHeader xHeader = m_xHeader;
+	if (this->HasFrameHashes()) {
+		xHeader.nFlags |= MOVIE_FLAG_FRAME_HASHES;
+	}
+	bool bWritten = std::fwrite(&xHeader, sizeof(MovieHeader), 1, pFile) == 1;
+	if (bWritten && m_pStartState) {
+		bWritten = std::fwrite(m_pStartState.get(), sizeof(MachineState), 1, pFile) == 1;
+	}
+	if (bWritten && !m_vInput.empty()) {
+		bWritten = std::fwrite(m_vInput.data(), m_vInput.size(), 1, pFile) == 1;
+	}
+	if (bWritten && (xHeader.nFlags & MOVIE_FLAG_FRAME_HASHES) && !m_vHashes.empty()) {
+		bWritten = std::fwrite(m_vHashes.data(), m_vHashes.size() * sizeof(uint64_t), 1, pFile) == 1;
+	}
+	bWritten = std::fclose(pFile) == 0 && bWritten;
+	if (!bWritten) {
+		throw std::runtime_error("Failed to write movie!");
+	}
+}
+
+void Movie::Load(const std::string& sPath) {
+	std::FILE* pFile = std::fopen(sPath.c_str(), "rb");
+	if (pFile == nullptr) {
+		throw std::runtime_error("Failed to open movie!");
+	}
+
+	MovieHeader xHeader;
+	std::unique_ptr<MachineState> pStartState;
+	std::vector<uint8_t> vInput;
+	std::vector<uint64_t> vHashes;
+	const char* sError = nullptr;
+	if (std::fread(&xHeader, sizeof(MovieHeader), 1, pFile) != 1 || xHeader.nMagic != PANE_MOVIE_MAGIC) {
+		sError = "Not a movie file!";
+	} else if (xHeader.nVersion != PANE_MOVIE_VERSION) {
+		sError = "Movie is not compatible with this version!";
+	} else if ((xHeader.nFlags & MOVIE_FLAG_START_STATE) && xHeader.nStateVersion != PANE_STATE_VERSION) {
+		sError = "Movie start state is not compatible with this version!";
+	} else {
+		if (xHeader.nFlags & MOVIE_FLAG_START_STATE) {
+			pStartState = std::make_unique<MachineState>();
+			if (std::fread(pStartState.get(), sizeof(MachineState), 1, pFile) != 1) {
+				sError = "Movie is truncated!";
+			}
+		}
+		// Check the frame count against the file before trusting it with an
+		// allocation
+		size_t nFrameSize = PANE_CONTROLLER_PORTS + ((xHeader.nFlags & MOVIE_FLAG_FRAME_HASHES) ? sizeof(uint64_t) : 0);
+		long nStart = std::ftell(pFile);
+		long nEnd = std::fseek(pFile, 0, SEEK_END) == 0 ? std::ftell(pFile) : -1;
+		if (sError == nullptr && (nStart < 0 || nEnd < nStart || static_cast<uint64_t>(nEnd - nStart) / nFrameSize < xHeader.nFrames)) {
+			sError = "Movie is truncated!";
+		}
+		if (sError == nullptr) {
+			vInput.resize(xHeader.nFrames * PANE_CONTROLLER_PORTS);
+			vHashes.resize(xHeader.nFrames);
+			bool bRead = std::fseek(pFile, nStart, SEEK_SET) == 0;
+			if (bRead && !vInput.empty()) {
+				bRead = std::fread(vInput.data(), vInput.size(), 1, pFile) == 1;
+			}
+			if (bRead && (xHeader.nFlags & MOVIE_FLAG_FRAME_HASHES) && !vHashes.empty()) {
+				bRead = std::fread(vHashes.data(), vHashes.size() * sizeof(uint64_t), 1, pFile) == 1;
+			}
+			if (!bRead) {
+				sError = "Movie is truncated!";
+			}
+		}
+	}
+	std::fclose(pFile);
+	if (sError != nullptr) {
+		throw std::runtime_error(sError);
+	}
+
+	m_xHeader = xHeader;
+	m_pStartState = std::move(pStartState);
+	m_vInput = std::move(vInput);
+	m_vHashes = std::move(vHashes);
+	m_nHashedFrames = (xHeader.nFlags & MOVIE_FLAG_FRAME_HASHES) ? xHeader.nFrames : 0;
+	m_xHeader.nFlags &= ~MOVIE_FLAG_FRAME_HASHES;
+}
+}
@@ -0,0 +1,90 @@
+#ifndef CEE_PANE_MOVIE_H_
+#define CEE_PANE_MOVIE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+#include "state.h"
+
+// "PNMV" little endian
+#define PANE_MOVIE_MAGIC    0x564D4E50
+// Bump whenever the file layout changes
+#define PANE_MOVIE_VERSION  2
+
+namespace pane {
+enum MovieFlags {
+	// A MachineState follows the header, otherwise the movie starts at
+	// power-on
+	MOVIE_FLAG_START_STATE = 1 << 0,
+	// nEndHash is set
+	MOVIE_FLAG_END_HASH    = 1 << 1,
+	// A state hash follows the input for every frame
+	MOVIE_FLAG_FRAME_HASHES = 1 << 2
+};
+
+// File layout: this header, the start state if flagged, then
+// PANE_CONTROLLER_PORTS button bytes per frame and the frame hashes if
+// flagged. Written in host byte order like MachineState.
+struct MovieHeader {
+	uint32_t nMagic;
+	uint32_t nVersion;
+	// PANE_STATE_VERSION the start state was written with
+	uint32_t nStateVersion;
+	uint32_t nFlags;
+	uint64_t nROMHash;
+	uint64_t nFrames;
+	// Machine::GetStateHash after the last frame
+	uint64_t nEndHash;
+};
+
+// Buttons held on every frame of a session, enough to replay it exactly
+// from its start.
+class Movie {
+public:
+	Movie();
+	~Movie();
+
+	// Starts an empty movie from power-on
+	void Reset(uint64_t nROMHash);
+	// Starts from xState instead, for movies that don't begin at power-on
+	void SetStartState(const MachineState& xState);
+	// Buttons for frame nFrame of the movie, dropping any frames after it so
+	// re-recording over rewound frames just works
+	void SetFrame(uint64_t nFrame, const uint8_t* pButtons);
+	// Machine::GetStateHash after frame nFrame, which must have been set.
+	// Saved only if every frame has one, set in order.
+	void SetFrameHash(uint64_t nFrame, uint64_t nHash);
+	void SetEndHash(uint64_t nHash);
+
+	// Both throw on I/O errors, Load also on files from another version
+	void Save(const std::string& sPath) const;
+	void Load(const std::string& sPath);
+
+	uint64_t GetFrameCount() const { return m_xHeader.nFrames; }
+	// PANE_CONTROLLER_PORTS bytes
+	const uint8_t* GetButtons(uint64_t nFrame) const { return &m_vInput[nFrame * PANE_CONTROLLER_PORTS]; }
+	uint64_t GetROMHash() const { return m_xHeader.nROMHash; }
+	// Identifies the first nFrames frames of the movie together with where
+	// it starts, so a state saved during one replay can be matched to
+	// another. nFrames is at most GetFrameCount.
+	uint64_t GetInputHash(uint64_t nFrames) const;
+	const MachineState* GetStartState() const { return m_pStartState.get(); }
+	bool HasFrameHashes() const { return m_nHashedFrames == m_xHeader.nFrames; }
+	uint64_t GetFrameHash(uint64_t nFrame) const { return m_vHashes[nFrame]; }
+	bool HasEndHash() const { return m_xHeader.nFlags & MOVIE_FLAG_END_HASH; }
+	uint64_t GetEndHash() const { return m_xHeader.nEndHash; }
+
+private:
+	MovieHeader m_xHeader;
+	std::unique_ptr<MachineState> m_pStartState;
+	std::vector<uint8_t> m_vInput;
+	std::vector<uint64_t> m_vHashes;
+	// Leading frames with a hash
+	uint64_t m_nHashedFrames;
+};
+}
+
+#endif
@@ -0,0 +1,226 @@
+#include "netplay.h"
+#include "hash.h"
+
+#include <chrono>
+#include <stdexcept>
+
+#include <cstring>
+
+namespace pane {
+// Every packet carries all local inputs the remote peer hasn't acknowledged,
+// so a lost packet costs nothing once the next one arrives.
+struct NetplayPacket {
+	uint32_t nMagic;
+	uint32_t nCount;
+	// Frame of pInputs[0]
+	uint64_t nFrame;
+	// Inputs the sender has from the receiver
+	uint64_t nAck;
+	// Latest confirmed state hash of the sender, nHashFrame is UINT64_MAX
+	// until there is one
+	uint64_t nHashFrame;
+	uint64_t nHash;
+	uint8_t pInputs[PANE_NETPLAY_PACKET_INPUTS];
+};
+
+LoopbackLink::LoopbackLink(uint32_t nLatency, double nLoss, uint32_t nSeed)
+ : m_nTick(0), m_nLatency(nLatency), m_nSeed(nSeed), m_nSent(0), m_nDropped(0)
+{
+	m_nLossThreshold = static_cast<uint32_t>(std::clamp(nLoss, 0.0, 1.0) * 0x10000);
+	m_pEnds[0] = std::make_unique<End>(this, 0);
+	m_pEnds[1] = std::make_unique<End>(this, 1);
+}
+
+LoopbackLink::~LoopbackLink() {
+
+}
+
+void LoopbackLink::Tick() {
+	std::lock_guard<std::mutex> xGuard(m_xLock);
+	m_nTick++;
+}
+
+void LoopbackLink::End::Send(const void* pData, size_t nSize) {
+	std::lock_guard<std::mutex> xGuard(m_pLink->m_xLock);
+	m_pLink->m_nSent++;
+	m_pLink->m_nSeed = m_pLink->m_nSeed * 1103515245 + 12345;
+	if (((m_pLink->m_nSeed >> 15) & 0xFFFF) < m_pLink->m_nLossThreshold) {
+		m_pLink->m_nDropped++;
+		return;
+	}
+
+	const uint8_t* pBytes = reinterpret_cast<const uint8_t*>(pData);
+	m_pLink->m_pQueues[m_nEnd ^ 1].push_back({ m_pLink->m_nTick + m_pLink->m_nLatency, std::vector<uint8_t>(pBytes, pBytes + nSize) });
+}
+
+size_t LoopbackLink::End::Receive(void* pData, size_t nCapacity) {
+	std::lock_guard<std::mutex> xGuard(m_pLink->m_xLock);
+	std::deque<Packet>& xQueue = m_pLink->m_pQueues[m_nEnd];
+	while (!xQueue.empty() && xQueue.front().nDeliverAt <= m_pLink->m_nTick) {
+		Packet xPacket = std::move(xQueue.front());
+		xQueue.pop_front();
+		if (xPacket.vData.size() <= nCapacity) {
+			std::memcpy(pData, xPacket.vData.data(), xPacket.vData.size());
+			return xPacket.vData.size();
+		}
+	}
+	return 0;
+}
+
+NetplaySession::NetplaySession(std::shared_ptr<Machine> pMachine, NetTransport* pTransport, uint8_t nLocalPort, uint32_t nInputDelay, uint32_t nMaxRollback)
+ : m_pMachine(pMachine), m_pTransport(pTransport), m_nLocalPort(nLocalPort), m_nInputDelay(nInputDelay), m_nMaxRollback(nMaxRollback), m_nFrame(0), m_nRollbackFrame(UINT64_MAX), m_nRemoteAck(0), m_nNextHashFrame(0), m_nDesyncFrame(UINT64_MAX), m_xStats{}
+{
+	if (m_nLocalPort > 1) {
+		throw std::runtime_error("Netplay only supports ports 0 and 1!");
+	}
+	if (m_nMaxRollback == 0 || m_nMaxRollback > PANE_NETPLAY_MAX_ROLLBACK) {
+		throw std::runtime_error("Invalid netplay rollback window!");
+	}
+
+	m_pSnapshots = std::make_unique<MachineState[]>(m_nMaxRollback + 1);
+	// Nothing pressed before the first delayed input
+	m_vLocal.assign(m_nInputDelay, 0);
+	for (size_t i = 0; i < PANE_NETPLAY_HASH_HISTORY; i++) {
+		m_pLocalHashes[i] = { UINT64_MAX, 0 };
+		m_pRemoteHashes[i] = { UINT64_MAX, 0 };
+	}
+}
+
+NetplaySession::~NetplaySession() {
+
+}
+
+bool NetplaySession::AdvanceFrame(uint8_t nButtons) {
+	this->Receive();
+	this->RollBack();
+	this->CheckHashes();
+
+	// Every frame past the remote input is a frame that may be rolled back
+	if (m_nFrame >= m_vRemote.size() + m_nMaxRollback) {
+		m_xStats.nStalls++;
+		this->Send();
+		return false;
+	}
+
+	m_vLocal.push_back(nButtons);
+	this->RunFrame(m_nFrame++);
+	m_xStats.nFrames++;
+	this->Send();
+	return true;
+}
+
+void NetplaySession::Receive() {
+	NetplayPacket xPacket;
+	size_t nHeader = offsetof(NetplayPacket, pInputs);
+	size_t nSize;
+	while ((nSize = m_pTransport->Receive(&xPacket, sizeof(xPacket))) != 0) {
+		if (nSize < nHeader || xPacket.nMagic != PANE_NETPLAY_MAGIC || xPacket.nCount > nSize - nHeader) {
+			continue;
+		}
+
+		// Packets may come out of order, only ever extend what is known
+		for (uint32_t i = 0; i < xPacket.nCount && xPacket.nFrame <= m_vRemote.size(); i++) {
+			uint64_t nFrame = xPacket.nFrame + i;
+			if (nFrame < m_vRemote.size()) {
+				continue;
+			}
+			m_vRemote.push_back(xPacket.pInputs[i]);
+			if (nFrame < m_nFrame && m_vUsed[nFrame] != xPacket.pInputs[i]) {
+				m_nRollbackFrame = std::min(m_nRollbackFrame, nFrame);
+			}
+		}
+		m_nRemoteAck = std::max(m_nRemoteAck, std::min<uint64_t>(xPacket.nAck, m_vLocal.size()));
+
+		if (xPacket.nHashFrame != UINT64_MAX && xPacket.nHashFrame % PANE_NETPLAY_HASH_INTERVAL == 0) {
+			HashEntry& xEntry = m_pRemoteHashes[(xPacket.nHashFrame / PANE_NETPLAY_HASH_INTERVAL) % PANE_NETPLAY_HASH_HISTORY];
+			if (xEntry.nFrame != xPacket.nHashFrame) {
+				xEntry = { xPacket.nHashFrame, xPacket.nHash };
+				this->CompareHash(xPacket.nHashFrame);
+			}
+		}
+	}
+}
+
+void NetplaySession::Send() {
+	NetplayPacket xPacket;
+	xPacket.nMagic = PANE_NETPLAY_MAGIC;
+	xPacket.nFrame = m_nRemoteAck;
+	xPacket.nCount = static_cast<uint32_t>(std::min<uint64_t>(m_vLocal.size() - m_nRemoteAck, PANE_NETPLAY_PACKET_INPUTS));
+	xPacket.nAck = m_vRemote.size();
+	xPacket.nHashFrame = UINT64_MAX;
+	xPacket.nHash = 0;
+	if (m_nNextHashFrame > 0) {
+		const HashEntry& xEntry = m_pLocalHashes[(m_nNextHashFrame / PANE_NETPLAY_HASH_INTERVAL - 1) % PANE_NETPLAY_HASH_HISTORY];
+		xPacket.nHashFrame = xEntry.nFrame;
+		xPacket.nHash = xEntry.nHash;
+	}
+	std::memcpy(xPacket.pInputs, m_vLocal.data() + m_nRemoteAck, xPacket.nCount);
+	m_pTransport->Send(&xPacket, offsetof(NetplayPacket, pInputs) + xPacket.nCount);
+}
+
+void NetplaySession::RollBack() {
+	if (m_nRollbackFrame == UINT64_MAX) {
+		return;
+	}
+
+	// No video, the frames in between are never presented
+	auto tStart = std::chrono::steady_clock::now();
+	uint64_t nFrames = m_nFrame - m_nRollbackFrame;
+	m_pMachine->LoadState(*this->GetSnapshot(m_nRollbackFrame));
+	for (uint64_t nFrame = m_nRollbackFrame; nFrame < m_nFrame; nFrame++) {
+		this->RunFrame(nFrame);
+	}
+	m_nRollbackFrame = UINT64_MAX;
+
+	m_xStats.nRollbacks++;
+	m_xStats.nRollbackFrames += nFrames;
+	m_xStats.nMaxRollbackFrames = std::max(m_xStats.nMaxRollbackFrames, static_cast<uint32_t>(nFrames));
+	m_xStats.nRollbackSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+}
+
+void NetplaySession::CheckHashes() {
+	// States before confirmed frames are final once the rollback is done.
+	// The stall keeps every one of them in the snapshot ring.
+	while (m_nNextHashFrame <= this->GetConfirmedFrame()) {
+		uint64_t nFrame = m_nNextHashFrame;
+		uint64_t nHash = nFrame == m_nFrame ? m_pMachine->GetStateHash() : HashMachineState(*this->GetSnapshot(nFrame));
+		m_pLocalHashes[(nFrame / PANE_NETPLAY_HASH_INTERVAL) % PANE_NETPLAY_HASH_HISTORY] = { nFrame, nHash };
+		m_nNextHashFrame += PANE_NETPLAY_HASH_INTERVAL;
+		this->CompareHash(nFrame);
+	}
+}
+
+void NetplaySession::CompareHash(uint64_t nFrame) {
+	size_t nSlot = (nFrame / PANE_NETPLAY_HASH_INTERVAL) % PANE_NETPLAY_HASH_HISTORY;
+	const HashEntry& xLocal = m_pLocalHashes[nSlot];
+	const HashEntry& xRemote = m_pRemoteHashes[nSlot];
+	if (xLocal.nFrame != nFrame || xRemote.nFrame != nFrame) {
+		return;
+	}
+	m_xStats.nHashChecks++;
+	if (xLocal.nHash != xRemote.nHash) {
+		m_nDesyncFrame = std::min(m_nDesyncFrame, nFrame);
+	}
+}
+
+void NetplaySession::RunFrame(uint64_t nFrame) {
+	m_pMachine->SaveState(this->GetSnapshot(nFrame));
+
+	// Unknown remote input is predicted to stay as it last was
+	uint8_t nRemote = 0;
+	if (nFrame < m_vRemote.size()) {
+		nRemote = m_vRemote[nFrame];
+	} else if (!m_vRemote.empty()) {
+		nRemote = m_vRemote.back();
+	}
+	if (nFrame == m_vUsed.size()) {
+		m_vUsed.push_back(nRemote);
+	} else {
+		m_vUsed[nFrame] = nRemote;
+	}
+
+	m_pMachine->GetControllers()->SetButtons(m_nLocalPort, m_vLocal[nFrame]);
+	m_pMachine->GetControllers()->SetButtons(m_nLocalPort ^ 1, nRemote);
+	m_pMachine->RunFrame();
+}
+}
@@ -0,0 +1,176 @@
+#ifndef CEE_PANE_NETPLAY_H_
+#define CEE_PANE_NETPLAY_H_
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <cstdint>
+#include <cstddef>
+
+#include "machine.h"
+#include "state.h"
+
+// "PNNP" little endian
+#define PANE_NETPLAY_MAGIC             0x504E4E50
+// Frames a peer may run ahead of the last input it has from the other
+#define PANE_NETPLAY_DEFAULT_ROLLBACK  8
+#define PANE_NETPLAY_MAX_ROLLBACK      32
+// Confirmed frames between state hash checks
+#define PANE_NETPLAY_HASH_INTERVAL     8
+#define PANE_NETPLAY_HASH_HISTORY      16
+// Most unacknowledged inputs resent in one packet
+#define PANE_NETPLAY_PACKET_INPUTS     128
+
+namespace pane {
+// Moves datagrams between the two peers. Like UDP, packets may be dropped
+// or arrive late but are never corrupted or split.
+class NetTransport {
+public:
+	virtual ~NetTransport() {}
+
+	virtual void Send(const void* pData, size_t nSize) = 0;
+	// Copies the next packet that has arrived to pData and returns its size,
+	// 0 once there are none. Packets larger than nCapacity are dropped.
+	virtual size_t Receive(void* pData, size_t nCapacity) = 0;
+};
+
+// Two in-process transports joined back to back. The link has its own
+// clock, moved on by Tick once per host frame, and delivers a packet
+// nLatency ticks after it was sent, dropping nLoss of them at random but
+// reproducibly. Safe to use with each end on its own thread.
+class LoopbackLink {
+public:
+	explicit LoopbackLink(uint32_t nLatency = 0, double nLoss = 0.0, uint32_t nSeed = 1);
+	~LoopbackLink();
+
+	NetTransport* GetEnd(size_t nEnd) { return m_pEnds[nEnd].get(); }
+	void Tick();
+
+	uint64_t GetSentCount() const { return m_nSent; }
+	uint64_t GetDroppedCount() const { return m_nDropped; }
+
+private:
+	struct Packet {
+		uint64_t nDeliverAt;
+		std::vector<uint8_t> vData;
+	};
+
+	class End : public NetTransport {
+	public:
+		End(LoopbackLink* pLink, size_t nEnd) : m_pLink(pLink), m_nEnd(nEnd) {}
+
+		virtual void Send(const void* pData, size_t nSize);
+		virtual size_t Receive(void* pData, size_t nCapacity);
+
+	private:
+		LoopbackLink* m_pLink;
+		size_t m_nEnd;
+	};
+
+private:
+	std::unique_ptr<End> m_pEnds[2];
+	// Packets on their way to each end
+	std::deque<Packet> m_pQueues[2];
+	std::mutex m_xLock;
+	uint64_t m_nTick;
+	uint32_t m_nLatency;
+	uint32_t m_nLossThreshold;
+	uint32_t m_nSeed;
+	uint64_t m_nSent;
+	uint64_t m_nDropped;
+};
+
+struct NetplayStats {
+	uint64_t nFrames;
+	// AdvanceFrame calls that waited on the remote peer instead of running
+	uint64_t nStalls;
+	uint64_t nRollbacks;
+	// Frames emulated again after a misprediction
+	uint64_t nRollbackFrames;
+	uint32_t nMaxRollbackFrames;
+	// Time spent restoring and re-simulating
+	double nRollbackSeconds;
+	// Confirmed states compared with the remote peer's
+	uint64_t nHashChecks;
+};
+
+// Rollback netplay for two peers, each driving its own Machine with the
+// other's controller predicted from its last known input. Every frame the
+// state is saved before it runs, when a remote input arrives that differs
+// from the prediction the machine goes back to the snapshot of that frame
+// and runs up to the present again with the right inputs, all within one
+// AdvanceFrame. Peers compare hashes of confirmed states every
+// PANE_NETPLAY_HASH_INTERVAL frames to catch desyncs.
+class NetplaySession {
+public:
+	// The machine must be started, in the same state on both peers. Local
+	// input is delayed nInputDelay frames, which trades latency for fewer
+	// rollbacks. Throws if nMaxRollback is above PANE_NETPLAY_MAX_ROLLBACK.
+	NetplaySession(std::shared_ptr<Machine> pMachine, NetTransport* pTransport, uint8_t nLocalPort, uint32_t nInputDelay = 0, uint32_t nMaxRollback = PANE_NETPLAY_DEFAULT_ROLLBACK);
+	~NetplaySession();
+
+	// Call once per host frame with the local buttons. Receives, rolls back
+	// if needed and runs the next frame, leaving the machine on it for
+	// presentation. Returns false without running anything if the remote
+	// peer is too far behind, the buttons are then dropped.
+	bool AdvanceFrame(uint8_t nButtons);
+
+	uint64_t GetFrame() const { return m_nFrame; }
+	// Frames both peers' inputs are known for
+	uint64_t GetConfirmedFrame() const { return std::min<uint64_t>(m_nFrame, m_vRemote.size()); }
+	// A confirmed state hashed differently on the remote peer
+	bool IsDesynced() const { return m_nDesyncFrame != UINT64_MAX; }
+	// Frame whose starting state differed, UINT64_MAX if none
+	uint64_t GetDesyncFrame() const { return m_nDesyncFrame; }
+	const NetplayStats& GetStats() const { return m_xStats; }
+
+private:
+	struct HashEntry {
+		uint64_t nFrame;
+		uint64_t nHash;
+	};
+
+	void Receive();
+	void Send();
+	void RollBack();
+	void CheckHashes();
+	void CompareHash(uint64_t nFrame);
+	// Sets both ports for nFrame and runs it, saving its snapshot first
+	void RunFrame(uint64_t nFrame);
+	MachineState* GetSnapshot(uint64_t nFrame) { return &m_pSnapshots[nFrame % (m_nMaxRollback + 1)]; }
+
+private:
+	std::shared_ptr<Machine> m_pMachine;
+	NetTransport* m_pTransport;
+	uint8_t m_nLocalPort;
+	uint32_t m_nInputDelay;
+	uint32_t m_nMaxRollback;
+
+	// Frames run so far, the next one to run
+	uint64_t m_nFrame;
+	// Indexed by frame, local input is known nInputDelay frames ahead
+	std::vector<uint8_t> m_vLocal;
+	std::vector<uint8_t> m_vRemote;
+	// Remote input each run frame was run with, predicted or not
+	std::vector<uint8_t> m_vUsed;
+	// Earliest frame run with a wrong prediction, UINT64_MAX if none
+	uint64_t m_nRollbackFrame;
+	// Local inputs the remote peer has
+	uint64_t m_nRemoteAck;
+	// State before each of the last nMaxRollback + 1 frames
+	std::unique_ptr<MachineState[]> m_pSnapshots;
+
+	HashEntry m_pLocalHashes[PANE_NETPLAY_HASH_HISTORY];
+	HashEntry m_pRemoteHashes[PANE_NETPLAY_HASH_HISTORY];
+	// Next confirmed frame to hash the starting state of
+	uint64_t m_nNextHashFrame;
+	uint64_t m_nDesyncFrame;
+
+	NetplayStats m_xStats;
+};
+}
+
+#endif
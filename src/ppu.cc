@@ -1,18 +1,21 @@
 #include "ppu.h"
 
+#include <cstddef>
 #include <cstdlib>
 #include <cstdint>
 #include <cstring>
 #include <stdexcept>
 
-int g_nCounter;
-
 namespace pane {
 PPU::PPU() {
 	m_pPixels = reinterpret_cast<uint8_t*>(std::calloc(PANE_NES_VISIBLE_IMAGE_WIDTH * PANE_NES_VISIBLE_IMAGE_HEIGHT * 4, sizeof(uint8_t)));
 	if (m_pPixels == nullptr) {
 		throw std::runtime_error("Failed to allocate pixel buffer for PPU.");
 	}
+
+	// CHR RAM and vertical mirroring until a cartridge says otherwise
+	this->MapPatternRAM();
+	this->SetMirroring(MIRROR_VERTICAL);
 }
 
 PPU::~PPU() {
@@ -24,20 +27,344 @@ PPU::~PPU() {
 
 void PPU::SetMMU(std::shared_ptr<MMU> pMMU) {
 	m_pMMU = pMMU;
+	// 0x2000 - 0x3FFF mirrors the eight PPU registers
+	m_pMMU->MapHandler(0x2000, 0x2000, PPU::ReadRegister, PPU::WriteRegister, this);
+	// Repeated PPUSTATUS reads only clear what the first one did
+	for (uint32_t pAddress = 0x2002; pAddress < 0x4000; pAddress += 8) {
+		m_pMMU->SetPollable(pAddress, true);
+	}
 }
 
 void PPU::SetCPU(std::shared_ptr<CPU> pCPU) {
 	m_pCPU = pCPU;
 }
 
-void PPU::Execute() {
-	if (m_bRender) {
-		g_nCounter = 0;
+void PPU::SetScheduler(Scheduler* pScheduler) {
+	m_pScheduler = pScheduler;
+	// Lets the scheduler restore pending events from a saved state
+	m_pScheduler->SetCallback(SCHEDULED_EVENT_VBLANK_NMI, PPU::OnVBlank, this);
+	m_pScheduler->SetCallback(SCHEDULED_EVENT_VBLANK_END, PPU::OnVBlankEnd, this);
+	m_pScheduler->SetCallback(SCHEDULED_EVENT_FRAME_END, PPU::OnFrameEnd, this);
+}
+
+void PPU::SetMemory(PPUMemory* pMemory) {
+	m_pMemory = pMemory;
+	for (uint32_t i = 0; i < PANE_PPU_PAGE_COUNT; i++) {
+		if (m_pPageOffsets[i] >= 0) {
+			this->MapPage(i, m_pPageOffsets[i]);
+		}
+	}
+}
+
+void PPU::MapPatterns(uint16_t pAddress, size_t nSize, const uint8_t* pData) {
+	if ((pAddress & (PANE_PPU_PAGE_SIZE - 1)) || (nSize & (PANE_PPU_PAGE_SIZE - 1)) || pAddress + nSize > 0x2000) {
+		throw std::runtime_error("Pattern mapping must be page aligned!");
+	}
+
+	uint32_t nFirst = pAddress >> PANE_PPU_PAGE_SHIFT;
+	uint32_t nCount = static_cast<uint32_t>(nSize >> PANE_PPU_PAGE_SHIFT);
+	for (uint32_t i = 0; i < nCount; i++) {
+		m_pReadPages[nFirst + i] = pData + (i << PANE_PPU_PAGE_SHIFT);
+		m_pWritePages[nFirst + i] = nullptr;
+		m_pPageOffsets[nFirst + i] = -1;
+	}
+}
+
+void PPU::MapPatternRAM(uint16_t pAddress, size_t nSize, size_t nRAMOffset) {
+	if ((pAddress & (PANE_PPU_PAGE_SIZE - 1)) || (nSize & (PANE_PPU_PAGE_SIZE - 1)) || (nRAMOffset & (PANE_PPU_PAGE_SIZE - 1)) || pAddress + nSize > 0x2000 || nRAMOffset + nSize > 0x2000) {
+		throw std::runtime_error("Pattern mapping must be page aligned!");
+	}
+
+	uint32_t nFirst = pAddress >> PANE_PPU_PAGE_SHIFT;
+	uint32_t nCount = static_cast<uint32_t>(nSize >> PANE_PPU_PAGE_SHIFT);
+	for (uint32_t i = 0; i < nCount; i++) {
+		this->MapPage(nFirst + i, offsetof(PPUMemory, pPatterns) + nRAMOffset + (i << PANE_PPU_PAGE_SHIFT));
+	}
+}
+
+void PPU::SetMirroring(NametableMirroring eMirroring) {
+	// Nametable each of 0x2000, 0x2400, 0x2800 and 0x2C00 shows
+	static const uint8_t s_pLayouts[][4] = {
+		{ 0, 0, 1, 1 }, // MIRROR_HORIZONTAL
+		{ 0, 1, 0, 1 }, // MIRROR_VERTICAL
+		{ 0, 0, 0, 0 }, // MIRROR_SINGLE_LOWER
+		{ 1, 1, 1, 1 }  // MIRROR_SINGLE_UPPER
+	};
+	for (uint32_t i = 0; i < 4; i++) {
+		this->MapPage((0x2000 >> PANE_PPU_PAGE_SHIFT) + i, offsetof(PPUMemory, pNametables) + (s_pLayouts[eMirroring][i] << PANE_PPU_PAGE_SHIFT));
 	}
-	g_nCounter++;
-	if (g_nCounter > 29780) {
-		m_bRender = true;
+}
+
+void PPU::SetRenderingCallback(RenderingCallback fnCallback, void* pUserData) {
+	m_fnRenderingCallback = fnCallback;
+	m_pRenderingUserData = pUserData;
+}
+
+void PPU::MapPage(uint32_t nPage, size_t nOffset) {
+	uint8_t* pPage = m_pMemory != nullptr ? reinterpret_cast<uint8_t*>(m_pMemory) + nOffset : nullptr;
+	m_pReadPages[nPage] = pPage;
+	m_pWritePages[nPage] = pPage;
+	m_pPageOffsets[nPage] = static_cast<int32_t>(nOffset);
+}
+
+void PPU::Reset() {
+	this->MapPatternRAM();
+	this->SetMirroring(MIRROR_VERTICAL);
+	this->SetRenderingCallback(nullptr, nullptr);
+	std::memset(m_pPixels, 0, PANE_NES_VISIBLE_IMAGE_WIDTH * PANE_NES_VISIBLE_IMAGE_HEIGHT * 4);
+
+	m_nTimestamp = m_nFrameStart = 0;
+	m_nFrames = 0;
+	m_nScanline = m_nDot = 0;
+	m_bRender = false;
+
+	m_nCtrl = m_nMask = m_nStatus = 0;
+	m_nOAMAddress = m_nReadBuffer = m_nLatch = 0;
+	m_pVRAMAddress = m_pTempAddress = 0;
+	m_nFineX = 0;
+	m_bWriteToggle = false;
+}
+
+void PPU::Start(uint64_t nTimestamp) {
+	m_nTimestamp = m_nFrameStart = nTimestamp;
+	m_nFrames = 0;
+	m_nScanline = m_nDot = 0;
+	m_bRender = false;
+
+	m_nCtrl = m_nMask = m_nStatus = 0;
+	m_nOAMAddress = m_nReadBuffer = m_nLatch = 0;
+	m_pVRAMAddress = m_pTempAddress = 0;
+	m_nFineX = 0;
+	m_bWriteToggle = false;
+
+	this->ScheduleFrameEvents();
+}
+
+void PPU::SaveState(PPUState* pState) const {
+	pState->nTimestamp = m_nTimestamp;
+	pState->nFrameStart = m_nFrameStart;
+	pState->nFrames = m_nFrames;
+	pState->nScanline = m_nScanline;
+	pState->nDot = m_nDot;
+
+	pState->nCtrl = m_nCtrl;
+	pState->nMask = m_nMask;
+	pState->nStatus = m_nStatus;
+	pState->nOAMAddress = m_nOAMAddress;
+	pState->nReadBuffer = m_nReadBuffer;
+	pState->nLatch = m_nLatch;
+	pState->pVRAMAddress = m_pVRAMAddress;
+	pState->pTempAddress = m_pTempAddress;
+	pState->nFineX = m_nFineX;
+	pState->bWriteToggle = m_bWriteToggle;
+	pState->bRender = m_bRender;
+}
+
+void PPU::LoadState(const PPUState& xState) {
+	m_nTimestamp = xState.nTimestamp;
+	m_nFrameStart = xState.nFrameStart;
+	m_nFrames = xState.nFrames;
+	m_nScanline = xState.nScanline;
+	m_nDot = xState.nDot;
+
+	m_nCtrl = xState.nCtrl;
+	m_nMask = xState.nMask;
+	m_nStatus = xState.nStatus;
+	m_nOAMAddress = xState.nOAMAddress;
+	m_nReadBuffer = xState.nReadBuffer;
+	m_nLatch = xState.nLatch;
+	m_pVRAMAddress = xState.pVRAMAddress;
+	m_pTempAddress = xState.pTempAddress;
+	m_nFineX = xState.nFineX;
+	m_bWriteToggle = xState.bWriteToggle;
+	m_bRender = xState.bRender;
+}
+
+void PPU::CatchUp(uint64_t nTimestamp) {
+	if (nTimestamp <= m_nTimestamp) {
+		return;
 	}
+
+	// Nothing is rendered yet, so catching up is just working out where the
+	// beam is now and applying any flag changes it swept past.
+	uint64_t nPrevDot = (m_nTimestamp - m_nFrameStart) / PANE_MASTER_CLOCKS_PER_PPU_DOT;
+	uint64_t nDot = (nTimestamp - m_nFrameStart) / PANE_MASTER_CLOCKS_PER_PPU_DOT;
+
+	// Vertical blank and sprite flags clear on dot 1 of the pre-render line
+	const uint64_t nClearDot = PANE_NES_PRERENDER_SCANLINE * PANE_NES_DOTS_PER_SCANLINE + 1;
+	if (nPrevDot < nClearDot && nDot >= nClearDot) {
+		m_nStatus &= ~(PPUSTATUS_VBLANK | PPUSTATUS_SPRITE_ZERO_HIT | PPUSTATUS_SPRITE_OVERFLOW);
+	}
+
+	m_nScanline = (nDot / PANE_NES_DOTS_PER_SCANLINE) % PANE_NES_SCANLINES_PER_FRAME;
+	m_nDot = nDot % PANE_NES_DOTS_PER_SCANLINE;
+	m_nTimestamp = nTimestamp;
+}
+
+void PPU::ScheduleFrameEvents() {
+	uint64_t nVBlank = m_nFrameStart + (PANE_NES_VBLANK_SCANLINE * PANE_NES_DOTS_PER_SCANLINE + 1) * PANE_MASTER_CLOCKS_PER_PPU_DOT;
+	uint64_t nVBlankEnd = m_nFrameStart + (PANE_NES_PRERENDER_SCANLINE * PANE_NES_DOTS_PER_SCANLINE + 1) * PANE_MASTER_CLOCKS_PER_PPU_DOT;
+	uint64_t nFrameEnd = m_nFrameStart + PANE_NES_DOTS_PER_FRAME * PANE_MASTER_CLOCKS_PER_PPU_DOT;
+
+	m_pScheduler->Schedule(SCHEDULED_EVENT_VBLANK_NMI, nVBlank, PPU::OnVBlank, this);
+	// Nothing to do here that CatchUp wouldn't, but scheduling it keeps every
+	// PPUSTATUS change on an event boundary so polling loops can be skipped.
+	m_pScheduler->Schedule(SCHEDULED_EVENT_VBLANK_END, nVBlankEnd, PPU::OnVBlankEnd, this);
+	m_pScheduler->Schedule(SCHEDULED_EVENT_FRAME_END, nFrameEnd, PPU::OnFrameEnd, this);
+}
+
+uint64_t PPU::GetCPUTimestamp() const {
+	return m_pCPU->GetCycleCount() * PANE_MASTER_CLOCKS_PER_CPU_CYCLE;
+}
+
+uint8_t PPU::ReadVRAM(uint16_t pAddress) {
+	pAddress &= 0x3FFF;
+	if (pAddress >= 0x3F00) {
+		return *this->GetPalette(pAddress);
+	}
+	// 0x3000 - 0x3EFF mirrors 0x2000 - 0x2EFF
+	uint16_t pMapped = pAddress >= 0x3000 ? pAddress - 0x1000 : pAddress;
+	return m_pReadPages[pMapped >> PANE_PPU_PAGE_SHIFT][pMapped & (PANE_PPU_PAGE_SIZE - 1)];
+}
+
+void PPU::WriteVRAM(uint16_t pAddress, uint8_t cVal) {
+	pAddress &= 0x3FFF;
+	if (pAddress >= 0x3F00) {
+		*this->GetPalette(pAddress) = cVal;
+		return;
+	}
+	uint16_t pMapped = pAddress >= 0x3000 ? pAddress - 0x1000 : pAddress;
+	uint8_t* pPage = m_pWritePages[pMapped >> PANE_PPU_PAGE_SHIFT];
+	if (pPage != nullptr) {
+		pPage[pMapped & (PANE_PPU_PAGE_SIZE - 1)] = cVal;
+	}
+}
+
+uint8_t* PPU::GetPalette(uint16_t pAddress) {
+	// 0x3F10/0x3F14/0x3F18/0x3F1C mirror the background entries
+	uint16_t nIndex = pAddress & 0x001F;
+	if ((nIndex & 0x0013) == 0x0010) {
+		nIndex &= ~0x0010;
+	}
+	return m_pMemory->pPalette + nIndex;
+}
+
+uint8_t PPU::ReadRegister(void* pUserData, uint16_t pAddress) {
+	PPU* pPPU = reinterpret_cast<PPU*>(pUserData);
+	pPPU->CatchUp(pPPU->GetCPUTimestamp());
+
+	uint8_t cVal = pPPU->m_nLatch;
+	switch (pAddress & 0x0007) {
+	case 2: // PPUSTATUS
+		cVal = (pPPU->m_nStatus & 0xE0) | (pPPU->m_nLatch & 0x1F);
+		pPPU->m_nStatus &= ~PPUSTATUS_VBLANK;
+		pPPU->m_bWriteToggle = false;
+		break;
+	case 4: // OAMDATA
+		cVal = pPPU->m_pMemory->pOAM[pPPU->m_nOAMAddress];
+		break;
+	case 7: { // PPUDATA
+		uint16_t pVRAM = pPPU->m_pVRAMAddress & 0x3FFF;
+		if (pVRAM >= 0x3F00) {
+			// Palette reads are immediate, the buffer gets the nametable byte underneath
+			cVal = pPPU->ReadVRAM(pVRAM);
+			pPPU->m_nReadBuffer = pPPU->ReadVRAM(pVRAM - 0x1000);
+		} else {
+			cVal = pPPU->m_nReadBuffer;
+			pPPU->m_nReadBuffer = pPPU->ReadVRAM(pVRAM);
+		}
+		pPPU->m_pVRAMAddress += (pPPU->m_nCtrl & PPUCTRL_INCREMENT_32) ? 32 : 1;
+		break;
+	}
+	default: // Write only registers return the open bus latch
+		break;
+	}
+
+	pPPU->m_nLatch = cVal;
+	return cVal;
+}
+
+void PPU::WriteRegister(void* pUserData, uint16_t pAddress, uint8_t cVal) {
+	PPU* pPPU = reinterpret_cast<PPU*>(pUserData);
+	pPPU->CatchUp(pPPU->GetCPUTimestamp());
+
+	pPPU->m_nLatch = cVal;
+	switch (pAddress & 0x0007) {
+	case 0: { // PPUCTRL
+		uint8_t nPrevCtrl = pPPU->m_nCtrl;
+		pPPU->m_nCtrl = cVal;
+		pPPU->m_pTempAddress = (pPPU->m_pTempAddress & 0xF3FF) | ((cVal & 0x03) << 10);
+		// Enabling NMI during vertical blank raises one immediately
+		if (!(nPrevCtrl & PPUCTRL_NMI_ENABLE) && (cVal & PPUCTRL_NMI_ENABLE) && (pPPU->m_nStatus & PPUSTATUS_VBLANK)) {
+			pPPU->m_pCPU->Interrupt(INT_NMI);
+		}
+		break;
+	}
+	case 1: { // PPUMASK
+		bool bWasRendering = pPPU->IsRenderingEnabled();
+		pPPU->m_nMask = cVal;
+		if (pPPU->m_fnRenderingCallback != nullptr && pPPU->IsRenderingEnabled() != bWasRendering) {
+			pPPU->m_fnRenderingCallback(pPPU->m_pRenderingUserData, pPPU->GetCPUTimestamp());
+		}
+		break;
+	}
+	case 3: // OAMADDR
+		pPPU->m_nOAMAddress = cVal;
+		break;
+	case 4: // OAMDATA
+		pPPU->m_pMemory->pOAM[pPPU->m_nOAMAddress++] = cVal;
+		break;
+	case 5: // PPUSCROLL
+		if (!pPPU->m_bWriteToggle) {
+			pPPU->m_pTempAddress = (pPPU->m_pTempAddress & 0xFFE0) | (cVal >> 3);
+			pPPU->m_nFineX = cVal & 0x07;
+		} else {
+			pPPU->m_pTempAddress = (pPPU->m_pTempAddress & 0x0C1F) | ((cVal & 0x07) << 12) | ((cVal & 0xF8) << 2);
+		}
+		pPPU->m_bWriteToggle = !pPPU->m_bWriteToggle;
+		break;
+	case 6: // PPUADDR
+		if (!pPPU->m_bWriteToggle) {
+			pPPU->m_pTempAddress = (pPPU->m_pTempAddress & 0x00FF) | ((cVal & 0x3F) << 8);
+		} else {
+			pPPU->m_pTempAddress = (pPPU->m_pTempAddress & 0xFF00) | cVal;
+			pPPU->m_pVRAMAddress = pPPU->m_pTempAddress;
+		}
+		pPPU->m_bWriteToggle = !pPPU->m_bWriteToggle;
+		break;
+	case 7: // PPUDATA
+		pPPU->WriteVRAM(pPPU->m_pVRAMAddress, cVal);
+		pPPU->m_pVRAMAddress += (pPPU->m_nCtrl & PPUCTRL_INCREMENT_32) ? 32 : 1;
+		break;
+	default: // PPUSTATUS is read only
+		break;
+	}
+}
+
+void PPU::OnVBlank(void* pUserData, uint64_t nTimestamp) {
+	PPU* pPPU = reinterpret_cast<PPU*>(pUserData);
+	pPPU->CatchUp(nTimestamp);
+
+	pPPU->m_nStatus |= PPUSTATUS_VBLANK;
+	if (pPPU->m_nCtrl & PPUCTRL_NMI_ENABLE) {
+		pPPU->m_pCPU->Interrupt(INT_NMI);
+	}
+}
+
+void PPU::OnVBlankEnd(void* pUserData, uint64_t nTimestamp) {
+	PPU* pPPU = reinterpret_cast<PPU*>(pUserData);
+	pPPU->CatchUp(nTimestamp);
+}
+
+void PPU::OnFrameEnd(void* pUserData, uint64_t nTimestamp) {
+	PPU* pPPU = reinterpret_cast<PPU*>(pUserData);
+	pPPU->CatchUp(nTimestamp);
+
+	pPPU->m_nFrameStart = nTimestamp;
+	pPPU->m_nFrames++;
+	pPPU->m_bRender = true;
+
+	pPPU->ScheduleFrameEvents();
 }
 }
 
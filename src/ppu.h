@@ -7,31 +7,154 @@
 
 #include "mmu.h"
 #include "cpu.h"
+#include "scheduler.h"
+#include "state.h"
 
 #define PANE_NES_VISIBLE_IMAGE_WIDTH    256
 #define PANE_NES_VISIBLE_IMAGE_HEIGHT   240
-#define PANE_NES_SCANLINES_PER_FRAME    261
+#define PANE_NES_SCANLINES_PER_FRAME    262
 #define PANE_NES_DOTS_PER_SCANLINE      341
+#define PANE_NES_DOTS_PER_FRAME         (PANE_NES_SCANLINES_PER_FRAME * PANE_NES_DOTS_PER_SCANLINE)
+#define PANE_NES_VBLANK_SCANLINE        241
+#define PANE_NES_PRERENDER_SCANLINE     261
+
+// Pattern tables and nametables are mapped in 1K pages, the smallest bank
+// cartridges switch
+#define PANE_PPU_PAGE_SHIFT   10
+#define PANE_PPU_PAGE_SIZE    (1 << PANE_PPU_PAGE_SHIFT)
+#define PANE_PPU_PAGE_COUNT   (0x3000 >> PANE_PPU_PAGE_SHIFT)
 
 namespace pane {
+enum PPUControlFlags {
+	PPUCTRL_INCREMENT_32 = 1 << 2,
+	PPUCTRL_NMI_ENABLE   = 1 << 7
+};
+
+enum PPUMaskFlags {
+	PPUMASK_SHOW_BACKGROUND = 1 << 3,
+	PPUMASK_SHOW_SPRITES    = 1 << 4
+};
+
+enum PPUStatusFlags {
+	PPUSTATUS_SPRITE_OVERFLOW = 1 << 5,
+	PPUSTATUS_SPRITE_ZERO_HIT = 1 << 6,
+	PPUSTATUS_VBLANK          = 1 << 7
+};
+
+// Which of the two 1K nametables in PPUMemory each of the four logical ones
+// at 0x2000 - 0x2FFF shows
+enum NametableMirroring {
+	MIRROR_HORIZONTAL = 0,
+	MIRROR_VERTICAL,
+	MIRROR_SINGLE_LOWER,
+	MIRROR_SINGLE_UPPER
+};
+
+// Called with the CPU timestamp of a PPUMASK write that turns rendering on
+// or off
+typedef void (*RenderingCallback)(void* pUserData, uint64_t nTimestamp);
+
+// The PPU is run lazily: it remembers the master clock timestamp it has been
+// brought up to and only catches up when the CPU touches one of its registers
+// or one of its scheduled events (vblank, frame end) fires.
 class PPU {
 public:
 	PPU();
 	~PPU();
 
+	// Attaching the MMU routes the 0x2000 - 0x3FFF register window to the PPU.
 	void SetMMU(std::shared_ptr<MMU> pMMU);
 	void SetCPU(std::shared_ptr<CPU> pCPU);
+	void SetScheduler(Scheduler* pScheduler);
+	// OAM, pattern tables, nametables and palette are worked on in place.
+	// Pages mapped into the old block follow it to the new one.
+	void SetMemory(PPUMemory* pMemory);
+
+	// Maps nSize bytes (a multiple of PANE_PPU_PAGE_SIZE) of the pattern
+	// tables at pAddress onto cartridge CHR ROM, writes are ignored. pData
+	// must outlive the mapping.
+	void MapPatterns(uint16_t pAddress, size_t nSize, const uint8_t* pData);
+	// Pattern tables at pAddress back to the CHR RAM in PPUMemory, from
+	// nRAMOffset into it. Boards with banked CHR RAM map parts of it.
+	void MapPatternRAM(uint16_t pAddress = 0x0000, size_t nSize = 0x2000, size_t nRAMOffset = 0);
+	void SetMirroring(NametableMirroring eMirroring);
+	// For mappers that count scanlines, which they only do while rendering
+	void SetRenderingCallback(RenderingCallback fnCallback, void* pUserData);
+
+	// Back to how a new PPU maps and shows things: CHR RAM, vertical
+	// mirroring, no rendering callback, a blank picture and registers at
+	// zero. Memory, MMU and scheduler stay attached.
+	void Reset();
+	// Starts the first frame at nTimestamp and schedules its events.
+	void Start(uint64_t nTimestamp);
+	// Brings the PPU up to nTimestamp (master clock). Never steps backwards.
+	void CatchUp(uint64_t nTimestamp);
 
-	void Execute();
 	bool ShouldRender() const { return m_bRender; }
 	void Rendered() { m_bRender = false; }
 
+	uint64_t GetFrameCount() const { return m_nFrames; }
+	// Master clock timestamp the current frame started at
+	uint64_t GetFrameStart() const { return m_nFrameStart; }
+	uint64_t GetTimestamp() const { return m_nTimestamp; }
+	bool IsRenderingEnabled() const { return (m_nMask & (PPUMASK_SHOW_BACKGROUND | PPUMASK_SHOW_SPRITES)) != 0; }
 	const uint8_t* GetPixels() const { return m_pPixels; }
 
+	// Registers and timing only, memory lives in the PPUMemory block
+	void SaveState(PPUState* pState) const;
+	void LoadState(const PPUState& xState);
+
+private:
+	void ScheduleFrameEvents();
+	uint64_t GetCPUTimestamp() const;
+
+	uint8_t ReadVRAM(uint16_t pAddress);
+	void WriteVRAM(uint16_t pAddress, uint8_t cVal);
+	uint8_t* GetPalette(uint16_t pAddress);
+	// nOffset is into PPUMemory
+	void MapPage(uint32_t nPage, size_t nOffset);
+
+	static uint8_t ReadRegister(void* pUserData, uint16_t pAddress);
+	static void WriteRegister(void* pUserData, uint16_t pAddress, uint8_t cVal);
+
+	static void OnVBlank(void* pUserData, uint64_t nTimestamp);
+	static void OnVBlankEnd(void* pUserData, uint64_t nTimestamp);
+	static void OnFrameEnd(void* pUserData, uint64_t nTimestamp);
+
 private:
 	std::shared_ptr<MMU> m_pMMU;
 	std::shared_ptr<CPU> m_pCPU;
+	Scheduler* m_pScheduler = nullptr;
+	PPUMemory* m_pMemory = nullptr;
 	uint8_t* m_pPixels = nullptr;
+	RenderingCallback m_fnRenderingCallback = nullptr;
+	void* m_pRenderingUserData = nullptr;
+
+	// 0x0000 - 0x2FFF, 0x3000 - 0x3EFF mirrors the nametables. ROM pages have
+	// no write pointer.
+	const uint8_t* m_pReadPages[PANE_PPU_PAGE_COUNT];
+	uint8_t* m_pWritePages[PANE_PPU_PAGE_COUNT];
+	// Where each page lives in PPUMemory, -1 if it maps something else
+	int32_t m_pPageOffsets[PANE_PPU_PAGE_COUNT];
+
+	// Timing
+	uint64_t m_nTimestamp = 0;
+	uint64_t m_nFrameStart = 0;
+	uint64_t m_nFrames = 0;
+	uint32_t m_nScanline = 0;
+	uint32_t m_nDot = 0;
+
+	// Registers
+	uint8_t m_nCtrl = 0;
+	uint8_t m_nMask = 0;
+	uint8_t m_nStatus = 0;
+	uint8_t m_nOAMAddress = 0;
+	uint8_t m_nReadBuffer = 0;
+	uint8_t m_nLatch = 0;
+	uint16_t m_pVRAMAddress = 0;
+	uint16_t m_pTempAddress = 0;
+	uint8_t m_nFineX = 0;
+	bool m_bWriteToggle = false;
 
 	bool m_bRender = 0;
 };
@@ -46,17 +46,21 @@ Renderer::~Renderer() {
 }
 
 void Renderer::Init() {
+	if (m_bInitialized) {
+		throw std::runtime_error("Attempting to initialize renderer twice!");
+	}
+	// Function pointers are loaded once per process, every renderer
+	// (one per window context) still sets up its own debug output
 	if (!s_bGLInitialized) {
 		GLenum ec = glewInit();
 		if (ec != GLEW_OK) {
 			throw std::runtime_error("Failed to initialize GLEW");
 		}
 		s_bGLInitialized = true;
-		glDebugMessageCallback(Renderer::DebugCallback, this);
-		glEnable(GL_DEBUG_OUTPUT);
-	} else {
-		throw std::runtime_error("Attempting to initialize renderer twice!");
 	}
+	glDebugMessageCallback(Renderer::DebugCallback, this);
+	glEnable(GL_DEBUG_OUTPUT);
+	m_bInitialized = true;
 
 	// Vertex format X, Y, U, V
 	float pVertices[] = {
@@ -138,6 +142,13 @@ void Renderer::Shutdown() {
 	if (!m_bInitialized) {
 		return;
 	}
+
+	glDeleteProgram(m_uShaderProgram);
+	glDeleteTextures(1, &m_uTexture);
+	glDeleteBuffers(1, &m_uIBO);
+	glDeleteBuffers(1, &m_uVBO);
+	glDeleteVertexArrays(1, &m_uVAO);
+	m_bInitialized = false;
 }
 
 void Renderer::UpdateImage(const void* pPixels) {
@@ -0,0 +1,180 @@
+#include "rewind.h"
+
+#include <chrono>
+#include <stdexcept>
+
+#include <cstring>
+
+#define PANE_REWIND_STATE_WORDS  (sizeof(MachineState) / sizeof(uint64_t))
+// A delta is a list of runs, each a header of unchanged and changed word
+// counts followed by the XOR of the changed words.
+#define PANE_REWIND_MAX_RUN      0xFFFF
+
+namespace pane {
+static_assert(sizeof(MachineState) % sizeof(uint64_t) == 0, "MachineState must be a whole number of words");
+
+RewindBuffer::RewindBuffer(size_t nBudget, uint32_t nInterval)
+ : m_nCapacity(nBudget), m_nInterval(nInterval > 0 ? nInterval : 1)
+{
+	m_pRing = std::make_unique<uint8_t[]>(m_nCapacity);
+	m_pNewest = std::make_unique<MachineState>();
+	m_pScratch = std::make_unique<uint8_t[]>(PANE_REWIND_STATE_WORDS * (sizeof(uint64_t) + 2 * sizeof(uint16_t)));
+	this->Clear();
+}
+
+RewindBuffer::~RewindBuffer() {
+
+}
+
+void RewindBuffer::Clear() {
+	m_xEntries.clear();
+	m_nHead = 0;
+	m_nBytesUsed = 0;
+	m_bHasNewest = false;
+	m_nFrame = 0;
+
+	m_nRecorded = 0;
+	m_nEncodedBytes = 0;
+	m_nRecordSeconds = 0.0;
+}
+
+void RewindBuffer::Record(Machine& xMachine) {
+	if (m_nFrame++ % m_nInterval != 0) {
+		return;
+	}
+
+	auto tStart = std::chrono::steady_clock::now();
+	// Diffed straight against the live state, only changed words are copied
+	const MachineState& xState = xMachine.SyncState();
+	if (m_bHasNewest) {
+		size_t nSize = this->Encode(&xState, m_pNewest.get(), m_pScratch.get());
+		this->Push(m_pScratch.get(), nSize);
+		m_nEncodedBytes += nSize;
+	} else {
+		std::memcpy(m_pNewest.get(), &xState, sizeof(MachineState));
+		m_bHasNewest = true;
+	}
+	m_nRecorded++;
+	m_nRecordSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+}
+
+bool RewindBuffer::StepBack(Machine& xMachine) {
+	if (m_xEntries.empty()) {
+		return false;
+	}
+
+	Entry xEntry = m_xEntries.back();
+	m_xEntries.pop_back();
+	m_nBytesUsed -= xEntry.nSize;
+	m_nHead = xEntry.nOffset;
+
+	this->Apply(m_pNewest.get(), m_pRing.get() + xEntry.nOffset, xEntry.nSize);
+	xMachine.LoadState(*m_pNewest);
+	m_nFrame = 1;
+	return true;
+}
+
+RewindStats RewindBuffer::GetStats() const {
+	return { m_xEntries.size(), m_nBytesUsed, m_nCapacity, m_nRecorded, m_nEncodedBytes, m_nRecordSeconds };
+}
+
+size_t RewindBuffer::Encode(const MachineState* pNew, MachineState* pOld, uint8_t* pOut) const {
+	const uint64_t* pNewWords = reinterpret_cast<const uint64_t*>(pNew);
+	uint64_t* pOldWords = reinterpret_cast<uint64_t*>(pOld);
+	uint8_t* pWrite = pOut;
+
+	size_t i = 0;
+	while (i < PANE_REWIND_STATE_WORDS) {
+		size_t nStart = i;
+		// Most of the state is unchanged, skip it a cache line at a time
+		while (i + 8 <= PANE_REWIND_STATE_WORDS && i - nStart + 8 <= PANE_REWIND_MAX_RUN) {
+			uint64_t nChanged = 0;
+			for (size_t j = 0; j < 8; j++) {
+				nChanged |= pNewWords[i + j] ^ pOldWords[i + j];
+			}
+			if (nChanged != 0) {
+				break;
+			}
+			i += 8;
+		}
+		while (i < PANE_REWIND_STATE_WORDS && pNewWords[i] == pOldWords[i] && i - nStart < PANE_REWIND_MAX_RUN) {
+			i++;
+		}
+		uint16_t nSkip = static_cast<uint16_t>(i - nStart);
+
+		nStart = i;
+		while (i < PANE_REWIND_STATE_WORDS && pNewWords[i] != pOldWords[i] && i - nStart < PANE_REWIND_MAX_RUN) {
+			i++;
+		}
+		uint16_t nLiteral = static_cast<uint16_t>(i - nStart);
+		// Nothing changed up to the end, no need to say so unless the delta
+		// would be empty. Entries are never empty so the ring can tell them
+		// apart by offset.
+		if (nLiteral == 0 && i == PANE_REWIND_STATE_WORDS && pWrite != pOut) {
+			break;
+		}
+
+		std::memcpy(pWrite, &nSkip, sizeof(nSkip));
+		std::memcpy(pWrite + sizeof(nSkip), &nLiteral, sizeof(nLiteral));
+		pWrite += sizeof(nSkip) + sizeof(nLiteral);
+		for (size_t j = nStart; j < i; j++) {
+			uint64_t nXOR = pNewWords[j] ^ pOldWords[j];
+			std::memcpy(pWrite, &nXOR, sizeof(nXOR));
+			pWrite += sizeof(nXOR);
+			pOldWords[j] = pNewWords[j];
+		}
+	}
+	return pWrite - pOut;
+}
+
+void RewindBuffer::Apply(MachineState* pState, const uint8_t* pDelta, size_t nSize) const {
+	uint64_t* pWords = reinterpret_cast<uint64_t*>(pState);
+	const uint8_t* pEnd = pDelta + nSize;
+
+	size_t i = 0;
+	while (pDelta < pEnd) {
+		uint16_t nSkip, nLiteral;
+		std::memcpy(&nSkip, pDelta, sizeof(nSkip));
+		std::memcpy(&nLiteral, pDelta + sizeof(nSkip), sizeof(nLiteral));
+		pDelta += sizeof(nSkip) + sizeof(nLiteral);
+
+		i += nSkip;
+		for (uint16_t j = 0; j < nLiteral; j++) {
+			uint64_t nXOR;
+			std::memcpy(&nXOR, pDelta, sizeof(nXOR));
+			pWords[i++] ^= nXOR;
+			pDelta += sizeof(nXOR);
+		}
+	}
+}
+
+void RewindBuffer::Push(const uint8_t* pDelta, size_t nSize) {
+	if (nSize > m_nCapacity) {
+		// Can't be linked to the history, so the history ends here
+		m_xEntries.clear();
+		m_nHead = 0;
+		m_nBytesUsed = 0;
+		return;
+	}
+
+	// Entries sit in the ring oldest to newest, the newest ending at the head
+	// and the oldest possibly wrapped around to after it. Only ever evict
+	// from the oldest end so the chain of deltas stays unbroken.
+	if (m_nHead + nSize > m_nCapacity) {
+		while (!m_xEntries.empty() && m_xEntries.front().nOffset >= m_nHead) {
+			m_nBytesUsed -= m_xEntries.front().nSize;
+			m_xEntries.pop_front();
+		}
+		m_nHead = 0;
+	}
+	while (!m_xEntries.empty() && m_xEntries.front().nOffset >= m_nHead && m_xEntries.front().nOffset < m_nHead + nSize) {
+		m_nBytesUsed -= m_xEntries.front().nSize;
+		m_xEntries.pop_front();
+	}
+
+	std::memcpy(m_pRing.get() + m_nHead, pDelta, nSize);
+	m_xEntries.push_back({ m_nHead, nSize });
+	m_nHead += nSize;
+	m_nBytesUsed += nSize;
+}
+}
@@ -0,0 +1,84 @@
+#ifndef CEE_PANE_REWIND_H_
+#define CEE_PANE_REWIND_H_
+
+#include <deque>
+#include <memory>
+
+#include <cstdint>
+#include <cstddef>
+
+#include "machine.h"
+#include "state.h"
+
+#define PANE_REWIND_DEFAULT_BUDGET  (64 << 20)
+
+namespace pane {
+struct RewindStats {
+	// Steps StepBack can take
+	size_t nSnapshots;
+	size_t nBytesUsed;
+	size_t nCapacity;
+	// Snapshots recorded since Clear, including evicted ones
+	uint64_t nRecorded;
+	uint64_t nEncodedBytes;
+	double nRecordSeconds;
+
+	double GetBytesPerSnapshot() const { return nRecorded > 0 ? static_cast<double>(nEncodedBytes) / nRecorded : 0.0; }
+	double GetSecondsPerSnapshot() const { return nRecorded > 0 ? nRecordSeconds / nRecorded : 0.0; }
+};
+
+// History of machine states in a fixed amount of memory. The newest state is
+// kept whole, every older one as the XOR against its successor with runs of
+// unchanged 64-bit words skipped. XOR works both ways, so stepping back is
+// applying the newest delta to the newest state. When the ring is full the
+// oldest deltas are dropped.
+class RewindBuffer {
+public:
+	// Snapshots every nInterval calls to Record. nBudget bounds the deltas,
+	// the two whole states come on top of it.
+	explicit RewindBuffer(size_t nBudget = PANE_REWIND_DEFAULT_BUDGET, uint32_t nInterval = 1);
+	~RewindBuffer();
+
+	// Call once per frame, between runs
+	void Record(Machine& xMachine);
+	// Loads the snapshot before the newest one and drops the newest, so
+	// recording carries on from the restored state. Returns false with the
+	// machine untouched once the history is exhausted.
+	bool StepBack(Machine& xMachine);
+	void Clear();
+
+	RewindStats GetStats() const;
+
+private:
+	struct Entry {
+		size_t nOffset;
+		size_t nSize;
+	};
+
+	// Also brings pOld up to pNew
+	size_t Encode(const MachineState* pNew, MachineState* pOld, uint8_t* pOut) const;
+	void Apply(MachineState* pState, const uint8_t* pDelta, size_t nSize) const;
+	void Push(const uint8_t* pDelta, size_t nSize);
+
+private:
+	std::unique_ptr<uint8_t[]> m_pRing;
+	size_t m_nCapacity;
+	size_t m_nHead;
+	size_t m_nBytesUsed;
+	std::deque<Entry> m_xEntries;
+
+	std::unique_ptr<MachineState> m_pNewest;
+	bool m_bHasNewest;
+	// Worst case delta, every word changed
+	std::unique_ptr<uint8_t[]> m_pScratch;
+
+	uint32_t m_nInterval;
+	uint32_t m_nFrame;
+
+	uint64_t m_nRecorded;
+	uint64_t m_nEncodedBytes;
+	double m_nRecordSeconds;
+};
+}
+
+#endif
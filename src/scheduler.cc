@@ -0,0 +1,96 @@
+#include "scheduler.h"
+
+#include <limits>
+#include <stdexcept>
+
+#include "state.h"
+
+namespace pane {
+Scheduler::Scheduler() {
+	for (uint32_t i = 0; i < SCHEDULED_EVENT_COUNT; i++) {
+		m_pCallbacks[i] = nullptr;
+		m_pUserData[i] = nullptr;
+	}
+	this->Reset();
+}
+
+Scheduler::~Scheduler() {
+
+}
+
+void Scheduler::Reset() {
+	m_nTimestamp = 0;
+	m_xQueue = decltype(m_xQueue)();
+	for (uint32_t i = 0; i < SCHEDULED_EVENT_COUNT; i++) {
+		m_pGenerations[i] = 0;
+		m_pTimestamps[i] = 0;
+	}
+}
+
+void Scheduler::Schedule(ScheduledEventType eType, uint64_t nTimestamp, ScheduledEventCallback fnCallback, void* pUserData) {
+	// Move to the next odd generation, invalidating any pending entry
+	m_pGenerations[eType] = (m_pGenerations[eType] + 1) | 1;
+	m_pTimestamps[eType] = nTimestamp;
+	this->SetCallback(eType, fnCallback, pUserData);
+	m_xQueue.push({ nTimestamp, m_pGenerations[eType], eType, fnCallback, pUserData });
+}
+
+void Scheduler::SetCallback(ScheduledEventType eType, ScheduledEventCallback fnCallback, void* pUserData) {
+	m_pCallbacks[eType] = fnCallback;
+	m_pUserData[eType] = pUserData;
+}
+
+void Scheduler::Cancel(ScheduledEventType eType) {
+	if (m_pGenerations[eType] & 1) {
+		m_pGenerations[eType]++;
+	}
+}
+
+uint64_t Scheduler::GetNextEventTimestamp() {
+	this->DropCancelled();
+	if (m_xQueue.empty()) {
+		return std::numeric_limits<uint64_t>::max();
+	}
+	return m_xQueue.top().nTimestamp;
+}
+
+void Scheduler::RunDueEvents() {
+	this->DropCancelled();
+	while (!m_xQueue.empty() && m_xQueue.top().nTimestamp <= m_nTimestamp) {
+		PendingEvent xEvent = m_xQueue.top();
+		m_xQueue.pop();
+		// Mark as no longer pending before the callback may reschedule it
+		m_pGenerations[xEvent.eType]++;
+		xEvent.fnCallback(xEvent.pUserData, xEvent.nTimestamp);
+		this->DropCancelled();
+	}
+}
+
+void Scheduler::SaveState(SchedulerState* pState) const {
+	pState->nTimestamp = m_nTimestamp;
+	for (uint32_t i = 0; i < SCHEDULED_EVENT_COUNT; i++) {
+		pState->pEvents[i] = this->IsScheduled(static_cast<ScheduledEventType>(i)) ? m_pTimestamps[i] : std::numeric_limits<uint64_t>::max();
+	}
+}
+
+void Scheduler::LoadState(const SchedulerState& xState) {
+	this->Reset();
+	m_nTimestamp = xState.nTimestamp;
+	for (uint32_t i = 0; i < SCHEDULED_EVENT_COUNT; i++) {
+		if (xState.pEvents[i] == std::numeric_limits<uint64_t>::max()) {
+			continue;
+		}
+		if (m_pCallbacks[i] == nullptr) {
+			throw std::runtime_error("Saved state has an event nothing handles!");
+		}
+		this->Schedule(static_cast<ScheduledEventType>(i), xState.pEvents[i], m_pCallbacks[i], m_pUserData[i]);
+	}
+}
+
+void Scheduler::DropCancelled() {
+	while (!m_xQueue.empty() && m_xQueue.top().nGeneration != m_pGenerations[m_xQueue.top().eType]) {
+		m_xQueue.pop();
+	}
+}
+}
+
@@ -0,0 +1,84 @@
+#ifndef CEE_PANE_SCHEDULER_H_
+#define CEE_PANE_SCHEDULER_H_
+
+#include <queue>
+#include <vector>
+
+#include <cstdint>
+
+// NTSC master clock is 21.477272 MHz, the CPU divides it by 12 and the PPU by 4
+#define PANE_MASTER_CLOCKS_PER_CPU_CYCLE    12
+#define PANE_MASTER_CLOCKS_PER_PPU_DOT      4
+
+namespace pane {
+enum ScheduledEventType {
+	SCHEDULED_EVENT_VBLANK_NMI = 0,
+	SCHEDULED_EVENT_VBLANK_END,
+	SCHEDULED_EVENT_FRAME_END,
+	SCHEDULED_EVENT_MAPPER_IRQ,
+	SCHEDULED_EVENT_APU_FRAME_COUNTER,
+	SCHEDULED_EVENT_COUNT
+};
+
+typedef void (*ScheduledEventCallback)(void* pUserData, uint64_t nTimestamp);
+
+struct SchedulerState;
+
+// Orders timed events on a 64-bit master clock. Components schedule the next
+// event that affects them and everything runs freely up to the earliest one.
+// At most one event of each type is pending, scheduling a type again replaces
+// the previous one.
+class Scheduler {
+public:
+	Scheduler();
+	~Scheduler();
+
+	void Reset();
+
+	uint64_t GetTimestamp() const { return m_nTimestamp; }
+	void Advance(uint64_t nClocks) { m_nTimestamp += nClocks; }
+
+	void Schedule(ScheduledEventType eType, uint64_t nTimestamp, ScheduledEventCallback fnCallback, void* pUserData);
+	// Callback LoadState uses to restore a pending event of the type, set
+	// by every Schedule as well.
+	void SetCallback(ScheduledEventType eType, ScheduledEventCallback fnCallback, void* pUserData);
+	void Cancel(ScheduledEventType eType);
+	bool IsScheduled(ScheduledEventType eType) const { return m_pGenerations[eType] & 1; }
+
+	uint64_t GetNextEventTimestamp();
+	// Fires every event due at or before the current timestamp, in timestamp
+	// order. Callbacks may schedule further events.
+	void RunDueEvents();
+
+	// Saves the clock and the timestamp of every pending event, loading
+	// replaces everything pending with them.
+	void SaveState(SchedulerState* pState) const;
+	void LoadState(const SchedulerState& xState);
+
+private:
+	struct PendingEvent {
+		uint64_t nTimestamp;
+		uint32_t nGeneration;
+		ScheduledEventType eType;
+		ScheduledEventCallback fnCallback;
+		void* pUserData;
+
+		bool operator>(const PendingEvent& other) const { return nTimestamp > other.nTimestamp; }
+	};
+
+	void DropCancelled();
+
+private:
+	uint64_t m_nTimestamp;
+	std::priority_queue<PendingEvent, std::vector<PendingEvent>, std::greater<PendingEvent>> m_xQueue;
+	// Odd while an event of the type is pending, bumped on every schedule and
+	// cancel so stale queue entries can be skipped lazily.
+	uint32_t m_pGenerations[SCHEDULED_EVENT_COUNT];
+	uint64_t m_pTimestamps[SCHEDULED_EVENT_COUNT];
+	ScheduledEventCallback m_pCallbacks[SCHEDULED_EVENT_COUNT];
+	void* m_pUserData[SCHEDULED_EVENT_COUNT];
+};
+}
+
+#endif
+
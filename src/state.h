@@ -0,0 +1,122 @@
+#ifndef CEE_PANE_STATE_H_
+#define CEE_PANE_STATE_H_
+
+#include <type_traits>
+
+#include <cstdint>
+
+#include "scheduler.h"
+
+// "PNST" little endian
+#define PANE_STATE_MAGIC    0x54534E50
+// Bump whenever the layout of MachineState or anything in it changes
+#define PANE_STATE_VERSION  3
+
+#define PANE_RAM_SIZE         0x0800
+#define PANE_APU_REGS_SIZE    0x0018
+#define PANE_CARTRIDGE_SIZE   (0x10000 - 0x4020)
+#define PANE_CONTROLLER_PORTS 2
+#define PANE_MAPPER_REGISTERS 16
+
+namespace pane {
+// Everything in this file is plain data with no pointers, so a state can be
+// copied with memcpy, kept in a ring buffer or written to disk as is.
+
+struct CPUState {
+	uint16_t pc;
+	uint8_t ac, x, y;
+	// Full status byte as CPU::GetStatus returns it
+	uint8_t sr, sp;
+	bool bJammed;
+	bool bInterruptPending;
+	uint8_t nInterruptType;
+	uint64_t nTotalCycles;
+	uint64_t nInstructions;
+	uint64_t nIdleCycles;
+};
+
+struct PPUState {
+	uint64_t nTimestamp;
+	uint64_t nFrameStart;
+	uint64_t nFrames;
+	uint32_t nScanline;
+	uint32_t nDot;
+
+	uint8_t nCtrl;
+	uint8_t nMask;
+	uint8_t nStatus;
+	uint8_t nOAMAddress;
+	uint8_t nReadBuffer;
+	uint8_t nLatch;
+	uint16_t pVRAMAddress;
+	uint16_t pTempAddress;
+	uint8_t nFineX;
+	bool bWriteToggle;
+	bool bRender;
+};
+
+struct SchedulerState {
+	uint64_t nTimestamp;
+	// UINT64_MAX when no event of the type is pending
+	uint64_t pEvents[SCHEDULED_EVENT_COUNT];
+};
+
+// Controller ports, worked on in place. Buttons are part of the state so
+// a restored state replays with the input it was saved with.
+struct InputState {
+	uint8_t pButtons[PANE_CONTROLLER_PORTS];
+	uint8_t pShift[PANE_CONTROLLER_PORTS];
+	bool bStrobe;
+};
+
+// Registers of whichever mapper the cartridge has, see the mapper for what
+// each one holds. Banks are mapped again from them when a state is loaded.
+struct MapperState {
+	uint8_t pRegisters[PANE_MAPPER_REGISTERS];
+	// Scanline counter clocks up to the last time the mapper looked
+	uint64_t nCounterClocks;
+};
+
+// Memory the PPU works on in place
+struct PPUMemory {
+	uint8_t pOAM[0x0100];
+	uint8_t pPatterns[0x2000];
+	uint8_t pNametables[0x0800];
+	uint8_t pPalette[0x0020];
+};
+
+// Memory the MMU maps, worked on in place
+struct MMUMemory {
+	uint8_t pRAM[PANE_RAM_SIZE];
+	uint8_t pAPURegs[PANE_APU_REGS_SIZE];
+	uint8_t pAPURegsUnused[0x4020 - 0x4000 - PANE_APU_REGS_SIZE];
+	uint8_t pCartridge[PANE_CARTRIDGE_SIZE];
+};
+
+// Complete state of a Machine in one block. The memory sections are where
+// the running machine actually keeps its memory, the register sections are
+// filled in from the components on save, so a snapshot is a few small
+// copies and one memcpy. The pixel buffer is not part of it, it is redrawn
+// by the next frame.
+struct MachineState {
+	uint32_t nMagic;
+	uint32_t nVersion;
+	uint32_t nSize;
+	uint32_t nReserved;
+
+	CPUState xCPU;
+	PPUState xPPU;
+	SchedulerState xScheduler;
+	InputState xInput;
+	MapperState xMapper;
+
+	alignas(64) PPUMemory xVideo;
+	// Last, so loading can copy everything before it in one go and leave
+	// this to MMU::LoadMemory
+	alignas(64) MMUMemory xMemory;
+};
+
+static_assert(std::is_trivially_copyable_v<MachineState>, "MachineState must be copyable with memcpy");
+}
+
+#endif
@@ -0,0 +1,71 @@
+#include "verifier.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace pane {
+MovieVerifier::MovieVerifier(size_t nThreads)
+ : m_xRunner(nThreads)
+{
+
+}
+
+MovieVerifier::~MovieVerifier() {
+
+}
+
+VerifyResult MovieVerifier::Verify(const Movie& xMovie, const KeyframeIndex* pIndex, const MachineSetup& fnSetup) {
+	if (!xMovie.HasFrameHashes()) {
+		throw std::runtime_error("Movie has no frame hashes to verify against!");
+	}
+
+	struct Segment {
+		uint64_t nStart;
+		uint64_t nEnd;
+		// Keyframe or the movie's start state, nullptr for power-on
+		const MachineState* pState;
+	};
+
+	// The state at the start of frame N is the one after frame N - 1
+	std::vector<Segment> vSegments;
+	vSegments.push_back({ 0, xMovie.GetFrameCount(), xMovie.GetStartState() });
+	size_t nEntries = pIndex != nullptr ? pIndex->GetEntryCount() : 0;
+	for (size_t i = 0; i < nEntries; i++) {
+		const KeyframeEntry& xEntry = pIndex->GetEntry(i);
+		if (xEntry.nFrame > 0 && xEntry.nFrame < xMovie.GetFrameCount()
+		    && HashMachineState(xEntry.xState) == xMovie.GetFrameHash(xEntry.nFrame - 1)) {
+			vSegments.push_back({ xEntry.nFrame, 0, &xEntry.xState });
+		}
+	}
+	std::sort(vSegments.begin(), vSegments.end(), [](const Segment& a, const Segment& b) { return a.nStart < b.nStart; });
+	vSegments.erase(std::unique(vSegments.begin(), vSegments.end(), [](const Segment& a, const Segment& b) { return a.nStart == b.nStart; }), vSegments.end());
+	for (size_t i = 0; i < vSegments.size(); i++) {
+		vSegments[i].nEnd = i + 1 < vSegments.size() ? vSegments[i + 1].nStart : xMovie.GetFrameCount();
+	}
+
+	std::vector<uint64_t> vDiverged(vSegments.size(), UINT64_MAX);
+	BatchStats xStats = m_xRunner.Run(vSegments.size(), [&](Machine& xMachine, size_t nJob) -> uint64_t {
+		const Segment& xSegment = vSegments[nJob];
+		fnSetup(xMachine);
+		xMachine.Start();
+		if (xSegment.pState != nullptr) {
+			xMachine.LoadState(*xSegment.pState);
+		}
+
+		for (uint64_t nFrame = xSegment.nStart; nFrame < xSegment.nEnd; nFrame++) {
+			for (uint8_t nPort = 0; nPort < PANE_CONTROLLER_PORTS; nPort++) {
+				xMachine.GetControllers()->SetButtons(nPort, xMovie.GetButtons(nFrame)[nPort]);
+			}
+			if (xMachine.RunFrame() != STOP_FRAME || xMachine.GetStateHash() != xMovie.GetFrameHash(nFrame)) {
+				vDiverged[nJob] = nFrame;
+				return nFrame - xSegment.nStart + 1;
+			}
+		}
+		return xSegment.nEnd - xSegment.nStart;
+	});
+
+	uint64_t nDiverged = *std::min_element(vDiverged.begin(), vDiverged.end());
+	return { nDiverged == UINT64_MAX, nDiverged, vSegments.size(), xStats.nFrames, xStats.nSeconds };
+}
+}
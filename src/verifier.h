@@ -0,0 +1,54 @@
+#ifndef CEE_PANE_VERIFIER_H_
+#define CEE_PANE_VERIFIER_H_
+
+#include <functional>
+
+#include <cstdint>
+#include <cstddef>
+
+#include "batch.h"
+#include "keyframes.h"
+#include "machine.h"
+#include "movie.h"
+
+namespace pane {
+struct VerifyResult {
+	bool bMatch;
+	// Earliest frame whose end state differs from the recording, or that
+	// stopped short (CPU jam), UINT64_MAX on a match
+	uint64_t nDivergedFrame;
+	size_t nSegments;
+	uint64_t nFrames;
+	double nSeconds;
+};
+
+// Called on a reset machine before Start, to put the cartridge in
+typedef std::function<void(Machine& xMachine)> MachineSetup;
+
+// Checks that a movie still replays into the states it was recorded in.
+// The movie is cut into segments at its keyframes and every segment runs
+// on its own worker from its keyframe, comparing each frame against the
+// movie's frame hashes. A keyframe is only used if it hashes like the
+// recording did at that point, so segments are independent and the
+// earliest mismatch of any segment is where a serial replay would first
+// have diverged. Workers reset their machine before every segment, so a
+// verifier can be reused and the result never depends on which worker ran
+// what before.
+class MovieVerifier {
+public:
+	// 0 threads uses every hardware thread
+	explicit MovieVerifier(size_t nThreads = 0);
+	~MovieVerifier();
+
+	size_t GetThreadCount() const { return m_xRunner.GetThreadCount(); }
+
+	// pIndex may be null, which verifies in one segment. Throws if the movie
+	// has no frame hashes.
+	VerifyResult Verify(const Movie& xMovie, const KeyframeIndex* pIndex, const MachineSetup& fnSetup);
+
+private:
+	BatchRunner m_xRunner;
+};
+}
+
+#endif
@@ -116,18 +116,18 @@ void Window::Init(uint32_t nWidth, uint32_t nHeight, const std::string& sTitle)
 }
 
 void Window::Shutdown() {
-	if (s_nWindowCount == 0 && s_bGLFWInitialized == true) {
-		glfwTerminate();
-		s_bGLFWInitialized = false;
-	}
-
 	if (!m_hWindow) {
 		return;
 	}
 
 	glfwDestroyWindow(m_hWindow);
 	m_hWindow = nullptr;
-	--s_nWindowCount;
+
+	// GLFW is process wide, the last window out terminates it
+	if (--s_nWindowCount == 0 && s_bGLFWInitialized == true) {
+		glfwTerminate();
+		s_bGLFWInitialized = false;
+	}
 }
 
 bool Window::ShouldClose() {
@@ -51,6 +51,7 @@ private:
 	std::deque<std::shared_ptr<Event>> m_xEventQueue;
 
 private:
+	// GLFW may only be used from the main thread, so these need no locking
 	static bool s_bGLFWInitialized;
 	static uint32_t s_nWindowCount;
 };